@@ -66,6 +66,17 @@ Aggregator::~Aggregator()
 
             free(pRingBuffer[j]);
         }
+
+        // Release memory alloc'ed for frame ring buffers
+        if (pFrameRingBuffer[j] != NULL)
+        {
+            for (UINT32 i = 0; i < nDevices[j] + nWASANNodes[j]; i++)
+                delete pFrameRingBuffer[j][i];
+
+            free(pFrameRingBuffer[j]);
+            pFrameRingBuffer[j] = NULL;
+        }
+
         // Set number of aggregated channels back to 0
         nAggregatedChannels[j] = 0;
 
@@ -90,6 +101,14 @@ Aggregator::~Aggregator()
     //-------- Free LP Filter memory of the Resampler class
     Resampler::FreeLPFilter();
 
+    if (hCaptureEvent != NULL)
+    {
+        for (UINT32 i = 0; i < nDevices[AGGREGATOR_CAPTURE]; i++)
+            if (hCaptureEvent[i] != NULL) CloseHandle(hCaptureEvent[i]);
+
+        free(hCaptureEvent);
+    }
+
     if (pCaptureClient != NULL)                     free(pCaptureClient);
     if (pRenderClient != NULL)                      free(pRenderClient);
     if (pAudioBufferGroupId != NULL)                free(pAudioBufferGroupId);
@@ -221,6 +240,7 @@ HRESULT Aggregator::InitializeCapture()
     pAudioClient[AGGREGATOR_CAPTURE]            = (IAudioClient**)malloc(nDevices[AGGREGATOR_CAPTURE] * sizeof(IAudioClient*));
     pwfx[AGGREGATOR_CAPTURE]                    = (WAVEFORMATEX**)malloc((nDevices[AGGREGATOR_CAPTURE] + nWASANNodes[AGGREGATOR_CAPTURE]) * sizeof(WAVEFORMATEX*));
     pCaptureClient                              = (IAudioCaptureClient**)malloc(nDevices[AGGREGATOR_CAPTURE] * sizeof(IAudioCaptureClient*));
+    hCaptureEvent                               = (HANDLE*)calloc(nDevices[AGGREGATOR_CAPTURE], sizeof(HANDLE));
     pAudioBuffer[AGGREGATOR_CAPTURE]            = (AudioBuffer**)malloc((nDevices[AGGREGATOR_CAPTURE] + nWASANNodes[AGGREGATOR_CAPTURE]) * sizeof(AudioBuffer*));
     pData[AGGREGATOR_CAPTURE]                   = (BYTE**)malloc((nDevices[AGGREGATOR_CAPTURE] + nWASANNodes[AGGREGATOR_CAPTURE]) * sizeof(BYTE*));
     nGCD[AGGREGATOR_CAPTURE]                    = (DWORD*)malloc((nDevices[AGGREGATOR_CAPTURE] + nWASANNodes[AGGREGATOR_CAPTURE]) * sizeof(DWORD));
@@ -235,6 +255,7 @@ HRESULT Aggregator::InitializeCapture()
     //-------- Check if allocation of any of the crucial variables failed, clean up and return with ENOMEM otherwise
     if (pAudioClient[AGGREGATOR_CAPTURE] == NULL ||
         pCaptureClient == NULL ||
+        hCaptureEvent == NULL ||
         pAudioBuffer[AGGREGATOR_CAPTURE] == NULL ||
         pData[AGGREGATOR_CAPTURE] == NULL ||
         pwfx[AGGREGATOR_CAPTURE] == NULL ||
@@ -314,15 +335,28 @@ HRESULT Aggregator::InitializeCapture()
         }
     }
 
-    //-------- Initialize streams to operate in poll mode
+    //-------- Initialize streams to operate in event-driven mode
     // Allow WASAPI to choose endpoint buffer size, glitches otherwise
     // for both, event-driven and polling methods, outputs 448 frames for mic
     for (UINT32 i = 0; i < nDevices[AGGREGATOR_CAPTURE]; i++)
     {
         hr = pAudioClient[AGGREGATOR_CAPTURE][i]->Initialize(AUDCLNT_SHAREMODE_SHARED,
-                                        0, 0,
+                                        AUDCLNT_STREAMFLAGS_EVENTCALLBACK, 0,
                                         0, pwfx[AGGREGATOR_CAPTURE][i], NULL);
             EXIT_ON_ERROR(hr)
+
+        // Auto-reset event WASAPI signals once per device period, so the capture thread sleeps in between
+        hCaptureEvent[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (hCaptureEvent[i] == NULL)
+        {
+            std::cout << ERR "Failed to create capture event for device " << i << "." END << std::endl;
+
+            hr = ENOMEM;
+            goto Exit;
+        }
+
+        hr = pAudioClient[AGGREGATOR_CAPTURE][i]->SetEventHandle(hCaptureEvent[i]);
+            EXIT_ON_ERROR(hr)
     }
 
     std::cout << "<-------- Capture Device Details -------->" << std::endl << std::endl;
@@ -367,31 +401,78 @@ HRESULT Aggregator::InitializeCapture()
             EXIT_ON_ERROR(hr)
     }
 
+    //-------- Resample integer PCM endpoints in fixed point, float endpoints ignore the request
+    if (RESAMPLER_FIXED_POINT)
+        for (UINT32 i = 0; i < nDevices[AGGREGATOR_CAPTURE] + nWASANNodes[AGGREGATOR_CAPTURE]; i++)
+            pAudioBuffer[AGGREGATOR_CAPTURE][i]->SetFixedPoint(TRUE);
+
     //-------- Set data structure size for channelwise audio storage
     for (UINT32 i = 0; i < nDevices[AGGREGATOR_CAPTURE] + nWASANNodes[AGGREGATOR_CAPTURE]; i++)
         nAggregatedChannels[AGGREGATOR_CAPTURE] += pwfx[AGGREGATOR_CAPTURE][i]->nChannels;
     
-    //-------- Create input ring buffer
-    pRingBuffer[AGGREGATOR_CAPTURE] = (RingBufferChannel**)malloc(nAggregatedChannels[AGGREGATOR_CAPTURE] * sizeof(RingBufferChannel*));
-    for (UINT32 i = 0; i < nAggregatedChannels[AGGREGATOR_CAPTURE]; i++)
-        pRingBuffer[AGGREGATOR_CAPTURE][i] = new RingBufferChannel();
-    
-    //-------- Initialize AudioBuffer objects' buffers using the obtained information
-    for (UINT32 i = 0; i < nDevices[AGGREGATOR_CAPTURE] + nWASANNodes[AGGREGATOR_CAPTURE]; i++)
+    //-------- Create one ring buffer per device holding all of its channels if requested
+    if (AGGREGATOR_FRAME_RING)
     {
-        UINT32 nChannels = pAudioBuffer[AGGREGATOR_CAPTURE][i]->GetChannelNumber();
-        
-        RingBufferChannel** pBuffer = (RingBufferChannel**)malloc(nChannels * sizeof(RingBufferChannel*));
+        pFrameRingBuffer[AGGREGATOR_CAPTURE] = (FrameRingBuffer**)calloc(nDevices[AGGREGATOR_CAPTURE] + nWASANNodes[AGGREGATOR_CAPTURE], sizeof(FrameRingBuffer*));
+        if (pFrameRingBuffer[AGGREGATOR_CAPTURE] == NULL)
+        {
+            hr = ENOMEM;
+            goto Exit;
+        }
 
-        for (UINT32 j = 0; j < nChannels; j++)
-            pBuffer[j] = pRingBuffer[AGGREGATOR_CAPTURE][i];
+        for (UINT32 i = 0; i < nDevices[AGGREGATOR_CAPTURE] + nWASANNodes[AGGREGATOR_CAPTURE]; i++)
+        {
+            pFrameRingBuffer[AGGREGATOR_CAPTURE][i] = new FrameRingBuffer(pwfx[AGGREGATOR_CAPTURE][i]->nChannels, nCircularBufferSize[AGGREGATOR_CAPTURE], AGGREGATOR_FRAME_RING_LAYOUT);
+            if (pFrameRingBuffer[AGGREGATOR_CAPTURE][i]->GetBufferPointer() == NULL)
+            {
+                hr = ENOMEM;
+                goto Exit;
+            }
 
-        hr = pAudioBuffer[AGGREGATOR_CAPTURE][i]->InitBuffer(&nEndpointBufferSize[AGGREGATOR_CAPTURE][i],
-                                                    pBuffer,
-                                                    &nCircularBufferSize[AGGREGATOR_CAPTURE],
-                                                    nUpsample[AGGREGATOR_CAPTURE][i], 
+            // Status codes of InitBuffer are not HRESULTs, so EXIT_ON_ERROR would let them through
+            hr = pAudioBuffer[AGGREGATOR_CAPTURE][i]->InitBuffer(&nEndpointBufferSize[AGGREGATOR_CAPTURE][i],
+                                                    pFrameRingBuffer[AGGREGATOR_CAPTURE][i],
+                                                    nUpsample[AGGREGATOR_CAPTURE][i],
                                                     nDownsample[AGGREGATOR_CAPTURE][i]);
-            EXIT_ON_ERROR(hr)
+            if (hr != ERROR_SUCCESS) goto Exit;
+        }
+    }
+    else
+    {
+        //-------- Create input ring buffer
+        pRingBuffer[AGGREGATOR_CAPTURE] = (RingBufferChannel**)malloc(nAggregatedChannels[AGGREGATOR_CAPTURE] * sizeof(RingBufferChannel*));
+        for (UINT32 i = 0; i < nAggregatedChannels[AGGREGATOR_CAPTURE]; i++)
+        {
+            pRingBuffer[AGGREGATOR_CAPTURE][i] = new RingBufferChannel(nCircularBufferSize[AGGREGATOR_CAPTURE]);
+            if (pRingBuffer[AGGREGATOR_CAPTURE][i]->GetBufferPointer() == NULL)
+            {
+                hr = ENOMEM;
+                goto Exit;
+            }
+        }
+
+        //-------- Capacity is rounded up to a power of two, let AudioBuffers know the actual one
+        if (nAggregatedChannels[AGGREGATOR_CAPTURE] > 0)
+            nCircularBufferSize[AGGREGATOR_CAPTURE] = pRingBuffer[AGGREGATOR_CAPTURE][0]->GetBufferSize();
+    
+        //-------- Initialize AudioBuffer objects' buffers using the obtained information
+        for (UINT32 i = 0; i < nDevices[AGGREGATOR_CAPTURE] + nWASANNodes[AGGREGATOR_CAPTURE]; i++)
+        {
+            UINT32 nChannels = pAudioBuffer[AGGREGATOR_CAPTURE][i]->GetChannelNumber();
+        
+            RingBufferChannel** pBuffer = (RingBufferChannel**)malloc(nChannels * sizeof(RingBufferChannel*));
+
+            for (UINT32 j = 0; j < nChannels; j++)
+                pBuffer[j] = pRingBuffer[AGGREGATOR_CAPTURE][i];
+
+            // Status codes of InitBuffer are not HRESULTs, so EXIT_ON_ERROR would let them through
+            hr = pAudioBuffer[AGGREGATOR_CAPTURE][i]->InitBuffer(&nEndpointBufferSize[AGGREGATOR_CAPTURE][i],
+                                                        pBuffer,
+                                                        &nCircularBufferSize[AGGREGATOR_CAPTURE],
+                                                        nUpsample[AGGREGATOR_CAPTURE][i], 
+                                                        nDownsample[AGGREGATOR_CAPTURE][i]);
+            if (hr != ERROR_SUCCESS) goto Exit;
+        }
     }
 
     //-------- Write captured data into a WAV file for debugging
@@ -401,6 +482,16 @@ HRESULT Aggregator::InitializeCapture()
             EXIT_ON_ERROR(hr)
     }
 
+    //-------- Keep recent captured data in memory for the trigger command
+    if (AGGREGATOR_FLIGHT_RECORDER)
+    {
+        for (UINT32 i = 0; i < nDevices[AGGREGATOR_CAPTURE] + nWASANNodes[AGGREGATOR_CAPTURE]; i++)
+        {
+            hr = pAudioBuffer[AGGREGATOR_CAPTURE][i]->InitFlightRecorder();
+            if (hr != ERROR_SUCCESS) goto Exit;
+        }
+    }
+
     //-------- If initialization succeeded, return with S_OK
     return hr;
 
@@ -424,9 +515,29 @@ Exit:
         free(pRingBuffer[AGGREGATOR_CAPTURE]);
     }
 
+    // Free frame ring buffers
+    if (pFrameRingBuffer[AGGREGATOR_CAPTURE] != NULL)
+    {
+        for (UINT32 i = 0; i < nDevices[AGGREGATOR_CAPTURE] + nWASANNodes[AGGREGATOR_CAPTURE]; i++)
+            delete pFrameRingBuffer[AGGREGATOR_CAPTURE][i];
+
+        free(pFrameRingBuffer[AGGREGATOR_CAPTURE]);
+        pFrameRingBuffer[AGGREGATOR_CAPTURE] = NULL;
+    }
+
     // Set number of aggregated channels back to 0
     nAggregatedChannels[AGGREGATOR_CAPTURE] = 0;
 
+    // Close events WASAPI signaled new packets on
+    if (hCaptureEvent != NULL)
+    {
+        for (UINT32 i = 0; i < nDevices[AGGREGATOR_CAPTURE]; i++)
+            if (hCaptureEvent[i] != NULL) CloseHandle(hCaptureEvent[i]);
+
+        free(hCaptureEvent);
+        hCaptureEvent = NULL;
+    }
+
     // Free dynamic arrays holding reference to 
     if (pAudioClient[AGGREGATOR_CAPTURE] != NULL)           free(pAudioClient[AGGREGATOR_CAPTURE]);
     if (pCaptureClient != NULL)                             free(pCaptureClient);
@@ -598,31 +709,78 @@ HRESULT Aggregator::InitializeRender()
             EXIT_ON_ERROR(hr)
     }
 
+    //-------- Resample integer PCM endpoints in fixed point, float endpoints ignore the request
+    if (RESAMPLER_FIXED_POINT)
+        for (UINT32 i = 0; i < nDevices[AGGREGATOR_RENDER] + nWASANNodes[AGGREGATOR_RENDER]; i++)
+            pAudioBuffer[AGGREGATOR_RENDER][i]->SetFixedPoint(TRUE);
+
     //-------- Set data structure size for channelwise audio storage
     for (UINT32 i = 0; i < nDevices[AGGREGATOR_RENDER] + nWASANNodes[AGGREGATOR_RENDER]; i++)
         nAggregatedChannels[AGGREGATOR_RENDER] += pwfx[AGGREGATOR_RENDER][i]->nChannels;
 
-    //-------- Create input ring buffer
-    pRingBuffer[AGGREGATOR_RENDER] = (RingBufferChannel**)malloc(nAggregatedChannels[AGGREGATOR_RENDER] * sizeof(RingBufferChannel*));
-    for (UINT32 i = 0; i < nAggregatedChannels[AGGREGATOR_RENDER]; i++)
-        pRingBuffer[AGGREGATOR_RENDER][i] = new RingBufferChannel();
+    //-------- Create one ring buffer per device holding all of its channels if requested
+    if (AGGREGATOR_FRAME_RING)
+    {
+        pFrameRingBuffer[AGGREGATOR_RENDER] = (FrameRingBuffer**)calloc(nDevices[AGGREGATOR_RENDER] + nWASANNodes[AGGREGATOR_RENDER], sizeof(FrameRingBuffer*));
+        if (pFrameRingBuffer[AGGREGATOR_RENDER] == NULL)
+        {
+            hr = ENOMEM;
+            goto Exit;
+        }
+
+        for (UINT32 i = 0; i < nDevices[AGGREGATOR_RENDER] + nWASANNodes[AGGREGATOR_RENDER]; i++)
+        {
+            pFrameRingBuffer[AGGREGATOR_RENDER][i] = new FrameRingBuffer(pwfx[AGGREGATOR_RENDER][i]->nChannels, nCircularBufferSize[AGGREGATOR_RENDER], AGGREGATOR_FRAME_RING_LAYOUT);
+            if (pFrameRingBuffer[AGGREGATOR_RENDER][i]->GetBufferPointer() == NULL)
+            {
+                hr = ENOMEM;
+                goto Exit;
+            }
 
-    //-------- Initialize AudioBuffer objects' buffers using the obtained information
-    for (UINT32 i = 0; i < nDevices[AGGREGATOR_RENDER] + nWASANNodes[AGGREGATOR_RENDER]; i++)
+            // Status codes of InitBuffer are not HRESULTs, so EXIT_ON_ERROR would let them through
+            hr = pAudioBuffer[AGGREGATOR_RENDER][i]->InitBuffer(&nEndpointBufferSize[AGGREGATOR_RENDER][i],
+                                                    pFrameRingBuffer[AGGREGATOR_RENDER][i],
+                                                    nUpsample[AGGREGATOR_RENDER][i],
+                                                    nDownsample[AGGREGATOR_RENDER][i]);
+            if (hr != ERROR_SUCCESS) goto Exit;
+        }
+    }
+    else
     {
-        UINT32 nChannels = pAudioBuffer[AGGREGATOR_RENDER][i]->GetChannelNumber();
+        //-------- Create input ring buffer
+        pRingBuffer[AGGREGATOR_RENDER] = (RingBufferChannel**)malloc(nAggregatedChannels[AGGREGATOR_RENDER] * sizeof(RingBufferChannel*));
+        for (UINT32 i = 0; i < nAggregatedChannels[AGGREGATOR_RENDER]; i++)
+        {
+            pRingBuffer[AGGREGATOR_RENDER][i] = new RingBufferChannel(nCircularBufferSize[AGGREGATOR_RENDER]);
+            if (pRingBuffer[AGGREGATOR_RENDER][i]->GetBufferPointer() == NULL)
+            {
+                hr = ENOMEM;
+                goto Exit;
+            }
+        }
 
-        RingBufferChannel** pBuffer = (RingBufferChannel**)malloc(nChannels * sizeof(RingBufferChannel*));
+        //-------- Capacity is rounded up to a power of two, let AudioBuffers know the actual one
+        if (nAggregatedChannels[AGGREGATOR_RENDER] > 0)
+            nCircularBufferSize[AGGREGATOR_RENDER] = pRingBuffer[AGGREGATOR_RENDER][0]->GetBufferSize();
 
-        for (UINT32 j = 0; j < nChannels; j++)
-            pBuffer[j] = pRingBuffer[AGGREGATOR_RENDER][i];
+        //-------- Initialize AudioBuffer objects' buffers using the obtained information
+        for (UINT32 i = 0; i < nDevices[AGGREGATOR_RENDER] + nWASANNodes[AGGREGATOR_RENDER]; i++)
+        {
+            UINT32 nChannels = pAudioBuffer[AGGREGATOR_RENDER][i]->GetChannelNumber();
 
-        hr = pAudioBuffer[AGGREGATOR_RENDER][i]->InitBuffer(&nEndpointBufferSize[AGGREGATOR_RENDER][i],
-                                                            pBuffer,
-                                                            &nCircularBufferSize[AGGREGATOR_RENDER],
-                                                            nUpsample[AGGREGATOR_RENDER][i],
-                                                            nDownsample[AGGREGATOR_RENDER][i]);
-            EXIT_ON_ERROR(hr)
+            RingBufferChannel** pBuffer = (RingBufferChannel**)malloc(nChannels * sizeof(RingBufferChannel*));
+
+            for (UINT32 j = 0; j < nChannels; j++)
+                pBuffer[j] = pRingBuffer[AGGREGATOR_RENDER][i];
+
+            // Status codes of InitBuffer are not HRESULTs, so EXIT_ON_ERROR would let them through
+            hr = pAudioBuffer[AGGREGATOR_RENDER][i]->InitBuffer(&nEndpointBufferSize[AGGREGATOR_RENDER][i],
+                                                                pBuffer,
+                                                                &nCircularBufferSize[AGGREGATOR_RENDER],
+                                                                nUpsample[AGGREGATOR_RENDER][i],
+                                                                nDownsample[AGGREGATOR_RENDER][i]);
+            if (hr != ERROR_SUCCESS) goto Exit;
+        }
     }
 
     //-------- Write captured data into a WAV file for debugging
@@ -655,6 +813,16 @@ Exit:
         free(pRingBuffer[AGGREGATOR_RENDER]);
     }
 
+    // Free frame ring buffers
+    if (pFrameRingBuffer[AGGREGATOR_RENDER] != NULL)
+    {
+        for (UINT32 i = 0; i < nDevices[AGGREGATOR_RENDER] + nWASANNodes[AGGREGATOR_RENDER]; i++)
+            delete pFrameRingBuffer[AGGREGATOR_RENDER][i];
+
+        free(pFrameRingBuffer[AGGREGATOR_RENDER]);
+        pFrameRingBuffer[AGGREGATOR_RENDER] = NULL;
+    }
+
     // Set number of aggregated channels back to 0
     nAggregatedChannels[AGGREGATOR_RENDER] = 0;
 
@@ -712,10 +880,37 @@ Exit:
     return hr;
 }
 
+HRESULT Aggregator::TriggerFlightRecorder()
+{
+    HRESULT hr = ERROR_SUCCESS;
+
+    // Compiled out, no device keeps a history to dump
+    if (!AGGREGATOR_FLIGHT_RECORDER)
+    {
+        std::cout << WRN "Flight recorder is not enabled, build with AGGREGATOR_FLIGHT_RECORDER to use trigger." END << std::endl;
+        return ERROR_NOT_SUPPORTED;
+    }
+
+    //-------- Dump every capture device, carry on past failures so the others still get theirs
+    for (UINT32 i = 0; i < nDevices[AGGREGATOR_CAPTURE] + nWASANNodes[AGGREGATOR_CAPTURE]; i++)
+    {
+        HRESULT hrDevice = pAudioBuffer[AGGREGATOR_CAPTURE][i]->TriggerFlightRecorder();
+
+        if (hrDevice == ERROR_BUSY)
+            std::cout << WRN "Flight recorder of capture device " << i << " is still dumping the previous trigger." END << std::endl;
+        else if (hrDevice != ERROR_SUCCESS)
+            std::cout << ERR "Flight recorder of capture device " << i << " failed to dump." END << std::endl;
+
+        if (hr == ERROR_SUCCESS) hr = hrDevice;
+    }
+
+    return hr;
+}
+
 HRESULT Aggregator::StartCapture()
 {
     HRESULT hr = ERROR_SUCCESS;
-    UINT32 nThreadId = 0;
+    UINT32 nThreadId = 0, nShards = 0, pShardNodes[UDP_RECEIVE_THREADS];
 
     //-------- Reset and start capturing on all selected devices
     for (UINT32 i = 0; i < nDevices[AGGREGATOR_CAPTURE]; i++)
@@ -729,32 +924,51 @@ HRESULT Aggregator::StartCapture()
 
     std::cout << MSG "Starting audio capture." END << std::endl;
 
-    if (nWASANNodes[AGGREGATOR_CAPTURE] > 0 && nDevices[AGGREGATOR_CAPTURE] > 0)
+    //-------- Deal WASAN capture nodes out to receive threads, each with a socket, port and core of its own
+    if (nWASANNodes[AGGREGATOR_CAPTURE] > 0)
     {
-        hCaptureThread = (HANDLE*)malloc(2 * sizeof(HANDLE));
-        dwCaptureThreadId = (DWORD*)malloc(2 * sizeof(DWORD));
-        nCaptureThread = 2;
+        pUDPCaptureShard = (UDPAudioBuffer**)malloc(nWASANNodes[AGGREGATOR_CAPTURE] * sizeof(UDPAudioBuffer*));
+        pUDPCaptureParam = (UDPCAPTURETHREADPARAM*)malloc(UDP_RECEIVE_THREADS * sizeof(UDPCAPTURETHREADPARAM));
+
+        if (pUDPCaptureShard != NULL && pUDPCaptureParam != NULL)
+            nShards = UDPAudioBuffer::AssignShards((UDPAudioBuffer**)(pAudioBuffer[AGGREGATOR_CAPTURE] + nDevices[AGGREGATOR_CAPTURE]),
+                                                    nWASANNodes[AGGREGATOR_CAPTURE],
+                                                    UDP_RECEIVE_THREADS,
+                                                    pUDPCaptureShard,
+                                                    pShardNodes);
+
+        if (nShards == 0)
+        {
+            std::cout << ERR "Failed to deal WASAN capture nodes out to receive threads." END << std::endl;
+
+            hr = E_OUTOFMEMORY;
+                EXIT_ON_ERROR(hr)
+        }
     }
-    else if (nWASANNodes[AGGREGATOR_CAPTURE] > 0 || nDevices[AGGREGATOR_CAPTURE] > 0)
+
+    nCaptureThread = nShards + ((nDevices[AGGREGATOR_CAPTURE] > 0) ? 1 : 0);
+
+    if (nCaptureThread > 0)
     {
-        hCaptureThread = (HANDLE*)malloc(sizeof(HANDLE));
-        dwCaptureThreadId = (DWORD*)malloc(sizeof(DWORD));
-        nCaptureThread = 1;
+        hCaptureThread = (HANDLE*)malloc(nCaptureThread * sizeof(HANDLE));
+        dwCaptureThreadId = (DWORD*)malloc(nCaptureThread * sizeof(DWORD));
     } // else it remains 0
 
     //-------- Start capturing on all chosen WASAN node sockets
-    if (nWASANNodes[AGGREGATOR_CAPTURE] > 0)
+    for (UINT32 i = 0, nFirst = 0; i < nShards; nFirst += pShardNodes[i++])
     {
-        // Create a struct for the UDP capture thread to access all necessary data elements
-        UDPCAPTURETHREADPARAM pCaptureThreadParam = {
+        // The thread reads its parameters for as long as it runs, they live with the Aggregator
+        pUDPCaptureParam[i] = {
             UDPServerIP,
-            (UDPAudioBuffer**)(pAudioBuffer[AGGREGATOR_CAPTURE] + nDevices[AGGREGATOR_CAPTURE]),
-            nWASANNodes[AGGREGATOR_CAPTURE],
-            &bDone[AGGREGATOR_CAPTURE]
+            pUDPCaptureShard + nFirst,
+            pShardNodes[i],
+            &bDone[AGGREGATOR_CAPTURE],
+            (UINT16)(UDP_RCV_PORT + i),
+            UDP_RECEIVE_CORE + i
         };
 
         // Create a server listener thread
-        hCaptureThread[nThreadId] = CreateThread(NULL, 0, UDPCaptureThread, (LPVOID)&pCaptureThreadParam, 0, &dwCaptureThreadId[nThreadId]);
+        hCaptureThread[nThreadId] = CreateThread(NULL, 0, UDPCaptureThread, (LPVOID)&pUDPCaptureParam[i], 0, &dwCaptureThreadId[nThreadId]);
 
         if (hCaptureThread[nThreadId] == NULL)
         {
@@ -764,7 +978,7 @@ HRESULT Aggregator::StartCapture()
                 EXIT_ON_ERROR(hr)
         }
 
-        std::cout << SUC "Succesfully created UDP Server thread." END << std::endl;
+        std::cout << SUC "Succesfully created UDP Server thread for " << pShardNodes[i] << " WASAN nodes on port " << UDP_RCV_PORT + i << "." END << std::endl;
         nThreadId++; // increment the helper variable
     }
 
@@ -780,7 +994,8 @@ HRESULT Aggregator::StartCapture()
             pData[AGGREGATOR_CAPTURE],
             &nEndpointBufferSize[AGGREGATOR_CAPTURE],
             &nEndpointPackets[AGGREGATOR_CAPTURE],
-            pCaptureClient
+            pCaptureClient,
+            hCaptureEvent
         };
 
         // Create a server listener thread
@@ -826,6 +1041,13 @@ HRESULT Aggregator::StopCapture()
 
     if (hCaptureThread != NULL) free(hCaptureThread);
     if (dwCaptureThreadId != NULL) free(dwCaptureThreadId);
+    if (pUDPCaptureShard != NULL) free(pUDPCaptureShard);
+    if (pUDPCaptureParam != NULL) free(pUDPCaptureParam);
+
+    hCaptureThread = NULL;
+    dwCaptureThreadId = NULL;
+    pUDPCaptureShard = NULL;
+    pUDPCaptureParam = NULL;
 
     return hr;
 
@@ -1091,7 +1313,7 @@ HRESULT Aggregator::GetWASANNodes(UINT8 nDeviceType)
     {
         std::cout   << MSG "Enter the IP address of this device on which to listen to WASAN capture nodes as a UDP server." << std::endl
                     << TAB "In current implementation, enter the IP address from the mobile hotspot tab. I.e: 192.168.137.1" << std::endl
-                    << TAB "Update firewall rules to allow UDP traffic on that IP, on port " << UDP_RCV_PORT << " , on public networks." END
+                    << TAB "Update firewall rules to allow UDP traffic on that IP, on ports " << UDP_RCV_PORT << " to " << UDP_RCV_PORT + UDP_RECEIVE_THREADS - 1 << " , on public networks." END
                     << std::endl << std::endl;
 
         bUserDone = FALSE;
@@ -1243,21 +1465,32 @@ DWORD WINAPI UDPCaptureThread(LPVOID lpParam)
 {
     // Cast void pointer into familiar struct
     UDPCAPTURETHREADPARAM* pCaptureThreadParam = (UDPCAPTURETHREADPARAM*)lpParam;
+    SYSTEM_INFO tSystemInfo;
+
+    // Pin to a core of its own, so the nodes' jitter buffers, decoders and resamplers stay in its caches
+    GetSystemInfo(&tSystemInfo);
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (pCaptureThreadParam->nCore % tSystemInfo.dwNumberOfProcessors));
     
     // Create UDP server socket
     SOCKET* server = CreateSocketUDP();
 
     if (server != NULL)
     {
+        // Register receive slots on the socket, NULL falls back to a recvfrom per datagram
+        UDPBATCH* pBatch = CreateBatchUDP(server);
+
         // Put thread into listen loop
         UDPAudioBuffer::ReceiveDataUDP(server,
+            pBatch,
             pCaptureThreadParam->sUDPServerIP,
+            pCaptureThreadParam->nPort,
             pCaptureThreadParam->pUDPAudioBuffer,
             pCaptureThreadParam->nWASANNodes,
             pCaptureThreadParam->bDone);
 
-        // Destroy socket after server returns from the receive routine
+        // Destroy socket after server returns from the receive routine, then the slots it no longer uses
         CloseSocketUDP(server);
+        CloseBatchUDP(pBatch);
     }
     std::cout << MSG << "UDP capture thread exited." END << std::endl;
 
@@ -1270,16 +1503,21 @@ DWORD WINAPI WASAPICaptureThread(LPVOID lpParam)
     // Cast void pointer into familiar struct
     WASAPICAPTURETHREADPARAM* pCaptureThreadParam = (WASAPICAPTURETHREADPARAM*)lpParam;
 
-    // Capture endpoint buffer data in a poll-based fashion
+    // Capture endpoint buffer data in an event-driven fashion
     while (!*pCaptureThreadParam->bDone)
     {
-        // Captures data from all devices
+        // Sleep until any device signals a new packet, time out to notice the stop flag
+        DWORD dwWait = WaitForMultipleObjects(pCaptureThreadParam->nDevices, pCaptureThreadParam->hCaptureEvent, FALSE, AGGREGATOR_WAIT_TIMEOUT_MILLISEC);
+        if (dwWait == WAIT_TIMEOUT) continue;
+
+        // Captures data from all devices, their periods are close so the others likely have packets too
         for (UINT32 i = 0; i < pCaptureThreadParam->nDevices; i++)
         {
             hr = pCaptureThreadParam->pCaptureClient[i]->GetNextPacketSize(pCaptureThreadParam->nEndpointPackets[i]);
                 EXIT_ON_ERROR(hr)
 
-            if (*pCaptureThreadParam->nEndpointPackets[i] > 0)
+            // Drain all packets queued since the last wake-up, the event is auto-reset and fires once per period
+            while (*pCaptureThreadParam->nEndpointPackets[i] > 0)
             {
                 hr = pCaptureThreadParam->pCaptureClient[i]->GetBuffer(&pCaptureThreadParam->pData[i],
                                                 pCaptureThreadParam->nEndpointBufferSize[i],
@@ -1294,6 +1532,9 @@ DWORD WINAPI WASAPICaptureThread(LPVOID lpParam)
 
                 hr = pCaptureThreadParam->pCaptureClient[i]->ReleaseBuffer(*pCaptureThreadParam->nEndpointBufferSize[i]);
                     EXIT_ON_ERROR(hr)
+
+                hr = pCaptureThreadParam->pCaptureClient[i]->GetNextPacketSize(pCaptureThreadParam->nEndpointPackets[i]);
+                    EXIT_ON_ERROR(hr)
             }
         }
     }
@@ -1312,13 +1553,40 @@ DWORD WINAPI RenderThread(LPVOID lpParam)
     // Cast void pointer into familiar struct
     RENDERTHREADPARAM* pRenderThreadParam = (RENDERTHREADPARAM*)lpParam;
 
-    // Creates UDP sockets for each UDPAudioBuffer
+    // Creates one UDP socket shared by all UDPAudioBuffers, so their datagrams leave in one batch per pass
+    SOCKET* pSocket = (pRenderThreadParam->nWASANNodes > 0) ? CreateSocketUDP() : NULL;
+    SOCKADDR_IN tAnyAddress = {};
+
+    // Registered I/O does not bind implicitly as sendto does, any local port will do
+    tAnyAddress.sin_family = AF_INET;
+    if (pSocket != NULL) bind(*pSocket, (SOCKADDR*)&tAnyAddress, sizeof(SOCKADDR_IN));
+
+    UDPBATCH* pBatch = CreateBatchUDP(pSocket);
+
+    // Number streams to nodes sharing an address the way their receivers do
+    UDPAudioBuffer::AssignStreams(pRenderThreadParam->pUDPAudioBuffer, pRenderThreadParam->nWASANNodes);
+
     for (UINT32 i = 0; i < pRenderThreadParam->nWASANNodes; i++)
-        pRenderThreadParam->pUDPAudioBuffer[i]->SetSocketUDP(CreateSocketUDP());
+    {
+        pRenderThreadParam->pUDPAudioBuffer[i]->SetSocketUDP(pSocket);
+        pRenderThreadParam->pUDPAudioBuffer[i]->SetBatchUDP(pBatch);
+
+        // Codec is picked by the sender alone, receivers decode whatever the header names
+        if (pRenderThreadParam->pUDPAudioBuffer[i]->SetCodecUDP(UDP_CODEC) != ERROR_SUCCESS)
+            std::cout << WRN << "WASAN render node " << i << " does not support codec " << UDP_CODEC << ", sending raw PCM." END << std::endl;
+
+        pRenderThreadParam->pUDPAudioBuffer[i]->SetParityUDP(UDP_FEC);
+    }
+
+    // Nodes taking the same stream get it from one pull and encode, sent to all of them
+    if (UDPAudioBuffer::AssignFanout(pRenderThreadParam->pUDPAudioBuffer, pRenderThreadParam->nWASANNodes, UDP_FANOUT) != ERROR_SUCCESS)
+        std::cout << WRN << "Failed to group WASAN render nodes by stream, some send their own." END << std::endl;
 
-    //-------- Render buffer data in a poll-based fashion
+    //-------- Render buffer data as the ring buffers fill up
     while (!*pRenderThreadParam->bDone)
     {
+        BOOL bServed = FALSE;
+
         // Pushes data from ring buffer into corresponding devices
         for (UINT32 i = 0; i < pRenderThreadParam->nDevices; i++)
         {
@@ -1331,34 +1599,94 @@ DWORD WINAPI RenderThread(LPVOID lpParam)
                     EXIT_ON_ERROR(hr)
 
                 // Load data from AudioBuffer's ring buffer into the WASAPI buffer for this device
-                hr = pRenderThreadParam->pAudioBuffer[i]->PullData(pRenderThreadParam->pData[i], *pRenderThreadParam->nEndpointBufferSize[i]);
+                hr = pRenderThreadParam->pAudioBuffer[i]->PullData(pRenderThreadParam->pData[i], *pRenderThreadParam->nEndpointBufferSize[i], NULL);
                     EXIT_ON_ERROR(hr)
 
                 // Release buffer before next packet
                 hr = pRenderThreadParam->pRenderClient[i]->ReleaseBuffer(*pRenderThreadParam->nEndpointBufferSize[i], *pRenderThreadParam->flags[i]);
                     EXIT_ON_ERROR(hr)
+
+                bServed = TRUE;
             }
         }
 
         // Pushes data from ring buffer into corresponding WASAN render nodes over UDP
         for (UINT32 i = 0; i < pRenderThreadParam->nWASANNodes; i++)
         {
+            // Followers of a fan-out are sent to by their leader, their ring buffer is not read
+            if (pRenderThreadParam->pUDPAudioBuffer[i]->GetFanoutLeader() != pRenderThreadParam->pUDPAudioBuffer[i])
+                continue;
+
             UINT32 nFrames = pRenderThreadParam->pUDPAudioBuffer[i]->FramesAvailable();
-            if (nFrames > 0)
+            if (nFrames >= UDP_WAKE_WATERMARK)
             {
                 // Get the lesser of the number of frames to write to the device
                 nFrames = min(nFrames, *pRenderThreadParam->nEndpointBufferSize[pRenderThreadParam->nDevices + i]);
 
                 // Load data from UDPAudioBuffer's ring buffer into the buffer for this device
                 pRenderThreadParam->pUDPAudioBuffer[i]->SendDataUDP(nFrames);
+
+                bServed = TRUE;
+            }
+        }
+
+        // Sends the datagrams staged for all WASAN render nodes in one call
+        if (pRenderThreadParam->nWASANNodes > 0)
+            pRenderThreadParam->pUDPAudioBuffer[0]->CommitSendUDP();
+
+        // Nothing was ready, sleep on the sink closest to its watermark until the DSP publishes enough frames for it
+        if (!bServed)
+        {
+            AudioBuffer* pWait = NULL;
+            UINT32 nWatermark = 0, nShortfall = MAXUINT32;
+
+            for (UINT32 i = 0; i < pRenderThreadParam->nDevices + pRenderThreadParam->nWASANNodes; i++)
+            {
+                AudioBuffer* pSink = (i < pRenderThreadParam->nDevices) ?
+                    pRenderThreadParam->pAudioBuffer[i] :
+                    pRenderThreadParam->pUDPAudioBuffer[i - pRenderThreadParam->nDevices];
+
+                // Followers of a fan-out are never served, waiting on them would only time out
+                if (i >= pRenderThreadParam->nDevices && ((UDPAudioBuffer*)pSink)->GetFanoutLeader() != pSink)
+                    continue;
+
+                UINT32 nMin = (i < pRenderThreadParam->nDevices) ? pSink->GetMinFramesOut() : UDP_WAKE_WATERMARK;
+                UINT32 nAvailable = pSink->FramesAvailable();
+
+                // Frames arrived since the sink was checked, serve it right away
+                if (nAvailable >= nMin)
+                {
+                    pWait = NULL;
+                    break;
+                }
+
+                if (nMin - nAvailable < nShortfall)
+                {
+                    nShortfall = nMin - nAvailable;
+                    nWatermark = nMin;
+                    pWait = pSink;
+                }
             }
+
+            if (pWait != NULL)
+                pWait->WaitForFrames(nWatermark, AGGREGATOR_WAIT_TIMEOUT_MILLISEC);
         }
     }
 
    
-    // Destroy sockets after UDP clients are done pushing data to server
+    // Destroy the shared socket after UDP clients are done pushing data to server, then the slots it no longer uses
+    CloseSocketUDP(pSocket);
+    CloseBatchUDP(pBatch);
+
+    UDPAudioBuffer::AssignFanout(pRenderThreadParam->pUDPAudioBuffer, pRenderThreadParam->nWASANNodes, UDPFANOUT_NONE);
+
     for (UINT32 i = 0; i < pRenderThreadParam->nWASANNodes; i++)
-        CloseSocketUDP(pRenderThreadParam->pUDPAudioBuffer[i]->GetSocketUDP());
+    {
+        pRenderThreadParam->pUDPAudioBuffer[i]->SetSocketUDP(NULL);
+        pRenderThreadParam->pUDPAudioBuffer[i]->SetBatchUDP(NULL);
+        pRenderThreadParam->pUDPAudioBuffer[i]->SetCodecUDP(UDPCODEC_PCM);
+        pRenderThreadParam->pUDPAudioBuffer[i]->SetParityUDP(FALSE);
+    }
 
     return hr;
 
@@ -1445,11 +1773,11 @@ DWORD WINAPI AudioEffectThread(LPVOID lpParam)
 {
     HRESULT hr = ERROR_SUCCESS;
     AUDIOEFFECTTHREADPARAM* pAudioEffectThreadParam = (AUDIOEFFECTTHREADPARAM*)lpParam;
-    UINT32 nFramesAvailable = 0;
 
     while (!*pAudioEffectThreadParam->bDone)
     {
-        if ((nFramesAvailable = pAudioEffectThreadParam->pAudioBuffer[AGGREGATOR_CAPTURE]->FramesAvailable()) > 0)
+        // Sleep until the producer publishes enough frames for this effect, time out to notice the stop flag
+        if (pAudioEffectThreadParam->pRingChannel[0]->WaitForFrames(pAudioEffectThreadParam->pEffect, AUDIOEFFECT_WAKE_WATERMARK, AGGREGATOR_WAIT_TIMEOUT_MILLISEC))
         {
             // Read data from the input ring buffer into the audio effect
             pAudioEffectThreadParam->pAudioBuffer[AGGREGATOR_CAPTURE]->ReadNextPacket(pAudioEffectThreadParam->pEffect);
@@ -11,6 +11,7 @@
 
 #include "config.h"
 #include "RingBufferChannel.h"
+#include "FrameRingBuffer.h"
 #include "AudioBuffer.h"
 #include "UDPAudioBuffer.h"
 #include "Resampler.h"
@@ -22,6 +23,8 @@ typedef struct UDPCaptureThreadParam {
 	UDPAudioBuffer** pUDPAudioBuffer;
 	UINT32 nWASANNodes;
 	BOOL* bDone;
+	UINT16 nPort;						// Port of the thread's shard of nodes
+	UINT32 nCore;						// Logical processor the thread is pinned to
 } UDPCAPTURETHREADPARAM;
 
 typedef struct WASAPICaptureThreadParam {
@@ -33,6 +36,7 @@ typedef struct WASAPICaptureThreadParam {
 	UINT32** nEndpointBufferSize;
 	UINT32** nEndpointPackets;
 	IAudioCaptureClient** pCaptureClient;
+	HANDLE* hCaptureEvent;
 } WASAPICAPTURETHREADPARAM;
 
 typedef struct RenderThreadParam {
@@ -61,7 +65,8 @@ typedef struct AudioEffectThreadParam {
 } AUDIOEFFECTTHREADPARAM;
 
 /// <summary>
-/// <para>Runs UDP server listener thread.</para>
+/// <para>Runs UDP server listener thread for one shard of WASAN capture nodes.</para>
+/// <para>Pinned to a logical processor, it receives, reorders, decodes and resamples for its nodes alone.</para>
 /// </summary>
 /// <param name="lpParam">- pointer to struct UDPCAPTURETHREADPARAM.</param>
 /// <returns></returns>
@@ -143,6 +148,18 @@ class Aggregator
 		/// <returns></returns>
 		HRESULT Stop();
 
+		/// <summary>
+		/// <para>Dumps the last FLIGHTRECORDER_PRE_TRIGGER_SEC and the next FLIGHTRECORDER_POST_TRIGGER_SEC
+		/// of each capture device into WAV files, without stopping capture.</para>
+		/// <para>Note: needs AGGREGATOR_FLIGHT_RECORDER.</para>
+		/// </summary>
+		/// <returns>
+		/// <para>ERROR_SUCCESS if a dump started for every capture device.</para>
+		/// <para>ERROR_NOT_SUPPORTED without AGGREGATOR_FLIGHT_RECORDER.</para>
+		/// <para>Status of the first device that failed otherwise.</para>
+		/// </returns>
+		HRESULT TriggerFlightRecorder();
+
 	private:
 		/// <summary>
 		/// <para>Pipes all active chosen type devices into console.</para> 
@@ -185,7 +202,7 @@ class Aggregator
 		HRESULT InitializeRender();
 		
 		/// <summary>
-		/// <para>Starts capturing audio from user-selected devices on a poll basis.</para>
+		/// <para>Starts capturing audio from user-selected devices on an event basis.</para>
 		/// </summary>
 		/// <returns></returns>		
 		HRESULT StartCapture();
@@ -238,6 +255,12 @@ class Aggregator
 
 		RingBufferChannel		** pRingBuffer[2]		{ NULL };
 
+		FrameRingBuffer			** pFrameRingBuffer[2]	{ NULL };	// Per-device storage used instead of pRingBuffer with AGGREGATOR_FRAME_RING
+
+		UDPAudioBuffer			** pUDPCaptureShard		{ NULL };	// WASAN capture nodes reordered by the receive thread serving them
+
+		UDPCAPTURETHREADPARAM	* pUDPCaptureParam		{ NULL };	// Parameters of each receive thread, alive as long as the thread
+
 		BOOL					bDone[2]				{ FALSE, FALSE };
 
 		BYTE					** pData[2]				{ NULL };
@@ -263,7 +286,8 @@ class Aggregator
 								* dwRenderThreadId		{ NULL };
 
 		HANDLE					* hCaptureThread		{ NULL },
-								* hRenderThread			{ NULL };
+								* hRenderThread			{ NULL },
+								* hCaptureEvent			{ NULL };	// Signaled by WASAPI each time a capture device has a packet ready
 
 		CHAR					* pWASANNodeIP[2]		{ NULL },
 								UDPServerIP[16];
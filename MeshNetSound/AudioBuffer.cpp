@@ -31,6 +31,8 @@
 #include "AudioBuffer.h"
 #include "AudioEffect.h"
 #include "RingBufferChannel.h"
+#include "FrameRingBuffer.h"
+#include "FlightRecorder.h"
 
 UINT32* AudioBuffer::pGroupId{ NULL };
 UINT32 AudioBuffer::nNewInstance{ 0 };
@@ -55,56 +57,27 @@ AudioBuffer::AudioBuffer(std::string filename, UINT32 nMember)
 
 AudioBuffer::~AudioBuffer()
 {
-    // Cleans up WAV files
+    // Completes WAV files, the recorder writes out whatever is still queued
     if (this->bOutputWAV)
     {
-        for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
+        for (UINT32 i = 0; i < this->nRecordTracks; i++)
         {
-            // Gets complete file length
-            this->nOriginalFileLength[i] = ftell(this->fOriginalOutputFiles[i]);
-
-            // Fills missing data chunk size data in the WAV file (Data) headers
-            fseek(this->fOriginalOutputFiles[i], 64, SEEK_SET); // updates file pointer into the byte identifying data chunk size
-            DWORD dataChunkSize = this->nOriginalFileLength[i] - 68;
-            fwrite(&dataChunkSize, sizeof(DWORD), 1, this->fOriginalOutputFiles[i]);
-
-            // Fills missing file size data in the WAV file (RIFF) headers
-            fseek(this->fOriginalOutputFiles[i], 4, SEEK_SET); // updates file pointer into the byte identifying file size
-            DWORD fileChunkSize = this->nOriginalFileLength[i] - 8;
-            fwrite(&fileChunkSize, sizeof(DWORD), 1, this->fOriginalOutputFiles[i]);
-
-            // Closes WAV files
-            fclose(this->fOriginalOutputFiles[i]);
+            if (this->pOriginalTrack != NULL) this->pRecorder->CloseTrack(this->pOriginalTrack[i]);
+            if (this->pResampledTrack != NULL) this->pRecorder->CloseTrack(this->pResampledTrack[i]);
         }
-        free(this->fOriginalOutputFiles);
-        free(this->nOriginalFileLength);
+    }
 
-        if (this->tResampleFmt.nUpsample > 1 || this->tResampleFmt.nDownsample > 1)
-        {
-            for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
-            {
-                // Gets complete file length
-                this->nResampledFileLength[i] = ftell(this->fResampledOutputFiles[i]);
+    free(this->pOriginalTrack);
+    free(this->pResampledTrack);
 
-                // Fills missing data chunk size data in the WAV file (Data) headers
-                fseek(this->fResampledOutputFiles[i], 64, SEEK_SET); // updates file pointer into the byte identifying data chunk size
-                DWORD dataChunkSize = this->nResampledFileLength[i] - 68;
-                fwrite(&dataChunkSize, sizeof(DWORD), 1, this->fResampledOutputFiles[i]);
+    // Completes a running dump with what was captured so far
+    delete this->pFlightRecorder;
 
-                // Fills missing file size data in the WAV file (RIFF) headers
-                fseek(this->fResampledOutputFiles[i], 4, SEEK_SET); // updates file pointer into the byte identifying file size
-                DWORD fileChunkSize = this->nResampledFileLength[i] - 8;
-                fwrite(&fileChunkSize, sizeof(DWORD), 1, this->fResampledOutputFiles[i]);
+    free(this->pRecordScratch);
 
-                // Closes WAV files
-                fclose(this->fResampledOutputFiles[i]);
-            }
-            free(this->fResampledOutputFiles);
-            free(this->nResampledFileLength);
-        }
-    }
+    if (this->pRecorder != NULL) WAVRecorder::Release();
 
-    free(this->tResampleFmt.pBuffer);
+    free(this->pScratch);
 
     delete this->pResampler;
 }
@@ -192,12 +165,12 @@ UINT32 AudioBuffer::GetChannelNumber()
 
 RingBufferChannel** AudioBuffer::GetRingBufferChannel()
 {
-    return this->tResampleFmt.pBuffer;
+    return this->pRingBufferChannel;
 }
 
 HRESULT AudioBuffer::SetRingBufferChannel(RingBufferChannel** pChannelArray)
 {
-    this->tResampleFmt.pBuffer = pChannelArray;
+    this->pRingBufferChannel = pChannelArray;
     return ERROR_SUCCESS;
 }
 
@@ -231,6 +204,19 @@ HRESULT AudioBuffer::SetFormat(WAVEFORMATEX* pwfx)
     return ERROR_SUCCESS;
 }
 
+HRESULT AudioBuffer::SetFixedPoint(BOOL bFixedPoint)
+{
+    BOOL bIntegerPCM = this->tEndpointFmt.wFormatTag == WAVE_FORMAT_PCM ||
+        (this->tEndpointFmt.wFormatTag == WAVE_FORMAT_EXTENSIBLE && this->tEndpointFmt.subFormat == KSDATAFORMAT_SUBTYPE_PCM);
+
+    // Q15 and Q31 SRC only, 24-bit PCM is supported in 32-bit containers
+    if (bFixedPoint && (!bIntegerPCM || (this->tEndpointFmt.wBitsPerSample != 16 && this->tEndpointFmt.wBitsPerSample != 32)))
+        return ERROR_NOT_SUPPORTED;
+
+    this->bFixedPoint = bFixedPoint;
+    return ERROR_SUCCESS;
+}
+
 HRESULT AudioBuffer::InitBuffer(UINT32* nEndpointBufferSize, RingBufferChannel** pCircularBuffer,
     DWORD nUpsample, DWORD nDownsample)
 {
@@ -243,6 +229,54 @@ HRESULT AudioBuffer::InitBuffer(UINT32* nEndpointBufferSize, RingBufferChannel**
     
     // Set LP scaling factor in the associated resampler according to the resampling factor
     this->pResampler->SetLPScaling(this->tResampleFmt.fFactor);
+    
+    // Follow the clock drift between the device and the ring buffer with an adjustable ratio if requested
+    this->bDriftTracking = RESAMPLER_DRIFT_TRACKING &&
+        this->pResampler->InitDrift(nUpsample, nDownsample, this->tEndpointFmt.nChannels) == ERROR_SUCCESS;
+    this->bResample = this->tResampleFmt.fFactor != 1.0 || this->bDriftTracking;
+
+    if (RESAMPLER_DRIFT_TRACKING && !this->bDriftTracking)
+        std::cout   << WRN "Drift tracking SRC of device "
+                    << this->nInstance
+                    << " was not initialized, nominal resampling factor is used." END
+                    << std::endl;
+
+    // Precompute polyphase filter bank for the rational factor, interpolating SRC is used if it cannot be built
+    if (!this->bDriftTracking && this->pResampler->InitPolyphase(nUpsample, nDownsample, this->tEndpointFmt.nChannels) != ERROR_SUCCESS)
+        std::cout   << WRN "Polyphase filter bank of device "
+                    << this->nInstance
+                    << " was not built, falling back to interpolating SRC." END
+                    << std::endl;
+    // Carry SRC history and phase across packets for continuous output, fixed-point SRC keeps its own,
+    // frame-wise SRC has no other way to reach the neighbouring packets
+    else if (!this->bFixedPoint && (RESAMPLER_STREAMING || this->pFrameRingBuffer != NULL) && 
+        this->pResampler->InitStream(*nEndpointBufferSize) != ERROR_SUCCESS)
+        std::cout   << WRN "Streaming SRC of device "
+                    << this->nInstance
+                    << " was not initialized, packets will be resampled independently." END
+                    << std::endl;
+
+    // Integer PCM cannot go through float SRC, so there is no fallback
+    if (this->bFixedPoint && this->bResample &&
+        this->pResampler->InitFixedPoint(this->tEndpointFmt.wBitsPerSample, *nEndpointBufferSize) != ERROR_SUCCESS)
+    {
+        std::cout   << ERR "Fixed-point SRC of device "
+                    << this->nInstance
+                    << " was not initialized." END
+                    << std::endl;
+        return ERROR_NOT_SUPPORTED;
+    }
+
+    // Frame-wise float SRC runs only on the streaming polyphase bank, so there is no fallback either
+    if (this->pFrameRingBuffer != NULL && this->bResample && !this->bFixedPoint && this->pResampler->GetHistoryLength() == 0)
+    {
+        std::cout   << ERR "Frame-wise SRC of device "
+                    << this->nInstance
+                    << " was not initialized." END
+                    << std::endl;
+        return ERROR_NOT_SUPPORTED;
+    }
+
     // Update the minimum number of ring buffer samples required for safe SRC prior to output to render device
     // value is unused if the device is a capture device
     this->UpdateMinFramesOut();
@@ -258,84 +292,245 @@ HRESULT AudioBuffer::InitBuffer(UINT32* nEndpointBufferSize, RingBufferChannel**
     return ERROR_SUCCESS;
 }
 
+HRESULT AudioBuffer::InitBuffer(UINT32* nEndpointBufferSize, FrameRingBuffer* pFrameRingBuffer,
+    DWORD nUpsample, DWORD nDownsample)
+{
+    // Whole frames of the device are moved at once, so they must match the frames of the ring buffer
+    if (pFrameRingBuffer == NULL || pFrameRingBuffer->GetChannelNumber() != this->tEndpointFmt.nChannels)
+        return ERROR_INVALID_PARAMETER;
+
+    this->pFrameRingBuffer = pFrameRingBuffer;
+
+    return this->InitBuffer(nEndpointBufferSize, (RingBufferChannel**)NULL, nUpsample, nDownsample);
+}
+
 HRESULT AudioBuffer::InitWAV()
 {
+    BYTE pFormat[sizeof(WAVEFORMATEXTENSIBLE)];
+    UINT32 nFormatBytes = 0;
+    HRESULT hr = ERROR_SUCCESS;
+
+    // Either a single file holding all channels, or a mono file per channel
+    this->nRecordTracks = WAV_FILE_INTERLEAVED ? 1 : this->tEndpointFmt.nChannels;
+
+    this->pRecorder = WAVRecorder::Acquire();
+    this->pOriginalTrack = (WAVRECORDERTRACK**)calloc(this->nRecordTracks, sizeof(WAVRECORDERTRACK*));
+    if (this->pRecordScratch == NULL)
+        this->pRecordScratch = (FLOAT*)malloc(WAVRECORDER_STAGING_SAMPLES * this->tEndpointFmt.nChannels * sizeof(FLOAT));
+
+    if (this->pRecorder == NULL || this->pOriginalTrack == NULL || this->pRecordScratch == NULL)
+        return ENOMEM;
+
     this->bOutputWAV = TRUE;
-    this->fOriginalOutputFiles = (FILE**)malloc(this->tEndpointFmt.nChannels * sizeof(FILE*));
-    this->nOriginalFileLength = (DWORD*)malloc(this->tEndpointFmt.nChannels * sizeof(DWORD));
 
-    WORD ch = 1;
-    DWORD fmtLength = 40;
-    DWORD newAvgBytesPerSec = this->tEndpointFmt.nAvgBytesPerSec / this->tEndpointFmt.nChannels;
-    WORD newBlockAlign = this->tEndpointFmt.nBlockAlign / this->tEndpointFmt.nChannels;
+    nFormatBytes = this->MakeWAVFormat(pFormat, this->tEndpointFmt.nSamplesPerSec);
 
-    for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
+    // FLAC quantizes to FLACCODEC_BITS_PER_SAMPLE bits, exact only for integer sources no wider than that
+    BOOL bFLAC = WAVRECORDER_FLAC && this->bFixedPoint && this->tEndpointFmt.wBitsPerSample <= FLACCODEC_BITS_PER_SAMPLE;
+    if (WAVRECORDER_FLAC && !bFLAC)
+        std::cout << WRN << "FLAC would not hold the " << this->tEndpointFmt.wBitsPerSample << "-bit samples of " << this->sFilename << " exactly, recording float WAV." END << std::endl;
+
+    hr = this->OpenWAVTracks(this->pOriginalTrack, "", pFormat, nFormatBytes, bFLAC);
+    if (hr != ERROR_SUCCESS) return hr;
+
+    if (this->tResampleFmt.nUpsample > 1 || this->tResampleFmt.nDownsample > 1)
     {
+        this->pResampledTrack = (WAVRECORDERTRACK**)calloc(this->nRecordTracks, sizeof(WAVRECORDERTRACK*));
+        if (this->pResampledTrack == NULL) return ENOMEM;
+
+        DWORD newResampledSamplesPerSec = this->tEndpointFmt.nSamplesPerSec * this->tResampleFmt.nUpsample / this->tResampleFmt.nDownsample;
+
+        nFormatBytes = this->MakeWAVFormat(pFormat, newResampledSamplesPerSec);
+
+        // Resampled samples are no longer integers of the source's width, they stay float
+        hr = this->OpenWAVTracks(this->pResampledTrack, " Resampled", pFormat, nFormatBytes, FALSE);
+        if (hr != ERROR_SUCCESS) return hr;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+HRESULT AudioBuffer::InitFlightRecorder()
+{
+    // Shares the conversion block with WAV recording, both run on the capture thread
+    if (this->pRecordScratch == NULL)
+        this->pRecordScratch = (FLOAT*)malloc(WAVRECORDER_STAGING_SAMPLES * this->tEndpointFmt.nChannels * sizeof(FLOAT));
+
+    if (this->pRecordScratch == NULL) return ENOMEM;
+
+    this->pFlightRecorder = new FlightRecorder("Audio Files/" + this->sFilename + " Trigger",
+        this->tEndpointFmt.nChannels,
+        this->tEndpointFmt.nSamplesPerSec,
+        this->tEndpointFmt.channelMask);
+
+    // History could not be allocated
+    if (this->pFlightRecorder->GetBufferSize() == 0)
+    {
+        delete this->pFlightRecorder;
+        this->pFlightRecorder = NULL;
+        return ENOMEM;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+HRESULT AudioBuffer::TriggerFlightRecorder()
+{
+    if (this->pFlightRecorder == NULL) return ERROR_NOT_SUPPORTED;
+
+    return this->pFlightRecorder->Trigger();
+}
+
+UINT32 AudioBuffer::MakeWAVFormat(BYTE* pFormat, DWORD nSamplesPerSec)
+{
+    WAVEFORMATEXTENSIBLE tFormat = {};
+    WORD ch = (WORD)(this->tEndpointFmt.nChannels / this->nRecordTracks);
+
+    // Samples are always recorded as converted by ReadSample, whatever the endpoint's sample format
+    tFormat.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+    tFormat.Format.nChannels = ch;
+    tFormat.Format.nSamplesPerSec = nSamplesPerSec;
+    tFormat.Format.nBlockAlign = ch * sizeof(FLOAT);
+    tFormat.Format.nAvgBytesPerSec = nSamplesPerSec * tFormat.Format.nBlockAlign;
+    tFormat.Format.wBitsPerSample = 8 * sizeof(FLOAT);
+    tFormat.Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+    tFormat.Samples.wValidBitsPerSample = 8 * sizeof(FLOAT);
+    // Speaker positions only hold for the device's full channel set
+    tFormat.dwChannelMask = (ch == this->tEndpointFmt.nChannels) ? this->tEndpointFmt.channelMask : 0;
+    tFormat.SubFormat = KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+
+    memcpy(pFormat, &tFormat, sizeof(WAVEFORMATEXTENSIBLE));
+
+    return sizeof(WAVEFORMATEXTENSIBLE);
+}
+
+HRESULT AudioBuffer::OpenWAVTracks(WAVRECORDERTRACK** pTrack, std::string sSuffix, BYTE* pFormat, UINT32 nFormatBytes, BOOL bFLAC)
+{
+    for (UINT32 i = 0; i < this->nRecordTracks; i++)
+    {
+        // Channel number is only part of the name when each channel has its own file
+        std::string sPath = "Audio Files/" + this->sFilename +
+            (WAV_FILE_INTERLEAVED ? "" : std::to_string(i + 1)) + sSuffix + (bFLAC ? ".flac" : ".wav");
+
         for (UINT8 attempts = 0; attempts < WAV_FILE_OPEN_ATTEMPTS; attempts++)
         {
-            this->fOriginalOutputFiles[i] = fopen(("Audio Files/" + this->sFilename + std::to_string(i + 1) + ".wav").c_str(), "wb");
-
-            if (this->fOriginalOutputFiles[i] != NULL) break;
-            else if (attempts == WAV_FILE_OPEN_ATTEMPTS - 1 && this->fOriginalOutputFiles[i] == NULL) 
+            // FLAC tracks take the same float frames, only channels and rate of the format matter to them
+            if (bFLAC)
+                pTrack[i] = this->pRecorder->OpenFLACTrack(sPath,
+                    ((WAVEFORMATEX*)pFormat)->nChannels,
+                    ((WAVEFORMATEX*)pFormat)->nSamplesPerSec);
+            else
+                pTrack[i] = this->pRecorder->OpenTrack(sPath, pFormat, nFormatBytes);
+
+            if (pTrack[i] != NULL) break;
+            else if (attempts == WAV_FILE_OPEN_ATTEMPTS - 1) 
                 return ERROR_TOO_MANY_OPEN_FILES;
         }
+    }
 
-        // RIFF Header
-        fputs("RIFF----WAVEfmt ", this->fOriginalOutputFiles[i]);
-        // Format-Section
-        fwrite(&fmtLength, sizeof(DWORD), 1, this->fOriginalOutputFiles[i]);
-        fwrite(&this->tEndpointFmt.wFormatTag, sizeof(WORD), 1, this->fOriginalOutputFiles[i]);
-        fwrite(&ch, sizeof(WORD), 1, this->fOriginalOutputFiles[i]);
-        fwrite(&this->tEndpointFmt.nSamplesPerSec, sizeof(DWORD), 1, this->fOriginalOutputFiles[i]);
-        fwrite(&newAvgBytesPerSec, sizeof(DWORD), 1, this->fOriginalOutputFiles[i]);
-        fwrite(&newBlockAlign, sizeof(WORD), 1, this->fOriginalOutputFiles[i]);
-        fwrite(&this->tEndpointFmt.wBitsPerSample, sizeof(WORD), 1, this->fOriginalOutputFiles[i]);
-        fwrite(&this->tEndpointFmt.cbSize, sizeof(WORD), 1, this->fOriginalOutputFiles[i]);
-        fwrite(&this->tEndpointFmt.wValidBitsPerSample, sizeof(WORD), 1, this->fOriginalOutputFiles[i]);
-        fwrite(&this->tEndpointFmt.channelMask, sizeof(DWORD), 1, this->fOriginalOutputFiles[i]);
-        fwrite(&this->tEndpointFmt.subFormat, sizeof(GUID), 1, this->fOriginalOutputFiles[i]);
-        // Data-Section
-        fputs("data----", this->fOriginalOutputFiles[i]);
+    return ERROR_SUCCESS;
+}
+
+void AudioBuffer::RecordFrames(WAVRECORDERTRACK** pTrack, BYTE* pFrames, UINT32 nFrames)
+{
+    // Hand frames over in blocks, one queue operation each instead of one write per sample
+    if (WAV_FILE_INTERLEAVED)
+    {
+        BYTE* pDataDummy = pFrames;
+
+        for (UINT32 j = 0; j < nFrames; j += WAVRECORDER_STAGING_SAMPLES)
+        {
+            UINT32 nBlock = min(nFrames - j, (UINT32)WAVRECORDER_STAGING_SAMPLES);
+            FLOAT* pSample = this->pRecordScratch;
+
+            for (UINT32 k = 0; k < nBlock; k++, pDataDummy += this->tEndpointFmt.nBlockAlign)
+                for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
+                    *pSample++ = this->ReadSample(pDataDummy, i);
+
+            this->pRecorder->Record(pTrack[0], this->pRecordScratch, nBlock * this->tEndpointFmt.nChannels * sizeof(FLOAT));
+        }
+        return;
     }
 
-    if (this->tResampleFmt.nUpsample > 1 || this->tResampleFmt.nDownsample > 1)
+    for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
     {
-        this->fResampledOutputFiles = (FILE**)malloc(this->tEndpointFmt.nChannels * sizeof(FILE*));
-        this->nResampledFileLength = (DWORD*)malloc(this->tEndpointFmt.nChannels * sizeof(DWORD));
+        BYTE* pDataDummy = pFrames;
 
-        newAvgBytesPerSec = newAvgBytesPerSec * this->tResampleFmt.nUpsample / this->tResampleFmt.nDownsample;
-        DWORD newResampledSamplesPerSec = this->tEndpointFmt.nSamplesPerSec * this->tResampleFmt.nUpsample / this->tResampleFmt.nDownsample;
+        for (UINT32 j = 0; j < nFrames; j += WAVRECORDER_STAGING_SAMPLES)
+        {
+            UINT32 nSamples = min(nFrames - j, (UINT32)WAVRECORDER_STAGING_SAMPLES);
 
-        for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
+            for (UINT32 k = 0; k < nSamples; k++, pDataDummy += this->tEndpointFmt.nBlockAlign)
+                this->pRecordScratch[k] = this->ReadSample(pDataDummy, i);
+
+            this->pRecorder->Record(pTrack[i], this->pRecordScratch, nSamples * sizeof(FLOAT));
+        }
+    }
+}
+
+void AudioBuffer::RecordHistory(BYTE* pFrames, UINT32 nFrames)
+{
+    BYTE* pDataDummy = pFrames;
+
+    for (UINT32 j = 0; j < nFrames; j += WAVRECORDER_STAGING_SAMPLES)
+    {
+        UINT32 nBlock = min(nFrames - j, (UINT32)WAVRECORDER_STAGING_SAMPLES);
+        FLOAT* pSample = this->pRecordScratch;
+
+        for (UINT32 k = 0; k < nBlock; k++, pDataDummy += this->tEndpointFmt.nBlockAlign)
+            for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
+                *pSample++ = this->ReadSample(pDataDummy, i);
+
+        this->pFlightRecorder->Push(this->pRecordScratch, nBlock);
+    }
+}
+
+void AudioBuffer::RecordChannels(WAVRECORDERTRACK** pTrack, UINT32 nFrames)
+{
+    // Interleave the frames past each ring buffer's write offset in blocks
+    if (WAV_FILE_INTERLEAVED)
+    {
+        for (UINT32 j = 0; j < nFrames; j += WAVRECORDER_STAGING_SAMPLES)
         {
-            for (UINT8 attempts = 0; attempts < WAV_FILE_OPEN_ATTEMPTS; attempts++)
-            {
-                this->fResampledOutputFiles[i] = fopen(("Audio Files/" + this->sFilename + std::to_string(i + 1) + " Resampled.wav").c_str(), "wb");
+            UINT32 nBlock = min(nFrames - j, (UINT32)WAVRECORDER_STAGING_SAMPLES);
+            FLOAT* pSample = this->pRecordScratch;
 
-                if (this->fResampledOutputFiles[i] != NULL) break;
-                else if (attempts == WAV_FILE_OPEN_ATTEMPTS - 1 && this->fResampledOutputFiles[i] == NULL) return ERROR_TOO_MANY_OPEN_FILES;
-            }
+            for (UINT32 k = 0; k < nBlock; k++)
+                for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
+                    *pSample++ = *(this->pRingBufferChannel[i]->GetBufferPointer() + ((this->pRingBufferChannel[i]->GetWriteOffset() + j + k) & this->pRingBufferChannel[i]->GetBufferMask()));
 
-            // RIFF Header
-            fputs("RIFF----WAVEfmt ", this->fResampledOutputFiles[i]);
-            // Format-Section
-            fwrite(&fmtLength, sizeof(DWORD), 1, this->fResampledOutputFiles[i]);
-            fwrite(&this->tEndpointFmt.wFormatTag, sizeof(WORD), 1, this->fResampledOutputFiles[i]);
-            fwrite(&ch, sizeof(WORD), 1, this->fResampledOutputFiles[i]);
-            fwrite(&newResampledSamplesPerSec, sizeof(DWORD), 1, this->fResampledOutputFiles[i]);
-            fwrite(&newAvgBytesPerSec, sizeof(DWORD), 1, this->fResampledOutputFiles[i]);
-            fwrite(&newBlockAlign, sizeof(WORD), 1, this->fResampledOutputFiles[i]);
-            fwrite(&this->tEndpointFmt.wBitsPerSample, sizeof(WORD), 1, this->fResampledOutputFiles[i]);
-            fwrite(&this->tEndpointFmt.cbSize, sizeof(WORD), 1, this->fResampledOutputFiles[i]);
-            fwrite(&this->tEndpointFmt.wValidBitsPerSample, sizeof(WORD), 1, this->fResampledOutputFiles[i]);
-            fwrite(&this->tEndpointFmt.channelMask, sizeof(DWORD), 1, this->fResampledOutputFiles[i]);
-            fwrite(&this->tEndpointFmt.subFormat, sizeof(GUID), 1, this->fResampledOutputFiles[i]);
-            // Data-Section
-            fputs("data----", this->fResampledOutputFiles[i]);
+            this->pRecorder->Record(pTrack[0], this->pRecordScratch, nBlock * this->tEndpointFmt.nChannels * sizeof(FLOAT));
         }
+        return;
     }
 
-    return ERROR_SUCCESS;
+    for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
+    {
+        UINT32 nBufferSize = this->pRingBufferChannel[i]->GetBufferSize();
+        UINT32 nWriteOffset = this->pRingBufferChannel[i]->GetWriteOffset();
+        FLOAT* pBuffer = this->pRingBufferChannel[i]->GetBufferPointer();
+
+        // If data was filled at most up to the end of memory allocated for ring buffer,
+        // or the ring buffer is mirrored and any span is contiguous
+        if (nWriteOffset + nFrames <= nBufferSize || this->pRingBufferChannel[i]->IsMirrored())
+            // Queue data from ring buffer from the previous offset up till the number of resampled frames
+            this->pRecorder->Record(pTrack[i],
+                pBuffer + nWriteOffset,
+                sizeof(FLOAT) * nFrames);
+        // If more data was filled in the buffer than the amount of free contigious memory in the ring buffer, go circularly
+        else
+        {
+            // Queue data from ring buffer's offset up till the end of the ring buffer
+            this->pRecorder->Record(pTrack[i],
+                pBuffer + nWriteOffset,
+                sizeof(FLOAT) * (nBufferSize - nWriteOffset));
+
+            // Queue data from ring buffer's beginnig up till the remaining number of resampled frames
+            this->pRecorder->Record(pTrack[i],
+                pBuffer,
+                sizeof(FLOAT) * ((nWriteOffset + nFrames) & (nBufferSize - 1)));
+        }
+    }
 }
 
 HRESULT AudioBuffer::PushData(BYTE* pData)
@@ -347,65 +542,56 @@ HRESULT AudioBuffer::PushData(BYTE* pData)
     // Modulo operator allows to go in circular fashion so no code duplication is required   
 
     if (pData != NULL)
+    {
         // Save original signal to file if user requested
         if (this->bOutputWAV)
-            for (UINT32 j = 0; j < *this->tEndpointFmt.nBufferSize; j++, pDataDummy += this->tEndpointFmt.nBlockAlign)
-                for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
-                    fwrite(((FLOAT*)pDataDummy) + i, sizeof(FLOAT), 1, this->fOriginalOutputFiles[i]);
+            this->RecordFrames(this->pOriginalTrack, pData, *this->tEndpointFmt.nBufferSize);
 
-    // Obtain all necessary locks for thread safety
-    for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
-        this->pRingBufferChannel[i]->PrepareToPullDataIn();
+        // Keep original signal in memory in case a trigger asks for it
+        if (this->pFlightRecorder != NULL)
+            this->RecordHistory(pData, *this->tEndpointFmt.nBufferSize);
+    }
+
+    // All channels of the device sit in a single ring buffer, move whole frames instead
+    if (this->pFrameRingBuffer != NULL)
+        return this->PushFrames(pData);
 
     // When user calls AudioBuffer::PullData with pData = NULL, AUDCLNT_BUFFERFLAGS_SILENT flag is set
     // results in keeping 0's bulk set in previous step in the audio buffer data structure
     if (pData != NULL)
     {
-        // Perform resampling if resampling factor is other than 1
-        if (this->tResampleFmt.fFactor != 1.0)
+        // Perform resampling if resampling factor is other than 1 or drift is tracked
+        if (this->bResample)
         {
-            // Sample rate convert the packet and place in circular buffer
-            nSamplesWritten = this->pResampler->Resample(
-                this->tResampleFmt, 
-                this->tEndpointFmt,
-                &pData, 
-                (void*)this->pRingBufferChannel,
-                0,
-                TRUE);
-
-            // Write freshly resampled stream into file if user requested
-            if (this->bOutputWAV)
+            if (this->bFixedPoint)
             {
-                for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
+                // Upper bound of output frames a single packet produces
+                UINT32 nFramesOut = (UINT32)((UINT64)*this->tEndpointFmt.nBufferSize * this->tResampleFmt.nUpsample / this->tResampleFmt.nDownsample) + 2;
+
+                // Sample rate convert the packet in integer PCM, then convert to float once per output sample
+                if (this->ReserveScratch(nFramesOut) == ERROR_SUCCESS)
                 {
-                    UINT32 nBufferSize = this->pRingBufferChannel[i]->GetBufferSize();
-                    UINT32 nWriteOffset = this->pRingBufferChannel[i]->GetWriteOffset();
-                    FLOAT* pBuffer = this->pRingBufferChannel[i]->GetBufferPointer();
-
-                    // If data was filled at most up to the end of memory allocated for ring buffer
-                    if (nWriteOffset + nSamplesWritten <= nBufferSize)
-                        // Write to file data from ring buffer from the previous offset up till the number of resampled frames
-                        fwrite(pBuffer + nWriteOffset,
-                            sizeof(FLOAT),
-                            nSamplesWritten,
-                            this->fResampledOutputFiles[i]);
-                    // If more data was filled in the buffer than the amount of free contigious memory in the ring buffer, go circularly
-                    else
-                    {
-                        // Write data to file from ring buffer's offset up till the end of the ring buffer
-                        fwrite(pBuffer + nWriteOffset,
-                            sizeof(FLOAT),
-                            nBufferSize - nWriteOffset,
-                            this->fResampledOutputFiles[i]);
-
-                        // Write data to file from ring buffer's beginnig up till the remaining number of resampled frames
-                        fwrite(pBuffer,
-                            sizeof(FLOAT),
-                            (nWriteOffset + nSamplesWritten) % nBufferSize,
-                            this->fResampledOutputFiles[i]);
-                    }
+                    nSamplesWritten = this->pResampler->ResampleFixed(pData, *this->tEndpointFmt.nBufferSize, this->pScratch, nFramesOut);
+
+                    pDataDummy = this->pScratch;
+                    for (UINT32 j = 0; j < nSamplesWritten; j++, pDataDummy += this->tEndpointFmt.nBlockAlign)
+                        for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
+                            *(this->pRingBufferChannel[i]->GetBufferPointer() + ((this->pRingBufferChannel[i]->GetWriteOffset() + j) & this->pRingBufferChannel[i]->GetBufferMask())) = this->ReadSample(pDataDummy, i);
                 }
             }
+            else
+                // Sample rate convert the packet and place in circular buffer
+                nSamplesWritten = this->pResampler->Resample(
+                    this->tResampleFmt, 
+                    this->tEndpointFmt,
+                    &pData, 
+                    (void*)this->pRingBufferChannel,
+                    0,
+                    TRUE);
+
+            // Write freshly resampled stream into file if user requested
+            if (this->bOutputWAV && this->pResampledTrack != NULL)
+                this->RecordChannels(this->pResampledTrack, nSamplesWritten);
         }
         else // If factor is 1, right data straight into the ring buffer, don't write resampled file
         {
@@ -414,68 +600,67 @@ HRESULT AudioBuffer::PushData(BYTE* pData)
 
             for (UINT32 j = 0; j < *this->tEndpointFmt.nBufferSize; j++, pDataDummy += this->tEndpointFmt.nBlockAlign)
                 for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
-                    *(this->pRingBufferChannel[i]->GetBufferPointer() + (this->pRingBufferChannel[i]->GetWriteOffset() + j) % this->pRingBufferChannel[i]->GetBufferSize()) = *(((FLOAT*)pData) + i);
+                    *(this->pRingBufferChannel[i]->GetBufferPointer() + ((this->pRingBufferChannel[i]->GetWriteOffset() + j) & this->pRingBufferChannel[i]->GetBufferMask())) = this->ReadSample(pDataDummy, i);
         }
     }
     else
     {
         // TODO: provide for case when silence was written to file
+        
+        // Nothing is written into the ring buffer, so SRC history no longer precedes the next packet
+        this->pResampler->ResetStream();
     }
 
     //-------------------- End --------------------//
+    // Publish the frames to consumers only after all of them are in place,
+    // consumers overrun by the new frames skip ahead on their own on the next read
     for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
-    {
-        UINT32 nWriteOffsetOld = this->pRingBufferChannel[i]->GetWriteOffset(), nReadOffsetOld = this->pRingBufferChannel[i]->GetReadOffset();
-        UINT32 nWriteOffsetNew = (nWriteOffsetOld + nSamplesWritten) % this->pRingBufferChannel[i]->GetBufferSize();
-        BOOL bWriteAheadReadByLap = this->pRingBufferChannel[i]->GetWriteAheadReadByLap();
-
-        // Update the offset to position after the last frame of the current chunk
-        this->pRingBufferChannel[i]->SetWriteOffset(nWriteOffsetNew);
-
-        // If write offset exceeded read offset by a whole lap, update read offset to the position of write offset,
-        // hence drop frames that were delayed and try to catch up from the new position
-        if (((nWriteOffsetOld > nReadOffsetOld || (bWriteAheadReadByLap && nWriteOffsetOld == nReadOffsetOld)) &&
-                nWriteOffsetNew > nReadOffsetOld&&
-                nWriteOffsetNew < nWriteOffsetOld) ||
-            ((nWriteOffsetOld < nReadOffsetOld || (bWriteAheadReadByLap && nWriteOffsetOld == nReadOffsetOld)) &&
-                nWriteOffsetNew < nReadOffsetOld &&
-                nWriteOffsetNew < nWriteOffsetOld) ||
-            ((nWriteOffsetOld < nReadOffsetOld || (bWriteAheadReadByLap && nWriteOffsetOld == nReadOffsetOld)) &&
-                nWriteOffsetNew > nReadOffsetOld))
-        {
-            // Set read offset from the same point as the last non-overwritten sample
-            this->pRingBufferChannel[i]->SetReadOffset(nWriteOffsetNew);
-        }
+        this->pRingBufferChannel[i]->CommitWrite(nSamplesWritten);
 
-        // Write offset catching up on read offset from the left (lower array indices)
-        // indicating that if both match and write offset increased, then read offset is 
-        // about to read overwritten newest data - not good, jump to the oldest valid instead
-        this->pRingBufferChannel[i]->SetWriteAheadReadByLap(
-            (nWriteOffsetNew <= nReadOffsetOld && nWriteOffsetOld > nReadOffsetOld) ||
-            (nWriteOffsetNew <= nReadOffsetOld && nWriteOffsetOld < nWriteOffsetNew)
-        );
-    }
+    // Steer the resampling ratio by the fill level the captured packet left the ring buffer at
+    if (this->bDriftTracking && pData != NULL)
+        this->pResampler->UpdateDrift(this->pRingBufferChannel[0]->GetFramesAvailable(), (DOUBLE)*this->tEndpointFmt.nBufferSize / this->tEndpointFmt.nSamplesPerSec);
 
-    // Release all necessary locks for thread safety
-    for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
-        this->pRingBufferChannel[i]->FinishToPullDataIn();
-    
     return ERROR_SUCCESS;
 }
 
-HRESULT AudioBuffer::PullData(BYTE* pData, UINT32 nFrames)
+HRESULT AudioBuffer::PullData(BYTE* pData, UINT32 nFrames, UINT32* pFramesOut)
 {
-    UINT32 nSamplesRead = nFrames;
+    UINT32 nSamplesRead = nFrames, nFramesOut = nFrames;
+    BYTE* pOut = pData;
 
-    // Obtain all necessary locks for thread safety
-    for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
-        this->pRingBufferChannel[i]->PrepareToPushDataOut();
+    // All channels of the device sit in a single ring buffer, move whole frames instead
+    if (this->pFrameRingBuffer != NULL)
+        return this->PullFrames(pData, nFrames, pFramesOut);
 
-    // Perform resampling if resampling factor is other than 1
-    if (this->tResampleFmt.fFactor != 1.0)
+    // Steer the resampling ratio by the fill level the render device finds the ring buffer at
+    if (this->bDriftTracking)
+        this->pResampler->UpdateDrift(this->pRingBufferChannel[0]->GetFramesAvailable(), (DOUBLE)nFrames / this->tEndpointFmt.nSamplesPerSec);
+
+    // Perform resampling if resampling factor is other than 1 or drift is tracked
+    if (this->bResample && this->bFixedPoint)
+    {
+        // Pull only as many frames as integer SRC needs on top of its history to fill the render buffer
+        nSamplesRead = min(this->pResampler->GetFramesNeeded(nFrames), this->pRingBufferChannel[0]->GetFramesAvailable());
+
+        nFramesOut = 0;
+
+        if (this->ReserveScratch(nSamplesRead) == ERROR_SUCCESS)
+        {
+            BYTE* pDataDummy = this->pScratch;
+            for (UINT32 j = 0; j < nSamplesRead; j++, pDataDummy += this->tEndpointFmt.nBlockAlign)
+                for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
+                    this->WriteSample(pDataDummy, i, *(this->pRingBufferChannel[i]->GetBufferPointer() + ((this->pRingBufferChannel[i]->GetReadOffset() + j) & this->pRingBufferChannel[i]->GetBufferMask())));
+
+            nFramesOut = this->pResampler->ResampleFixed(this->pScratch, nSamplesRead, pData, nFrames);
+        }
+        else
+            nSamplesRead = 0;
+    }
+    else if (this->bResample)
     {
-        // Sample rate convert the packet and place in output device's buffer
-        nSamplesRead = this->pResampler->Resample(
+        // Sample rate convert the packet and place in output device's buffer, streaming SRC stops short once its right wing runs out of input
+        nFramesOut = this->pResampler->Resample(
             this->tResampleFmt,
             this->tEndpointFmt,
             (void*)this->pRingBufferChannel,
@@ -488,25 +673,68 @@ HRESULT AudioBuffer::PullData(BYTE* pData, UINT32 nFrames)
         // Push nFrames from the ring buffer into the endpoint buffer for playback
         for (UINT32 j = 0; j < nFrames; j++, pData += this->tEndpointFmt.nBlockAlign)
             for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
-                *(((FLOAT*)pData) + i) = *(this->pRingBufferChannel[i]->GetBufferPointer() + (this->pRingBufferChannel[i]->GetReadOffset() + j) % this->pRingBufferChannel[i]->GetBufferSize());
+                this->WriteSample(pData, i, *(this->pRingBufferChannel[i]->GetBufferPointer() + ((this->pRingBufferChannel[i]->GetReadOffset() + j) & this->pRingBufferChannel[i]->GetBufferMask())));
     }
 
-    // Update read pointer respecting the circular buffer traversal
-    for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
-    {
-        this->pRingBufferChannel[i]->SetReadOffset((this->pRingBufferChannel[i]->GetReadOffset() + nSamplesRead) % this->pRingBufferChannel[i]->GetBufferSize());
+    // Render silence for the frames SRC came short on rather than whatever the endpoint buffer held
+    if (nFramesOut < nFrames)
+        memset(pOut + (SIZE_T)nFramesOut * this->tEndpointFmt.nBlockAlign, 0, (SIZE_T)(nFrames - nFramesOut) * this->tEndpointFmt.nBlockAlign);
 
-        // If read offset caught up on the write offset from the left, clear the boolean
-        this->pRingBufferChannel[i]->SetWriteAheadReadByLap(this->pRingBufferChannel[i]->GetReadOffset() > this->pRingBufferChannel[i]->GetWriteOffset());
-    }
+    if (pFramesOut != NULL) *pFramesOut = nFramesOut;
+
+    // SRC reads a different number of frames than it writes, advance by the input frames it moved past
+    if (this->bResample && !this->bFixedPoint)
+        nSamplesRead = this->pResampler->GetFramesConsumed();
 
-    // Release all necessary locks for thread safety
+    // Hand the frames back to the producer, ring buffer never lets the read cursor pass the write index
     for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
-        this->pRingBufferChannel[i]->FinishToPushDataOut();
+        this->pRingBufferChannel[i]->CommitRead(nSamplesRead);
 
     return ERROR_SUCCESS;
 }
 
+const ENDPOINTFMT* AudioBuffer::GetEndpointFmt()
+{
+    return &this->tEndpointFmt;
+}
+
+BOOL AudioBuffer::GetFixedPoint()
+{
+    return this->bFixedPoint;
+}
+
+FLOAT AudioBuffer::ReadSample(BYTE* pFrame, UINT32 nChannel)
+{
+    if (!this->bFixedPoint)
+        return ((FLOAT*)pFrame)[nChannel];
+    else if (this->tEndpointFmt.wBitsPerSample == 16)
+        return ((INT16*)pFrame)[nChannel] * (1.0f / 32768.0f);
+    else
+        return (FLOAT)(((INT32*)pFrame)[nChannel] * (1.0 / 2147483648.0));
+}
+
+void AudioBuffer::WriteSample(BYTE* pFrame, UINT32 nChannel, FLOAT fSample)
+{
+    if (!this->bFixedPoint)
+        ((FLOAT*)pFrame)[nChannel] = fSample;
+    else if (this->tEndpointFmt.wBitsPerSample == 16)
+        ((INT16*)pFrame)[nChannel] = (INT16)min(max(floor(fSample * 32768.0 + 0.5), -32768.0), 32767.0);
+    else
+        ((INT32*)pFrame)[nChannel] = (INT32)min(max(floor(fSample * 2147483648.0 + 0.5), -2147483648.0), 2147483647.0);
+}
+
+HRESULT AudioBuffer::ReserveScratch(UINT32 nFrames)
+{
+    if (nFrames <= this->nScratchFrames) return ERROR_SUCCESS;
+
+    BYTE* dummy = (BYTE*)realloc(this->pScratch, (SIZE_T)nFrames * this->tEndpointFmt.nBlockAlign);
+    if (dummy == NULL) return ENOMEM;
+
+    this->pScratch = dummy;
+    this->nScratchFrames = nFrames;
+    return ERROR_SUCCESS;
+}
+
 HRESULT AudioBuffer::SetEndpointBufferSize(UINT32 nFrames)
 {
     // Set buffer size to the new number
@@ -518,7 +746,10 @@ HRESULT AudioBuffer::SetEndpointBufferSize(UINT32 nFrames)
 
 HRESULT AudioBuffer::UpdateMinFramesOut()
 {
-    this->nMinFramesOut = ceil(*this->tEndpointFmt.nBufferSize * this->tResampleFmt.fFactor);
+    this->nMinFramesOut = ceil(*this->tEndpointFmt.nBufferSize * this->tResampleFmt.fFactor) + this->pResampler->GetHistoryLength();
+
+    // Drift tracking holds enough frames in the ring buffer to absorb the jitter of packet arrival
+    this->pResampler->SetDriftTarget(RESAMPLER_DRIFT_TARGET_PACKETS * this->nMinFramesOut);
     return ERROR_SUCCESS;
 }
 
@@ -526,3 +757,156 @@ UINT32 AudioBuffer::GetMinFramesOut()
 {
     return this->nMinFramesOut;
 }
+
+UINT32 AudioBuffer::FramesAvailable()
+{
+    if (this->pFrameRingBuffer != NULL)
+        return this->pFrameRingBuffer->GetFramesAvailable();
+
+    if (this->pRingBufferChannel != NULL && this->pRingBufferChannel[0] != NULL)
+        return this->pRingBufferChannel[0]->GetFramesAvailable();
+
+    return 0;
+}
+
+BOOL AudioBuffer::WaitForFrames(UINT32 nFrames, DWORD dwMilliseconds)
+{
+    if (this->pFrameRingBuffer != NULL)
+        return this->pFrameRingBuffer->WaitForFrames(nFrames, dwMilliseconds);
+
+    if (this->pRingBufferChannel != NULL && this->pRingBufferChannel[0] != NULL)
+        return this->pRingBufferChannel[0]->WaitForFrames(nFrames, dwMilliseconds);
+
+    return FALSE;
+}
+
+HRESULT AudioBuffer::PushFrames(BYTE* pData)
+{
+    UINT32 nFramesIn = *this->tEndpointFmt.nBufferSize;
+
+    // Nothing is written into the ring buffer, so SRC history no longer precedes the next packet
+    if (pData == NULL)
+    {
+        this->pResampler->ResetStream();
+        return ERROR_SUCCESS;
+    }
+
+    if (this->bResample)
+    {
+        // Upper bound of output frames a single packet produces
+        UINT32 nFramesOut = (UINT32)((UINT64)nFramesIn * this->tResampleFmt.nUpsample / this->tResampleFmt.nDownsample) + 2;
+
+        if (this->ReserveScratch(nFramesOut) != ERROR_SUCCESS) return ENOMEM;
+
+        // Sample rate convert the packet frame-wise in the endpoint's format
+        UINT32 nFramesWritten = this->bFixedPoint ?
+            this->pResampler->ResampleFixed(pData, nFramesIn, this->pScratch, nFramesOut) :
+            this->pResampler->ResampleFrames((FLOAT*)pData, nFramesIn, (FLOAT*)this->pScratch, nFramesOut);
+
+        // Write freshly resampled stream into file if user requested
+        if (this->bOutputWAV && this->pResampledTrack != NULL)
+            this->RecordFrames(this->pResampledTrack, this->pScratch, nFramesWritten);
+
+        this->StoreFrames(this->pScratch, nFramesWritten);
+    }
+    else // If factor is 1, right data straight into the ring buffer
+        this->StoreFrames(pData, nFramesIn);
+
+    // Steer the resampling ratio by the fill level the captured packet left the ring buffer at
+    if (this->bDriftTracking)
+        this->pResampler->UpdateDrift(this->pFrameRingBuffer->GetFramesAvailable(), (DOUBLE)nFramesIn / this->tEndpointFmt.nSamplesPerSec);
+
+    return ERROR_SUCCESS;
+}
+
+HRESULT AudioBuffer::PullFrames(BYTE* pData, UINT32 nFrames, UINT32* pFramesOut)
+{
+    UINT32 nFramesOut = 0;
+
+    // Steer the resampling ratio by the fill level the render device finds the ring buffer at
+    if (this->bDriftTracking)
+        this->pResampler->UpdateDrift(this->pFrameRingBuffer->GetFramesAvailable(), (DOUBLE)nFrames / this->tEndpointFmt.nSamplesPerSec);
+
+    if (this->bResample)
+    {
+        // Pull only as many frames as SRC needs on top of its history to fill the render buffer
+        UINT32 nFramesIn = min(this->pResampler->GetFramesNeeded(nFrames), this->pFrameRingBuffer->GetFramesAvailable());
+
+        if (this->ReserveScratch(nFramesIn) != ERROR_SUCCESS) return ENOMEM;
+
+        nFramesIn = this->LoadFrames(this->pScratch, nFramesIn);
+
+        nFramesOut = this->bFixedPoint ?
+            this->pResampler->ResampleFixed(this->pScratch, nFramesIn, pData, nFrames) :
+            this->pResampler->ResampleFrames((FLOAT*)this->pScratch, nFramesIn, (FLOAT*)pData, nFrames);
+    }
+    else // If factor is 1, right data straight into the device's buffer
+        nFramesOut = this->LoadFrames(pData, nFrames);
+
+    // Render silence for the frames the ring buffer came short on rather than whatever the endpoint buffer held
+    if (nFramesOut < nFrames)
+        memset(pData + (SIZE_T)nFramesOut * this->tEndpointFmt.nBlockAlign, 0, (SIZE_T)(nFrames - nFramesOut) * this->tEndpointFmt.nBlockAlign);
+
+    if (pFramesOut != NULL) *pFramesOut = nFramesOut;
+
+    return ERROR_SUCCESS;
+}
+
+void AudioBuffer::StoreFrames(BYTE* pFrames, UINT32 nFrames)
+{
+    FrameRingBuffer* pRing = this->pFrameRingBuffer;
+
+    // Float frames already are ring buffer frames, copy them whole
+    if (!this->bFixedPoint)
+    {
+        pRing->WriteFrames((FLOAT*)pFrames, nFrames);
+        return;
+    }
+
+    // Only the newest frames fit a packet larger than the ring, they land where they would have after the older ones
+    UINT32 nSkipped = (nFrames > pRing->GetBufferSize()) ? nFrames - pRing->GetBufferSize() : 0;
+    pFrames += (SIZE_T)nSkipped * this->tEndpointFmt.nBlockAlign;
+    nFrames -= nSkipped;
+
+    FLOAT* pBuffer = pRing->GetBufferPointer();
+    UINT32 nMask = pRing->GetBufferMask(), nOffset = (pRing->GetWriteOffset() + nSkipped) & nMask;
+    UINT32 nFrameStride = pRing->GetFrameStride(), nChannelStride = pRing->GetChannelStride();
+
+    // Convert integer PCM a frame at a time, wrapping once per frame rather than once per sample
+    for (UINT32 j = 0; j < nFrames; j++, pFrames += this->tEndpointFmt.nBlockAlign)
+    {
+        FLOAT* pFrame = pBuffer + (SIZE_T)((nOffset + j) & nMask) * nFrameStride;
+        for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
+            pFrame[(SIZE_T)i * nChannelStride] = this->ReadSample(pFrames, i);
+    }
+
+    // Publish the frames to the consumer only after all of them are in place, it resyncs past the skipped ones
+    pRing->CommitWrite(nSkipped + nFrames);
+}
+
+UINT32 AudioBuffer::LoadFrames(BYTE* pFrames, UINT32 nFrames)
+{
+    FrameRingBuffer* pRing = this->pFrameRingBuffer;
+
+    // Float frames already are endpoint frames, copy them whole
+    if (!this->bFixedPoint)
+        return pRing->ReadFrames((FLOAT*)pFrames, nFrames);
+
+    nFrames = min(nFrames, pRing->GetFramesAvailable());
+
+    FLOAT* pBuffer = pRing->GetBufferPointer();
+    UINT32 nOffset = pRing->GetReadOffset(), nMask = pRing->GetBufferMask();
+    UINT32 nFrameStride = pRing->GetFrameStride(), nChannelStride = pRing->GetChannelStride();
+
+    for (UINT32 j = 0; j < nFrames; j++, pFrames += this->tEndpointFmt.nBlockAlign)
+    {
+        FLOAT* pFrame = pBuffer + (SIZE_T)((nOffset + j) & nMask) * nFrameStride;
+        for (UINT32 i = 0; i < this->tEndpointFmt.nChannels; i++)
+            this->WriteSample(pFrames, i, pFrame[(SIZE_T)i * nChannelStride]);
+    }
+
+    // Hand the frames back to the producer only once they are converted
+    pRing->CommitRead(nFrames);
+
+    return nFrames;
+}
@@ -11,6 +11,11 @@
 #include "config.h"
 #include "Resampler.h"
 #include "AudioEffect.h"
+#include "WAVRecorder.h"
+
+class RingBufferChannel;
+class FrameRingBuffer;
+class FlightRecorder;
 
 /// <summary>
 /// Class representing a distinct physical or virtual device with associated ring buffer space,
@@ -40,7 +45,7 @@ class AudioBuffer
 
 		/// <summary>
 		/// <para>AudioBuffer destructor.</para>
-		/// <para>Closes WAV files, if used, and frees alloc'ed memory of FILE arrays and file lengths.</para>
+		/// <para>Completes WAV files, if used, and frees alloc'ed memory of recorder track arrays.</para>
 		/// </summary>
 		virtual ~AudioBuffer();
 
@@ -78,6 +83,19 @@ class AudioBuffer
 		/// <returns>ERROR_SUCCESS or ENOMEM.</returns>
 		HRESULT SetFormat(WAVEFORMATEX* pwfx);
 
+		/// <summary>
+		/// <para>Selects integer (Q15/Q31) SRC for this AudioBuffer instead of float SRC.</para>
+		/// <para>Packets of 16-bit or 32-bit integer PCM are then resampled without conversion
+		/// to float, converting only once per sample when moved into or out of the float ring buffer.</para>
+		/// <para>Note: must be called after AudioBuffer::SetFormat() and before AudioBuffer::InitBuffer().</para>
+		/// </summary>
+		/// <param name="bFixedPoint">- indicator if fixed-point SRC should be used.</param>
+		/// <returns>
+		/// <para>ERROR_SUCCESS if the mode was set.</para>
+		/// <para>ERROR_NOT_SUPPORTED if the endpoint does not stream 16-bit or 32-bit integer PCM.</para>
+		/// </returns>
+		HRESULT SetFixedPoint(BOOL bFixedPoint);
+
 		/// <summary>
 		/// <para>Initializes stream resample properties and endpoint buffer size.</para>
 		/// <para>Note: currently not thread-safe since AudioBuffer::nNextChannelOffset
@@ -95,17 +113,58 @@ class AudioBuffer
 		/// </returns>
 		HRESULT InitBuffer(UINT32* nEndpointBufferSize, RingBufferChannel** pCircularBuffer,
 							DWORD nUpsample, DWORD nDownsample);
+
+		/// <summary>
+		/// <para>Initializes stream resample properties and endpoint buffer size
+		/// for storage of all channels of the device in a single FrameRingBuffer.</para>
+		/// <para>AudioBuffer::PushData() and AudioBuffer::PullData() then move whole frames
+		/// between the endpoint and the ring buffer, with SRC done frame-wise in between.</para>
+		/// </summary>
+		/// <param name="nEndpointBufferSize">- length of endpoint buffer per channel</param>
+		/// <param name="pFrameRingBuffer">- ring buffer with as many channels as the device</param>
+		/// <param name="nUpsample">- upsampling factor</param>
+		/// <param name="nDownsample">- downsampling factor</param>
+		/// <returns>
+		/// <para>ERROR_SUCCESS if buffer set up succeeded.</para>
+		/// <para>ERROR_INVALID_PARAMETER if the ring buffer's frame does not match the device's.</para>
+		/// <para>ERROR_NOT_SUPPORTED if SRC required by the device cannot run frame-wise.</para>
+		/// </returns>
+		HRESULT InitBuffer(UINT32* nEndpointBufferSize, FrameRingBuffer* pFrameRingBuffer,
+							DWORD nUpsample, DWORD nDownsample);
 		
 		/// <summary>
 		/// <para>Initializes .WAV file headers for each channel of a device.
 		/// If original stream is resampled, also initializes .WAV file headers 
 		/// for the resampled version of the dat.</para>
+		/// <para>Files are written by the shared WAVRecorder thread, real-time threads only queue blocks for it.</para>
+		/// <para>With WAVRECORDER_FLAC, the files are losslessly compressed FLAC instead of float WAV.</para>
 		/// </summary>
 		/// <returns>
-		/// <para>ERROR_TOO_MANY_OPEN_FILES if fopen fails for FILE_OPEN_ATTEMPTS times.</para>
+		/// <para>ERROR_TOO_MANY_OPEN_FILES if a file fails to open for FILE_OPEN_ATTEMPTS times.</para>
+		/// <para>ENOMEM if the recorder could not be started or memory allocation failed.</para>
 		/// <para>ERROR_SUCCESS if WAV file for each channel is properly initialized.</para>
 		/// </returns>		
 		HRESULT InitWAV();
+
+		/// <summary>
+		/// <para>Starts keeping the recent history of the original stream in memory with a FlightRecorder,
+		/// to be written to disk on AudioBuffer::TriggerFlightRecorder().</para>
+		/// <para>Note: must be called after AudioBuffer::SetFormat().</para>
+		/// </summary>
+		/// <returns>
+		/// <para>ENOMEM if memory allocation failed.</para>
+		/// <para>ERROR_SUCCESS otherwise.</para>
+		/// </returns>
+		HRESULT InitFlightRecorder();
+
+		/// <summary>
+		/// <para>Dumps the history before and the audio after this moment into a WAV file, while capture carries on.</para>
+		/// </summary>
+		/// <returns>
+		/// <para>ERROR_NOT_SUPPORTED if AudioBuffer::InitFlightRecorder() was not called.</para>
+		/// <para>Status of FlightRecorder::Trigger() otherwise.</para>
+		/// </returns>
+		HRESULT TriggerFlightRecorder();
 		
 		/// <summary>
 		/// <para>The main audio data decimating method.</para>
@@ -136,8 +195,9 @@ class AudioBuffer
 		/// </summary>
 		/// <param name="pData">- pointer to the first byte into the buffer to place audio packet for render.</param>
 		/// <param name="nFrames">- number of frames available in the ring buffer to be pushed for render.</param>
+		/// <param name="pFramesOut">- receives the number of frames SRC produced, the rest up to nFrames being silence, NULL if not needed.</param>
 		/// <returns></returns>		
-		HRESULT PullData(BYTE* pData, UINT32 nFrames);
+		HRESULT PullData(BYTE* pData, UINT32 nFrames, UINT32* pFramesOut);
 
 		UINT32 GetChannelNumber();
 
@@ -164,7 +224,137 @@ class AudioBuffer
 		/// <returns>Least number of frames needed for safe SRC for this device.</returns>
 		UINT32 GetMinFramesOut();
 
+		/// <summary>
+		/// <para>Gets number of frames in the ring buffer of this device not yet pulled for render.</para>
+		/// </summary>
+		/// <returns>Number of frames, 0 if no ring buffer is attached.</returns>
+		UINT32 FramesAvailable();
+
+		/// <summary>
+		/// <para>Blocks the render thread until the ring buffer of this device holds at least nFrames frames.</para>
+		/// <para>Waits on the first channel's RingBufferChannel, all channels are published together, or on the FrameRingBuffer.</para>
+		/// </summary>
+		/// <param name="nFrames">- watermark in frames.</param>
+		/// <param name="dwMilliseconds">- longest time to block.</param>
+		/// <returns>TRUE if the watermark is reached, FALSE on timeout or if no ring buffer is attached.</returns>
+		BOOL WaitForFrames(UINT32 nFrames, DWORD dwMilliseconds);
+
 	protected:
+		/// <summary>
+		/// <para>Gets the format of the endpoint's packets.</para>
+		/// </summary>
+		/// <returns>Pointer to the endpoint format of this AudioBuffer.</returns>
+		const ENDPOINTFMT* GetEndpointFmt();
+
+		/// <summary>
+		/// <para>Gets whether the endpoint's packets are integer PCM, as set by AudioBuffer::SetFixedPoint().</para>
+		/// </summary>
+		/// <returns>TRUE for integer PCM, FALSE for float.</returns>
+		BOOL GetFixedPoint();
+
+		/// <summary>
+		/// <para>Reads a sample of the endpoint's format as float.</para>
+		/// </summary>
+		/// <param name="pFrame">- pointer to the first byte of an interleaved frame.</param>
+		/// <param name="nChannel">- channel index within the frame.</param>
+		/// <returns>Sample normalized to [-1, 1).</returns>
+		FLOAT ReadSample(BYTE* pFrame, UINT32 nChannel);
+
+		/// <summary>
+		/// <para>Writes a float sample in the endpoint's format, rounding and saturating if it is integer PCM.</para>
+		/// </summary>
+		/// <param name="pFrame">- pointer to the first byte of an interleaved frame.</param>
+		/// <param name="nChannel">- channel index within the frame.</param>
+		/// <param name="fSample">- sample normalized to [-1, 1).</param>
+		void WriteSample(BYTE* pFrame, UINT32 nChannel, FLOAT fSample);
+
+		/// <summary>
+		/// <para>Grows the staging buffer between SRC and ring buffer to hold at least nFrames endpoint frames.</para>
+		/// </summary>
+		/// <param name="nFrames">- number of frames required.</param>
+		/// <returns>ERROR_SUCCESS or ENOMEM.</returns>
+		HRESULT ReserveScratch(UINT32 nFrames);
+
+		/// <summary>
+		/// <para>AudioBuffer::PushData() counterpart for a FrameRingBuffer.</para>
+		/// </summary>
+		/// <param name="pData">- pointer to the first byte into the endpoint's newly captured packet.</param>
+		/// <returns>ERROR_SUCCESS or ENOMEM.</returns>
+		HRESULT PushFrames(BYTE* pData);
+
+		/// <summary>
+		/// <para>AudioBuffer::PullData() counterpart for a FrameRingBuffer.</para>
+		/// <para>Fills the part of the render buffer the ring buffer came short on with silence.</para>
+		/// </summary>
+		/// <param name="pData">- pointer to the first byte into the buffer to place audio packet for render.</param>
+		/// <param name="nFrames">- number of frames to render.</param>
+		/// <param name="pFramesOut">- receives the number of frames taken from the ring buffer, NULL if not needed.</param>
+		/// <returns>ERROR_SUCCESS or ENOMEM.</returns>
+		HRESULT PullFrames(BYTE* pData, UINT32 nFrames, UINT32* pFramesOut);
+
+		/// <summary>
+		/// <para>Converts frames of the endpoint's format into the FrameRingBuffer and publishes them.</para>
+		/// <para>Float frames are copied whole, integer PCM frames converted one frame at a time.</para>
+		/// </summary>
+		/// <param name="pFrames">- pointer to the first byte of interleaved endpoint frames.</param>
+		/// <param name="nFrames">- number of frames.</param>
+		void StoreFrames(BYTE* pFrames, UINT32 nFrames);
+
+		/// <summary>
+		/// <para>Converts frames out of the FrameRingBuffer into the endpoint's format and releases them.</para>
+		/// </summary>
+		/// <param name="pFrames">- pointer to the first byte of the interleaved endpoint frame buffer.</param>
+		/// <param name="nFrames">- number of frames requested.</param>
+		/// <returns>Number of frames converted, at most the number available.</returns>
+		UINT32 LoadFrames(BYTE* pFrames, UINT32 nFrames);
+
+		/// <summary>
+		/// <para>Serializes the WAVE_FORMAT_EXTENSIBLE fmt chunk body of a recorded file.</para>
+		/// <para>Samples are recorded as 32-bit float, all channels of the device in one file
+		/// if WAV_FILE_INTERLEAVED, one channel per file otherwise.</para>
+		/// </summary>
+		/// <param name="pFormat">- buffer of at least sizeof(WAVEFORMATEXTENSIBLE) bytes.</param>
+		/// <param name="nSamplesPerSec">- sample rate of the file.</param>
+		/// <returns>Size of the fmt chunk body.</returns>
+		UINT32 MakeWAVFormat(BYTE* pFormat, DWORD nSamplesPerSec);
+
+		/// <summary>
+		/// <para>Opens the WAV files of the device with the WAVRecorder, or FLAC files if asked to.</para>
+		/// </summary>
+		/// <param name="pTrack">- array of nRecordTracks tracks to fill.</param>
+		/// <param name="sSuffix">- appended to the file name after the channel number, if any.</param>
+		/// <param name="pFormat">- fmt chunk body of each file.</param>
+		/// <param name="nFormatBytes">- size of the fmt chunk body.</param>
+		/// <param name="bFLAC">- TRUE to record FLAC, only exact for samples that are integers of at most FLACCODEC_BITS_PER_SAMPLE bits.</param>
+		/// <returns>ERROR_SUCCESS or ERROR_TOO_MANY_OPEN_FILES.</returns>
+		HRESULT OpenWAVTracks(WAVRECORDERTRACK** pTrack, std::string sSuffix, BYTE* pFormat, UINT32 nFormatBytes, BOOL bFLAC);
+
+		/// <summary>
+		/// <para>Converts frames to float and queues them to the WAVRecorder tracks,
+		/// interleaved or split channelwise.</para>
+		/// <para>Lock-free and syscall-free, safe on the capture and render threads.</para>
+		/// </summary>
+		/// <param name="pTrack">- array of nRecordTracks tracks.</param>
+		/// <param name="pFrames">- pointer to the first byte of interleaved endpoint frames.</param>
+		/// <param name="nFrames">- number of frames.</param>
+		void RecordFrames(WAVRECORDERTRACK** pTrack, BYTE* pFrames, UINT32 nFrames);
+
+		/// <summary>
+		/// <para>Converts frames to float and appends them to the FlightRecorder history in blocks.</para>
+		/// <para>Lock-free and syscall-free, safe on the capture thread.</para>
+		/// </summary>
+		/// <param name="pFrames">- pointer to the first byte of interleaved endpoint frames.</param>
+		/// <param name="nFrames">- number of frames.</param>
+		void RecordHistory(BYTE* pFrames, UINT32 nFrames);
+
+		/// <summary>
+		/// <para>Queues frames just placed past the write offset of each ring buffer channel
+		/// to the WAVRecorder tracks, interleaved or straight from each channel.</para>
+		/// </summary>
+		/// <param name="pTrack">- array of nRecordTracks tracks.</param>
+		/// <param name="nFrames">- number of frames.</param>
+		void RecordChannels(WAVRECORDERTRACK** pTrack, UINT32 nFrames);
+
 		/// <summary>
 		/// <para>Function for derived classes to simulate the effect of WASAPI updating endpoint
 		/// buffer size on each returned packet.</para>
@@ -175,17 +365,25 @@ class AudioBuffer
 
 	private:
 		// WAV file output related variables
-		FILE				** fOriginalOutputFiles			{ NULL },
-							** fResampledOutputFiles		{ NULL };
-		DWORD				* nOriginalFileLength			{ NULL },
-							* nResampledFileLength			{ NULL };
+		WAVRecorder			* pRecorder						{ NULL };
+		WAVRECORDERTRACK	** pOriginalTrack				{ NULL },	// Files of the captured stream
+							** pResampledTrack				{ NULL };	// Files of the resampled stream, if resampled
+		UINT32				nRecordTracks					{ 0 };		// 1 if WAV_FILE_INTERLEAVED, else a file per channel
+		FLOAT				* pRecordScratch				{ NULL };	// Block of float frames or samples for the recorder
+		FlightRecorder		* pFlightRecorder				{ NULL };	// In-memory history of the captured stream, if kept
 		std::string			sFilename;
 		BOOL				bOutputWAV						{ FALSE };
 	
 		// Circular buffer related variables
-		RingBufferChannel	** pRingBufferChannel;
+		RingBufferChannel	** pRingBufferChannel				{ NULL };
+		FrameRingBuffer		* pFrameRingBuffer				{ NULL };	// Storage of all channels in one allocation, used instead of pRingBufferChannel if set
 		Resampler			* pResampler;
 		RESAMPLEFMT			tResampleFmt;
+		BOOL				bFixedPoint						{ FALSE };	// Indicator if integer PCM is resampled in fixed point
+		BOOL				bDriftTracking					{ FALSE };	// Indicator if the resampling ratio follows the clock drift
+		BOOL				bResample						{ FALSE };	// Indicator if the stream goes through SRC, also at nominally equal rates when tracking drift
+		BYTE				* pScratch						{ NULL };	// Interleaved endpoint frames staged between SRC and ring buffer
+		UINT32				nScratchFrames					{ 0 };
 		UINT32				nTimeAlignOffset				{ 0 },
 							nMinFramesOut					{ 0 };		// Indicator for output ring buffer when safe to SRC for output
 																		// to avoid coming short on samples
@@ -0,0 +1,858 @@
+#include "FLACCodec.h"
+#include <mmreg.h>
+#include <cmath>
+
+static_assert(FLACCODEC_BITS_PER_SAMPLE >= 4 && FLACCODEC_BITS_PER_SAMPLE <= 24, "FLACCodec quantizes to at most 24 bits");
+static_assert(FLACCODEC_BLOCK_FRAMES % (1 << FLACCODEC_MAX_PARTITION_ORDER) == 0 && FLACCODEC_BLOCK_FRAMES <= 65535,
+	"FLACCodec block must split into every partition order and fit a 16-bit block size");
+
+/// <summary>
+/// <para>CRC tables of FLAC frames, built once on first use.</para>
+/// </summary>
+typedef struct FLACCRCTables {
+	BYTE				pCrc8[256];			// Frame header, x^8 + x^2 + x + 1
+	WORD				pCrc16[256];		// Whole frame, x^16 + x^15 + x^2 + 1
+
+	FLACCRCTables()
+	{
+		for (UINT32 i = 0; i < 256; i++)
+		{
+			BYTE nCrc8 = (BYTE)i;
+			WORD nCrc16 = (WORD)(i << 8);
+
+			for (UINT32 b = 0; b < 8; b++)
+			{
+				nCrc8 = (nCrc8 & 0x80) ? (BYTE)((nCrc8 << 1) ^ 0x07) : (BYTE)(nCrc8 << 1);
+				nCrc16 = (nCrc16 & 0x8000) ? (WORD)((nCrc16 << 1) ^ 0x8005) : (WORD)(nCrc16 << 1);
+			}
+
+			pCrc8[i] = nCrc8;
+			pCrc16[i] = nCrc16;
+		}
+	}
+} FLACCRCTABLES;
+
+static const FLACCRCTABLES& GetCRCTables()
+{
+	// Function-local static is constructed exactly once, also when encoder threads race for it
+	static const FLACCRCTABLES tTables;
+	return tTables;
+}
+
+static BYTE Crc8(const BYTE* pData, UINT64 nBytes)
+{
+	const FLACCRCTABLES& tTables = GetCRCTables();
+	BYTE nCrc = 0;
+
+	while (nBytes--) nCrc = tTables.pCrc8[nCrc ^ *pData++];
+
+	return nCrc;
+}
+
+static WORD Crc16(const BYTE* pData, UINT64 nBytes)
+{
+	const FLACCRCTABLES& tTables = GetCRCTables();
+	WORD nCrc = 0;
+
+	while (nBytes--) nCrc = (WORD)(nCrc << 8) ^ tTables.pCrc16[(nCrc >> 8) ^ *pData++];
+
+	return nCrc;
+}
+
+//-------- Bit writer
+static inline void PutBits(FLACBITSTREAM* pStream, UINT32 nValue, UINT32 nBits)
+{
+	// At most 7 bits linger in the cache, so up to 32 more always fit
+	pStream->nCache = (pStream->nCache << nBits) | (nValue & (UINT32)((1ULL << nBits) - 1));
+	pStream->nCacheBits += nBits;
+
+	while (pStream->nCacheBits >= 8)
+	{
+		pStream->nCacheBits -= 8;
+		pStream->pData[pStream->nBytes++] = (BYTE)(pStream->nCache >> pStream->nCacheBits);
+	}
+}
+
+static inline void PutUnary(FLACBITSTREAM* pStream, UINT32 nZeros)
+{
+	for (; nZeros >= 32; nZeros -= 32) PutBits(pStream, 0, 32);
+
+	PutBits(pStream, 1, nZeros + 1);
+}
+
+static inline void PutRice(FLACBITSTREAM* pStream, INT32 nResidual, UINT32 nParameter)
+{
+	// Fold the sign into the lowest bit, small magnitudes of either sign get small codes
+	UINT32 nFolded = ((UINT32)nResidual << 1) ^ (UINT32)(nResidual >> 31);
+	UINT32 nQuotient = nFolded >> nParameter;
+
+	// Common case of a short quotient goes out as a single write
+	if (nQuotient + 1 + nParameter <= 32)
+		PutBits(pStream, (1U << nParameter) | (nFolded & ((1U << nParameter) - 1)), nQuotient + 1 + nParameter);
+	else
+	{
+		PutUnary(pStream, nQuotient);
+		PutBits(pStream, nFolded, nParameter);
+	}
+}
+
+static inline void PutUTF8(FLACBITSTREAM* pStream, UINT64 nValue)
+{
+	if (nValue < 0x80)
+	{
+		PutBits(pStream, (UINT32)nValue, 8);
+		return;
+	}
+
+	// Each continuation byte carries 6 bits, the leading byte what is left next to its length prefix
+	UINT32 nBytes = 2;
+	while (nBytes < 7 && nValue >= (1ULL << (5 * nBytes + 1))) nBytes++;
+
+	PutBits(pStream, ((0xFF << (8 - nBytes)) & 0xFF) | (UINT32)(nValue >> (6 * (nBytes - 1))), 8);
+
+	for (UINT32 i = nBytes - 1; i > 0; i--)
+		PutBits(pStream, 0x80 | (UINT32)((nValue >> (6 * (i - 1))) & 0x3F), 8);
+}
+
+//-------- Bit reader
+static inline BOOL GetBits(FLACBITSTREAM* pStream, UINT32 nBits, UINT32* pValue)
+{
+	while (pStream->nCacheBits < nBits)
+	{
+		if (pStream->nPosition == pStream->nBytes) return FALSE;
+
+		pStream->nCache = (pStream->nCache << 8) | pStream->pData[pStream->nPosition++];
+		pStream->nCacheBits += 8;
+	}
+
+	pStream->nCacheBits -= nBits;
+	*pValue = (UINT32)(pStream->nCache >> pStream->nCacheBits) & (UINT32)((1ULL << nBits) - 1);
+
+	return TRUE;
+}
+
+static inline BOOL GetSigned(FLACBITSTREAM* pStream, UINT32 nBits, INT32* pValue)
+{
+	UINT32 nValue = 0;
+	if (!GetBits(pStream, nBits, &nValue)) return FALSE;
+
+	*pValue = (nBits > 0) ? (INT32)(nValue << (32 - nBits)) >> (32 - nBits) : 0;
+
+	return TRUE;
+}
+
+static inline BOOL GetUnary(FLACBITSTREAM* pStream, UINT32* pZeros)
+{
+	UINT32 nBit = 0;
+
+	for (*pZeros = 0; GetBits(pStream, 1, &nBit); (*pZeros)++)
+		if (nBit) return TRUE;
+
+	return FALSE;
+}
+
+//-------- Fixed predictors
+static inline INT64 PredictFixed(const INT32* pSample, UINT32 nOrder)
+{
+	// Polynomial extrapolation of the previous nOrder samples, as in FLAC's fixed subframes
+	switch (nOrder)
+	{
+		case 1: return (INT64)pSample[-1];
+		case 2: return 2 * (INT64)pSample[-1] - pSample[-2];
+		case 3: return 3 * ((INT64)pSample[-1] - pSample[-2]) + pSample[-3];
+		case 4: return 4 * ((INT64)pSample[-1] + pSample[-3]) - 6 * (INT64)pSample[-2] - pSample[-4];
+		default: return 0;
+	}
+}
+
+static UINT32 GetSampleSizeCode(UINT32 nBits)
+{
+	switch (nBits)
+	{
+		case 8: return 1;
+		case 12: return 2;
+		case 16: return 4;
+		case 20: return 5;
+		case 24: return 6;
+		default: return 0;					// Taken from STREAMINFO
+	}
+}
+
+UINT32 FLACCodec::MakeStreamHeader(BYTE* pHeader, UINT32 nChannels, DWORD nSamplesPerSec)
+{
+	memset(pHeader, 0, FLACCODEC_HEADER_BYTES);
+
+	memcpy(pHeader, "fLaC", 4);
+	// Last metadata block, of type STREAMINFO and 34 bytes long
+	pHeader[4] = 0x80;
+	pHeader[7] = 34;
+
+	BYTE* pInfo = pHeader + 8;
+
+	// Every block but the last is of the same size
+	pInfo[0] = pInfo[2] = (BYTE)(FLACCODEC_BLOCK_FRAMES >> 8);
+	pInfo[1] = pInfo[3] = (BYTE)FLACCODEC_BLOCK_FRAMES;
+
+	// Sample rate, channels and sample size, followed by the 36-bit length filled in later
+	UINT64 nFields = ((UINT64)nSamplesPerSec << 44) | ((UINT64)(nChannels - 1) << 41) | ((UINT64)(FLACCODEC_BITS_PER_SAMPLE - 1) << 36);
+	for (UINT32 i = 0; i < 8; i++)
+		pInfo[10 + i] = (BYTE)(nFields >> (56 - 8 * i));
+
+	// MD5 signature stays 0, meaning not computed
+
+	return FLACCODEC_HEADER_BYTES;
+}
+
+void FLACCodec::SetStreamInfo(BYTE* pHeader, UINT64 nFrames, UINT32 nMinFrameBytes, UINT32 nMaxFrameBytes)
+{
+	BYTE* pInfo = pHeader + 8;
+
+	for (UINT32 i = 0; i < 3; i++)
+	{
+		pInfo[4 + i] = (BYTE)(nMinFrameBytes >> (16 - 8 * i));
+		pInfo[7 + i] = (BYTE)(nMaxFrameBytes >> (16 - 8 * i));
+	}
+
+	// Length is only 36 bits wide, 0 stands for unknown
+	if (nFrames >= (1ULL << 36)) nFrames = 0;
+
+	pInfo[13] = (BYTE)((pInfo[13] & 0xF0) | (nFrames >> 32));
+	for (UINT32 i = 0; i < 4; i++)
+		pInfo[14 + i] = (BYTE)(nFrames >> (24 - 8 * i));
+}
+
+UINT32 FLACCodec::GetMaxFrameBytes(UINT32 nChannels)
+{
+	// Frame header and footer, then a verbatim subframe per channel with the most wasted bits signaled
+	return 16 + nChannels * (6 + FLACCODEC_BLOCK_FRAMES * FLACCODEC_BITS_PER_SAMPLE / 8) + 3;
+}
+
+UINT32 FLACCodec::EncodeFrame(const FLOAT* pFrames, UINT32 nFrames, UINT32 nChannels, UINT64 nFrameNumber, INT32* pScratch, BYTE* pFrame)
+{
+	FLACBITSTREAM tStream = { pFrame, 0, 0, 0, 0 };
+	INT32* pSample = pScratch;
+	INT32* pResidual = pScratch + FLACCODEC_BLOCK_FRAMES;
+
+	const DOUBLE fScale = (DOUBLE)(1 << (FLACCODEC_BITS_PER_SAMPLE - 1));
+
+	// Sync code, fixed block size, block size as a 16-bit field at the end, sample rate from STREAMINFO
+	PutBits(&tStream, 0x3FFE, 14);
+	PutBits(&tStream, 0, 2);
+	PutBits(&tStream, 0x7, 4);
+	PutBits(&tStream, 0x0, 4);
+	// Independent channels
+	PutBits(&tStream, nChannels - 1, 4);
+	PutBits(&tStream, GetSampleSizeCode(FLACCODEC_BITS_PER_SAMPLE), 3);
+	PutBits(&tStream, 0, 1);
+	PutUTF8(&tStream, nFrameNumber);
+	PutBits(&tStream, nFrames - 1, 16);
+	// Header ends byte-aligned
+	PutBits(&tStream, Crc8(pFrame, tStream.nBytes), 8);
+
+	for (UINT32 i = 0; i < nChannels; i++)
+	{
+		// Quantize once, everything past this point is exact
+		for (UINT32 j = 0; j < nFrames; j++)
+			pSample[j] = (INT32)min(max(floor(pFrames[j * nChannels + i] * fScale + 0.5), -fScale), fScale - 1.0);
+
+		FLACCodec::EncodeSubframe(&tStream, pSample, pResidual, nFrames, FLACCODEC_BITS_PER_SAMPLE);
+	}
+
+	// Zero-pad to a byte, then the CRC of the whole frame
+	if (tStream.nCacheBits > 0) PutBits(&tStream, 0, 8 - tStream.nCacheBits);
+	PutBits(&tStream, Crc16(pFrame, tStream.nBytes), 16);
+
+	return (UINT32)tStream.nBytes;
+}
+
+void FLACCodec::EncodeSubframe(FLACBITSTREAM* pStream, INT32* pSample, INT32* pResidual, UINT32 nFrames, UINT32 nBits)
+{
+	BOOL bConstant = TRUE;
+	UINT32 nOr = 0;
+
+	for (UINT32 j = 0; j < nFrames; j++)
+	{
+		nOr |= (UINT32)pSample[j];
+		bConstant &= (pSample[j] == pSample[0]);
+	}
+
+	// Silence and DC cost a single sample
+	if (bConstant)
+	{
+		PutBits(pStream, 0x00, 8);
+		PutBits(pStream, (UINT32)pSample[0], nBits);
+		return;
+	}
+
+	// Low bits that are 0 in every sample, e.g. 8 of them for a 16-bit source quantized to 24 bits
+	UINT32 nWasted = 0;
+	while (!(nOr & 1)) { nOr >>= 1; nWasted++; }
+
+	if (nWasted > 0)
+	{
+		for (UINT32 j = 0; j < nFrames; j++) pSample[j] >>= nWasted;
+		nBits -= nWasted;
+	}
+
+	// Subframe header, wasted bits flag and their unary count
+	UINT64 nVerbatimBits = 8 + nWasted + (UINT64)nFrames * nBits;
+	UINT64 nFixedBits = ~0ULL;
+	UINT32 nOrder = 0, nPartitionOrder = 0, nRiceBits = 4;
+	UINT32 pParameter[1 << FLACCODEC_MAX_PARTITION_ORDER];
+
+	// Fixed predictors need warm-up samples and a partition 0 longer than them
+	if (nFrames > 2 * FLACCODEC_MAX_FIXED_ORDER)
+	{
+		// Pick the order whose residual has the smallest magnitude, a good proxy of its Rice coded size
+		UINT64 pError[FLACCODEC_MAX_FIXED_ORDER + 1] = { 0 };
+
+		for (UINT32 j = FLACCODEC_MAX_FIXED_ORDER; j < nFrames; j++)
+			for (UINT32 p = 0; p <= FLACCODEC_MAX_FIXED_ORDER; p++)
+			{
+				INT64 nError = pSample[j] - PredictFixed(pSample + j, p);
+				pError[p] += (UINT64)((nError < 0) ? -nError : nError);
+			}
+
+		for (UINT32 p = 1; p <= FLACCODEC_MAX_FIXED_ORDER; p++)
+			if (pError[p] < pError[nOrder]) nOrder = p;
+
+		// Residual of order 4 of 24-bit samples is at most 28 bits wide, always fits
+		for (UINT32 j = nOrder; j < nFrames; j++)
+			pResidual[j - nOrder] = (INT32)(pSample[j] - PredictFixed(pSample + j, nOrder));
+
+		// Finest partitioning that divides the block evenly, with partition 0 longer than the warm-up
+		UINT32 nMaxPartitionOrder = FLACCODEC_MAX_PARTITION_ORDER;
+		while (nMaxPartitionOrder > 0 && ((nFrames & ((1U << nMaxPartitionOrder) - 1)) || (nFrames >> nMaxPartitionOrder) <= nOrder))
+			nMaxPartitionOrder--;
+
+		// Sums of folded residuals of the finest partitions, merged pairwise for coarser ones
+		UINT64 pSum[1 << FLACCODEC_MAX_PARTITION_ORDER] = { 0 };
+		UINT32 nLength = nFrames >> nMaxPartitionOrder;
+
+		for (UINT32 j = nOrder; j < nFrames; j++)
+			pSum[j / nLength] += ((UINT32)pResidual[j - nOrder] << 1) ^ (UINT32)(pResidual[j - nOrder] >> 31);
+
+		for (INT32 p = (INT32)nMaxPartitionOrder; p >= 0; p--)
+		{
+			UINT32 nPartitions = 1U << p;
+			UINT32 pTrial[1 << FLACCODEC_MAX_PARTITION_ORDER];
+			UINT32 nMaxParameter = 0;
+			UINT64 nBitsTotal = 0;
+
+			if (p < (INT32)nMaxPartitionOrder)
+				for (UINT32 k = 0; k < nPartitions; k++)
+					pSum[k] = pSum[2 * k] + pSum[2 * k + 1];
+
+			for (UINT32 k = 0; k < nPartitions; k++)
+			{
+				UINT64 nCount = (nFrames >> p) - ((k == 0) ? nOrder : 0);
+				UINT64 nBest = ~0ULL;
+
+				// Upper bound of the Rice coded size, sum of the quotients is at most the quotient of the sum
+				for (UINT32 r = 0; r <= 30; r++)
+				{
+					UINT64 nBitsPartition = nCount * (r + 1) + (pSum[k] >> r);
+					if (nBitsPartition < nBest) { nBest = nBitsPartition; pTrial[k] = r; }
+				}
+
+				nBitsTotal += nBest;
+				nMaxParameter = max(nMaxParameter, pTrial[k]);
+			}
+
+			// Parameters above 14 need the 5-bit field
+			UINT32 nTrialRiceBits = (nMaxParameter > 14) ? 5 : 4;
+			nBitsTotal += 8 + nWasted + (UINT64)nOrder * nBits + 6 + (UINT64)nPartitions * nTrialRiceBits;
+
+			if (nBitsTotal < nFixedBits)
+			{
+				nFixedBits = nBitsTotal;
+				nPartitionOrder = (UINT32)p;
+				nRiceBits = nTrialRiceBits;
+				memcpy(pParameter, pTrial, nPartitions * sizeof(UINT32));
+			}
+		}
+	}
+
+	BOOL bFixed = nFixedBits < nVerbatimBits;
+
+	// Zero padding bit, type and wasted bits flag
+	PutBits(pStream, ((bFixed ? 0x08 | nOrder : 0x01) << 1) | (nWasted > 0), 8);
+	if (nWasted > 0) PutUnary(pStream, nWasted - 1);
+
+	if (!bFixed)
+	{
+		for (UINT32 j = 0; j < nFrames; j++)
+			PutBits(pStream, (UINT32)pSample[j], nBits);
+		return;
+	}
+
+	for (UINT32 j = 0; j < nOrder; j++)
+		PutBits(pStream, (UINT32)pSample[j], nBits);
+
+	// Rice coding with 4 or 5-bit parameters, then the partitions
+	PutBits(pStream, (nRiceBits == 5) ? 1 : 0, 2);
+	PutBits(pStream, nPartitionOrder, 4);
+
+	INT32* pValue = pResidual;
+	for (UINT32 k = 0; k < (1U << nPartitionOrder); k++)
+	{
+		UINT32 nCount = (nFrames >> nPartitionOrder) - ((k == 0) ? nOrder : 0);
+
+		PutBits(pStream, pParameter[k], nRiceBits);
+
+		for (UINT32 j = 0; j < nCount; j++)
+			PutRice(pStream, *pValue++, pParameter[k]);
+	}
+}
+
+HRESULT FLACCodec::DecodeSubframe(FLACBITSTREAM* pStream, INT32* pSample, UINT32 nFrames, UINT32 nBits)
+{
+	UINT32 nPad = 0, nType = 0, nWastedFlag = 0, nWasted = 0;
+
+	if (!GetBits(pStream, 1, &nPad) || !GetBits(pStream, 6, &nType) || !GetBits(pStream, 1, &nWastedFlag) || nPad != 0)
+		return ERROR_INVALID_DATA;
+
+	if (nWastedFlag)
+	{
+		if (!GetUnary(pStream, &nWasted)) return ERROR_INVALID_DATA;
+		nWasted++;
+	}
+
+	if (nWasted >= nBits) return ERROR_INVALID_DATA;
+	nBits -= nWasted;
+
+	// Linear prediction subframes are never written
+	if (nType >= 0x20) return ERROR_NOT_SUPPORTED;
+
+	if (nType == 0x00)
+	{
+		INT32 nValue = 0;
+		if (!GetSigned(pStream, nBits, &nValue)) return ERROR_INVALID_DATA;
+
+		for (UINT32 j = 0; j < nFrames; j++) pSample[j] = nValue;
+	}
+	else if (nType == 0x01)
+	{
+		for (UINT32 j = 0; j < nFrames; j++)
+			if (!GetSigned(pStream, nBits, pSample + j)) return ERROR_INVALID_DATA;
+	}
+	else if (nType >= 0x08 && nType <= 0x08 + FLACCODEC_MAX_FIXED_ORDER)
+	{
+		UINT32 nOrder = nType - 0x08;
+		UINT32 nMethod = 0, nPartitionOrder = 0;
+
+		for (UINT32 j = 0; j < nOrder; j++)
+			if (!GetSigned(pStream, nBits, pSample + j)) return ERROR_INVALID_DATA;
+
+		if (!GetBits(pStream, 2, &nMethod) || !GetBits(pStream, 4, &nPartitionOrder)) return ERROR_INVALID_DATA;
+		if (nMethod > 1) return ERROR_INVALID_DATA;
+		if ((nFrames & ((1U << nPartitionOrder) - 1)) || (nFrames >> nPartitionOrder) < nOrder) return ERROR_INVALID_DATA;
+
+		UINT32 nRiceBits = nMethod ? 5 : 4;
+		UINT32 nEscape = (1U << nRiceBits) - 1;
+		INT32* pValue = pSample + nOrder;
+
+		for (UINT32 k = 0; k < (1U << nPartitionOrder); k++)
+		{
+			UINT32 nCount = (nFrames >> nPartitionOrder) - ((k == 0) ? nOrder : 0);
+			UINT32 nParameter = 0;
+
+			if (!GetBits(pStream, nRiceBits, &nParameter)) return ERROR_INVALID_DATA;
+
+			// Escaped partition holds plain signed values of the given width
+			if (nParameter == nEscape)
+			{
+				UINT32 nRawBits = 0;
+				if (!GetBits(pStream, 5, &nRawBits)) return ERROR_INVALID_DATA;
+
+				for (UINT32 j = 0; j < nCount; j++)
+					if (!GetSigned(pStream, nRawBits, pValue++)) return ERROR_INVALID_DATA;
+				continue;
+			}
+
+			for (UINT32 j = 0; j < nCount; j++)
+			{
+				UINT32 nQuotient = 0, nRemainder = 0;
+				if (!GetUnary(pStream, &nQuotient) || !GetBits(pStream, nParameter, &nRemainder)) return ERROR_INVALID_DATA;
+
+				UINT32 nFolded = (nQuotient << nParameter) | nRemainder;
+				*pValue++ = (INT32)(nFolded >> 1) ^ -(INT32)(nFolded & 1);
+			}
+		}
+
+		// Residuals turn into samples in place, each prediction only looks back at finished ones
+		for (UINT32 j = nOrder; j < nFrames; j++)
+			pSample[j] = (INT32)(pSample[j] + PredictFixed(pSample + j, nOrder));
+	}
+	else
+		return ERROR_INVALID_DATA;
+
+	if (nWasted > 0)
+		for (UINT32 j = 0; j < nFrames; j++) pSample[j] = (INT32)((UINT32)pSample[j] << nWasted);
+
+	return ERROR_SUCCESS;
+}
+
+HRESULT FLACCodec::DecodeFrame(const BYTE* pFrame, UINT32 nBytes, UINT32 nChannels, INT32* pScratch, FLOAT* pFrames, UINT32* pDecoded)
+{
+	// Reader never writes through the cursor
+	FLACBITSTREAM tStream = { (BYTE*)pFrame, nBytes, 0, 0, 0 };
+	UINT32 nFrames = 0;
+
+	const FLOAT fScale = 1.0f / (FLOAT)(1 << (FLACCODEC_BITS_PER_SAMPLE - 1));
+
+	HRESULT hr = FLACCodec::ReadFrame(&tStream, nChannels, FLACCODEC_BITS_PER_SAMPLE, pScratch, FLACCODEC_BLOCK_FRAMES, &nFrames);
+	if (hr != ERROR_SUCCESS) return hr;
+
+	for (UINT32 j = 0; j < nFrames; j++)
+		for (UINT32 i = 0; i < nChannels; i++)
+			pFrames[j * nChannels + i] = (FLOAT)pScratch[i * FLACCODEC_BLOCK_FRAMES + j] * fScale;
+
+	*pDecoded = nFrames;
+	return ERROR_SUCCESS;
+}
+
+HRESULT FLACCodec::ReadFrame(FLACBITSTREAM* pStream, UINT32 nChannels, UINT32 nBits, INT32* pSample, UINT32 nMaxFrames, UINT32* pFrames)
+{
+	UINT64 nFrameStart = pStream->nPosition;
+	UINT32 nSync = 0, nBlockingStrategy = 0, nBlockSizeCode = 0, nRateCode = 0, nChannelCode = 0, nSizeCode = 0, nReserved = 0;
+	UINT32 nLead = 0, nValue = 0, nFrames = 0, nCrc = 0;
+
+	pStream->nCache = 0;
+	pStream->nCacheBits = 0;
+
+	if (!GetBits(pStream, 15, &nSync) || !GetBits(pStream, 1, &nBlockingStrategy) || nSync != 0x7FFC ||
+		!GetBits(pStream, 4, &nBlockSizeCode) || !GetBits(pStream, 4, &nRateCode) ||
+		!GetBits(pStream, 4, &nChannelCode) || !GetBits(pStream, 3, &nSizeCode) || !GetBits(pStream, 1, &nReserved) ||
+		nBlockSizeCode == 0 || nRateCode == 0x0F || nSizeCode == 3 || nReserved != 0)
+		return ERROR_INVALID_DATA;
+
+	// Mid/side stereo and sample sizes other than the stream's are never written
+	if (nChannelCode >= 8 || nChannelCode + 1 != nChannels ||
+		(nSizeCode != 0 && nSizeCode != GetSampleSizeCode(nBits)))
+		return (nChannelCode > 10) ? ERROR_INVALID_DATA : ERROR_NOT_SUPPORTED;
+
+	// Frame or sample number, UTF-8 coded, only its length matters
+	if (!GetBits(pStream, 8, &nLead))
+		return ERROR_INVALID_DATA;
+	for (UINT32 nMask = 0x80; (nLead & nMask) && nMask > 0x01; nMask >>= 1)
+		if (nMask != 0x80 && (!GetBits(pStream, 8, &nValue) || (nValue & 0xC0) != 0x80))
+			return ERROR_INVALID_DATA;
+
+	if (nBlockSizeCode == 1) nFrames = 192;
+	else if (nBlockSizeCode <= 5) nFrames = 576 << (nBlockSizeCode - 2);
+	else if (nBlockSizeCode == 6 && GetBits(pStream, 8, &nValue)) nFrames = nValue + 1;
+	else if (nBlockSizeCode == 7 && GetBits(pStream, 16, &nValue)) nFrames = nValue + 1;
+	else if (nBlockSizeCode >= 8) nFrames = 256 << (nBlockSizeCode - 8);
+
+	// Rates other than the stream's carry their value in the header, skip it
+	if ((nRateCode == 0x0C && !GetBits(pStream, 8, &nValue)) ||
+		((nRateCode == 0x0D || nRateCode == 0x0E) && !GetBits(pStream, 16, &nValue)) ||
+		nFrames == 0 || !GetBits(pStream, 8, &nCrc) ||
+		nCrc != Crc8(pStream->pData + nFrameStart, pStream->nPosition - 1 - nFrameStart))
+		return ERROR_INVALID_DATA;
+
+	// Samples of a channel are nMaxFrames apart in the output
+	if (nFrames > nMaxFrames) return ERROR_NOT_SUPPORTED;
+
+	for (UINT32 i = 0; i < nChannels; i++)
+	{
+		HRESULT hr = FLACCodec::DecodeSubframe(pStream, pSample + i * nMaxFrames, nFrames, nBits);
+		if (hr != ERROR_SUCCESS) return hr;
+	}
+
+	// Frame is zero-padded to a byte, the bits left in the cache are padding
+	pStream->nCacheBits = 0;
+
+	UINT64 nFrameEnd = pStream->nPosition;
+	if (!GetBits(pStream, 16, &nCrc) || nCrc != Crc16(pStream->pData + nFrameStart, nFrameEnd - nFrameStart))
+		return ERROR_INVALID_DATA;
+
+	*pFrames = nFrames;
+	return ERROR_SUCCESS;
+}
+
+HRESULT FLACCodec::DecodeFile(std::string sSource, std::string sDestination)
+{
+	HRESULT hr = ERROR_SUCCESS;
+	HANDLE hSource = INVALID_HANDLE_VALUE, hDestination = INVALID_HANDLE_VALUE;
+	LARGE_INTEGER tSize = {};
+	BYTE* pData = NULL;
+	INT32* pSample = NULL;
+	BYTE* pOutput = NULL;
+	UINT32 nChannels = 0, nBits = 0, nContainerBytes = 0;
+	DWORD nSamplesPerSec = 0;
+	UINT64 nDataBytes = 0;
+	FLACBITSTREAM tStream = {};
+	WAVEFORMATEXTENSIBLE tFormat = {};
+	BYTE pHeader[12 + 8 + sizeof(WAVEFORMATEXTENSIBLE) + 8];
+	DWORD nWritten = 0;
+
+	hSource = CreateFileA(sSource.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hSource == INVALID_HANDLE_VALUE) return ERROR_FILE_NOT_FOUND;
+
+	if (!GetFileSizeEx(hSource, &tSize) || (UINT64)tSize.QuadPart > (SIZE_T)-1)
+	{
+		CloseHandle(hSource);
+		return ENOMEM;
+	}
+
+	pData = (BYTE*)malloc((SIZE_T)tSize.QuadPart + 1);
+	if (pData == NULL)
+	{
+		CloseHandle(hSource);
+		return ENOMEM;
+	}
+
+	for (UINT64 nRead = 0; nRead < (UINT64)tSize.QuadPart; )
+	{
+		DWORD nChunk = (DWORD)min((UINT64)tSize.QuadPart - nRead, (UINT64)(1 << 30)), nDone = 0;
+
+		if (!ReadFile(hSource, pData + nRead, nChunk, &nDone, NULL) || nDone == 0)
+		{
+			tSize.QuadPart = (LONGLONG)nRead;
+			break;
+		}
+		nRead += nDone;
+	}
+	CloseHandle(hSource);
+
+	tStream.pData = pData;
+	tStream.nBytes = (UINT64)tSize.QuadPart;
+
+	// Stream marker, then STREAMINFO always comes first among the metadata blocks
+	if (tStream.nBytes < FLACCODEC_HEADER_BYTES || memcmp(pData, "fLaC", 4) != 0 || (pData[4] & 0x7F) != 0)
+	{
+		hr = ERROR_INVALID_DATA;
+		goto Exit;
+	}
+
+	nSamplesPerSec = ((DWORD)pData[18] << 12) | ((DWORD)pData[19] << 4) | (pData[20] >> 4);
+	nChannels = ((pData[20] >> 1) & 0x07) + 1;
+	nBits = (((pData[20] & 0x01) << 4) | (pData[21] >> 4)) + 1;
+
+	// Skip the remaining metadata blocks up to the one flagged last
+	tStream.nPosition = 4;
+	for (BOOL bLast = FALSE; !bLast; )
+	{
+		if (tStream.nPosition + 4 > tStream.nBytes)
+		{
+			hr = ERROR_INVALID_DATA;
+			goto Exit;
+		}
+
+		bLast = (pData[tStream.nPosition] & 0x80) != 0;
+		tStream.nPosition += 4 + (((UINT64)pData[tStream.nPosition + 1] << 16) | ((UINT64)pData[tStream.nPosition + 2] << 8) | pData[tStream.nPosition + 3]);
+	}
+
+	if (nBits > 24 || nSamplesPerSec == 0)
+	{
+		hr = ERROR_NOT_SUPPORTED;
+		goto Exit;
+	}
+
+	nContainerBytes = (nBits + 7) / 8;
+	pSample = (INT32*)malloc(65536 * nChannels * sizeof(INT32));
+	pOutput = (BYTE*)malloc(65536 * nChannels * nContainerBytes);
+	if (pSample == NULL || pOutput == NULL)
+	{
+		hr = ENOMEM;
+		goto Exit;
+	}
+
+	hDestination = CreateFileA(sDestination.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hDestination == INVALID_HANDLE_VALUE)
+	{
+		hr = ERROR_FILE_NOT_FOUND;
+		goto Exit;
+	}
+
+	// Integer PCM holding the decoded samples as they are, sizes are filled in once all frames are out
+	tFormat.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+	tFormat.Format.nChannels = (WORD)nChannels;
+	tFormat.Format.nSamplesPerSec = nSamplesPerSec;
+	tFormat.Format.nBlockAlign = (WORD)(nChannels * nContainerBytes);
+	tFormat.Format.nAvgBytesPerSec = nSamplesPerSec * tFormat.Format.nBlockAlign;
+	tFormat.Format.wBitsPerSample = (WORD)(8 * nContainerBytes);
+	tFormat.Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+	tFormat.Samples.wValidBitsPerSample = (WORD)nBits;
+	tFormat.SubFormat = KSDATAFORMAT_SUBTYPE_PCM;
+
+	memcpy(pHeader, "RIFF----WAVEfmt ", 16);
+	*(DWORD*)(pHeader + 16) = sizeof(WAVEFORMATEXTENSIBLE);
+	memcpy(pHeader + 20, &tFormat, sizeof(WAVEFORMATEXTENSIBLE));
+	memcpy(pHeader + 20 + sizeof(WAVEFORMATEXTENSIBLE), "data----", 8);
+
+	if (!WriteFile(hDestination, pHeader, sizeof(pHeader), &nWritten, NULL))
+	{
+		hr = ERROR_FILE_NOT_FOUND;
+		goto Exit;
+	}
+
+	while (tStream.nPosition < tStream.nBytes)
+	{
+		UINT32 nFrames = 0;
+
+		hr = FLACCodec::ReadFrame(&tStream, nChannels, nBits, pSample, 65536, &nFrames);
+		if (hr != ERROR_SUCCESS) goto Exit;
+
+		// Interleave little-endian, left-justified in the container, 8-bit WAV being unsigned
+		BYTE* pByte = pOutput;
+		for (UINT32 j = 0; j < nFrames; j++)
+			for (UINT32 i = 0; i < nChannels; i++)
+			{
+				UINT32 nContainer = (UINT32)pSample[i * 65536 + j] << (8 * nContainerBytes - nBits);
+				if (nContainerBytes == 1) nContainer ^= 0x80;
+
+				for (UINT32 b = 0; b < nContainerBytes; b++)
+					*pByte++ = (BYTE)(nContainer >> (8 * b));
+			}
+
+		if (!WriteFile(hDestination, pOutput, (DWORD)(pByte - pOutput), &nWritten, NULL))
+		{
+			hr = ERROR_FILE_NOT_FOUND;
+			goto Exit;
+		}
+
+		nDataBytes += (UINT64)(pByte - pOutput);
+	}
+
+	// Sizes saturate past 4 GiB, as most readers expect of RIFF
+	*(DWORD*)(pHeader + 4) = (DWORD)min(sizeof(pHeader) - 8 + nDataBytes, 0xFFFFFFFFULL);
+	*(DWORD*)(pHeader + sizeof(pHeader) - 4) = (DWORD)min(nDataBytes, 0xFFFFFFFFULL);
+
+	SetFilePointer(hDestination, 0, NULL, FILE_BEGIN);
+	WriteFile(hDestination, pHeader, sizeof(pHeader), &nWritten, NULL);
+
+Exit:
+	if (hDestination != INVALID_HANDLE_VALUE) CloseHandle(hDestination);
+	free(pData);
+	free(pSample);
+	free(pOutput);
+
+	return hr;
+}
+
+HRESULT FLACCodec::CheckRoundTrip(std::string sPath, UINT32 nBits, UINT32 nChannels)
+{
+	HRESULT hr = ERROR_SUCCESS;
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	const UINT32 nFrames = 3 * FLACCODEC_BLOCK_FRAMES + 123;
+	const UINT32 nShift = FLACCODEC_BITS_PER_SAMPLE - nBits, nContainerBytes = (FLACCODEC_BITS_PER_SAMPLE + 7) / 8;
+	const UINT32 nWAVHeader = 12 + 8 + sizeof(WAVEFORMATEXTENSIBLE) + 8, nWAVBytes = nWAVHeader + nFrames * nChannels * nContainerBytes;
+	INT32* pSource = NULL;
+	FLOAT* pFrames = NULL;
+	INT32* pScratch = NULL;
+	BYTE* pFrame = NULL;
+	BYTE* pWAV = NULL;
+	BYTE pHeader[FLACCODEC_HEADER_BYTES];
+	UINT32 nMinFrameBytes = MAXUINT32, nMaxFrameBytes = 0;
+	DWORD nDone = 0;
+
+	if (nBits < 4 || nBits > FLACCODEC_BITS_PER_SAMPLE || nChannels == 0 || nChannels > 8) return ERROR_NOT_SUPPORTED;
+
+	pSource = (INT32*)malloc((SIZE_T)nFrames * nChannels * sizeof(INT32));
+	pFrames = (FLOAT*)malloc((SIZE_T)nFrames * nChannels * sizeof(FLOAT));
+	pScratch = (INT32*)malloc(2 * FLACCODEC_BLOCK_FRAMES * sizeof(INT32));
+	pFrame = (BYTE*)malloc(FLACCodec::GetMaxFrameBytes(nChannels));
+	if (pSource == NULL || pFrames == NULL || pScratch == NULL || pFrame == NULL)
+	{
+		hr = ENOMEM;
+		goto Exit;
+	}
+
+	// Tone, noise, silence and full scale, so every subframe type and both clipping edges are hit
+	for (UINT32 j = 0, nNoise = 1; j < nFrames; j++)
+		for (UINT32 i = 0; i < nChannels; i++)
+		{
+			INT32 nMax = (1 << (nBits - 1)) - 1;
+			INT32 nSample = 0;
+
+			nNoise = nNoise * 1664525 + 1013904223;
+
+			if (j < FLACCODEC_BLOCK_FRAMES)
+				nSample = (INT32)(nMax * 0.7 * sin(0.01 * (i + 1) * j));
+			else if (j < 2 * FLACCODEC_BLOCK_FRAMES)
+				nSample = (INT32)(nNoise >> (33 - nBits)) - (nMax + 1) / 2;
+			else if (j >= 3 * FLACCODEC_BLOCK_FRAMES)
+				nSample = (j & 1) ? nMax : -nMax - 1;
+
+			// Float as a device of that width hands it to the recorder
+			pSource[(SIZE_T)j * nChannels + i] = nSample;
+			pFrames[(SIZE_T)j * nChannels + i] = (FLOAT)nSample / (FLOAT)(1 << (nBits - 1));
+		}
+
+	hFile = CreateFileA((sPath + ".flac").c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		hr = ERROR_FILE_NOT_FOUND;
+		goto Exit;
+	}
+
+	FLACCodec::MakeStreamHeader(pHeader, nChannels, 48000);
+	WriteFile(hFile, pHeader, FLACCODEC_HEADER_BYTES, &nDone, NULL);
+
+	for (UINT32 j = 0, n = 0; j < nFrames; j += FLACCODEC_BLOCK_FRAMES, n++)
+	{
+		UINT32 nBlock = min(nFrames - j, (UINT32)FLACCODEC_BLOCK_FRAMES);
+		UINT32 nBytes = FLACCodec::EncodeFrame(pFrames + (SIZE_T)j * nChannels, nBlock, nChannels, n, pScratch, pFrame);
+
+		nMinFrameBytes = min(nMinFrameBytes, nBytes);
+		nMaxFrameBytes = max(nMaxFrameBytes, nBytes);
+
+		if (!WriteFile(hFile, pFrame, nBytes, &nDone, NULL))
+		{
+			hr = ERROR_FILE_NOT_FOUND;
+			goto Exit;
+		}
+	}
+
+	FLACCodec::SetStreamInfo(pHeader, nFrames, nMinFrameBytes, nMaxFrameBytes);
+	SetFilePointer(hFile, 0, NULL, FILE_BEGIN);
+	WriteFile(hFile, pHeader, FLACCODEC_HEADER_BYTES, &nDone, NULL);
+	CloseHandle(hFile);
+	hFile = INVALID_HANDLE_VALUE;
+
+	hr = FLACCodec::DecodeFile(sPath + ".flac", sPath + ".wav");
+	if (hr != ERROR_SUCCESS) goto Exit;
+
+	// Decoded samples follow the header DecodeFile writes, FLACCODEC_BITS_PER_SAMPLE wide
+	pWAV = (BYTE*)malloc(nWAVBytes);
+	if (pWAV == NULL)
+	{
+		hr = ENOMEM;
+		goto Exit;
+	}
+
+	hFile = CreateFileA((sPath + ".wav").c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE || !ReadFile(hFile, pWAV, nWAVBytes, &nDone, NULL) || nDone != nWAVBytes)
+	{
+		hr = ERROR_INVALID_DATA;
+		goto Exit;
+	}
+
+	// A source sample of nBits comes back shifted up to the width FLAC holds it at, nothing else may differ
+	for (UINT32 k = 0; k < nFrames * nChannels; k++)
+	{
+		UINT32 nContainer = 0;
+		for (UINT32 b = 0; b < nContainerBytes; b++)
+			nContainer |= (UINT32)pWAV[nWAVHeader + (SIZE_T)k * nContainerBytes + b] << (8 * b);
+
+		INT32 nDecoded = (INT32)(nContainer << (32 - 8 * nContainerBytes)) >> (32 - FLACCODEC_BITS_PER_SAMPLE);
+		if (nDecoded != (INT32)((UINT32)pSource[k] << nShift))
+		{
+			hr = ERROR_INVALID_DATA;
+			goto Exit;
+		}
+	}
+
+Exit:
+	if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+	free(pSource);
+	free(pFrames);
+	free(pScratch);
+	free(pFrame);
+	free(pWAV);
+
+	return hr;
+}
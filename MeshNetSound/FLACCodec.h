@@ -0,0 +1,143 @@
+#pragma once
+#include <windows.h>
+#include <string>
+#include "config.h"
+
+/// <summary>
+/// <para>Bit-level cursor over a byte buffer, most significant bit first as FLAC streams are.</para>
+/// </summary>
+typedef struct FLACBitStream {
+	BYTE				* pData;
+	UINT64				nBytes;				// Bytes written or readable
+	UINT64				nPosition;			// Bytes consumed, readers only
+	UINT64				nCache;				// Bits not yet written out or consumed
+	UINT32				nCacheBits;
+} FLACBITSTREAM;
+
+/// <summary>
+/// <para>Lossless encoder and decoder of the FLAC format subset the WAVRecorder writes.</para>
+/// <para>Frames hold FLACCODEC_BLOCK_FRAMES frames of FLACCODEC_BITS_PER_SAMPLE bit integer samples, float input
+/// being quantized once on the way in. Each channel is coded on its own as a constant, a fixed polynomial predictor
+/// of order 0 to 4 with Rice coded residuals over up to 2^FLACCODEC_MAX_PARTITION_ORDER partitions, or verbatim,
+/// whichever is smallest. Zero low bits common to a block, as in 16-bit sources, are stripped as wasted bits.</para>
+/// <para>Quantizing is exact for the float samples of integer sources of up to FLACCODEC_BITS_PER_SAMPLE bits.
+/// Float sources lose their low mantissa bits below 0.5 and are clipped to [-1, 1).</para>
+/// <para>Frames are self-contained, so blocks encode independently on any thread. FLACCodec::DecodeFile() turns
+/// a stream back into a WAV file, and FLACCodec::CheckRoundTrip() compares it with the source.</para>
+/// </summary>
+class FLACCodec
+{
+	public:
+		/// <summary>
+		/// <para>Serializes the "fLaC" marker and the STREAMINFO metadata block of an empty stream.</para>
+		/// </summary>
+		/// <param name="pHeader">- buffer of at least FLACCODEC_HEADER_BYTES bytes.</param>
+		/// <param name="nChannels">- number of channels, 1 to 8.</param>
+		/// <param name="nSamplesPerSec">- sample rate of the stream.</param>
+		/// <returns>FLACCODEC_HEADER_BYTES.</returns>
+		static UINT32 MakeStreamHeader(BYTE* pHeader, UINT32 nChannels, DWORD nSamplesPerSec);
+
+		/// <summary>
+		/// <para>Fills in the length and frame size bounds of the STREAMINFO block built by FLACCodec::MakeStreamHeader().</para>
+		/// </summary>
+		/// <param name="pHeader">- stream header.</param>
+		/// <param name="nFrames">- frames encoded so far.</param>
+		/// <param name="nMinFrameBytes">- size of the smallest FLAC frame, 0 if unknown.</param>
+		/// <param name="nMaxFrameBytes">- size of the largest FLAC frame, 0 if unknown.</param>
+		static void SetStreamInfo(BYTE* pHeader, UINT64 nFrames, UINT32 nMinFrameBytes, UINT32 nMaxFrameBytes);
+
+		/// <summary>
+		/// <para>Gets an upper bound of the size of an encoded block.</para>
+		/// </summary>
+		/// <param name="nChannels">- number of channels.</param>
+		/// <returns>Bytes to reserve for the output of FLACCodec::EncodeFrame().</returns>
+		static UINT32 GetMaxFrameBytes(UINT32 nChannels);
+
+		/// <summary>
+		/// <para>Encodes a block of interleaved float frames into one FLAC frame.</para>
+		/// <para>Thread-safe, works only on the buffers passed in.</para>
+		/// </summary>
+		/// <param name="pFrames">- interleaved float frames in [-1, 1), clipped otherwise.</param>
+		/// <param name="nFrames">- number of frames, at most FLACCODEC_BLOCK_FRAMES, fewer only in the last block.</param>
+		/// <param name="nChannels">- number of channels, 1 to 8.</param>
+		/// <param name="nFrameNumber">- index of the block in the stream.</param>
+		/// <param name="pScratch">- 2 * FLACCODEC_BLOCK_FRAMES integers of scratch space.</param>
+		/// <param name="pFrame">- buffer of FLACCodec::GetMaxFrameBytes() bytes receiving the frame.</param>
+		/// <returns>Size of the encoded frame.</returns>
+		static UINT32 EncodeFrame(const FLOAT* pFrames, UINT32 nFrames, UINT32 nChannels, UINT64 nFrameNumber, INT32* pScratch, BYTE* pFrame);
+
+		/// <summary>
+		/// <para>Decodes one FLAC frame written by FLACCodec::EncodeFrame() back into interleaved float frames.</para>
+		/// <para>Thread-safe, works only on the buffers passed in.</para>
+		/// </summary>
+		/// <param name="pFrame">- first byte of the frame.</param>
+		/// <param name="nBytes">- bytes readable, at least the size of the frame.</param>
+		/// <param name="nChannels">- number of channels it was encoded with.</param>
+		/// <param name="pScratch">- nChannels * FLACCODEC_BLOCK_FRAMES integers of scratch space.</param>
+		/// <param name="pFrames">- receives the interleaved float frames.</param>
+		/// <param name="pDecoded">- receives the number of frames.</param>
+		/// <returns>ERROR_SUCCESS, ERROR_INVALID_DATA if the frame is corrupt or ERROR_NOT_SUPPORTED.</returns>
+		static HRESULT DecodeFrame(const BYTE* pFrame, UINT32 nBytes, UINT32 nChannels, INT32* pScratch, FLOAT* pFrames, UINT32* pDecoded);
+
+		/// <summary>
+		/// <para>Decodes a FLAC file written by the WAVRecorder into an integer PCM WAV file.</para>
+		/// <para>Note: reads the whole source file into memory, meant for tools and round-trip tests.</para>
+		/// </summary>
+		/// <param name="sSource">- path of the FLAC file.</param>
+		/// <param name="sDestination">- path of the WAV file, overwritten if it exists.</param>
+		/// <returns>
+		/// <para>ERROR_SUCCESS if every frame decoded and passed its CRC.</para>
+		/// <para>ERROR_FILE_NOT_FOUND if either file could not be opened.</para>
+		/// <para>ERROR_INVALID_DATA if the stream is corrupt.</para>
+		/// <para>ERROR_NOT_SUPPORTED if the stream uses FLAC features the WAVRecorder never writes.</para>
+		/// <para>ENOMEM if memory allocation failed.</para>
+		/// </returns>
+		static HRESULT DecodeFile(std::string sSource, std::string sDestination);
+
+		/// <summary>
+		/// <para>Checks that integer samples come back exactly through FLACCodec::EncodeFrame() and FLACCodec::DecodeFile().</para>
+		/// <para>Encodes a few blocks of a synthetic integer source, the last one short, as the WAVRecorder would into
+		/// a FLAC file, decodes it into a WAV file next to it and compares every sample with the source.</para>
+		/// </summary>
+		/// <param name="sPath">- path of both files without extension, overwritten if they exist.</param>
+		/// <param name="nBits">- width of the source samples, 4 to FLACCODEC_BITS_PER_SAMPLE.</param>
+		/// <param name="nChannels">- number of channels, 1 to 8.</param>
+		/// <returns>
+		/// <para>ERROR_SUCCESS if every sample matched.</para>
+		/// <para>ERROR_INVALID_DATA if any did not, otherwise what writing or decoding the files failed with.</para>
+		/// </returns>
+		static HRESULT CheckRoundTrip(std::string sPath, UINT32 nBits, UINT32 nChannels);
+
+	private:
+		/// <summary>
+		/// <para>Encodes the samples of one channel as the smallest of a constant, fixed or verbatim subframe.</para>
+		/// </summary>
+		/// <param name="pStream">- frame being written.</param>
+		/// <param name="pSample">- samples of the channel, shifted in place if bits are wasted.</param>
+		/// <param name="pResidual">- scratch space for the residual.</param>
+		/// <param name="nFrames">- number of samples.</param>
+		/// <param name="nBits">- bits per sample.</param>
+		static void EncodeSubframe(FLACBITSTREAM* pStream, INT32* pSample, INT32* pResidual, UINT32 nFrames, UINT32 nBits);
+
+		/// <summary>
+		/// <para>Decodes one subframe into the samples of a channel.</para>
+		/// </summary>
+		/// <param name="pStream">- frame being read.</param>
+		/// <param name="pSample">- receives the samples of the channel.</param>
+		/// <param name="nFrames">- number of samples.</param>
+		/// <param name="nBits">- bits per sample.</param>
+		/// <returns>ERROR_SUCCESS, ERROR_INVALID_DATA or ERROR_NOT_SUPPORTED.</returns>
+		static HRESULT DecodeSubframe(FLACBITSTREAM* pStream, INT32* pSample, UINT32 nFrames, UINT32 nBits);
+
+		/// <summary>
+		/// <para>Decodes the frame at the cursor into the samples of each channel, checking both of its CRCs.</para>
+		/// </summary>
+		/// <param name="pStream">- stream positioned at the frame's sync code, left past its footer.</param>
+		/// <param name="nChannels">- number of channels of the stream.</param>
+		/// <param name="nBits">- bits per sample of the stream.</param>
+		/// <param name="pSample">- receives the samples, channel after channel.</param>
+		/// <param name="nMaxFrames">- distance between the channels in pSample, longer frames are not supported.</param>
+		/// <param name="pFrames">- receives the number of frames.</param>
+		/// <returns>ERROR_SUCCESS, ERROR_INVALID_DATA or ERROR_NOT_SUPPORTED.</returns>
+		static HRESULT ReadFrame(FLACBITSTREAM* pStream, UINT32 nChannels, UINT32 nBits, INT32* pSample, UINT32 nMaxFrames, UINT32* pFrames);
+};
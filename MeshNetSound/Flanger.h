@@ -67,7 +67,7 @@ class Flanger : public AudioEffect
 
 			float* processBuffer = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetBufferPointer();
 			int bufferSize = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetBufferSize();
-			int offset = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetReadOffset();
+			int offset = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetReadOffset(this);
 			float* outputBuffer = pContext->fOutputBuffer;
 
 			float* delayBuffer = ((FLANGERCONTEXT*)pContext->pRingBufferChannelEffectContext)->delayBuffer;
@@ -110,7 +110,7 @@ class Flanger : public AudioEffect
 		{
 			float* buffer = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetBufferPointer();
 			int bufferSize = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetBufferSize();
-			int offset = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetReadOffset();
+			int offset = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetReadOffset(this);
 			float* delayBuffer = ((FLANGERCONTEXT*)pContext->pRingBufferChannelEffectContext)->delayBuffer;
 			int delayBufferWritePosition = ((FLANGERCONTEXT*)pContext->pRingBufferChannelEffectContext)->delayBufferWritePosition;
 
@@ -0,0 +1,202 @@
+#include "FlightRecorder.h"
+#include <iostream>
+#include <cmath>
+
+FlightRecorder::FlightRecorder(std::string sPath, UINT32 nChannels, DWORD nSamplesPerSec, DWORD dwChannelMask)
+{
+	UINT32 nSampleBytes = FLIGHTRECORDER_INT16 ? sizeof(INT16) : sizeof(FLOAT);
+	UINT64 nFrames = (UINT64)(FLIGHTRECORDER_PRE_TRIGGER_SEC + FLIGHTRECORDER_POST_TRIGGER_SEC) * nSamplesPerSec;
+
+	// Round capacity up to a power of two, so that any offset wraps with a mask,
+	// with a quarter on top so the producer stays clear of a dump that lags a little behind
+	UINT32 nBufferSize = RINGBUFFER_CACHE_LINE;
+	while (nBufferSize < nFrames + nFrames / 4 && nBufferSize < 0x80000000) nBufferSize <<= 1;
+
+	SIZE_T nBytes = (SIZE_T)nBufferSize * nChannels * nSampleBytes;
+
+	this->pHistory = (nChannels > 0 && nSamplesPerSec > 0) ? (BYTE*)_aligned_malloc(nBytes, RINGBUFFER_CACHE_LINE) : NULL;
+
+	// Touch every page now rather than on the capture thread, the history starts out as silence
+	if (this->pHistory != NULL)
+	{
+		memset(this->pHistory, 0, nBytes);
+		this->nChannels = nChannels;
+		this->nFrameBytes = nChannels * nSampleBytes;
+		this->nBufferSize = nBufferSize;
+		this->nBufferMask = nBufferSize - 1;
+		this->nSamplesPerSec = nSamplesPerSec;
+		this->dwChannelMask = dwChannelMask;
+		this->sPath = sPath;
+	}
+}
+
+FlightRecorder::~FlightRecorder()
+{
+	if (this->hDumpThread != NULL)
+	{
+		this->bStop.store(TRUE, std::memory_order_relaxed);
+		WaitForSingleObject(this->hDumpThread, INFINITE);
+		CloseHandle(this->hDumpThread);
+	}
+
+	_aligned_free(this->pHistory);
+}
+
+UINT32 FlightRecorder::GetBufferSize()
+{
+	return this->nBufferSize;
+}
+
+void FlightRecorder::Push(const FLOAT* pFrames, UINT32 nFrames)
+{
+	if (this->pHistory == NULL) return;
+
+	UINT64 nWrite = this->nWrite.load(std::memory_order_relaxed);
+
+	for (UINT32 j = 0; j < nFrames; j++, pFrames += this->nChannels)
+	{
+		BYTE* pFrame = this->pHistory + (SIZE_T)((nWrite + j) & this->nBufferMask) * this->nFrameBytes;
+
+		if (FLIGHTRECORDER_INT16)
+			for (UINT32 i = 0; i < this->nChannels; i++)
+				((INT16*)pFrame)[i] = (INT16)min(max(floor(pFrames[i] * 32768.0 + 0.5), -32768.0), 32767.0);
+		else
+			memcpy(pFrame, pFrames, this->nFrameBytes);
+	}
+
+	// Release pairs with the acquire in Dump: the dump thread sees the frames before the new count
+	this->nWrite.store(nWrite + nFrames, std::memory_order_release);
+}
+
+HRESULT FlightRecorder::Trigger()
+{
+	if (this->pHistory == NULL) return ENOMEM;
+
+	// One dump at a time, a trigger during a dump is already covered by it
+	if (this->bDumping.exchange(TRUE, std::memory_order_acquire)) return ERROR_BUSY;
+
+	// Previous dump is done, only its handle is left
+	if (this->hDumpThread != NULL)
+	{
+		WaitForSingleObject(this->hDumpThread, INFINITE);
+		CloseHandle(this->hDumpThread);
+		this->hDumpThread = NULL;
+	}
+
+	WAVEFORMATEXTENSIBLE tFormat = {};
+	WORD nBitsPerSample = (WORD)(8 * this->nFrameBytes / this->nChannels);
+
+	tFormat.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+	tFormat.Format.nChannels = (WORD)this->nChannels;
+	tFormat.Format.nSamplesPerSec = this->nSamplesPerSec;
+	tFormat.Format.nBlockAlign = (WORD)this->nFrameBytes;
+	tFormat.Format.nAvgBytesPerSec = this->nSamplesPerSec * this->nFrameBytes;
+	tFormat.Format.wBitsPerSample = nBitsPerSample;
+	tFormat.Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+	tFormat.Samples.wValidBitsPerSample = nBitsPerSample;
+	tFormat.dwChannelMask = this->dwChannelMask;
+	tFormat.SubFormat = FLIGHTRECORDER_INT16 ? KSDATAFORMAT_SUBTYPE_PCM : KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+
+	this->pRecorder = WAVRecorder::Acquire();
+	if (this->pRecorder == NULL)
+	{
+		this->bDumping.store(FALSE, std::memory_order_release);
+		return ENOMEM;
+	}
+
+	std::string sFile = this->sPath + " " + std::to_string(++this->nDumps) + ".wav";
+
+	this->pTrack = this->pRecorder->OpenTrack(sFile, (const BYTE*)&tFormat, sizeof(WAVEFORMATEXTENSIBLE));
+	if (this->pTrack == NULL)
+	{
+		WAVRecorder::Release();
+		this->bDumping.store(FALSE, std::memory_order_release);
+		return ERROR_TOO_MANY_OPEN_FILES;
+	}
+
+	// Window around the frame the producer is about to write
+	UINT64 nTrigger = this->nWrite.load(std::memory_order_acquire);
+	UINT64 nPreFrames = (UINT64)FLIGHTRECORDER_PRE_TRIGGER_SEC * this->nSamplesPerSec;
+
+	this->nDumpFrom = (nTrigger > nPreFrames) ? nTrigger - nPreFrames : 0;
+	this->nDumpTo = nTrigger + (UINT64)FLIGHTRECORDER_POST_TRIGGER_SEC * this->nSamplesPerSec;
+
+	this->hDumpThread = CreateThread(NULL, 0, FlightRecorder::DumpThread, (LPVOID)this, 0, NULL);
+	if (this->hDumpThread == NULL)
+	{
+		this->pRecorder->CloseTrack(this->pTrack);
+		WAVRecorder::Release();
+		this->bDumping.store(FALSE, std::memory_order_release);
+		return ENOMEM;
+	}
+
+	// Disk writes must never preempt capture, render or DSP threads
+	SetThreadPriority(this->hDumpThread, THREAD_PRIORITY_BELOW_NORMAL);
+
+	std::cout << MSG "Flight recorder dumping " << FLIGHTRECORDER_PRE_TRIGGER_SEC << " s before and "
+		<< FLIGHTRECORDER_POST_TRIGGER_SEC << " s after the trigger into " << sFile << "." END << std::endl;
+
+	return ERROR_SUCCESS;
+}
+
+DWORD WINAPI FlightRecorder::DumpThread(LPVOID lpParam)
+{
+	((FlightRecorder*)lpParam)->Dump();
+	return 0;
+}
+
+void FlightRecorder::Dump()
+{
+	UINT64 nFrame = this->nDumpFrom, nSkipped = 0;
+	ULONGLONG nLastProgress = GetTickCount64();
+
+	while (nFrame < this->nDumpTo && !this->bStop.load(std::memory_order_relaxed))
+	{
+		UINT64 nWrite = this->nWrite.load(std::memory_order_acquire);
+
+		// Wait for the producer to capture more, give up if capture has stopped
+		if (nFrame == nWrite)
+		{
+			if (GetTickCount64() - nLastProgress > ENDPOINT_TIMEOUT_MILLISEC) break;
+
+			Sleep(WAVRECORDER_FLUSH_MILLISEC);
+			continue;
+		}
+
+		// Contiguous run of the history, up to its end
+		UINT32 nOffset = (UINT32)nFrame & this->nBufferMask;
+		UINT32 nFrames = (UINT32)min(min(nWrite, this->nDumpTo) - nFrame, (UINT64)(this->nBufferSize - nOffset));
+		nFrames = min(nFrames, this->pRecorder->GetQueueSpace(this->pTrack) / this->nFrameBytes);
+
+		// Recorder queue is full, let the recorder thread catch up instead of dropping
+		if (nFrames == 0)
+		{
+			Sleep(WAVRECORDER_FLUSH_MILLISEC);
+			continue;
+		}
+
+		this->pRecorder->Record(this->pTrack, this->pHistory + (SIZE_T)nOffset * this->nFrameBytes, nFrames * this->nFrameBytes);
+
+		UINT64 nStart = nFrame;
+		nFrame += nFrames;
+		nLastProgress = GetTickCount64();
+
+		// Producer lapped the dump while the run was copied, skip to well past the oldest frame still held
+		nWrite = this->nWrite.load(std::memory_order_acquire);
+		if (nWrite - nStart > this->nBufferSize)
+		{
+			UINT64 nOldest = nWrite - this->nBufferSize + this->nBufferSize / 4;
+			nSkipped += max(nOldest, nFrame) - nStart;
+			nFrame = max(nFrame, nOldest);
+		}
+	}
+
+	this->pRecorder->CloseTrack(this->pTrack);
+	this->pTrack = NULL;
+	WAVRecorder::Release();
+
+	if (nSkipped > 0)
+		std::cout << WRN "Flight recorder dump fell behind capture, " << nSkipped << " frames of it are corrupt or missing." END << std::endl;
+
+	this->bDumping.store(FALSE, std::memory_order_release);
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <string>
+#include "config.h"
+#include "WAVRecorder.h"
+
+/// <summary>
+/// <para>Pre-trigger history of the audio of a device, held in memory and written to disk only on demand.</para>
+/// <para>The capture thread appends interleaved frames to a power of two ring holding FLIGHTRECORDER_PRE_TRIGGER_SEC
+/// plus FLIGHTRECORDER_POST_TRIGGER_SEC of audio with headroom, stored as 16-bit integers if FLIGHTRECORDER_INT16
+/// to halve its memory. FlightRecorder::Trigger() dumps the audio preceding and following the trigger into a WAV file
+/// from a low priority thread through the WAVRecorder, while capture carries on.</para>
+/// <para>Producer and dump thread exchange a monotonically increasing frame counter with acquire/release ordering,
+/// the same way RingBufferChannel does. Producer never waits: should the dump fall a whole ring behind,
+/// the frames overwritten meanwhile are skipped.</para>
+/// </summary>
+class FlightRecorder
+{
+	public:
+		/// <summary>
+		/// <para>Allocates the history of a device.</para>
+		/// <para>Note: on allocation failure the history is NULL and FlightRecorder::Trigger() fails.</para>
+		/// </summary>
+		/// <param name="sPath">- path of the dumped files, without the dump number and extension.</param>
+		/// <param name="nChannels">- number of samples in a frame.</param>
+		/// <param name="nSamplesPerSec">- sample rate of the device.</param>
+		/// <param name="dwChannelMask">- speaker positions of the channels, 0 if unknown.</param>
+		FlightRecorder(std::string sPath, UINT32 nChannels, DWORD nSamplesPerSec, DWORD dwChannelMask);
+
+		/// <summary>
+		/// <para>Cuts a running dump short, completing its file with what was captured so far.</para>
+		/// </summary>
+		~FlightRecorder();
+
+		/// <summary>
+		/// <para>Gets the capacity of the history.</para>
+		/// </summary>
+		/// <returns>Number of frames held, 0 if allocation failed.</returns>
+		UINT32 GetBufferSize();
+
+		/// <summary>
+		/// <para>Appends frames to the history.</para>
+		/// <para>Lock-free and syscall-free, safe on the capture thread, the only producer.</para>
+		/// </summary>
+		/// <param name="pFrames">- interleaved float frames.</param>
+		/// <param name="nFrames">- number of frames.</param>
+		void Push(const FLOAT* pFrames, UINT32 nFrames);
+
+		/// <summary>
+		/// <para>Starts dumping the last FLIGHTRECORDER_PRE_TRIGGER_SEC of the history, followed by the next
+		/// FLIGHTRECORDER_POST_TRIGGER_SEC as they are captured, into a new numbered WAV file.</para>
+		/// <para>Returns right away, the dump completes in the background.</para>
+		/// </summary>
+		/// <returns>
+		/// <para>ERROR_SUCCESS if the dump started.</para>
+		/// <para>ERROR_BUSY if the previous dump is still running.</para>
+		/// <para>ERROR_TOO_MANY_OPEN_FILES if the file could not be opened.</para>
+		/// <para>ENOMEM if the history or the dump thread could not be allocated.</para>
+		/// </returns>
+		HRESULT Trigger();
+
+	private:
+		/// <summary>
+		/// <para>Runs FlightRecorder::Dump() on a low priority thread.</para>
+		/// </summary>
+		/// <param name="lpParam">- pointer to the FlightRecorder.</param>
+		/// <returns>0.</returns>
+		static DWORD WINAPI DumpThread(LPVOID lpParam);
+
+		/// <summary>
+		/// <para>Queues the frames from nDumpFrom to nDumpTo to the WAVRecorder as the producer passes them,
+		/// then closes the file.</para>
+		/// </summary>
+		void Dump();
+
+		BYTE				* pHistory			{ NULL };	// Interleaved frames of INT16 or FLOAT samples
+		UINT32				nChannels			{ 0 },
+							nFrameBytes			{ 0 },
+							nBufferSize			{ 0 },		// Frames in the history, power of two
+							nBufferMask			{ 0 },
+							nDumps				{ 0 };		// Number of the last dumped file
+		DWORD				nSamplesPerSec		{ 0 },
+							dwChannelMask		{ 0 };
+		std::string			sPath;
+
+		WAVRecorder			* pRecorder			{ NULL };
+		WAVRECORDERTRACK	* pTrack			{ NULL };	// File of the running dump
+		UINT64				nDumpFrom			{ 0 },		// Frame range of the running dump
+							nDumpTo				{ 0 };
+		HANDLE				hDumpThread			{ NULL };
+		std::atomic<BOOL>	bDumping			{ FALSE };	// Set by Trigger, cleared by the dump thread once done
+		std::atomic<BOOL>	bStop				{ FALSE };	// Cuts the running dump short
+
+		alignas(RINGBUFFER_CACHE_LINE)
+		std::atomic<UINT64>	nWrite				{ 0 };		// Frames pushed since construction, never wraps
+};
@@ -0,0 +1,250 @@
+#include "FrameRingBuffer.h"
+
+#pragma comment(lib, "Synchronization.lib")
+
+FrameRingBuffer::FrameRingBuffer(UINT32 nChannels, UINT32 nFrames, FRAMERINGLAYOUT eLayout)
+{
+	// Round capacity up to a power of two, so that any offset wraps with a mask,
+	// and to at least a cache line of samples, so that each planar block starts on one
+	UINT32 nBufferSize = RINGBUFFER_CACHE_LINE / sizeof(FLOAT);
+	while (nBufferSize < nFrames && nBufferSize < 0x80000000) nBufferSize <<= 1;
+
+	SIZE_T nBytes = sizeof(FLOAT) * (SIZE_T)nBufferSize * nChannels;
+
+	this->pBuffer = (nChannels > 0) ? (FLOAT*)_aligned_malloc(nBytes, RINGBUFFER_CACHE_LINE) : NULL;
+
+	// Start out with silence
+	if (this->pBuffer != NULL)
+	{
+		memset(this->pBuffer, 0, nBytes);
+		this->nChannels = nChannels;
+		this->nBufferSize = nBufferSize;
+		this->nBufferMask = nBufferSize - 1;
+		this->eLayout = eLayout;
+	}
+}
+
+FrameRingBuffer::~FrameRingBuffer()
+{
+	_aligned_free(this->pBuffer);
+}
+
+UINT32 FrameRingBuffer::GetChannelNumber()
+{
+	return this->nChannels;
+}
+
+UINT32 FrameRingBuffer::GetBufferSize()
+{
+	return this->nBufferSize;
+}
+
+UINT32 FrameRingBuffer::GetBufferMask()
+{
+	return this->nBufferMask;
+}
+
+FRAMERINGLAYOUT FrameRingBuffer::GetLayout()
+{
+	return this->eLayout;
+}
+
+FLOAT* FrameRingBuffer::GetBufferPointer()
+{
+	return this->pBuffer;
+}
+
+UINT32 FrameRingBuffer::GetFrameStride()
+{
+	return (this->eLayout == FRAMERING_INTERLEAVED) ? this->nChannels : 1;
+}
+
+UINT32 FrameRingBuffer::GetChannelStride()
+{
+	return (this->eLayout == FRAMERING_INTERLEAVED) ? 1 : this->nBufferSize;
+}
+
+FLOAT* FrameRingBuffer::GetFramePointer(UINT32 nOffset)
+{
+	if (this->eLayout != FRAMERING_INTERLEAVED) return NULL;
+
+	return this->pBuffer + (SIZE_T)(nOffset & this->nBufferMask) * this->nChannels;
+}
+
+FLOAT* FrameRingBuffer::GetChannelPointer(UINT32 nChannel)
+{
+	if (this->eLayout != FRAMERING_PLANAR || nChannel >= this->nChannels) return NULL;
+
+	return this->pBuffer + (SIZE_T)nChannel * this->nBufferSize;
+}
+
+UINT32 FrameRingBuffer::GetFramesAvailable()
+{
+	// Acquire pairs with the release in CommitWrite: frames below the loaded index are visible to this thread
+	UINT64 nRead = this->nRead.load(std::memory_order_acquire);
+	UINT64 nWrite = this->nWrite.load(std::memory_order_acquire);
+
+	return (UINT32)min(nWrite - nRead, (UINT64)this->nBufferSize);
+}
+
+UINT32 FrameRingBuffer::GetFramesFree()
+{
+	UINT64 nWrite = this->nWrite.load(std::memory_order_relaxed);
+	UINT64 nRead = this->nRead.load(std::memory_order_acquire);
+
+	// Full, or the consumer is lapped and has yet to skip ahead
+	return (nWrite - nRead >= this->nBufferSize) ? 0 : (UINT32)(this->nBufferSize - (nWrite - nRead));
+}
+
+UINT32 FrameRingBuffer::GetWriteOffset()
+{
+	// Only the producer advances the write index, so its own view is always current
+	return (UINT32)this->nWrite.load(std::memory_order_relaxed) & this->nBufferMask;
+}
+
+BOOL FrameRingBuffer::WaitForFrames(UINT32 nFrames, DWORD dwMilliseconds)
+{
+	// A watermark above the capacity could never be reached
+	nFrames = min(max(nFrames, (UINT32)1), this->nBufferSize);
+
+	ULONGLONG nDeadline = GetTickCount64() + dwMilliseconds;
+
+	while (TRUE)
+	{
+		UINT64 nWrite = this->nWrite.load(std::memory_order_acquire);
+		UINT64 nRead = this->nRead.load(std::memory_order_acquire);
+		if (nWrite - nRead >= nFrames) return TRUE;
+
+		this->nWakeAt.store(nRead + nFrames, std::memory_order_release);
+
+		// Pairs with the fence in CommitWrite: either the producer sees the watermark, or this load sees its commit
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (this->nWrite.load(std::memory_order_acquire) != nWrite) continue;
+
+		ULONGLONG nNow = GetTickCount64();
+		if (nNow >= nDeadline) return FALSE;
+
+		// Returns at once if the producer published anything since the load above
+		WaitOnAddress(&this->nWrite, &nWrite, sizeof(UINT64), (DWORD)(nDeadline - nNow));
+	}
+}
+
+void FrameRingBuffer::CommitWrite(UINT32 nFrames)
+{
+	UINT64 nWrite = this->nWrite.load(std::memory_order_relaxed) + nFrames;
+	this->nWrite.store(nWrite, std::memory_order_release);
+
+	// Store-then-load on two atomics, release and acquire alone would let this and a waiter both miss the other
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	// Only a single load while the consumer does not sleep or its watermark is not reached yet
+	UINT64 nWakeAt = this->nWakeAt.load(std::memory_order_acquire);
+	if (nWrite >= nWakeAt && this->nWakeAt.compare_exchange_strong(nWakeAt, MAXUINT64, std::memory_order_acq_rel))
+		WakeByAddressSingle(&this->nWrite);
+}
+
+UINT32 FrameRingBuffer::GetReadOffset()
+{
+	return (UINT32)this->Resync() & this->nBufferMask;
+}
+
+void FrameRingBuffer::CommitRead(UINT32 nFrames)
+{
+	// Never move past the producer, release pairs with the acquire in GetFramesFree
+	UINT64 nRead = this->Resync();
+	UINT64 nWrite = this->nWrite.load(std::memory_order_acquire);
+	this->nRead.store(min(nRead + nFrames, nWrite), std::memory_order_release);
+}
+
+void FrameRingBuffer::WriteFrames(const FLOAT* pFrames, UINT32 nFrames)
+{
+	// Only the newest frames fit a packet larger than the ring, they land where they would have after the older ones
+	UINT32 nSkipped = (nFrames > this->nBufferSize) ? nFrames - this->nBufferSize : 0;
+	pFrames += (SIZE_T)nSkipped * this->nChannels;
+	nFrames -= nSkipped;
+
+	UINT32 nOffset = (this->GetWriteOffset() + nSkipped) & this->nBufferMask;
+	UINT32 nFirst = min(nFrames, this->nBufferSize - nOffset);
+
+	if (this->eLayout == FRAMERING_INTERLEAVED)
+	{
+		// Whole frames up till the end of the ring buffer, then the rest into its beginning
+		memcpy(this->pBuffer + (SIZE_T)nOffset * this->nChannels,
+			pFrames,
+			sizeof(FLOAT) * nFirst * this->nChannels);
+
+		memcpy(this->pBuffer,
+			pFrames + (SIZE_T)nFirst * this->nChannels,
+			sizeof(FLOAT) * (nFrames - nFirst) * this->nChannels);
+	}
+	else
+	{
+		// Channel by channel, so that each block is written sequentially
+		for (UINT32 i = 0; i < this->nChannels; i++)
+		{
+			FLOAT* pBlock = this->pBuffer + (SIZE_T)i * this->nBufferSize;
+			const FLOAT* pSample = pFrames + i;
+
+			for (UINT32 j = 0; j < nFirst; j++, pSample += this->nChannels)
+				pBlock[nOffset + j] = *pSample;
+			for (UINT32 j = 0; j < nFrames - nFirst; j++, pSample += this->nChannels)
+				pBlock[j] = *pSample;
+		}
+	}
+
+	// Publish the frames only after they are in place, a lapped consumer resyncs past the skipped ones
+	this->CommitWrite(nSkipped + nFrames);
+}
+
+UINT32 FrameRingBuffer::ReadFrames(FLOAT* pFrames, UINT32 nFrames)
+{
+	nFrames = min(nFrames, this->GetFramesAvailable());
+
+	UINT32 nOffset = this->GetReadOffset();
+	UINT32 nFirst = min(nFrames, this->nBufferSize - nOffset);
+
+	if (this->eLayout == FRAMERING_INTERLEAVED)
+	{
+		memcpy(pFrames,
+			this->pBuffer + (SIZE_T)nOffset * this->nChannels,
+			sizeof(FLOAT) * nFirst * this->nChannels);
+
+		memcpy(pFrames + (SIZE_T)nFirst * this->nChannels,
+			this->pBuffer,
+			sizeof(FLOAT) * (nFrames - nFirst) * this->nChannels);
+	}
+	else
+	{
+		for (UINT32 i = 0; i < this->nChannels; i++)
+		{
+			FLOAT* pBlock = this->pBuffer + (SIZE_T)i * this->nBufferSize;
+			FLOAT* pSample = pFrames + i;
+
+			for (UINT32 j = 0; j < nFirst; j++, pSample += this->nChannels)
+				*pSample = pBlock[nOffset + j];
+			for (UINT32 j = 0; j < nFrames - nFirst; j++, pSample += this->nChannels)
+				*pSample = pBlock[j];
+		}
+	}
+
+	// Hand the frames back to the producer only once they are copied out
+	this->CommitRead(nFrames);
+
+	return nFrames;
+}
+
+UINT64 FrameRingBuffer::Resync()
+{
+	UINT64 nRead = this->nRead.load(std::memory_order_relaxed);
+	UINT64 nWrite = this->nWrite.load(std::memory_order_acquire);
+
+	// If the producer overran the consumer, drop the overwritten frames and
+	// continue from the oldest frame still in the buffer
+	if (nWrite - nRead > this->nBufferSize)
+	{
+		nRead = nWrite - this->nBufferSize;
+		this->nRead.store(nRead, std::memory_order_release);
+	}
+
+	return nRead;
+}
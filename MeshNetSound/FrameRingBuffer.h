@@ -0,0 +1,161 @@
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include "config.h"
+
+/// <summary>
+/// <para>Arrangement of the samples of all channels within the single allocation of a FrameRingBuffer.</para>
+/// </summary>
+typedef enum FrameRingLayout {
+	FRAMERING_INTERLEAVED,							// Frames of nChannels samples one after another, as WASAPI packets are
+	FRAMERING_PLANAR								// Block of nBufferSize samples per channel, one channel after another
+} FRAMERINGLAYOUT;
+
+/// <summary>
+/// <para>Lock-free single producer, single consumer ring buffer of whole frames of a device.</para>
+/// <para>Alternative to an array of RingBufferChannel's: all channels of the device sit in one
+/// cache line aligned allocation, so the producer and consumer move a frame at once rather than
+/// touching nChannels separate buffers for every frame.</para>
+/// <para>Exposes an interleaved-frame view (FRAMERING_INTERLEAVED) or a planar-block view (FRAMERING_PLANAR).
+/// Sample of channel i at offset n is at GetBufferPointer() + (n &amp; GetBufferMask()) * GetFrameStride() + i * GetChannelStride()
+/// for either layout.</para>
+/// <para>Note: producer never blocks. If it overruns the consumer, the consumer skips ahead to the oldest
+/// frame still in the buffer on its next read.</para>
+/// </summary>
+class FrameRingBuffer
+{
+	public:
+		/// <summary>
+		/// <para>Allocates a ring of at least nFrames frames of nChannels samples,
+		/// rounded up to a power of two so that offsets wrap with a mask.</para>
+		/// <para>Note: on allocation failure the buffer pointer is NULL and the size is 0.</para>
+		/// </summary>
+		/// <param name="nChannels">- number of samples in a frame.</param>
+		/// <param name="nFrames">- minimum capacity in frames.</param>
+		/// <param name="eLayout">- arrangement of samples in memory.</param>
+		FrameRingBuffer(UINT32 nChannels, UINT32 nFrames = AGGREGATOR_CIRCULAR_BUFFER_SIZE, FRAMERINGLAYOUT eLayout = FRAMERING_INTERLEAVED);
+
+		~FrameRingBuffer();
+
+		UINT32 GetChannelNumber();
+
+		UINT32 GetBufferSize();
+
+		UINT32 GetBufferMask();
+
+		FRAMERINGLAYOUT GetLayout();
+
+		FLOAT* GetBufferPointer();
+
+		/// <summary>
+		/// <para>Gets distance in samples between consecutive frames of the same channel.</para>
+		/// </summary>
+		/// <returns>nChannels if interleaved, 1 if planar.</returns>
+		UINT32 GetFrameStride();
+
+		/// <summary>
+		/// <para>Gets distance in samples between consecutive channels of the same frame.</para>
+		/// </summary>
+		/// <returns>1 if interleaved, size of the buffer if planar.</returns>
+		UINT32 GetChannelStride();
+
+		/// <summary>
+		/// <para>Interleaved-frame view: gets the frame at the offset.</para>
+		/// </summary>
+		/// <param name="nOffset">- offset into the buffer, wrapped by the mask.</param>
+		/// <returns>Pointer to nChannels consecutive samples, NULL if the layout is planar.</returns>
+		FLOAT* GetFramePointer(UINT32 nOffset);
+
+		/// <summary>
+		/// <para>Planar-block view: gets the block of the channel.</para>
+		/// </summary>
+		/// <param name="nChannel">- channel index.</param>
+		/// <returns>Pointer to size of the buffer consecutive samples, NULL if the layout is interleaved.</returns>
+		FLOAT* GetChannelPointer(UINT32 nChannel);
+
+		/// <summary>
+		/// <para>Gets number of frames published but not yet read.</para>
+		/// </summary>
+		/// <returns>Number of frames, at most the size of the buffer.</returns>
+		UINT32 GetFramesAvailable();
+
+		/// <summary>
+		/// <para>Gets number of frames the producer can write without overrunning the consumer.</para>
+		/// </summary>
+		/// <returns>Number of free frames.</returns>
+		UINT32 GetFramesFree();
+
+		/// <summary>
+		/// <para>Blocks until at least nFrames frames are available to the consumer, or the timeout elapses.</para>
+		/// <para>Sleeps on the write index with WaitOnAddress, woken by the producer once it publishes past the watermark.</para>
+		/// </summary>
+		/// <param name="nFrames">- watermark in frames, clamped to the size of the buffer.</param>
+		/// <param name="dwMilliseconds">- longest time to block.</param>
+		/// <returns>TRUE if the watermark is reached, FALSE on timeout.</returns>
+		BOOL WaitForFrames(UINT32 nFrames, DWORD dwMilliseconds);
+
+		/// <summary>
+		/// <para>Gets index into the buffer at which the producer writes the next frame.</para>
+		/// </summary>
+		/// <returns>Write offset.</returns>
+		UINT32 GetWriteOffset();
+
+		/// <summary>
+		/// <para>Publishes nFrames frames the producer wrote starting at the write offset.</para>
+		/// <para>Wakes the consumer blocked in WaitForFrames if its watermark is reached.</para>
+		/// </summary>
+		/// <param name="nFrames">- number of frames written.</param>
+		void CommitWrite(UINT32 nFrames);
+
+		/// <summary>
+		/// <para>Gets index into the buffer of the next frame of the consumer.</para>
+		/// <para>Skips the consumer ahead if the producer has overrun it.</para>
+		/// </summary>
+		/// <returns>Read offset.</returns>
+		UINT32 GetReadOffset();
+
+		/// <summary>
+		/// <para>Releases nFrames frames read by the consumer back to the producer.</para>
+		/// </summary>
+		/// <param name="nFrames">- number of frames read.</param>
+		void CommitRead(UINT32 nFrames);
+
+		/// <summary>
+		/// <para>Copies interleaved frames in at the write offset and publishes them.</para>
+		/// <para>Takes at most 2 memcpy's in the interleaved layout, transposes in the planar layout.</para>
+		/// </summary>
+		/// <param name="pFrames">- interleaved frames of nChannels samples.</param>
+		/// <param name="nFrames">- number of frames, only the newest size of the buffer frames are kept if larger.</param>
+		void WriteFrames(const FLOAT* pFrames, UINT32 nFrames);
+
+		/// <summary>
+		/// <para>Copies interleaved frames out from the read offset and releases them.</para>
+		/// </summary>
+		/// <param name="pFrames">- buffer for interleaved frames of nChannels samples.</param>
+		/// <param name="nFrames">- number of frames requested.</param>
+		/// <returns>Number of frames copied, at most the number available.</returns>
+		UINT32 ReadFrames(FLOAT* pFrames, UINT32 nFrames);
+
+	private:
+		/// <summary>
+		/// <para>Moves the consumer past frames the producer has already overwritten.</para>
+		/// </summary>
+		/// <returns>Position of the consumer.</returns>
+		UINT64 Resync();
+
+		FLOAT				*pBuffer						{ NULL };
+
+		UINT32				nChannels						{ 0 },
+							nBufferSize						{ 0 },		// Power of two
+							nBufferMask						{ 0 };
+
+		FRAMERINGLAYOUT		eLayout							{ FRAMERING_INTERLEAVED };
+
+		// Producer and consumer indices on separate cache lines
+		alignas(RINGBUFFER_CACHE_LINE)
+		std::atomic<UINT64>	nWrite							{ 0 },		// Frames published since creation, never wraps
+							nWakeAt							{ MAXUINT64 };	// Write index the blocked consumer waits for
+
+		alignas(RINGBUFFER_CACHE_LINE)
+		std::atomic<UINT64>	nRead							{ 0 };		// Frames consumed since creation, never wraps
+};
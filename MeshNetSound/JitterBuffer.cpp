@@ -0,0 +1,176 @@
+#include "JitterBuffer.h"
+#include <cfloat>
+#include <cmath>
+
+JitterBuffer::JitterBuffer(DWORD nSamplesPerSec, UINT32 nGuard)
+{
+	this->pSlab = (BYTE*)_aligned_malloc((SIZE_T)UDP_JITTER_SLOTS * UDP_PACKET_BYTES, RINGBUFFER_CACHE_LINE);
+	this->nSamplesPerSec = max(nSamplesPerSec, (DWORD)1);
+	this->nGuard = nGuard;
+
+	for (UINT32 i = 0; i < UDP_JITTER_SLOTS; i++)
+	{
+		this->pSlot[i] = {};
+		this->pSlot[i].pPayload = (this->pSlab != NULL) ? this->pSlab + (SIZE_T)i * UDP_PACKET_BYTES : NULL;
+	}
+}
+
+JitterBuffer::~JitterBuffer()
+{
+	_aligned_free(this->pSlab);
+}
+
+HRESULT JitterBuffer::Insert(UINT32 nSequence, UINT64 nTimestamp, const BYTE* pPayload, UINT32 nFrames, UINT32 nBytes, DOUBLE fArrival)
+{
+	if (this->pSlab == NULL) return ENOMEM;
+
+	DOUBLE fTransit = fArrival - (DOUBLE)nTimestamp / this->nSamplesPerSec;
+
+	if (!this->bSynced) this->Resync(nSequence, nTimestamp, fTransit);
+
+	// Sequence numbers wrap, compare by their signed distance
+	INT32 nAhead = (INT32)(nSequence - this->nNext);
+
+	if (nAhead < 0 && nAhead > -UDP_SEQUENCE_WINDOW)
+	{
+		this->nLate++;
+		return ERROR_INVALID_DATA;
+	}
+
+	// Far behind is a restarted sender, beyond the slots a jump ahead, either way what is held is of no use anymore
+	if (nAhead < 0 || nAhead >= UDP_JITTER_SLOTS)
+	{
+		this->nLost += this->nHeld;
+		this->Resync(nSequence, nTimestamp, fTransit);
+	}
+
+	JITTERSLOT* pSlot = &this->pSlot[nSequence & (UDP_JITTER_SLOTS - 1)];
+	if (pSlot->bFilled)
+	{
+		this->nLate++;
+		return ERROR_INVALID_DATA;
+	}
+
+	pSlot->nBytes = min(nBytes, (UINT32)UDP_PACKET_BYTES);
+	memcpy(pSlot->pPayload, pPayload, pSlot->nBytes);
+	pSlot->nTimestamp = nTimestamp;
+	pSlot->nSequence = nSequence;
+	pSlot->nFrames = nFrames;
+	pSlot->bFilled = TRUE;
+	this->nHeld++;
+
+	// Smoothed deviation of the transit time of consecutive arrivals, as in RFC 3550
+	this->fJitter += (fabs(fTransit - this->fTransit) - this->fJitter) / 16.0;
+	this->fTransit = fTransit;
+
+	// Drifts up by 0.1% of the audio received, so a sender clock running up to 1000 ppm slow is followed
+	this->fMinTransit = min(this->fMinTransit + 0.001 * nFrames / this->nSamplesPerSec, fTransit);
+
+	// Deep enough for the jitter and at least a datagram plus the guard, bounded so reordering fits the slots
+	this->fTarget = min(max(UDP_JITTER_FACTOR * this->fJitter + (DOUBLE)(1 + this->nGuard) * nFrames / this->nSamplesPerSec,
+		UDP_JITTER_MIN_MILLISEC / 1000.0), UDP_JITTER_MAX_MILLISEC / 1000.0);
+
+	// Move the playout point gradually, the drift tracking of the ring buffer absorbs the change
+	this->fOffset += (this->fMinTransit + this->fTarget - this->fOffset) / 64.0;
+
+	// Ran dry and this one is overdue already, the sender paused or transit grew: start over from here
+	if (this->nHeld == 1 && fTransit > this->fOffset + this->fTarget)
+	{
+		this->fMinTransit = fTransit;
+		this->fOffset = fTransit + this->fTarget;
+	}
+
+	return ERROR_SUCCESS;
+}
+
+UINT32 JitterBuffer::Pop(DOUBLE fNow, BYTE** pPayload, UINT32* pBytes)
+{
+	while (this->nHeld > 0 && fNow >= this->GetDeadline())
+	{
+		JITTERSLOT* pSlot = &this->pSlot[this->nNext & (UDP_JITTER_SLOTS - 1)];
+
+		if (pSlot->bFilled)
+		{
+			pSlot->bFilled = FALSE;
+			this->nHeld--;
+			this->nNext++;
+			this->nNextTimestamp = pSlot->nTimestamp + pSlot->nFrames;
+
+			*pPayload = pSlot->pPayload;
+			*pBytes = pSlot->nBytes;
+			return pSlot->nFrames;
+		}
+
+		// Missing at its turn, spread the frames up to the next datagram held over the datagrams missing
+		UINT32 nMissing = 1;
+		while (!this->pSlot[(this->nNext + nMissing) & (UDP_JITTER_SLOTS - 1)].bFilled) nMissing++;
+
+		JITTERSLOT* pHeld = &this->pSlot[(this->nNext + nMissing) & (UDP_JITTER_SLOTS - 1)];
+		UINT32 nFrames = (pHeld->nTimestamp > this->nNextTimestamp) ? (UINT32)((pHeld->nTimestamp - this->nNextTimestamp) / nMissing) : 0;
+
+		this->nLost++;
+		this->nNext++;
+		this->nNextTimestamp += nFrames;
+
+		if (nFrames > 0)
+		{
+			*pPayload = NULL;
+			*pBytes = 0;
+			return nFrames;
+		}
+	}
+
+	return 0;
+}
+
+DOUBLE JitterBuffer::GetDeadline()
+{
+	if (this->nHeld == 0) return DBL_MAX;
+
+	return (DOUBLE)this->nNextTimestamp / this->nSamplesPerSec + this->fOffset;
+}
+
+DOUBLE JitterBuffer::GetJitter()
+{
+	return this->fJitter;
+}
+
+DOUBLE JitterBuffer::GetTargetDelay()
+{
+	return this->fTarget;
+}
+
+UINT64 JitterBuffer::GetPacketsLate()
+{
+	return this->nLate;
+}
+
+UINT64 JitterBuffer::GetPacketsLost()
+{
+	return this->nLost;
+}
+
+DOUBLE JitterBuffer::GetTime()
+{
+	static LARGE_INTEGER tFrequency = {};
+	LARGE_INTEGER tCounter;
+
+	if (tFrequency.QuadPart == 0) QueryPerformanceFrequency(&tFrequency);
+	QueryPerformanceCounter(&tCounter);
+
+	return (DOUBLE)tCounter.QuadPart / tFrequency.QuadPart;
+}
+
+void JitterBuffer::Resync(UINT32 nSequence, UINT64 nTimestamp, DOUBLE fTransit)
+{
+	for (UINT32 i = 0; i < UDP_JITTER_SLOTS; i++)
+		this->pSlot[i].bFilled = FALSE;
+
+	this->nHeld = 0;
+	this->nNext = nSequence;
+	this->nNextTimestamp = nTimestamp;
+	this->fTransit = fTransit;
+	this->fMinTransit = fTransit;
+	this->fOffset = fTransit + this->fTarget;
+	this->bSynced = TRUE;
+}
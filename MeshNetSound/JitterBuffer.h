@@ -0,0 +1,117 @@
+#pragma once
+#include <windows.h>
+#include "config.h"
+
+/// <summary>
+/// <para>Datagram held by a JitterBuffer until its playout time.</para>
+/// </summary>
+typedef struct JitterSlot {
+	BYTE				* pPayload;			// UDP_PACKET_BYTES of the slab
+	UINT64				nTimestamp;			// Sample timestamp of the first frame
+	UINT32				nSequence;
+	UINT32				nFrames;
+	UINT32				nBytes;				// Bytes of the payload held
+	BOOL				bFilled;
+} JITTERSLOT;
+
+/// <summary>
+/// <para>Adaptive playout buffer of the datagrams of one WASAN stream.</para>
+/// <para>Datagrams are held in UDP_JITTER_SLOTS slots indexed by sequence number, which reorders them,
+/// and each is played out once the local clock passes its sample timestamp plus a playout offset.
+/// The offset follows the fastest transit time seen plus a target delay of UDP_JITTER_FACTOR times
+/// the inter-arrival jitter, estimated as in RFC 3550, bounded by UDP_JITTER_MIN_MILLISEC and UDP_JITTER_MAX_MILLISEC.</para>
+/// <para>Datagrams arriving after their turn count as late, those still missing at their turn as lost.</para>
+/// <para>Note: not thread-safe, the receive thread both inserts and plays out.</para>
+/// </summary>
+class JitterBuffer
+{
+	public:
+		/// <summary>
+		/// <para>Allocates the slots of a stream.</para>
+		/// <para>Note: on allocation failure JitterBuffer::Insert() fails.</para>
+		/// </summary>
+		/// <param name="nSamplesPerSec">- sample rate of the stream's timestamps.</param>
+		/// <param name="nGuard">- datagrams of delay held on top of the jitter, for rebuilt ones to still make their turn.</param>
+		JitterBuffer(DWORD nSamplesPerSec, UINT32 nGuard);
+
+		~JitterBuffer();
+
+		/// <summary>
+		/// <para>Copies a datagram's payload into the slot of its sequence number.</para>
+		/// </summary>
+		/// <param name="nSequence">- sequence number of the datagram.</param>
+		/// <param name="nTimestamp">- sample timestamp of its first frame.</param>
+		/// <param name="pPayload">- datagram or payload to hold.</param>
+		/// <param name="nFrames">- number of frames it carries.</param>
+		/// <param name="nBytes">- size of the payload, at most UDP_PACKET_BYTES.</param>
+		/// <param name="fArrival">- local time of arrival from JitterBuffer::GetTime().</param>
+		/// <returns>ERROR_SUCCESS, ERROR_INVALID_DATA if late or duplicate, or ENOMEM.</returns>
+		HRESULT Insert(UINT32 nSequence, UINT64 nTimestamp, const BYTE* pPayload, UINT32 nFrames, UINT32 nBytes, DOUBLE fArrival);
+
+		/// <summary>
+		/// <para>Takes the next datagram whose playout time has come.</para>
+		/// <para>A datagram missing at its turn is skipped as lost, if a later one is already held.</para>
+		/// </summary>
+		/// <param name="fNow">- local time from JitterBuffer::GetTime().</param>
+		/// <param name="pPayload">- set to what JitterBuffer::Insert() held of the datagram, valid until the next
+		/// JitterBuffer::Insert(), or to NULL for a lost datagram.</param>
+		/// <param name="pBytes">- set to the size of what was held.</param>
+		/// <returns>Number of frames of the datagram, estimated for a lost one, 0 if none is due.</returns>
+		UINT32 Pop(DOUBLE fNow, BYTE** pPayload, UINT32* pBytes);
+
+		/// <summary>
+		/// <para>Gets the playout time of the next datagram.</para>
+		/// </summary>
+		/// <returns>Local time in seconds, or DBL_MAX if nothing is held.</returns>
+		DOUBLE GetDeadline();
+
+		/// <summary>
+		/// <para>Gets the smoothed inter-arrival jitter.</para>
+		/// </summary>
+		/// <returns>Jitter in seconds.</returns>
+		DOUBLE GetJitter();
+
+		/// <summary>
+		/// <para>Gets the delay datagrams are currently held for on top of the fastest transit.</para>
+		/// </summary>
+		/// <returns>Target delay in seconds.</returns>
+		DOUBLE GetTargetDelay();
+
+		UINT64 GetPacketsLate();
+
+		UINT64 GetPacketsLost();
+
+		/// <summary>
+		/// <para>Reads the high-resolution local clock.</para>
+		/// </summary>
+		/// <returns>Time in seconds.</returns>
+		static DOUBLE GetTime();
+
+	private:
+		/// <summary>
+		/// <para>Drops everything held and starts over at a datagram, after the sender restarted or jumped ahead.</para>
+		/// </summary>
+		/// <param name="nSequence">- sequence number of the datagram.</param>
+		/// <param name="nTimestamp">- sample timestamp of its first frame.</param>
+		/// <param name="fTransit">- its transit time.</param>
+		void Resync(UINT32 nSequence, UINT64 nTimestamp, DOUBLE fTransit);
+
+		BYTE				* pSlab				{ NULL };	// UDP_JITTER_SLOTS payloads of UDP_PACKET_BYTES
+		JITTERSLOT			pSlot[UDP_JITTER_SLOTS];
+		DWORD				nSamplesPerSec		{ 0 };
+		UINT32				nGuard				{ 0 };
+
+		BOOL				bSynced				{ FALSE };	// A datagram was inserted, the fields below are valid
+		UINT32				nNext				{ 0 },		// Sequence number of the next datagram to play out
+							nHeld				{ 0 };		// Slots filled
+		UINT64				nNextTimestamp		{ 0 };		// Sample timestamp the next datagram starts at
+
+		DOUBLE				fOffset				{ 0 },		// Playout time less the sample timestamp in seconds
+							fTransit			{ 0 },		// Transit time of the last datagram, arrival less timestamp
+							fMinTransit			{ 0 },		// Fastest transit, slowly forgotten to follow clock drift
+							fJitter				{ 0 },
+							fTarget				{ UDP_JITTER_MIN_MILLISEC / 1000.0 };
+
+		UINT64				nLate				{ 0 },
+							nLost				{ 0 };
+};
@@ -0,0 +1,187 @@
+#include "PacketConcealer.h"
+#include <cmath>
+
+PacketConcealer::PacketConcealer(UINT32 nChannels, DWORD nSamplesPerSec)
+{
+	this->nChannels = nChannels;
+	this->nMinPeriod = max(nSamplesPerSec / UDP_PLC_MAX_PITCH_HZ, (DWORD)1);
+	this->nMaxPeriod = max(nSamplesPerSec / UDP_PLC_MIN_PITCH_HZ, this->nMinPeriod);
+	this->nWindow = max(this->nMaxPeriod / 2, (UINT32)1);
+	this->nOverlap = max(nSamplesPerSec * UDP_PLC_OVERLAP_MILLISEC / 1000, (DWORD)1);
+	this->nHold = nSamplesPerSec * UDP_PLC_HOLD_MILLISEC / 1000;
+	this->nFade = max(nSamplesPerSec * UDP_PLC_FADE_MILLISEC / 1000, (DWORD)1);
+
+	// Longest period, the cross-fade leading into it and the window compared against it
+	UINT32 nFrames = RINGBUFFER_CACHE_LINE;
+	while (nFrames < this->nMaxPeriod + this->nWindow + this->nOverlap) nFrames <<= 1;
+
+	this->pHistory = (nChannels > 0) ? (FLOAT*)_aligned_malloc((SIZE_T)nFrames * nChannels * sizeof(FLOAT), RINGBUFFER_CACHE_LINE) : NULL;
+	this->pMono = (FLOAT*)malloc((SIZE_T)(this->nMaxPeriod + this->nWindow) * sizeof(FLOAT));
+	this->pContinuation = (FLOAT*)malloc((SIZE_T)max(nChannels, (UINT32)1) * sizeof(FLOAT));
+	this->nMask = nFrames - 1;
+
+	if (this->pMono == NULL || this->pContinuation == NULL)
+	{
+		_aligned_free(this->pHistory);
+		this->pHistory = NULL;
+	}
+}
+
+PacketConcealer::~PacketConcealer()
+{
+	_aligned_free(this->pHistory);
+	free(this->pMono);
+	free(this->pContinuation);
+}
+
+UINT32 PacketConcealer::Resume(FLOAT* pFrames, UINT32 nFrames)
+{
+	UINT32 nFaded = 0;
+
+	if (this->pHistory == NULL) return 0;
+
+	// Fade the received audio in over the concealment's continuation
+	if (this->bConcealing)
+	{
+		nFaded = min(nFrames, this->nOverlap);
+		for (UINT32 j = 0; j < nFaded; j++)
+		{
+			FLOAT fIn = (FLOAT)(j + 1) / (nFaded + 1);
+
+			this->Synthesize(this->pContinuation);
+			for (UINT32 i = 0; i < this->nChannels; i++)
+				pFrames[j * this->nChannels + i] = fIn * pFrames[j * this->nChannels + i] + (1.0f - fIn) * this->pContinuation[i];
+		}
+
+		this->bConcealing = FALSE;
+	}
+
+	// Only the end of a long packet stays in the history
+	UINT32 nSkip = (nFrames > this->nMask + 1) ? nFrames - (this->nMask + 1) : 0;
+	for (UINT32 j = nSkip; j < nFrames; j++)
+		memcpy(this->GetFrame(this->nWritten + j), pFrames + (SIZE_T)j * this->nChannels, this->nChannels * sizeof(FLOAT));
+
+	this->nWritten += nFrames;
+
+	return nFaded;
+}
+
+void PacketConcealer::Conceal(FLOAT* pFrames, UINT32 nFrames)
+{
+	if (this->pHistory == NULL)
+	{
+		memset(pFrames, 0, (SIZE_T)nFrames * this->nChannels * sizeof(FLOAT));
+		return;
+	}
+
+	// Loss starts, pick the period to repeat once for the whole burst
+	if (!this->bConcealing)
+	{
+		this->nPeriod = this->FindPeriod();
+		this->nBlend = min(this->nOverlap, this->nPeriod / 2);
+		this->nSegment = this->nWritten - this->nPeriod;
+		this->nPhase = 0;
+		this->nConcealed = 0;
+		this->bConcealing = TRUE;
+	}
+
+	for (UINT32 j = 0; j < nFrames; j++)
+		this->Synthesize(pFrames + (SIZE_T)j * this->nChannels);
+
+	this->nTotal += nFrames;
+}
+
+UINT64 PacketConcealer::GetFramesConcealed()
+{
+	return this->nTotal;
+}
+
+UINT32 PacketConcealer::FindPeriod()
+{
+	// Repetitions cross-fade into the frames leading into the period, those must be in the history too
+	if (this->nWritten < this->nMinPeriod + this->nOverlap + this->nWindow) return 0;
+
+	UINT32 nLags = (UINT32)min((UINT64)this->nMaxPeriod, this->nWritten - this->nOverlap - this->nWindow);
+	UINT32 nMono = nLags + this->nWindow;
+	UINT64 nFirst = this->nWritten - nMono;
+
+	// Search on the channel sum, all channels repeat with the same period
+	for (UINT32 j = 0; j < nMono; j++)
+	{
+		FLOAT* pFrame = this->GetFrame(nFirst + j);
+		this->pMono[j] = 0.0f;
+		for (UINT32 i = 0; i < this->nChannels; i++)
+			this->pMono[j] += pFrame[i];
+	}
+
+	// Window at the end of the history against the window a lag before it
+	const FLOAT* pEnd = this->pMono + nLags;
+	DOUBLE fEnergy = 0.0, fBestScore = 0.0;
+	UINT32 nBest = nLags;
+
+	for (UINT32 k = 0; k < this->nWindow; k++)
+		fEnergy += (DOUBLE)pEnd[(INT32)k - (INT32)this->nMinPeriod] * pEnd[(INT32)k - (INT32)this->nMinPeriod];
+
+	for (UINT32 nLag = this->nMinPeriod; nLag <= nLags; nLag++)
+	{
+		const FLOAT* pLagged = pEnd - nLag;
+		DOUBLE fCorrelation = 0.0;
+
+		for (UINT32 k = 0; k < this->nWindow; k++)
+			fCorrelation += (DOUBLE)pEnd[k] * pLagged[k];
+
+		// Normalized by the lagged window only, the end window is the same for every lag
+		if (fCorrelation > 0.0 && fEnergy > 0.0 && fCorrelation * fCorrelation / fEnergy > fBestScore)
+		{
+			fBestScore = fCorrelation * fCorrelation / fEnergy;
+			nBest = nLag;
+		}
+
+		// Slide the lagged window's energy by a frame
+		if (nLag < nLags)
+			fEnergy += (DOUBLE)pLagged[-1] * pLagged[-1] - (DOUBLE)pLagged[this->nWindow - 1] * pLagged[this->nWindow - 1];
+	}
+
+	return nBest;
+}
+
+void PacketConcealer::Synthesize(FLOAT* pFrame)
+{
+	// Full level, then a linear fade to silence
+	FLOAT fGain = (this->nConcealed < this->nHold) ? 1.0f :
+		(this->nConcealed < this->nHold + this->nFade) ? 1.0f - (FLOAT)(this->nConcealed - this->nHold) / this->nFade : 0.0f;
+
+	if (this->nPeriod == 0 || fGain == 0.0f)
+	{
+		memset(pFrame, 0, this->nChannels * sizeof(FLOAT));
+	}
+	else
+	{
+		const FLOAT* pCurrent = this->GetFrame(this->nSegment + this->nPhase);
+		UINT32 nTail = this->nPeriod - this->nBlend;
+
+		// Tail of the repetition fades into the frames that led into the period, so the next repetition continues them
+		if (this->nPhase >= nTail)
+		{
+			const FLOAT* pLead = this->GetFrame(this->nSegment - this->nBlend + (this->nPhase - nTail));
+			FLOAT fLead = (FLOAT)(this->nPhase - nTail + 1) / (this->nBlend + 1);
+
+			for (UINT32 i = 0; i < this->nChannels; i++)
+				pFrame[i] = fGain * ((1.0f - fLead) * pCurrent[i] + fLead * pLead[i]);
+		}
+		else
+		{
+			for (UINT32 i = 0; i < this->nChannels; i++)
+				pFrame[i] = fGain * pCurrent[i];
+		}
+
+		this->nPhase = (this->nPhase + 1 == this->nPeriod) ? 0 : this->nPhase + 1;
+	}
+
+	this->nConcealed++;
+}
+
+FLOAT* PacketConcealer::GetFrame(UINT64 nFrame)
+{
+	return this->pHistory + (SIZE_T)(nFrame & this->nMask) * this->nChannels;
+}
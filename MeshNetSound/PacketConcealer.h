@@ -0,0 +1,92 @@
+#pragma once
+#include <windows.h>
+#include "config.h"
+
+/// <summary>
+/// <para>Fills the gaps lost datagrams leave in a WASAN stream by waveform repetition.</para>
+/// <para>Keeps the most recent audio received, and on a loss repeats its last pitch period,
+/// found by normalized autocorrelation once per burst, cross-fading the tail of each repetition
+/// into the audio leading into the period so the repetitions join without clicks.
+/// Bursts longer than UDP_PLC_HOLD_MILLISEC fade out over UDP_PLC_FADE_MILLISEC into silence,
+/// and the first datagram received afterwards is cross-faded in from the concealment.</para>
+/// <para>Per concealed frame the cost is a few multiply-adds per channel, the period search
+/// is bounded by the pitch range and runs only when a burst starts.</para>
+/// <para>Note: not thread-safe, the receive thread both feeds and conceals.</para>
+/// </summary>
+class PacketConcealer
+{
+	public:
+		/// <summary>
+		/// <para>Allocates the history of a stream.</para>
+		/// <para>Note: on allocation failure PacketConcealer::Conceal() produces silence.</para>
+		/// </summary>
+		/// <param name="nChannels">- number of samples in a frame.</param>
+		/// <param name="nSamplesPerSec">- sample rate of the stream.</param>
+		PacketConcealer(UINT32 nChannels, DWORD nSamplesPerSec);
+
+		~PacketConcealer();
+
+		/// <summary>
+		/// <para>Takes frames received into the history, cross-fading their beginning from the concealment
+		/// in place if they end a loss.</para>
+		/// </summary>
+		/// <param name="pFrames">- interleaved float frames.</param>
+		/// <param name="nFrames">- number of frames.</param>
+		/// <returns>Number of leading frames changed.</returns>
+		UINT32 Resume(FLOAT* pFrames, UINT32 nFrames);
+
+		/// <summary>
+		/// <para>Produces frames in place of lost ones, continuing a concealment already underway.</para>
+		/// </summary>
+		/// <param name="pFrames">- interleaved float frames to fill.</param>
+		/// <param name="nFrames">- number of frames.</param>
+		void Conceal(FLOAT* pFrames, UINT32 nFrames);
+
+		/// <summary>
+		/// <para>Gets the number of frames produced by PacketConcealer::Conceal() so far.</para>
+		/// </summary>
+		/// <returns>Number of frames.</returns>
+		UINT64 GetFramesConcealed();
+
+	private:
+		/// <summary>
+		/// <para>Finds the lag, within the pitch range, the end of the history best repeats at.</para>
+		/// </summary>
+		/// <returns>Period in frames, 0 if the history is too short to repeat.</returns>
+		UINT32 FindPeriod();
+
+		/// <summary>
+		/// <para>Writes the next frame of the concealment, advancing the repetition and the fade-out.</para>
+		/// </summary>
+		/// <param name="pFrame">- frame of nChannels samples to fill.</param>
+		void Synthesize(FLOAT* pFrame);
+
+		/// <summary>
+		/// <para>Gets a frame of the history by its absolute index.</para>
+		/// </summary>
+		/// <param name="nFrame">- number of frames received before it.</param>
+		/// <returns>Pointer to its first sample.</returns>
+		FLOAT* GetFrame(UINT64 nFrame);
+
+		FLOAT				* pHistory			{ NULL };	// Interleaved frames received last, power of two
+		FLOAT				* pMono				{ NULL };	// Channel sum of the end of the history for the period search
+		FLOAT				* pContinuation		{ NULL };	// Frame of the concealment faded out on resume
+		UINT32				nChannels			{ 0 },
+							nMask				{ 0 },		// Frames in the history less 1
+							nMinPeriod			{ 0 },
+							nMaxPeriod			{ 0 },
+							nWindow				{ 0 },		// Frames compared by the period search
+							nOverlap			{ 0 },		// Frames of each cross-fade
+							nHold				{ 0 },		// Frames concealed at full level
+							nFade				{ 0 };		// Frames the level then fades to silence over
+		UINT64				nWritten			{ 0 };		// Frames received in total
+
+		// Concealment underway
+		BOOL				bConcealing			{ FALSE };
+		UINT64				nSegment			{ 0 };		// Index of the first frame of the repeated period
+		UINT32				nPeriod				{ 0 },		// Frames repeated, 0 for silence
+							nBlend				{ 0 },		// Frames of the cross-fade between repetitions
+							nPhase				{ 0 },		// Position within the period
+							nConcealed			{ 0 };		// Frames produced in this burst
+		UINT64				nTotal				{ 0 };
+};
@@ -0,0 +1,140 @@
+#include "PacketParity.h"
+#include "UDPAudioBuffer.h"
+
+static_assert((UDP_FEC_HISTORY & (UDP_FEC_HISTORY - 1)) == 0 && UDP_FEC_HISTORY >= UDP_FEC_GROUP,
+	"UDP_FEC_HISTORY must be a power of two holding a whole group");
+
+PacketParity::PacketParity()
+{
+	this->pSlab = (BYTE*)_aligned_malloc((SIZE_T)(UDP_FEC_HISTORY + 1) * UDP_PACKET_BYTES, RINGBUFFER_CACHE_LINE);
+
+	for (UINT32 i = 0; i < UDP_FEC_HISTORY; i++)
+	{
+		this->pSlot[i] = {};
+		this->pSlot[i].pPacket = (this->pSlab != NULL) ? this->pSlab + (SIZE_T)(i + 1) * UDP_PACKET_BYTES : NULL;
+	}
+}
+
+PacketParity::~PacketParity()
+{
+	_aligned_free(this->pSlab);
+}
+
+UINT32 PacketParity::Protect(const UDPAUDIOHEADER* pHeader, UINT32 nBytes, const BYTE** pParity)
+{
+	UDPAUDIOHEADER* pOuter = (UDPAUDIOHEADER*)this->pSlab;
+	UDPPARITYHEADER* pXor = (UDPPARITYHEADER*)(pOuter + 1);
+	BYTE* pPayload = (BYTE*)(pXor + 1);
+	UINT32 nPayload = nBytes - sizeof(UDPAUDIOHEADER);
+
+	if (this->pSlab == NULL || nBytes + sizeof(UDPPARITYHEADER) > UDP_PACKET_BYTES) return 0;
+
+	// First of a group, the parity takes its stream fields and starts from zero
+	if (this->nCount == 0)
+	{
+		memset(this->pSlab, 0, UDP_PACKET_BYTES);
+		*pOuter = *pHeader;
+		pOuter->nCodec = UDPCODEC_PARITY;
+		this->nLongest = 0;
+	}
+
+	pXor->nTimestamp ^= pHeader->nTimestamp;
+	pXor->nFrames ^= pHeader->nFrames;
+	pXor->nBytes ^= (UINT16)nPayload;
+	pXor->nCodec ^= pHeader->nCodec;
+
+	const BYTE* pSource = (const BYTE*)(pHeader + 1);
+	for (UINT32 i = 0; i < nPayload; i++)
+		pPayload[i] ^= pSource[i];
+
+	this->nLongest = max(this->nLongest, nPayload);
+
+	if (++this->nCount < UDP_FEC_GROUP) return 0;
+
+	pOuter->nFrames = (UINT16)this->nCount;
+	this->nCount = 0;
+
+	*pParity = this->pSlab;
+	return sizeof(UDPAUDIOHEADER) + sizeof(UDPPARITYHEADER) + this->nLongest;
+}
+
+void PacketParity::Keep(const UDPAUDIOHEADER* pHeader, UINT32 nBytes)
+{
+	if (this->pSlab == NULL || nBytes > UDP_PACKET_BYTES) return;
+
+	PARITYSLOT* pSlot = &this->pSlot[pHeader->nSequence & (UDP_FEC_HISTORY - 1)];
+
+	memcpy(pSlot->pPacket, pHeader, nBytes);
+	pSlot->nSequence = pHeader->nSequence;
+	pSlot->nBytes = nBytes;
+}
+
+UINT32 PacketParity::Recover(const UDPAUDIOHEADER* pHeader, UINT32 nBytes, const BYTE** pPacket)
+{
+	const UDPPARITYHEADER* pXor = (const UDPPARITYHEADER*)(pHeader + 1);
+	const BYTE* pParity = (const BYTE*)(pXor + 1);
+	UINT32 nParity = nBytes - sizeof(UDPAUDIOHEADER) - sizeof(UDPPARITYHEADER);
+	UINT32 nMissing = MAXUINT32;
+
+	if (this->pSlab == NULL || nBytes < sizeof(UDPAUDIOHEADER) + sizeof(UDPPARITYHEADER) || pHeader->nFrames > UDP_FEC_HISTORY) return 0;
+
+	// XOR gives back one datagram of the group, none is missing or the rest is not here yet
+	for (UINT32 k = 0; k < pHeader->nFrames; k++)
+	{
+		const PARITYSLOT* pSlot = &this->pSlot[(pHeader->nSequence + k) & (UDP_FEC_HISTORY - 1)];
+
+		if (pSlot->nBytes > 0 && pSlot->nSequence == pHeader->nSequence + k) continue;
+		if (nMissing != MAXUINT32) return 0;
+
+		nMissing = k;
+	}
+
+	if (nMissing == MAXUINT32) return 0;
+
+	// Parity carries the XOR of the group, XOR the datagrams present out of it
+	UDPPARITYHEADER tXor = *pXor;
+	for (UINT32 k = 0; k < pHeader->nFrames; k++)
+	{
+		if (k == nMissing) continue;
+
+		const PARITYSLOT* pKept = &this->pSlot[(pHeader->nSequence + k) & (UDP_FEC_HISTORY - 1)];
+		const UDPAUDIOHEADER* pKeptHeader = (const UDPAUDIOHEADER*)pKept->pPacket;
+
+		tXor.nTimestamp ^= pKeptHeader->nTimestamp;
+		tXor.nFrames ^= pKeptHeader->nFrames;
+		tXor.nBytes ^= (UINT16)(pKept->nBytes - sizeof(UDPAUDIOHEADER));
+		tXor.nCodec ^= pKeptHeader->nCodec;
+	}
+
+	if (tXor.nBytes > nParity || sizeof(UDPAUDIOHEADER) + tXor.nBytes > UDP_PACKET_BYTES) return 0;
+
+	// Rebuilt in the slot it would have been kept in
+	PARITYSLOT* pSlot = &this->pSlot[(pHeader->nSequence + nMissing) & (UDP_FEC_HISTORY - 1)];
+	UDPAUDIOHEADER* pRebuilt = (UDPAUDIOHEADER*)pSlot->pPacket;
+	BYTE* pPayload = (BYTE*)(pRebuilt + 1);
+
+	*pRebuilt = *pHeader;
+	pRebuilt->nCodec = tXor.nCodec;
+	pRebuilt->nFrames = tXor.nFrames;
+	pRebuilt->nSequence = pHeader->nSequence + nMissing;
+	pRebuilt->nTimestamp = tXor.nTimestamp;
+
+	memcpy(pPayload, pParity, tXor.nBytes);
+	for (UINT32 k = 0; k < pHeader->nFrames; k++)
+	{
+		if (k == nMissing) continue;
+
+		const PARITYSLOT* pKept = &this->pSlot[(pHeader->nSequence + k) & (UDP_FEC_HISTORY - 1)];
+		const BYTE* pSource = pKept->pPacket + sizeof(UDPAUDIOHEADER);
+		UINT32 nSource = min(pKept->nBytes - (UINT32)sizeof(UDPAUDIOHEADER), (UINT32)tXor.nBytes);
+
+		for (UINT32 i = 0; i < nSource; i++)
+			pPayload[i] ^= pSource[i];
+	}
+
+	pSlot->nSequence = pRebuilt->nSequence;
+	pSlot->nBytes = sizeof(UDPAUDIOHEADER) + tXor.nBytes;
+
+	*pPacket = pSlot->pPacket;
+	return pSlot->nBytes;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <windows.h>
+#include "config.h"
+
+struct UDPAudioHeader;
+
+/// <summary>
+/// <para>Datagram kept by a receiving PacketParity to rebuild the others of its group from.</para>
+/// </summary>
+typedef struct ParitySlot {
+	BYTE				* pPacket;			// UDP_PACKET_BYTES of the slab
+	UINT32				nSequence;
+	UINT32				nBytes;				// Size of the datagram, 0 if the slot is empty
+} PARITYSLOT;
+
+/// <summary>
+/// <para>Forward error correction of a WASAN stream by XOR parity over groups of datagrams.</para>
+/// <para>The sender XORs every UDP_FEC_GROUP consecutive datagrams, their varying header fields and their payloads
+/// zero-padded to the longest, into one parity datagram sent after the group. The receiver keeps the last
+/// UDP_FEC_HISTORY datagrams, and when a parity datagram finds exactly one of its group missing, XORs the others
+/// out of it to get the missing one back whole, so it can still meet its playout time in the jitter buffer.</para>
+/// <para>Costs 1/UDP_FEC_GROUP of the bandwidth and a group of playout delay, recovers any single loss per group.</para>
+/// <para>Note: not thread-safe, the sending or the receiving thread of a stream owns its PacketParity.</para>
+/// </summary>
+class PacketParity
+{
+	public:
+		/// <summary>
+		/// <para>Allocates the parity datagram and the history of a stream.</para>
+		/// <para>Note: on allocation failure nothing is protected or rebuilt.</para>
+		/// </summary>
+		PacketParity();
+
+		~PacketParity();
+
+		/// <summary>
+		/// <para>Adds a datagram about to be sent to the parity of its group.</para>
+		/// </summary>
+		/// <param name="pHeader">- datagram, its payload following the header.</param>
+		/// <param name="nBytes">- size of the datagram, at most UDP_PACKET_BYTES less a UDPPARITYHEADER.</param>
+		/// <param name="pParity">- set to the parity datagram once the group is complete, valid until the next call.</param>
+		/// <returns>Size of the parity datagram to send after this one, 0 while the group is incomplete.</returns>
+		UINT32 Protect(const UDPAudioHeader* pHeader, UINT32 nBytes, const BYTE** pParity);
+
+		/// <summary>
+		/// <para>Keeps a received datagram to rebuild others of its group from.</para>
+		/// </summary>
+		/// <param name="pHeader">- datagram, its payload following the header.</param>
+		/// <param name="nBytes">- size of the datagram.</param>
+		void Keep(const UDPAudioHeader* pHeader, UINT32 nBytes);
+
+		/// <summary>
+		/// <para>Rebuilds the one datagram of a parity datagram's group that did not arrive.</para>
+		/// </summary>
+		/// <param name="pHeader">- parity datagram.</param>
+		/// <param name="nBytes">- size of the parity datagram.</param>
+		/// <param name="pPacket">- set to the rebuilt datagram, valid until the next call, to validate as if received.</param>
+		/// <returns>Size of the rebuilt datagram, 0 if none or more than one of the group is missing.</returns>
+		UINT32 Recover(const UDPAudioHeader* pHeader, UINT32 nBytes, const BYTE** pPacket);
+
+	private:
+		BYTE				* pSlab				{ NULL };	// Parity datagram, then UDP_FEC_HISTORY kept ones
+		PARITYSLOT			pSlot[UDP_FEC_HISTORY];
+		UINT32				nCount				{ 0 },		// Datagrams of the group added so far by the sender
+							nLongest			{ 0 };		// Longest payload among them
+};
@@ -66,7 +66,7 @@ class PitchShifter : public AudioEffect
 
             float* processBuffer = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetBufferPointer();
             int bufferSize = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetBufferSize();
-            int offset = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetReadOffset();
+            int offset = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetReadOffset(this);
             float* outputBuffer = pContext->fOutputBuffer;
 
             int delayBufferWritePosition = ((FLANGERCONTEXT*)pContext->pRingBufferChannelEffectContext)->delayBufferWritePosition;
@@ -104,7 +104,7 @@ class PitchShifter : public AudioEffect
         {
             float* buffer = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetBufferPointer();
             int bufferSize = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetBufferSize();
-            int offset = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetReadOffset();
+            int offset = ((RingBufferChannel*)pContext->pRingBufferChannel)->GetReadOffset(this);
             float* delayBuffer = ((FLANGERCONTEXT*)pContext->pRingBufferChannelEffectContext)->delayBuffer;
             int delayBufferWritePosition = ((FLANGERCONTEXT*)pContext->pRingBufferChannelEffectContext)->delayBufferWritePosition;
 
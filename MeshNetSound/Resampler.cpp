@@ -1,6 +1,6 @@
 /*
     TODO:
-        I.------convert code to fixed-point arithmetic for performance gain and control.
+        I.------convert interpolating SRC to fixed-point arithmetic as well, polyphase SRC already has it.
         II.-----update Resampler::Resample() to start from smallest coefficients in both wings to
                 increase precision of the floating point numbers.
         III.----optimize Resampler::Resample() to skip interpolation of samples for which original data
@@ -41,10 +41,15 @@
  */
 
 RESAMPLERPARAMS	Resampler::tResamplerParams;
+RESAMPLERKERNEL	Resampler::tKernel;
 
 Resampler::Resampler(){}
 
-Resampler::~Resampler(){}
+Resampler::~Resampler()
+{
+    this->FreeStream();
+    this->FreePolyphase();
+}
 
 DOUBLE Resampler::Izero(DOUBLE x)
 {
@@ -67,6 +72,9 @@ DOUBLE Resampler::Izero(DOUBLE x)
 
 void Resampler::InitLPFilter(BOOL bHighQuality, DOUBLE fRollOff, DOUBLE fBeta, UINT32 nTwosExp)
 {
+    // Dispatch decided once per process, all Resampler instances share the kernels
+    tKernel = SelectResamplerKernel();
+
     tResamplerParams.bHighQuality = bHighQuality;
     tResamplerParams.nNz = bHighQuality ? RESAMPLER_N_QUALITY_H : RESAMPLER_N_QUALITY_L;
     tResamplerParams.fRollOff = fRollOff;
@@ -109,12 +117,500 @@ void Resampler::InitLPFilter(BOOL bHighQuality, DOUBLE fRollOff, DOUBLE fBeta, U
 
     // Last coefficient not interpolated
     tResamplerParams.pImpD[tResamplerParams.nNh - 1] = (FLOAT)(tResamplerParams.pImp[tResamplerParams.nNh - 1]);
+
+    // Q31 copy of the table for fixed-point SRC, deltas are taken after quantization
+    // so that integer interpolation hits table entries exactly
+    tResamplerParams.pImpQ = (INT32*)malloc(tResamplerParams.nNh * sizeof(INT32));
+    tResamplerParams.pImpDQ = (INT32*)malloc(tResamplerParams.nNh * sizeof(INT32));
+
+    for (UINT32 i = 0; i < tResamplerParams.nNh; i++)
+        tResamplerParams.pImpQ[i] = (INT32)floor((DOUBLE)tResamplerParams.pImp[i] * 2147483648.0 + 0.5);
+    
+    for (UINT32 i = 0; i < tResamplerParams.nNh - 1; i++)
+        tResamplerParams.pImpDQ[i] = tResamplerParams.pImpQ[i + 1] - tResamplerParams.pImpQ[i];
+
+    tResamplerParams.pImpDQ[tResamplerParams.nNh - 1] = tResamplerParams.pImpQ[tResamplerParams.nNh - 1];
 }
 
 void Resampler::FreeLPFilter()
 {
     free(tResamplerParams.pImp);
     free(tResamplerParams.pImpD);
+    free(tResamplerParams.pImpQ);
+    free(tResamplerParams.pImpDQ);
+}
+
+DOUBLE Resampler::LPValue(DOUBLE fDistance)
+{
+    DOUBLE fIndex = fDistance * tResamplerParams.nNl;
+    
+    // Outside of the tabulated wing the filter is truncated
+    if (fIndex >= tResamplerParams.nNh - 1) return 0;
+
+    UINT32 nIndex = (UINT32)fIndex;
+    return tResamplerParams.pImp[nIndex] + tResamplerParams.pImpD[nIndex] * (fIndex - nIndex);
+}
+
+INT32 Resampler::LPValueQ(UINT64 nNum, UINT64 nDen)
+{
+    // Table index and interpolation fraction as an exact quotient and remainder
+    UINT64 nIndex = nNum * tResamplerParams.nNl / nDen;
+    UINT64 nFrac = nNum * tResamplerParams.nNl % nDen;
+
+    if (nIndex >= tResamplerParams.nNh - 1) return 0;
+
+    return tResamplerParams.pImpQ[nIndex] + (INT32)((INT64)tResamplerParams.pImpDQ[nIndex] * (INT64)nFrac / (INT64)nDen);
+}
+
+HRESULT Resampler::InitPolyphase(DWORD nUpsample, DWORD nDownsample, UINT32 nChannels)
+{
+    // History layout depends on the bank, so it must be rebuilt with Resampler::InitStream()
+    this->FreeStream();
+    this->FreePolyphase();
+    this->tDrift = { 0 };
+
+    // No bank needed if the stream is not resampled
+    if (nUpsample == nDownsample) return ERROR_SUCCESS;
+
+    // Bank would grow too large for an irreducible ratio, let the interpolating SRC handle it
+    if (nUpsample > RESAMPLER_POLYPHASE_MAX_PHASES) return ERROR_NOT_SUPPORTED;
+
+    return this->BuildPolyphase(nUpsample, nDownsample, nChannels, nUpsample);
+}
+
+HRESULT Resampler::InitDrift(DWORD nUpsample, DWORD nDownsample, UINT32 nChannels)
+{
+    this->FreeStream();
+    this->FreePolyphase();
+    this->tDrift = { 0 };
+
+    if (nUpsample > RESAMPLER_POLYPHASE_MAX_PHASES) return ERROR_NOT_SUPPORTED;
+
+    // Same ratio over more phases, so that blending adjacent rows approximates off-grid instants well,
+    // also makes a bank for L = M since nominally equal rates still need SRC to follow the drift
+    DWORD nOversample = max((RESAMPLER_DRIFT_MIN_PHASES + nUpsample - 1) / nUpsample, 1);
+    nOversample = max(min(nOversample, RESAMPLER_POLYPHASE_MAX_PHASES / nUpsample), 1);
+
+    // Extra row past the last phase holds row 0 shifted by one input sample to blend towards
+    HRESULT hr = this->BuildPolyphase(nUpsample * nOversample, nDownsample * nOversample, nChannels, nUpsample * nOversample + 1);
+    if (hr != ERROR_SUCCESS) return hr;
+
+    this->tDrift.bTracking = TRUE;
+    this->SetDriftStep(0);
+
+    return ERROR_SUCCESS;
+}
+
+void Resampler::SetDriftTarget(UINT32 nFrames)
+{
+    this->tDrift.fTarget = nFrames;
+}
+
+void Resampler::UpdateDrift(UINT32 nFill, DOUBLE fElapsed)
+{
+    if (!this->tDrift.bTracking || fElapsed <= 0) return;
+
+    // Fill level jumps by a whole packet every time either side of the ring runs, average it out
+    if (!this->tDrift.bPrimed)
+        this->tDrift.fFill = nFill;
+    else
+        this->tDrift.fFill += (nFill - this->tDrift.fFill) * fElapsed / (RESAMPLER_DRIFT_AVERAGING_SEC + fElapsed);
+    this->tDrift.bPrimed = TRUE;
+
+    // Ring fill integrates the rate mismatch minus the correction, so the PI loop is of 2nd order:
+    // gains place its poles at the chosen bandwidth and damping, slow enough to make pitch changes inaudible
+    DOUBLE fOmega = 2.0 * M_PI * RESAMPLER_DRIFT_BANDWIDTH_HZ;
+    DOUBLE fKp = 2.0 * RESAMPLER_DRIFT_DAMPING * fOmega / AGGREGATOR_SAMPLE_FREQ;
+    DOUBLE fKi = fOmega * fOmega / AGGREGATOR_SAMPLE_FREQ;
+    DOUBLE fLimit = RESAMPLER_DRIFT_MAX_PPM * 1E-6;
+    DOUBLE fError = this->tDrift.fFill - this->tDrift.fTarget;
+
+    // Clamping the integral term prevents windup while the ring is still filling up at start
+    this->tDrift.fIntegral = min(max(this->tDrift.fIntegral + fKi * fError * fElapsed, -fLimit), fLimit);
+    this->tDrift.fCorrection = min(max(fKp * fError + this->tDrift.fIntegral, -fLimit), fLimit);
+
+    // Overfull ring needs a larger step through the input on either side:
+    // fewer frames written per captured frame, or more frames read per rendered frame
+    this->SetDriftStep(this->tDrift.fCorrection);
+}
+
+void Resampler::SetDriftStep(DOUBLE fCorrection)
+{
+    // Step per output frame in 1/2^32-ths of a phase, split into input frames, whole phases and a fraction
+    UINT64 nPhaseUnit = (UINT64)this->tPolyphase.nPhases << 32;
+    UINT64 nStepQ = (UINT64)floor(this->tPolyphase.nStep * 4294967296.0 * (1.0 + fCorrection) + 0.5);
+
+    this->tPolyphase.nStepInt = (UINT32)(nStepQ / nPhaseUnit);
+    this->tPolyphase.nStepFrac = (UINT32)((nStepQ % nPhaseUnit) >> 32);
+    this->tPolyphase.nStepSub = (UINT32)(nStepQ & 0xFFFFFFFF);
+}
+
+HRESULT Resampler::BuildPolyphase(DWORD nUpsample, DWORD nDownsample, UINT32 nChannels, UINT32 nRows)
+{
+    // When decimating, the filter is stretched by 1/factor to lower the cut-off below the new Nyquist
+    // and scaled by the factor to maintain unity gain
+    DOUBLE fScale = min(1.0, (DOUBLE)nUpsample / (DOUBLE)nDownsample);
+
+    this->tPolyphase.nPhases = nUpsample;
+    this->tPolyphase.nStep = nDownsample;
+    this->tPolyphase.nStepInt = nDownsample / nUpsample;
+    this->tPolyphase.nStepFrac = nDownsample % nUpsample;
+    this->tPolyphase.nHalfTaps = (UINT32)ceil(tResamplerParams.nNz / fScale);
+    this->tPolyphase.nTaps = 2 * this->tPolyphase.nHalfTaps;
+    this->tPolyphase.nChannels = nChannels;
+    this->tPolyphase.nRows = nRows;
+    this->tPolyphase.pBank = (FLOAT*)malloc((SIZE_T)nRows * this->tPolyphase.nTaps * sizeof(FLOAT));
+    this->tPolyphase.pAccumulator = (FLOAT*)malloc(nChannels * sizeof(FLOAT));
+    this->tPolyphase.pRow = malloc(this->tPolyphase.nTaps * sizeof(INT32));
+
+    if (this->tPolyphase.pBank == NULL || this->tPolyphase.pAccumulator == NULL || this->tPolyphase.pRow == NULL)
+    {
+        this->FreePolyphase();
+        return ENOMEM;
+    }
+
+    // Row p holds coefficients for the output instant p/L input periods past the input sample nInput,
+    // column j multiplies the input sample (nInput - nHalfTaps + 1 + j), ordered oldest to newest
+    for (UINT32 p = 0; p < nRows; p++)
+    {
+        DOUBLE fPhase = (DOUBLE)p / (DOUBLE)this->tPolyphase.nPhases;
+        FLOAT* H = this->tPolyphase.pBank + (SIZE_T)p * this->tPolyphase.nTaps;
+
+        for (UINT32 j = 0; j < this->tPolyphase.nTaps; j++)
+        {
+            DOUBLE fDistance = fabs((DOUBLE)((INT32)j - (INT32)this->tPolyphase.nHalfTaps + 1) - fPhase);
+            H[j] = (FLOAT)(LPValue(fDistance * fScale) * fScale);
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+void Resampler::FreePolyphase()
+{
+    free(this->tPolyphase.pBank);
+    free(this->tPolyphase.pAccumulator);
+    free(this->tPolyphase.pBankQ15);
+    free(this->tPolyphase.pBankQ31);
+    free(this->tPolyphase.pAccumulatorQ);
+    free(this->tPolyphase.pRow);
+    this->tPolyphase = { NULL };
+}
+
+HRESULT Resampler::InitFixedPoint(WORD wBitsPerSample, UINT32 nFramesMax)
+{
+    if (this->tPolyphase.pBank == NULL || (wBitsPerSample != 16 && wBitsPerSample != 32)) return ERROR_NOT_SUPPORTED;
+
+    UINT32 nPhases = this->tPolyphase.nPhases, nStep = this->tPolyphase.nStep, nTaps = this->tPolyphase.nTaps, nRows = this->tPolyphase.nRows;
+    
+    // Distance of tap j of row p from the filter center is |(j - nHalfTaps + 1)*L - p| / L input periods,
+    // scaled by L/M when decimating, which reduces to the same numerator over max(L, M)
+    UINT64 nDen = max(nPhases, nStep);
+
+    this->tPolyphase.pAccumulatorQ = (INT64*)malloc(this->tPolyphase.nChannels * sizeof(INT64));
+    if (wBitsPerSample == 16)
+        this->tPolyphase.pBankQ15 = (INT16*)malloc((SIZE_T)nRows * nTaps * sizeof(INT16));
+    else
+        this->tPolyphase.pBankQ31 = (INT32*)malloc((SIZE_T)nRows * nTaps * sizeof(INT32));
+
+    if (this->tPolyphase.pAccumulatorQ == NULL || (this->tPolyphase.pBankQ15 == NULL && this->tPolyphase.pBankQ31 == NULL))
+    {
+        free(this->tPolyphase.pAccumulatorQ);
+        free(this->tPolyphase.pBankQ15);
+        free(this->tPolyphase.pBankQ31);
+        this->tPolyphase.pAccumulatorQ = NULL;
+        this->tPolyphase.pBankQ15 = NULL;
+        this->tPolyphase.pBankQ31 = NULL;
+        return ENOMEM;
+    }
+
+    for (UINT32 p = 0; p < nRows; p++)
+    {
+        for (UINT32 j = 0; j < nTaps; j++)
+        {
+            INT64 nNum = ((INT64)j - (INT64)this->tPolyphase.nHalfTaps + 1) * nPhases - p;
+            INT64 nCoeff = LPValueQ((UINT64)(nNum < 0 ? -nNum : nNum), nDen);
+
+            // Unity gain when decimating
+            if (nPhases < nStep)
+                nCoeff = nCoeff * nPhases / nStep;
+
+            if (wBitsPerSample == 16)
+                this->tPolyphase.pBankQ15[(SIZE_T)p * nTaps + j] = (INT16)min(max((nCoeff + (1 << 15)) >> 16, (INT64)INT16_MIN), (INT64)INT16_MAX);
+            else
+                this->tPolyphase.pBankQ31[(SIZE_T)p * nTaps + j] = (INT32)nCoeff;
+        }
+    }
+
+    this->tPolyphase.wFixedBits = wBitsPerSample;
+
+    // Integer input must be staged for widening anyway, so fixed-point SRC always streams
+    if (!this->tStream.bStreaming)
+        return this->InitStream(nFramesMax);
+
+    return ERROR_SUCCESS;
+}
+
+HRESULT Resampler::InitStream(UINT32 nFramesMax)
+{
+    this->FreeStream();
+
+    // Streaming is only supported by the polyphase SRC
+    if (this->tPolyphase.pBank == NULL) return ERROR_SUCCESS;
+
+    // Room for the history under both wings and a full packet behind it
+    this->tStream.nCapacity = this->tPolyphase.nTaps + nFramesMax;
+    this->tStream.pHistory = (FLOAT*)malloc((SIZE_T)this->tStream.nCapacity * this->tPolyphase.nChannels * sizeof(FLOAT));
+
+    if (this->tStream.pHistory == NULL)
+    {
+        this->tStream = { NULL };
+        return ENOMEM;
+    }
+
+    this->tStream.bStreaming = TRUE;
+    this->ResetStream();
+
+    return ERROR_SUCCESS;
+}
+
+void Resampler::ResetStream()
+{
+    if (!this->tStream.bStreaming) return;
+
+    // Prime the left wing of the first output instant with silence
+    this->tStream.nFrames = this->tPolyphase.nHalfTaps - 1;
+    this->tStream.nInput = this->tPolyphase.nHalfTaps - 1;
+    this->tStream.nPhase = 0;
+    this->tStream.nSubPhase = 0;
+    memset(this->tStream.pHistory, 0, (SIZE_T)this->tStream.nFrames * this->tPolyphase.nChannels * sizeof(FLOAT));
+}
+
+void Resampler::FreeStream()
+{
+    free(this->tStream.pHistory);
+    this->tStream = { NULL };
+}
+
+UINT32 Resampler::ResampleFixed(void* pDataSrc, UINT32 nFramesIn, void* pDataDst, UINT32 nFramesOutMax)
+{
+    UINT32 nChannels = this->tPolyphase.nChannels;
+    UINT32 nTaps = this->tPolyphase.nTaps;
+    UINT32 nHalfTaps = this->tPolyphase.nHalfTaps;
+    INT64* pAccumulator = this->tPolyphase.pAccumulatorQ;
+    UINT32 nFramesWritten = 0;
+    
+    this->nFramesConsumed = 0;
+
+    // Append the new packet behind the history retained from the previous packets
+    if (this->tStream.nFrames + nFramesIn > this->tStream.nCapacity)
+    {
+        INT32* dummy = (INT32*)realloc(this->tStream.pHistoryQ, ((SIZE_T)this->tStream.nFrames + nFramesIn) * nChannels * sizeof(INT32));
+        
+        // Drop the packet rather than corrupt the stream if history cannot grow
+        if (dummy == NULL) return 0;
+
+        this->tStream.pHistoryQ = dummy;
+        this->tStream.nCapacity = this->tStream.nFrames + nFramesIn;
+    }
+
+    INT32* pAppend = this->tStream.pHistoryQ + (SIZE_T)this->tStream.nFrames * nChannels;
+    if (this->tPolyphase.wFixedBits == 16)
+        for (UINT32 k = 0; k < nFramesIn * nChannels; k++)
+            pAppend[k] = ((INT16*)pDataSrc)[k];
+    else
+        memcpy(pAppend, pDataSrc, (SIZE_T)nFramesIn * nChannels * sizeof(INT32));
+
+    this->tStream.nFrames += nFramesIn;
+    this->nFramesConsumed = nFramesIn;
+
+    INT64 nInput = this->tStream.nInput;
+    UINT32 nPhase = this->tStream.nPhase;
+    UINT32 nSubPhase = this->tStream.nSubPhase;
+
+    // Stop once the right wing runs out of input, rest is computed on the next call
+    while (nInput < (INT64)this->tStream.nFrames - nHalfTaps && nFramesWritten < nFramesOutMax)
+    {
+        // History always covers the left wing, so no clipping of the taps is needed
+        INT32* X = this->tStream.pHistoryQ + (SIZE_T)(nInput - nHalfTaps + 1) * nChannels;
+
+        for (UINT32 i = 0; i < nChannels; i++)
+            pAccumulator[i] = 0;
+
+        if (this->tPolyphase.wFixedBits == 16)
+        {
+            INT16* H = this->tPolyphase.pBankQ15 + (SIZE_T)nPhase * nTaps;
+            INT16* Y = (INT16*)pDataDst + (SIZE_T)nFramesWritten * nChannels;
+
+            // Between two bank rows when tracking drift, blend them with a Q14 weight
+            if (nSubPhase != 0)
+            {
+                INT16* pRow = (INT16*)this->tPolyphase.pRow;
+                for (UINT32 j = 0; j < nTaps; j++)
+                    pRow[j] = H[j] + (INT16)(((INT32)(H[j + nTaps] - H[j]) * (INT32)(nSubPhase >> 18)) >> 14);
+                H = pRow;
+            }
+
+            // Q15 x Q15 products fit 32 bits, accumulate in 64 to never overflow
+            for (UINT32 j = 0; j < nTaps; j++, X += nChannels)
+                for (UINT32 i = 0; i < nChannels; i++)
+                    pAccumulator[i] += H[j] * X[i];
+
+            for (UINT32 i = 0; i < nChannels; i++)
+                Y[i] = (INT16)min(max((pAccumulator[i] + (1 << 14)) >> 15, (INT64)INT16_MIN), (INT64)INT16_MAX);
+        }
+        else
+        {
+            INT32* H = this->tPolyphase.pBankQ31 + (SIZE_T)nPhase * nTaps;
+            INT32* Y = (INT32*)pDataDst + (SIZE_T)nFramesWritten * nChannels;
+
+            // Between two bank rows when tracking drift, blend them with a Q16 weight
+            if (nSubPhase != 0)
+            {
+                INT32* pRow = (INT32*)this->tPolyphase.pRow;
+                for (UINT32 j = 0; j < nTaps; j++)
+                    pRow[j] = H[j] + (INT32)((((INT64)H[j + nTaps] - H[j]) * (nSubPhase >> 16)) >> 16);
+                H = pRow;
+            }
+
+            // Q31 x Q31 products are Q62, drop guard bits per tap to leave headroom for the sum
+            for (UINT32 j = 0; j < nTaps; j++, X += nChannels)
+                for (UINT32 i = 0; i < nChannels; i++)
+                    pAccumulator[i] += ((INT64)H[j] * X[i]) >> RESAMPLER_Q31_GUARD_BITS;
+
+            for (UINT32 i = 0; i < nChannels; i++)
+                Y[i] = (INT32)min(max((pAccumulator[i] + ((INT64)1 << (30 - RESAMPLER_Q31_GUARD_BITS))) >> (31 - RESAMPLER_Q31_GUARD_BITS), (INT64)INT32_MIN), (INT64)INT32_MAX);
+        }
+
+        // Advance to the next output phase, carrying into the next input frame on overflow
+        nFramesWritten++;
+        this->AdvancePhase(nInput, nPhase, nSubPhase);
+    }
+
+    // Retain only the frames still under the left wing of the next output instant
+    INT64 nDrop = min(max(nInput - nHalfTaps + 1, (INT64)0), (INT64)this->tStream.nFrames);
+    memmove(this->tStream.pHistoryQ,
+        this->tStream.pHistoryQ + (SIZE_T)nDrop * nChannels,
+        (SIZE_T)(this->tStream.nFrames - nDrop) * nChannels * sizeof(INT32));
+
+    this->tStream.nFrames -= (UINT32)nDrop;
+    this->tStream.nInput = nInput - nDrop;
+    this->tStream.nPhase = nPhase;
+    this->tStream.nSubPhase = nSubPhase;
+
+    return nFramesWritten;
+}
+
+UINT32 Resampler::ResampleFrames(FLOAT* pDataSrc, UINT32 nFramesIn, FLOAT* pDataDst, UINT32 nFramesOutMax)
+{
+    UINT32 nChannels = this->tPolyphase.nChannels;
+    UINT32 nTaps = this->tPolyphase.nTaps;
+    UINT32 nHalfTaps = this->tPolyphase.nHalfTaps;
+    UINT32 nFramesWritten = 0;
+
+    this->nFramesConsumed = 0;
+
+    // History carries the left wing across calls, there is nothing to filter without it
+    if (!this->tStream.bStreaming) return 0;
+
+    // Append the new frames behind the history retained from the previous calls
+    if (this->tStream.nFrames + nFramesIn > this->tStream.nCapacity)
+    {
+        FLOAT* dummy = (FLOAT*)realloc(this->tStream.pHistory, ((SIZE_T)this->tStream.nFrames + nFramesIn) * nChannels * sizeof(FLOAT));
+        
+        // Drop the frames rather than corrupt the stream if history cannot grow
+        if (dummy == NULL) return 0;
+
+        this->tStream.pHistory = dummy;
+        this->tStream.nCapacity = this->tStream.nFrames + nFramesIn;
+    }
+    memcpy(this->tStream.pHistory + (SIZE_T)this->tStream.nFrames * nChannels, pDataSrc, (SIZE_T)nFramesIn * nChannels * sizeof(FLOAT));
+
+    this->tStream.nFrames += nFramesIn;
+    this->nFramesConsumed = nFramesIn;
+
+    INT64 nInput = this->tStream.nInput;
+    UINT32 nPhase = this->tStream.nPhase;
+    UINT32 nSubPhase = this->tStream.nSubPhase;
+
+    // Stop once the right wing runs out of input, rest is computed on the next call
+    while (nInput < (INT64)this->tStream.nFrames - nHalfTaps && nFramesWritten < nFramesOutMax)
+    {
+        // History always covers the left wing, so no clipping of the taps is needed
+        FLOAT* X = this->tStream.pHistory + (SIZE_T)(nInput - nHalfTaps + 1) * nChannels;
+        FLOAT* H = this->tPolyphase.pBank + (SIZE_T)nPhase * nTaps;
+
+        // Between two bank rows when tracking drift, blend them once per output frame rather than per channel
+        if (nSubPhase != 0)
+        {
+            FLOAT fWeight = nSubPhase * (1.0f / 4294967296.0f);
+            FLOAT* pRow = (FLOAT*)this->tPolyphase.pRow;
+            for (UINT32 j = 0; j < nTaps; j++)
+                pRow[j] = H[j] + fWeight * (H[j + nTaps] - H[j]);
+            H = pRow;
+        }
+
+        // Whole output frame at once, straight into the interleaved destination
+        tKernel.pMacInterleaved(H, X, nTaps, nChannels, pDataDst + (SIZE_T)nFramesWritten * nChannels);
+
+        // Advance to the next output phase, carrying into the next input frame on overflow
+        nFramesWritten++;
+        this->AdvancePhase(nInput, nPhase, nSubPhase);
+    }
+
+    // Retain only the frames still under the left wing of the next output instant
+    INT64 nDrop = min(max(nInput - nHalfTaps + 1, (INT64)0), (INT64)this->tStream.nFrames);
+    memmove(this->tStream.pHistory,
+        this->tStream.pHistory + (SIZE_T)nDrop * nChannels,
+        (SIZE_T)(this->tStream.nFrames - nDrop) * nChannels * sizeof(FLOAT));
+
+    this->tStream.nFrames -= (UINT32)nDrop;
+    this->tStream.nInput = nInput - nDrop;
+    this->tStream.nPhase = nPhase;
+    this->tStream.nSubPhase = nSubPhase;
+
+    return nFramesWritten;
+}
+
+UINT32 Resampler::GetFramesNeeded(UINT32 nFramesOut)
+{
+    if (nFramesOut == 0 || !this->tStream.bStreaming) return 0;
+
+    // Input frame preceding the last requested output instant, phase accumulated in 1/2^32-ths of a phase
+    UINT64 nSteps = nFramesOut - 1;
+    UINT64 nPhaseQ = (((UINT64)this->tStream.nPhase + nSteps * this->tPolyphase.nStepFrac) << 32) + this->tStream.nSubPhase + nSteps * this->tPolyphase.nStepSub;
+    INT64 nLast = this->tStream.nInput + nSteps * this->tPolyphase.nStepInt + nPhaseQ / ((UINT64)this->tPolyphase.nPhases << 32);
+    INT64 nNeeded = nLast + this->tPolyphase.nHalfTaps + 1 - this->tStream.nFrames;
+
+    return nNeeded > 0 ? (UINT32)nNeeded : 0;
+}
+
+void Resampler::AdvancePhase(INT64& nInput, UINT32& nPhase, UINT32& nSubPhase)
+{
+    nInput += this->tPolyphase.nStepInt;
+    nPhase += this->tPolyphase.nStepFrac;
+    
+    // Fraction of a phase is only nonzero when tracking drift
+    UINT32 nSubPhaseOld = nSubPhase;
+    nSubPhase += this->tPolyphase.nStepSub;
+    if (nSubPhase < nSubPhaseOld)
+        nPhase++;
+
+    if (nPhase >= this->tPolyphase.nPhases)
+    {
+        nPhase -= this->tPolyphase.nPhases;
+        nInput++;
+    }
+}
+
+UINT32 Resampler::GetFramesConsumed()
+{
+    return this->nFramesConsumed;
+}
+
+UINT32 Resampler::GetHistoryLength()
+{
+    return this->tStream.bStreaming ? this->tPolyphase.nTaps : 0;
 }
 
 void Resampler::SetLPScaling(FLOAT fFactor)
@@ -128,6 +624,10 @@ void Resampler::SetLPScaling(FLOAT fFactor)
 
 UINT32 Resampler::Resample(RESAMPLEFMT& tResampleFmt, ENDPOINTFMT& tEndpointFmt, void* pDataSrc, void* pDataDst, UINT32 nFramesLimit, BOOL bIn)
 {
+    // Rational factors with a prebuilt bank skip all of the per-sample phase arithmetic below
+    if (this->tPolyphase.pBank != NULL)
+        return this->ResamplePolyphase(tEndpointFmt, pDataSrc, pDataDst, nFramesLimit, bIn);
+
     DOUBLE dh = tResamplerParams.nNl;               // Step size through the filter table
     DOUBLE dt = 1.0 / tResampleFmt.fFactor;         // Output sampling period
     DOUBLE fEndTime = *tEndpointFmt.nBufferSize;
@@ -162,7 +662,7 @@ UINT32 Resampler::Resample(RESAMPLEFMT& tResampleFmt, ENDPOINTFMT& tEndpointFmt,
             INT32 nX = 0;
 
             // Make note of the next cell's offset to reduce computational cost
-            UINT32 position = (tResampleFmt.pBuffer[0]->GetWriteOffset() + nFramesWritten) % *tResampleFmt.nBufferSize;
+            UINT32 position = bIn ? (((RingBufferChannel**)pDataDst)[0]->GetWriteOffset() + nFramesWritten) & ((RingBufferChannel**)pDataDst)[0]->GetBufferMask() : 0;
 
             // Clear current ring buffer pointed cell for each channel
             for (UINT32 i = 0; i < tEndpointFmt.nChannels; i++)
@@ -268,13 +768,13 @@ UINT32 Resampler::Resample(RESAMPLEFMT& tResampleFmt, ENDPOINTFMT& tEndpointFmt,
             INT32 nX = 0;
 
             // Make note of the next cell's offset to reduce computational cost
-            UINT32 position = (((RingBufferChannel**)pDataDst)[0]->GetWriteOffset() + nFramesWritten) % *tResampleFmt.nBufferSize;
+            UINT32 position = bIn ? (((RingBufferChannel**)pDataDst)[0]->GetWriteOffset() + nFramesWritten) & ((RingBufferChannel**)pDataDst)[0]->GetBufferMask() : 0;
 
             // Clear current ring buffer pointed cell for each channel
             for (UINT32 i = 0; i < tEndpointFmt.nChannels; i++)
             {
                 if (bIn)    // SRC of captured data into ring buffer
-                    *(tResampleFmt.pBuffer[i]->GetBufferPointer() + position) = 0;
+                    *(((RingBufferChannel**)pDataDst)[i]->GetBufferPointer() + position) = 0;
                 else        // SRC of processed data out of ring buffer
                     *(*((FLOAT**)pDataDst) + nFramesWritten * (UINT64)tEndpointFmt.nChannels + i) = 0;
             }
@@ -358,5 +858,139 @@ UINT32 Resampler::Resample(RESAMPLEFMT& tResampleFmt, ENDPOINTFMT& tEndpointFmt,
             fCurrentTime += dt;
         }
     }
+    this->nFramesConsumed = (UINT32)fCurrentTime;
+    return nFramesWritten;
+}
+
+UINT32 Resampler::ResamplePolyphase(ENDPOINTFMT& tEndpointFmt, void* pDataSrc, void* pDataDst, UINT32 nFramesLimit, BOOL bIn)
+{
+    UINT32 nChannels = tEndpointFmt.nChannels;
+    UINT32 nTaps = this->tPolyphase.nTaps;
+    UINT32 nHalfTaps = this->tPolyphase.nHalfTaps;
+    FLOAT* pAccumulator = this->tPolyphase.pAccumulator;
+    RingBufferChannel** pRing = (RingBufferChannel**)(bIn ? pDataDst : pDataSrc);
+    UINT32 nRingSize = pRing[0]->GetBufferSize(), nRingMask = pRing[0]->GetBufferMask();
+    BOOL bRingMirrored = pRing[0]->IsMirrored();
+    UINT32 nRingOffset = bIn ? pRing[0]->GetWriteOffset() : pRing[0]->GetReadOffset();
+    BOOL bStreaming = this->tStream.bStreaming;
+    
+    FLOAT* pInput = bIn ? *(FLOAT**)pDataSrc : NULL;
+    INT64 nInputFrames = bIn ? *tEndpointFmt.nBufferSize : pRing[0]->GetFramesAvailable();
+    INT64 nInput = 0;
+    UINT32 nPhase = 0, nSubPhase = 0, nFramesWritten = 0;
+
+    if (bStreaming && bIn)
+    {
+        // Append the new packet behind the history retained from the previous packets
+        if (this->tStream.nFrames + nInputFrames > this->tStream.nCapacity)
+        {
+            FLOAT* dummy = (FLOAT*)realloc(this->tStream.pHistory, (SIZE_T)(this->tStream.nFrames + nInputFrames) * nChannels * sizeof(FLOAT));
+            
+            // Drop the packet rather than corrupt the stream if history cannot grow
+            if (dummy == NULL) return 0;
+
+            this->tStream.pHistory = dummy;
+            this->tStream.nCapacity = this->tStream.nFrames + (UINT32)nInputFrames;
+        }
+        memcpy(this->tStream.pHistory + (SIZE_T)this->tStream.nFrames * nChannels, pInput, (SIZE_T)nInputFrames * nChannels * sizeof(FLOAT));
+        
+        this->tStream.nFrames += (UINT32)nInputFrames;
+        pInput = this->tStream.pHistory;
+        nInputFrames = this->tStream.nFrames;
+        nInput = this->tStream.nInput;
+        nPhase = this->tStream.nPhase;
+        nSubPhase = this->tStream.nSubPhase;
+    }
+    else if (bStreaming)
+    {
+        // Ring buffer itself keeps the history, read offset points at the oldest frame under the left wing
+        nInput = nHalfTaps - 1;
+        nPhase = this->tStream.nPhase;
+        nSubPhase = this->tStream.nSubPhase;
+    }
+
+    // In streaming mode stop once the right wing runs out of input, rest is computed on the next call,
+    // otherwise the whole packet is filtered with 0's in place of missing neighbours
+    INT64 nInputEnd = bStreaming ? nInputFrames - nHalfTaps : (bIn ? nInputFrames : INT64_MAX);
+    UINT32 nOutputLimit = bIn ? UINT32_MAX : nFramesLimit;
+
+    while (nInput < nInputEnd && nFramesWritten < nOutputLimit)
+    {
+        // Index of the input frame multiplied by the first coefficient of the bank row
+        INT64 nBase = nInput - nHalfTaps + 1;
+        FLOAT* H = this->tPolyphase.pBank + (SIZE_T)nPhase * nTaps;
+
+        // Clip the range of coefficients to the available input once per output frame instead of per tap
+        UINT32 jStart = (nBase < 0) ? (UINT32)(-nBase) : 0;
+        UINT32 jEnd = (nBase + nTaps > nInputFrames) ? (UINT32)max(nInputFrames - nBase, (INT64)0) : nTaps;
+
+        // Between two bank rows when tracking drift, blend them once per output frame rather than per channel
+        if (nSubPhase != 0)
+        {
+            FLOAT fWeight = nSubPhase * (1.0f / 4294967296.0f);
+            FLOAT* pRow = (FLOAT*)this->tPolyphase.pRow;
+            for (UINT32 j = jStart; j < jEnd; j++)
+                pRow[j] = H[j] + fWeight * (H[j + nTaps] - H[j]);
+            H = pRow;
+        }
+
+        if (bIn)    // SRC of captured interleaved data into ring buffer
+        {
+            tKernel.pMacInterleaved(H + jStart, pInput + (nBase + jStart) * nChannels, jEnd - jStart, nChannels, pAccumulator);
+
+            // Store the finished output frame into each channel of the ring buffer once
+            UINT32 nPosition = (nRingOffset + nFramesWritten) & nRingMask;
+            for (UINT32 i = 0; i < nChannels; i++)
+                *(pRing[i]->GetBufferPointer() + nPosition) = pAccumulator[i];
+        }
+        else        // SRC of processed planar data out of ring buffer
+        {
+            // Taps span at most 2 contiguous runs of each channel, split at the ring's wrap point,
+            // a mirrored ring presents them as a single run
+            UINT32 nSpan = jEnd - jStart;
+            UINT32 nStart = (UINT32)((nRingOffset + nBase + jStart) & nRingMask);
+            UINT32 nFirst = bRingMirrored ? nSpan : min(nSpan, nRingSize - nStart);
+
+            // Store the finished output frame interleaved into the device's render linear buffer
+            FLOAT* Y = *(FLOAT**)pDataDst + (UINT64)nFramesWritten * nChannels;
+            for (UINT32 i = 0; i < nChannels; i++)
+            {
+                FLOAT* X = pRing[i]->GetBufferPointer();
+
+                Y[i] = tKernel.pMacPlanar(H + jStart, X + nStart, nFirst);
+                if (nFirst < nSpan)
+                    Y[i] += tKernel.pMacPlanar(H + jStart + nFirst, X, nSpan - nFirst);
+            }
+        }
+
+        // Advance to the next output phase, carrying into the next input frame on overflow
+        nFramesWritten++;
+        this->AdvancePhase(nInput, nPhase, nSubPhase);
+    }
+
+    if (bStreaming && bIn)
+    {
+        // Retain only the frames still under the left wing of the next output instant
+        INT64 nDrop = min(max(nInput - nHalfTaps + 1, (INT64)0), (INT64)this->tStream.nFrames);
+        memmove(this->tStream.pHistory,
+            this->tStream.pHistory + (SIZE_T)nDrop * nChannels,
+            (SIZE_T)(this->tStream.nFrames - nDrop) * nChannels * sizeof(FLOAT));
+
+        this->tStream.nFrames -= (UINT32)nDrop;
+        this->tStream.nInput = nInput - nDrop;
+        this->tStream.nPhase = nPhase;
+        this->tStream.nSubPhase = nSubPhase;
+        this->nFramesConsumed = (UINT32)nDrop;
+    }
+    else if (bStreaming)
+    {
+        // Caller advances the read offset past the frames no longer under the left wing
+        this->tStream.nPhase = nPhase;
+        this->tStream.nSubPhase = nSubPhase;
+        this->nFramesConsumed = (UINT32)(nInput - (nHalfTaps - 1));
+    }
+    else
+        this->nFramesConsumed = (UINT32)min(nInput, nInputFrames);
+
     return nFramesWritten;
 }
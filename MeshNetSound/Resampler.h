@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "config.h"
+#include "ResamplerKernel.h"
 
 //-------- Type Definitions of AudioBuffer (placed here to avoid circular dependency error)
 typedef struct endpointfmt {
@@ -33,6 +34,8 @@ typedef struct resamplefmt {
 typedef struct resampler {
 	FLOAT* pImp;	// Filter coefficients
 	FLOAT* pImpD;	// Filter coefficient deltas
+	INT32* pImpQ;	// Filter coefficients in Q31
+	INT32* pImpDQ;	// Filter coefficient deltas in Q31
 	UINT32 nNz;
 	UINT32 nNh;
 	UINT32 nNl;
@@ -43,6 +46,47 @@ typedef struct resampler {
 	DOUBLE fBeta;
 } RESAMPLERPARAMS;
 
+typedef struct polyphase {
+	FLOAT* pBank;		// nPhases-by-nTaps matrix of filter coefficients, one row per output phase
+	FLOAT* pAccumulator;// Per-channel MAC registers of the output frame being computed
+	UINT32 nPhases;		// L - number of distinct output phases (upsampling factor)
+	UINT32 nStep;		// M - input samples advanced per L output samples (downsampling factor)
+	UINT32 nStepInt;	// Integer part of M/L - whole input samples advanced per output sample
+	UINT32 nStepFrac;	// Remainder of M/L - phase increment per output sample
+	UINT32 nStepSub;	// Fraction of a phase in 1/2^32-ths added per output sample, nonzero only when tracking drift
+	UINT32 nTaps;		// Number of coefficients in each phase (both wings)
+	UINT32 nHalfTaps;	// Number of coefficients in each wing
+	UINT32 nChannels;
+	UINT32 nRows;		// Number of rows in the bank, nPhases + 1 when tracking drift
+	void* pRow;			// Scratch row of nTaps coefficients blended between 2 adjacent rows of the bank
+	INT16* pBankQ15;	// pBank in Q15 for 16-bit PCM, NULL unless fixed-point SRC is enabled
+	INT32* pBankQ31;	// pBank in Q31 for 32-bit PCM, NULL unless fixed-point SRC is enabled
+	INT64* pAccumulatorQ;// Per-channel integer MAC registers of the output frame being computed
+	WORD wFixedBits;	// Bit width of integer PCM for fixed-point SRC, 0 for float SRC
+} RESAMPLERPOLYPHASE;
+
+typedef struct resamplerstream {
+	union {
+		FLOAT* pHistory;	// Interleaved staging of the previous packets' tail followed by the current packet
+		INT32* pHistoryQ;	// Same for fixed-point SRC, 16-bit PCM is widened on append (both are 32 bits wide)
+	};
+	UINT32 nCapacity;	// Number of frames pHistory can hold
+	UINT32 nFrames;		// Number of frames currently held in pHistory
+	INT64 nInput;		// Index into pHistory of the input frame preceding the next output instant
+	UINT32 nPhase;		// Output phase carried over between packets
+	UINT32 nSubPhase;	// Fraction of the output phase carried over between packets
+	BOOL bStreaming;	// Indicator if SRC state is carried over between packets
+} RESAMPLERSTREAM;
+
+typedef struct resamplerdrift {
+	DOUBLE fTarget;		// Ring buffer fill level, in frames, the controller steers towards
+	DOUBLE fFill;		// Low-passed ring buffer fill level
+	DOUBLE fIntegral;	// Integral term of the PI controller
+	DOUBLE fCorrection;	// Current relative correction of the step through the input
+	BOOL bPrimed;		// Indicator if fFill holds a measurement yet
+	BOOL bTracking;		// Indicator if the resampling ratio follows the ring buffer fill level
+} RESAMPLERDRIFT;
+
 /// <summary>
 /// Class performing sample rate conversion on its associated AudioBuffer object
 /// in the data flow pipe in front of and right after the DSP processor.
@@ -89,10 +133,164 @@ class Resampler
 		/// <param name="fFactor">- resampling factor</param>		
 		void SetLPScaling(FLOAT fFactor);
 
+		/// <summary>
+		/// <para>Builds the polyphase filter bank for the rational resampling factor L/M
+		/// of the parent AudioBuffer.</para>
+		/// <para>Each of the L rows holds the already interpolated, already scaled coefficients
+		/// for one output phase, so that the SRC inner loop reduces to a plain dot product.</para>
+		/// <para>Note: must be called after Resampler::InitLPFilter() and after the parent
+		/// AudioBuffer knows its channel count.</para>
+		/// </summary>
+		/// <param name="nUpsample">- upsampling factor L.</param>
+		/// <param name="nDownsample">- downsampling factor M.</param>
+		/// <param name="nChannels">- number of interleaved channels of the parent's device.</param>
+		/// <returns>
+		/// <para>ERROR_SUCCESS if the bank was built or no SRC is needed.</para>
+		/// <para>ERROR_NOT_SUPPORTED if L exceeds RESAMPLER_POLYPHASE_MAX_PHASES,
+		/// Resampler then falls back to the interpolating SRC.</para>
+		/// <para>ENOMEM if allocation of the bank failed.</para>
+		/// </returns>
+		HRESULT InitPolyphase(DWORD nUpsample, DWORD nDownsample, UINT32 nChannels);
+
+		/// <summary>
+		/// <para>Releases memory of the polyphase filter bank, if any.</para>
+		/// </summary>
+		void FreePolyphase();
+
+		/// <summary>
+		/// <para>Builds the polyphase filter bank for the nominal factor L/M, like Resampler::InitPolyphase(),
+		/// with a resampling ratio that can be nudged at runtime to track the clock drift
+		/// between the device and the ring buffer's consumer or producer.</para>
+		/// <para>The bank is oversampled to at least RESAMPLER_DRIFT_MIN_PHASES phases and output instants
+		/// falling between 2 phases blend the adjacent rows. A bank is built even when L = M.</para>
+		/// <para>Note: must be called instead of Resampler::InitPolyphase(), followed by Resampler::SetDriftTarget().</para>
+		/// </summary>
+		/// <param name="nUpsample">- nominal upsampling factor L.</param>
+		/// <param name="nDownsample">- nominal downsampling factor M.</param>
+		/// <param name="nChannels">- number of interleaved channels of the parent's device.</param>
+		/// <returns>
+		/// <para>ERROR_SUCCESS if the bank was built.</para>
+		/// <para>ERROR_NOT_SUPPORTED if L exceeds RESAMPLER_POLYPHASE_MAX_PHASES.</para>
+		/// <para>ENOMEM if allocation of the bank failed.</para>
+		/// </returns>
+		HRESULT InitDrift(DWORD nUpsample, DWORD nDownsample, UINT32 nChannels);
+
+		/// <summary>
+		/// <para>Sets the ring buffer fill level the drift controller steers towards.</para>
+		/// </summary>
+		/// <param name="nFrames">- target number of frames available in the ring buffer.</param>
+		void SetDriftTarget(UINT32 nFrames);
+
+		/// <summary>
+		/// <para>Feeds a ring buffer fill level measurement into the PI controller and adjusts
+		/// the resampling ratio by at most RESAMPLER_DRIFT_MAX_PPM.</para>
+		/// <para>Overfull ring buffer speeds up the step through the input, draining one slows it down,
+		/// which holds latency bounded instead of periodically dropping frames.</para>
+		/// <para>Note: must be called once per packet from the thread performing SRC, has no effect
+		/// unless Resampler::InitDrift() succeeded.</para>
+		/// </summary>
+		/// <param name="nFill">- number of frames available in the ring buffer.</param>
+		/// <param name="fElapsed">- time since the previous measurement in seconds.</param>
+		void UpdateDrift(UINT32 nFill, DOUBLE fElapsed);
+
+		/// <summary>
+		/// <para>Switches the polyphase SRC into streaming mode in which the input history
+		/// and the output phase persist across packets.</para>
+		/// <para>Output is then continuous and independent of the packet size, at the cost of
+		/// nHalfTaps input frames, or Nz*Fs/F' when decimating, of latency.</para>
+		/// <para>Note: must be called after Resampler::InitPolyphase(), has no effect if the bank was not built.</para>
+		/// </summary>
+		/// <param name="nFramesMax">- expected maximum number of frames per packet used to presize the history,
+		/// larger packets grow it on demand.</param>
+		/// <returns>ERROR_SUCCESS or ENOMEM.</returns>
+		HRESULT InitStream(UINT32 nFramesMax);
+
+		/// <summary>
+		/// <para>Discards the input history and re-primes it with silence.</para>
+		/// <para>Must be called when the input stream is discontinuous (i.e. device glitch or dropped packets).</para>
+		/// </summary>
+		void ResetStream();
+
+		/// <summary>
+		/// <para>Releases memory of the streaming SRC history, if any.</para>
+		/// </summary>
+		void FreeStream();
+
+		/// <summary>
+		/// <para>Switches the polyphase SRC to integer arithmetic on integer PCM.</para>
+		/// <para>Quantizes the bank to Q15 for 16-bit PCM or to Q31 for 32-bit PCM
+		/// (incl. 24-bit samples in 32-bit containers) directly from the Q31 LP filter table,
+		/// so that the output is bit-exact across runs and machines.</para>
+		/// <para>Fixed-point SRC is always streaming, history is allocated if Resampler::InitStream()
+		/// was not called prior.</para>
+		/// <para>Note: must be called after Resampler::InitPolyphase(). Once enabled, Resampler::ResampleFixed()
+		/// must be used instead of Resampler::Resample().</para>
+		/// </summary>
+		/// <param name="wBitsPerSample">- container width of the integer PCM samples, 16 or 32.</param>
+		/// <param name="nFramesMax">- expected maximum number of frames per packet used to presize the history.</param>
+		/// <returns>
+		/// <para>ERROR_SUCCESS if integer bank was built.</para>
+		/// <para>ERROR_NOT_SUPPORTED if bank was not built or sample width is not 16 or 32 bits.</para>
+		/// <para>ENOMEM if allocation failed.</para>
+		/// </returns>
+		HRESULT InitFixedPoint(WORD wBitsPerSample, UINT32 nFramesMax);
+
+		/// <summary>
+		/// <para>Integer counterpart of Resampler::Resample() for interleaved 16-bit or 32-bit PCM
+		/// in and out, using the width passed to Resampler::InitFixedPoint().</para>
+		/// <para>Accumulates in 64-bit registers, rounds and saturates once per output sample.</para>
+		/// <para>Input is always consumed whole: frames not yet covered by the right wing of the filter,
+		/// or beyond nFramesOutMax output frames, stay in the history for the next call.</para>
+		/// </summary>
+		/// <param name="pDataSrc">- pointer to the first byte of nFramesIn interleaved input frames.</param>
+		/// <param name="nFramesIn">- number of input frames.</param>
+		/// <param name="pDataDst">- pointer to the first byte of the interleaved output buffer.</param>
+		/// <param name="nFramesOutMax">- capacity of the output buffer in frames.</param>
+		/// <returns>Returns the number of resampled frames written to the buffer.</returns>
+		UINT32 ResampleFixed(void* pDataSrc, UINT32 nFramesIn, void* pDataDst, UINT32 nFramesOutMax);
+
+		/// <summary>
+		/// <para>Float counterpart of Resampler::ResampleFixed() for interleaved frames in and out,
+		/// used with a FrameRingBuffer where whole frames are moved between SRC and the ring buffer.</para>
+		/// <para>Input is always consumed whole: frames not yet covered by the right wing of the filter,
+		/// or beyond nFramesOutMax output frames, stay in the history for the next call.</para>
+		/// <para>Note: requires streaming mode, Resampler::InitStream() must be called prior.</para>
+		/// </summary>
+		/// <param name="pDataSrc">- nFramesIn interleaved input frames.</param>
+		/// <param name="nFramesIn">- number of input frames.</param>
+		/// <param name="pDataDst">- interleaved output buffer.</param>
+		/// <param name="nFramesOutMax">- capacity of the output buffer in frames.</param>
+		/// <returns>Returns the number of resampled frames written to the buffer, 0 if not streaming.</returns>
+		UINT32 ResampleFrames(FLOAT* pDataSrc, UINT32 nFramesIn, FLOAT* pDataDst, UINT32 nFramesOutMax);
+
+		/// <summary>
+		/// <para>Gets the number of input frames fixed-point or frame SRC needs on top of its history
+		/// to produce nFramesOut output frames.</para>
+		/// <para>Used to pull exactly enough frames out of the ring buffer before SRC into a render buffer.</para>
+		/// </summary>
+		/// <param name="nFramesOut">- number of output frames requested.</param>
+		/// <returns>Number of input frames to pass to the next Resampler::ResampleFixed() or Resampler::ResampleFrames() call.</returns>
+		UINT32 GetFramesNeeded(UINT32 nFramesOut);
+
+		/// <summary>
+		/// <para>Gets the number of input frames the last call to Resampler::Resample() advanced through.</para>
+		/// <para>Used to advance the ring buffer read offset after SRC out of the ring buffer,
+		/// because the number of frames read differs from the number of frames written.</para>
+		/// </summary>
+		/// <returns>Number of consumed input frames.</returns>
+		UINT32 GetFramesConsumed();
+
+		/// <summary>
+		/// <para>Gets the number of extra input frames streaming SRC needs beyond the ones
+		/// spanned by the output packet itself.</para>
+		/// </summary>
+		/// <returns>Number of filter taps in streaming mode, 0 otherwise.</returns>
+		UINT32 GetHistoryLength();
+
 		/// <summary>
 		/// <para>Performs SRC on the WASAPI audio packet and stores output
 		/// into the AudioBuffer's corresponding ring buffer.</para>
-		/// <para>Note: the SRC implementation might create slight artifacts
+		/// <para>Note: unless streaming mode is enabled, the SRC implementation might create slight artifacts
 		/// because each packet is treated independently and instead of actual Nz*Fs/F's or Nz
 		/// extra input samples before and after current packet, padds with 0's.</para>
 		/// <para>Note: for each sample, starts from largest coefficients in both wings
@@ -119,8 +317,62 @@ class Resampler
 		/// <returns></returns>		
 		static DOUBLE Izero(DOUBLE x);
 
+		/// <summary>
+		/// <para>Evaluates the Kaiser-windowed LP filter at an arbitrary distance from its center
+		/// by linear interpolation between the table entries.</para>
+		/// </summary>
+		/// <param name="fDistance">- distance from the center of the filter in units of zero-crossings.</param>
+		/// <returns>Filter value, 0 outside of the tabulated wing.</returns>
+		static DOUBLE LPValue(DOUBLE fDistance);
+
+		/// <summary>
+		/// <para>Integer counterpart of Resampler::LPValue() on the Q31 table.</para>
+		/// </summary>
+		/// <param name="nNum">- numerator of the distance from the center of the filter in units of zero-crossings.</param>
+		/// <param name="nDen">- denominator of the distance.</param>
+		/// <returns>Filter value in Q31, 0 outside of the tabulated wing.</returns>
+		static INT32 LPValueQ(UINT64 nNum, UINT64 nDen);
+
+		/// <summary>
+		/// <para>Polyphase counterpart of Resampler::Resample() used when the bank is built.</para>
+		/// <para>Steps through the phases with integer arithmetic only and computes each output
+		/// frame as a dot product of a bank row with the input frames, accumulating all channels
+		/// in registers before storing them once.</para>
+		/// <para>Dot products run on the SIMD kernels picked by Resampler::InitLPFilter().</para>
+		/// </summary>
+		/// <returns>Returns the number of resampled values written to the buffer.</returns>
+		UINT32 ResamplePolyphase(ENDPOINTFMT& tEndpointFmt, void* pDataSrc, void* pDataDst, UINT32 nFramesLimit, BOOL bIn);
+
+		/// <summary>
+		/// <para>Allocates and fills the polyphase filter bank shared by Resampler::InitPolyphase()
+		/// and Resampler::InitDrift().</para>
+		/// </summary>
+		/// <param name="nUpsample">- number of phases L.</param>
+		/// <param name="nDownsample">- number of phases M advanced per output sample.</param>
+		/// <param name="nChannels">- number of interleaved channels of the parent's device.</param>
+		/// <param name="nRows">- number of rows to compute, rows past L continue into the next input sample.</param>
+		/// <returns>ERROR_SUCCESS or ENOMEM.</returns>
+		HRESULT BuildPolyphase(DWORD nUpsample, DWORD nDownsample, UINT32 nChannels, UINT32 nRows);
+
+		/// <summary>
+		/// <para>Splits the step through the input, corrected by a relative amount, into whole
+		/// input frames, whole phases and a fraction of a phase.</para>
+		/// </summary>
+		/// <param name="fCorrection">- relative correction of the nominal step M/L.</param>
+		void SetDriftStep(DOUBLE fCorrection);
+
+		/// <summary>
+		/// <para>Advances the SRC position by one output sample.</para>
+		/// </summary>
+		void AdvancePhase(INT64& nInput, UINT32& nPhase, UINT32& nSubPhase);
+
 	private:
 		// Variables
 		FLOAT						fLPScale				{ 1.0 };
+		RESAMPLERPOLYPHASE			tPolyphase				{ NULL };
+		RESAMPLERSTREAM				tStream					{ NULL };
+		RESAMPLERDRIFT				tDrift					{ 0 };
+		UINT32						nFramesConsumed			{ 0 };
 		static RESAMPLERPARAMS		tResamplerParams;
+		static RESAMPLERKERNEL		tKernel;
 };
@@ -0,0 +1,433 @@
+/*
+    TODO:
+        I.------add FMA variants once accumulated rounding differences against the scalar kernels
+                are acceptable for regression tests.
+        II.-----add AVX-512 kernels for 16+ channel arrays.
+*/
+
+#include "ResamplerKernel.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #define RESAMPLER_KERNEL_X86
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+        #define RESAMPLER_TARGET_AVX2
+        #define RESAMPLER_TARGET_SSE2
+    #else
+        #include <cpuid.h>
+        #define RESAMPLER_TARGET_AVX2 __attribute__((target("avx2")))
+        #define RESAMPLER_TARGET_SSE2 __attribute__((target("sse2")))
+    #endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+    #define RESAMPLER_KERNEL_NEON
+    #if defined(_MSC_VER)
+        #include <arm64_neon.h>
+    #else
+        #include <arm_neon.h>
+    #endif
+#endif
+
+//---------------- Scalar kernels ----------------//
+
+static void MacInterleavedScalar(const FLOAT* H, const FLOAT* X, UINT32 nTaps, UINT32 nChannels, FLOAT* Y)
+{
+    for (UINT32 i = 0; i < nChannels; i++)
+        Y[i] = 0;
+
+    for (UINT32 j = 0; j < nTaps; j++, X += nChannels)
+        for (UINT32 i = 0; i < nChannels; i++)
+            Y[i] += H[j] * X[i];
+}
+
+static FLOAT MacPlanarScalar(const FLOAT* H, const FLOAT* X, UINT32 nTaps)
+{
+    // 4 independent partial sums break the dependency chain of the adds
+    FLOAT acc[4] = { 0 };
+    UINT32 j = 0;
+
+    for (; j + 4 <= nTaps; j += 4)
+    {
+        acc[0] += H[j] * X[j];
+        acc[1] += H[j + 1] * X[j + 1];
+        acc[2] += H[j + 2] * X[j + 2];
+        acc[3] += H[j + 3] * X[j + 3];
+    }
+    for (; j < nTaps; j++)
+        acc[0] += H[j] * X[j];
+
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+#if defined(RESAMPLER_KERNEL_X86)
+//---------------- SSE2 kernels ----------------//
+
+RESAMPLER_TARGET_SSE2 static inline FLOAT HorizontalSumSSE(__m128 acc)
+{
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+}
+
+RESAMPLER_TARGET_SSE2 static FLOAT MacPlanarSSE(const FLOAT* H, const FLOAT* X, UINT32 nTaps)
+{
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    UINT32 j = 0;
+
+    for (; j + 8 <= nTaps; j += 8)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(H + j), _mm_loadu_ps(X + j)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(H + j + 4), _mm_loadu_ps(X + j + 4)));
+    }
+    for (; j + 4 <= nTaps; j += 4)
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(H + j), _mm_loadu_ps(X + j)));
+
+    FLOAT v = HorizontalSumSSE(_mm_add_ps(acc0, acc1));
+    for (; j < nTaps; j++)
+        v += H[j] * X[j];
+
+    return v;
+}
+
+RESAMPLER_TARGET_SSE2 static void MacInterleavedSSE(const FLOAT* H, const FLOAT* X, UINT32 nTaps, UINT32 nChannels, FLOAT* Y)
+{
+    UINT32 i = 0;
+
+    // Mono is a plain dot product
+    if (nChannels == 1)
+    {
+        Y[0] = MacPlanarSSE(H, X, nTaps);
+        return;
+    }
+
+    // Stereo vectorizes across taps: each register holds 2 L/R frames, coefficients duplicated pairwise
+    if (nChannels == 2)
+    {
+        __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+        UINT32 j = 0;
+
+        for (; j + 4 <= nTaps; j += 4)
+        {
+            __m128 h = _mm_loadu_ps(H + j);
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_unpacklo_ps(h, h), _mm_loadu_ps(X + 2 * j)));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_unpackhi_ps(h, h), _mm_loadu_ps(X + 2 * j + 4)));
+        }
+
+        // Fold (L,R,L,R) into (L,R)
+        __m128 acc = _mm_add_ps(acc0, acc1);
+        acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+
+        FLOAT l = _mm_cvtss_f32(acc), r = _mm_cvtss_f32(_mm_shuffle_ps(acc, acc, 1));
+        for (; j < nTaps; j++)
+        {
+            l += H[j] * X[2 * j];
+            r += H[j] * X[2 * j + 1];
+        }
+        Y[0] = l;
+        Y[1] = r;
+        return;
+    }
+
+    // Wider arrays vectorize across channels: blocks of channels stay in registers for all taps
+    for (; i + 8 <= nChannels; i += 8)
+    {
+        __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+        const FLOAT* x = X + i;
+
+        for (UINT32 j = 0; j < nTaps; j++, x += nChannels)
+        {
+            __m128 h = _mm_set1_ps(H[j]);
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(h, _mm_loadu_ps(x)));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(h, _mm_loadu_ps(x + 4)));
+        }
+        _mm_storeu_ps(Y + i, acc0);
+        _mm_storeu_ps(Y + i + 4, acc1);
+    }
+    for (; i + 4 <= nChannels; i += 4)
+    {
+        __m128 acc = _mm_setzero_ps();
+        const FLOAT* x = X + i;
+
+        for (UINT32 j = 0; j < nTaps; j++, x += nChannels)
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(H[j]), _mm_loadu_ps(x)));
+
+        _mm_storeu_ps(Y + i, acc);
+    }
+    for (; i < nChannels; i++)
+    {
+        FLOAT acc = 0;
+        const FLOAT* x = X + i;
+
+        for (UINT32 j = 0; j < nTaps; j++, x += nChannels)
+            acc += H[j] * *x;
+
+        Y[i] = acc;
+    }
+}
+
+//---------------- AVX2 kernels ----------------//
+
+RESAMPLER_TARGET_AVX2 static FLOAT MacPlanarAVX2(const FLOAT* H, const FLOAT* X, UINT32 nTaps)
+{
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    UINT32 j = 0;
+
+    for (; j + 16 <= nTaps; j += 16)
+    {
+        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(H + j), _mm256_loadu_ps(X + j)));
+        acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(H + j + 8), _mm256_loadu_ps(X + j + 8)));
+    }
+    for (; j + 8 <= nTaps; j += 8)
+        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(H + j), _mm256_loadu_ps(X + j)));
+
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 v4 = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    v4 = _mm_add_ps(v4, _mm_movehl_ps(v4, v4));
+    v4 = _mm_add_ss(v4, _mm_shuffle_ps(v4, v4, 1));
+
+    FLOAT v = _mm_cvtss_f32(v4);
+    for (; j < nTaps; j++)
+        v += H[j] * X[j];
+
+    return v;
+}
+
+RESAMPLER_TARGET_AVX2 static void MacInterleavedAVX2(const FLOAT* H, const FLOAT* X, UINT32 nTaps, UINT32 nChannels, FLOAT* Y)
+{
+    UINT32 i = 0;
+
+    if (nChannels == 1)
+    {
+        Y[0] = MacPlanarAVX2(H, X, nTaps);
+        return;
+    }
+
+    // Stereo: 4 L/R frames per register, coefficients duplicated pairwise by a cross-lane permute
+    if (nChannels == 2)
+    {
+        const __m256i nDuplicate = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+        __m256 acc = _mm256_setzero_ps();
+        UINT32 j = 0;
+
+        for (; j + 4 <= nTaps; j += 4)
+        {
+            __m256 h = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_loadu_ps(H + j)), nDuplicate);
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(h, _mm256_loadu_ps(X + 2 * j)));
+        }
+
+        // Fold (L,R,L,R,L,R,L,R) into (L,R)
+        __m128 v4 = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+        v4 = _mm_add_ps(v4, _mm_movehl_ps(v4, v4));
+
+        FLOAT l = _mm_cvtss_f32(v4), r = _mm_cvtss_f32(_mm_shuffle_ps(v4, v4, 1));
+        for (; j < nTaps; j++)
+        {
+            l += H[j] * X[2 * j];
+            r += H[j] * X[2 * j + 1];
+        }
+        Y[0] = l;
+        Y[1] = r;
+        return;
+    }
+
+    // 16-32 channel arrays: 2 YMM accumulators cover 16 channels for the whole filter length
+    for (; i + 16 <= nChannels; i += 16)
+    {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        const FLOAT* x = X + i;
+
+        for (UINT32 j = 0; j < nTaps; j++, x += nChannels)
+        {
+            __m256 h = _mm256_set1_ps(H[j]);
+            acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(h, _mm256_loadu_ps(x)));
+            acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(h, _mm256_loadu_ps(x + 8)));
+        }
+        _mm256_storeu_ps(Y + i, acc0);
+        _mm256_storeu_ps(Y + i + 8, acc1);
+    }
+    for (; i + 8 <= nChannels; i += 8)
+    {
+        __m256 acc = _mm256_setzero_ps();
+        const FLOAT* x = X + i;
+
+        for (UINT32 j = 0; j < nTaps; j++, x += nChannels)
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(H[j]), _mm256_loadu_ps(x)));
+
+        _mm256_storeu_ps(Y + i, acc);
+    }
+    for (; i + 4 <= nChannels; i += 4)
+    {
+        __m128 acc = _mm_setzero_ps();
+        const FLOAT* x = X + i;
+
+        for (UINT32 j = 0; j < nTaps; j++, x += nChannels)
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(H[j]), _mm_loadu_ps(x)));
+
+        _mm_storeu_ps(Y + i, acc);
+    }
+    for (; i < nChannels; i++)
+    {
+        FLOAT acc = 0;
+        const FLOAT* x = X + i;
+
+        for (UINT32 j = 0; j < nTaps; j++, x += nChannels)
+            acc += H[j] * *x;
+
+        Y[i] = acc;
+    }
+}
+
+static BOOL IsAVX2Supported()
+{
+    INT32 info[4];
+    UINT64 xcr0;
+
+#if defined(_MSC_VER)
+    __cpuid(info, 0);
+    if (info[0] < 7) return FALSE;
+
+    __cpuid(info, 1);
+    // OSXSAVE and AVX
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return FALSE;
+    xcr0 = _xgetbv(0);
+
+    __cpuidex(info, 7, 0);
+#else
+    if (__get_cpuid_max(0, NULL) < 7) return FALSE;
+
+    __cpuid(1, info[0], info[1], info[2], info[3]);
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return FALSE;
+
+    UINT32 eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    xcr0 = ((UINT64)edx << 32) | eax;
+
+    __cpuid_count(7, 0, info[0], info[1], info[2], info[3]);
+#endif
+    // OS must save XMM and YMM state on context switches
+    if ((xcr0 & 6) != 6) return FALSE;
+
+    return (info[1] & (1 << 5)) != 0;
+}
+
+static BOOL IsSSE2Supported()
+{
+#if defined(_M_X64) || defined(__x86_64__)
+    return TRUE;
+#elif defined(_MSC_VER)
+    return IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+#endif
+
+#if defined(RESAMPLER_KERNEL_NEON)
+//---------------- NEON kernels ----------------//
+
+static FLOAT MacPlanarNEON(const FLOAT* H, const FLOAT* X, UINT32 nTaps)
+{
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+    UINT32 j = 0;
+
+    for (; j + 8 <= nTaps; j += 8)
+    {
+        acc0 = vaddq_f32(acc0, vmulq_f32(vld1q_f32(H + j), vld1q_f32(X + j)));
+        acc1 = vaddq_f32(acc1, vmulq_f32(vld1q_f32(H + j + 4), vld1q_f32(X + j + 4)));
+    }
+    for (; j + 4 <= nTaps; j += 4)
+        acc0 = vaddq_f32(acc0, vmulq_f32(vld1q_f32(H + j), vld1q_f32(X + j)));
+
+    FLOAT v = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; j < nTaps; j++)
+        v += H[j] * X[j];
+
+    return v;
+}
+
+static void MacInterleavedNEON(const FLOAT* H, const FLOAT* X, UINT32 nTaps, UINT32 nChannels, FLOAT* Y)
+{
+    UINT32 i = 0;
+
+    if (nChannels == 1)
+    {
+        Y[0] = MacPlanarNEON(H, X, nTaps);
+        return;
+    }
+
+    // Stereo: de-interleaving loads split 4 frames into L and R registers
+    if (nChannels == 2)
+    {
+        float32x4_t accL = vdupq_n_f32(0), accR = vdupq_n_f32(0);
+        UINT32 j = 0;
+
+        for (; j + 4 <= nTaps; j += 4)
+        {
+            float32x4_t h = vld1q_f32(H + j);
+            float32x4x2_t x = vld2q_f32(X + 2 * j);
+            accL = vaddq_f32(accL, vmulq_f32(h, x.val[0]));
+            accR = vaddq_f32(accR, vmulq_f32(h, x.val[1]));
+        }
+
+        FLOAT l = vaddvq_f32(accL), r = vaddvq_f32(accR);
+        for (; j < nTaps; j++)
+        {
+            l += H[j] * X[2 * j];
+            r += H[j] * X[2 * j + 1];
+        }
+        Y[0] = l;
+        Y[1] = r;
+        return;
+    }
+
+    for (; i + 8 <= nChannels; i += 8)
+    {
+        float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+        const FLOAT* x = X + i;
+
+        for (UINT32 j = 0; j < nTaps; j++, x += nChannels)
+        {
+            acc0 = vaddq_f32(acc0, vmulq_n_f32(vld1q_f32(x), H[j]));
+            acc1 = vaddq_f32(acc1, vmulq_n_f32(vld1q_f32(x + 4), H[j]));
+        }
+        vst1q_f32(Y + i, acc0);
+        vst1q_f32(Y + i + 4, acc1);
+    }
+    for (; i + 4 <= nChannels; i += 4)
+    {
+        float32x4_t acc = vdupq_n_f32(0);
+        const FLOAT* x = X + i;
+
+        for (UINT32 j = 0; j < nTaps; j++, x += nChannels)
+            acc = vaddq_f32(acc, vmulq_n_f32(vld1q_f32(x), H[j]));
+
+        vst1q_f32(Y + i, acc);
+    }
+    for (; i < nChannels; i++)
+    {
+        FLOAT acc = 0;
+        const FLOAT* x = X + i;
+
+        for (UINT32 j = 0; j < nTaps; j++, x += nChannels)
+            acc += H[j] * *x;
+
+        Y[i] = acc;
+    }
+}
+#endif
+
+RESAMPLERKERNEL SelectResamplerKernel()
+{
+#if defined(RESAMPLER_KERNEL_X86)
+    if (IsAVX2Supported())
+        return { MacInterleavedAVX2, MacPlanarAVX2, "AVX2" };
+
+    if (IsSSE2Supported())
+        return { MacInterleavedSSE, MacPlanarSSE, "SSE2" };
+#elif defined(RESAMPLER_KERNEL_NEON)
+    // NEON is mandatory on ARM64
+    return { MacInterleavedNEON, MacPlanarNEON, "NEON" };
+#endif
+
+    return { MacInterleavedScalar, MacPlanarScalar, "scalar" };
+}
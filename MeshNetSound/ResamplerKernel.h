@@ -0,0 +1,31 @@
+#pragma once
+#include <windows.h>
+#include "config.h"
+
+//-------- Type Definitions of Resampler MAC kernels
+/// <summary>
+/// <para>Multiplies nTaps interleaved frames of nChannels samples with nTaps filter coefficients
+/// and stores the per-channel sums into Y once.</para>
+/// </summary>
+typedef void (*RESAMPLERMACINTERLEAVED)(const FLOAT* H, const FLOAT* X, UINT32 nTaps, UINT32 nChannels, FLOAT* Y);
+
+/// <summary>
+/// <para>Dot product of nTaps filter coefficients with nTaps contiguous samples of a single channel.</para>
+/// </summary>
+typedef FLOAT (*RESAMPLERMACPLANAR)(const FLOAT* H, const FLOAT* X, UINT32 nTaps);
+
+typedef struct resamplerkernel {
+	RESAMPLERMACINTERLEAVED pMacInterleaved;	// Kernel for SRC of interleaved capture packets
+	RESAMPLERMACPLANAR pMacPlanar;				// Kernel for SRC of planar ring buffer channels
+	const CHAR* sName;
+} RESAMPLERKERNEL;
+
+/// <summary>
+/// <para>Picks the widest MAC kernels supported by the CPU the process runs on.</para>
+/// <para>Checks for AVX2 (with OS support for YMM state) and SSE2 on x86/x64, and NEON on ARM64,
+/// falls back to portable scalar kernels otherwise.</para>
+/// <para>Note: all kernels use separate multiply and add, so results are identical
+/// up to the order of summation.</para>
+/// </summary>
+/// <returns>Set of kernels to use for the lifetime of the process.</returns>
+RESAMPLERKERNEL SelectResamplerKernel();
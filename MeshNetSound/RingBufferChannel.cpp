@@ -1,246 +1,257 @@
 #include "RingBufferChannel.h"
 
+#pragma comment(lib, "onecore.lib")
+#pragma comment(lib, "Synchronization.lib")
+
 UINT32 RingBufferChannel::nNewInstance{ 0 };
 
-RingBufferChannel::RingBufferChannel()
+RingBufferChannel::RingBufferChannel(UINT32 nFrames)
 {
-	// Initialize read/write locks for ring buffer read and write offset
-	InitializeSRWLock(&this->srwWriteOffset);
-	InitializeSRWLock(&this->srwReadOffset);
-	InitializeSRWLock(&this->srwWriteAheadReadByLap);
-    InitializeSRWLock(&this->srwFramesAvailable);
-}
+	// Round capacity up to a power of two, so that any offset wraps with a mask
+	UINT32 nBufferSize = 1;
+	while (nBufferSize < nFrames && nBufferSize < 0x80000000) nBufferSize <<= 1;
 
-RingBufferChannel::~RingBufferChannel()
-{
+	// Both views of a mirrored ring must start on an allocation granularity boundary,
+	// which is a power of two too, so rounding the capacity keeps the mask valid
+	if (RINGBUFFER_MIRRORED)
+	{
+		SYSTEM_INFO tSystemInfo;
+		GetSystemInfo(&tSystemInfo);
+		while (sizeof(FLOAT) * (SIZE_T)nBufferSize < tSystemInfo.dwAllocationGranularity) nBufferSize <<= 1;
 
-}
+		this->MapMirrored(sizeof(FLOAT) * (SIZE_T)nBufferSize);
+	}
 
-BOOL RingBufferChannel::BindAudioEffect(AudioEffect* pAudioEffect)
-{
-	// Return FALSE if the audio effect is already bound to the ring buffer channel
-	if (this->nAudioEffect > 0 && pAudioEffect != NULL)
-		for (UINT32 i = 0; i < this->nAudioEffect; i++)
-			if (this->pAudioEffectMap[i].pAudioEffect == pAudioEffect) return FALSE;
-	
-	// Else bind it
-	AUDIOEFFECTMAPEL* dummy;
-
-	// If the list of bound effects is empty
-	if (this->pAudioEffectMap == NULL)
-		dummy = (AUDIOEFFECTMAPEL*)malloc(sizeof(AUDIOEFFECTMAPEL));
-	// If the list of bound effects is non-empty
-	else
-		dummy = (AUDIOEFFECTMAPEL*)realloc(this->pAudioEffectMap, (this->nAudioEffect + 1) * sizeof(AUDIOEFFECTMAPEL));
+	SIZE_T nBytes = sizeof(FLOAT) * (SIZE_T)nBufferSize;
 
-	// If allocation succeeded, update pointer
-	if (dummy != NULL)
-		this->pAudioEffectMap = dummy;
-	// Else return FALSE
-	else
-		return FALSE;
+	// Large pages only pay off for rings spanning at least one, smaller ones stay on the heap
+	if (RINGBUFFER_LARGE_PAGES && this->pBuffer == NULL)
+	{
+		SIZE_T nLargePage = GetLargePageMinimum();
+		if (nLargePage > 0 && nBytes >= nLargePage)
+		{
+			// Fails without SeLockMemoryPrivilege or if physical memory is too fragmented
+			this->pBuffer = (FLOAT*)VirtualAlloc(NULL, (nBytes + nLargePage - 1) & ~(nLargePage - 1), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			this->bLargePages = (this->pBuffer != NULL);
+		}
+	}
 
-	// Record new audio effect's pointer and set its consumed status to 0
-	this->pAudioEffectMap[this->nAudioEffect].pAudioEffect = pAudioEffect;
-	this->pAudioEffectMap[this->nAudioEffect].bConsumed = 0;
-	// Increment number of audio effects consuming this ring buffer channel
-	this->nAudioEffect++;
+	if (this->pBuffer == NULL)
+		this->pBuffer = (FLOAT*)_aligned_malloc(nBytes, RINGBUFFER_CACHE_LINE);
 
-	return TRUE;
+	// Start out with silence
+	if (this->pBuffer != NULL)
+	{
+		memset(this->pBuffer, 0, nBytes);
+		this->nBufferSize = nBufferSize;
+		this->nBufferMask = nBufferSize - 1;
+	}
+
+	// Default cursor and all AudioEffect slots start empty at the beginning of the buffer
+	this->tDefaultCursor.nRead.store(0, std::memory_order_relaxed);
+	this->tDefaultCursor.pAudioEffect.store(NULL, std::memory_order_relaxed);
+
+	for (UINT32 i = 0; i < RINGBUFFER_MAX_CONSUMERS; i++)
+	{
+		this->pCursor[i].nRead.store(0, std::memory_order_relaxed);
+		this->pCursor[i].pAudioEffect.store(NULL, std::memory_order_relaxed);
+	}
 }
 
-BOOL RingBufferChannel::UnbindAudioEffect(AudioEffect* pAudioEffect)
+RingBufferChannel::~RingBufferChannel()
 {
-	if (this->nAudioEffect == 0) return TRUE;
-
-	// Return FALSE if the audio effect was not found bound to the ring buffer channel
-	BOOL bFound = FALSE;
-	if (this->nAudioEffect > 0 && pAudioEffect != NULL)
-		for (UINT32 i = 0; i < this->nAudioEffect; i++)
-			if (this->pAudioEffectMap[i].pAudioEffect == pAudioEffect) bFound = TRUE;
+	if (this->bMirrored)
+	{
+		UnmapViewOfFile(this->pBuffer + this->nBufferSize);
+		UnmapViewOfFile(this->pBuffer);
+	}
+	else if (this->bLargePages)
+		VirtualFree(this->pBuffer, 0, MEM_RELEASE);
+	else
+		_aligned_free(this->pBuffer);
+}
 
-	if (!bFound) return FALSE;
+BOOL RingBufferChannel::BindAudioEffect(AudioEffect* pAudioEffect)
+{
+	// Return FALSE if the audio effect is invalid or already bound to the ring buffer channel
+	if (pAudioEffect == NULL || this->GetCursor(pAudioEffect) != NULL) return FALSE;
 
-	// If no more audio effects associated remain, free array and return with TRUE
-	if ((this->nAudioEffect - 1) == 0)
+	for (UINT32 i = 0; i < RINGBUFFER_MAX_CONSUMERS; i++)
 	{
-		free(this->pAudioEffectMap);
-		this->pAudioEffectMap = NULL;
-		this->nAudioEffect = 0;
+		// Reserve the first free slot, the cursors of bound consumers are never touched
+		AudioEffect* pFree = NULL;
+		if (!this->pCursor[i].pAudioEffect.compare_exchange_strong(pFree, RINGBUFFER_CURSOR_RESERVED, std::memory_order_acq_rel))
+			continue;
+
+		// Start reading from the newest frame, otherwise the new consumer would hold back the reclaim point
+		// while the slot is published and the producer could overrun it right away
+		this->pCursor[i].nRead.store(this->nWrite.load(std::memory_order_acquire), std::memory_order_relaxed);
+
+		// Publish, the release pairs with the acquire in GetCursor and GetFramesFree
+		this->pCursor[i].pAudioEffect.store(pAudioEffect, std::memory_order_release);
+		this->nAudioEffect.fetch_add(1, std::memory_order_release);
 		return TRUE;
 	}
 
-	// If some nodes still remain, create a placeholder for new array
-	AUDIOEFFECTMAPEL* dummy = (AUDIOEFFECTMAPEL*)malloc((this->nAudioEffect - 1) * sizeof(AUDIOEFFECTMAPEL));
+	// All slots are taken
+	return FALSE;
+}
+
+BOOL RingBufferChannel::UnbindAudioEffect(AudioEffect* pAudioEffect)
+{
+	if (pAudioEffect == NULL) return FALSE;
 
-	// If allocation succeeded, update pointer
-	if (dummy != NULL)
+	for (UINT32 i = 0; i < RINGBUFFER_MAX_CONSUMERS; i++)
 	{
-		// Copy all but the requested audio effect associations into the new array
-		for (UINT32 i = 0, j = 0; i < this->nAudioEffect; i++, j++)
-			dummy[i] = (this->pAudioEffectMap[j].pAudioEffect == pAudioEffect) ? 
-				this->pAudioEffectMap[++j] : 
-				this->pAudioEffectMap[j];
-
-		// Free old memory and update pointer
-		free(this->pAudioEffectMap);
-		this->pAudioEffectMap = dummy;
+		AudioEffect* pBound = pAudioEffect;
+		if (this->pCursor[i].pAudioEffect.compare_exchange_strong(pBound, NULL, std::memory_order_acq_rel))
+		{
+			this->nAudioEffect.fetch_sub(1, std::memory_order_release);
+			return TRUE;
+		}
 	}
-	// Else return FALSE
-	else
-		return FALSE;
 
-	// Only when everything succeeded, update number of associated audio effects
-	this->nAudioEffect--;
-
-	return TRUE;
+	// Return FALSE if the audio effect was not found bound to the ring buffer channel
+	return FALSE;
 }
 
 UINT32 RingBufferChannel::GetFramesAvailable()
 {
-    return (this->nWriteOffset > this->nReadOffset) ?
-        (this->nWriteOffset - this->nReadOffset) :                      // data to read is linear
-        (this->nBufferSize - this->nReadOffset + this->nWriteOffset);   // data to read is circular
+	return this->GetFramesAvailable(NULL);
+}
+
+UINT32 RingBufferChannel::GetFramesAvailable(AudioEffect* pAudioEffect)
+{
+	RINGBUFFERCURSOR* pCursor = this->GetCursor(pAudioEffect);
+	if (pCursor == NULL) return 0;
+
+	// Acquire pairs with the release in CommitWrite: frames below the loaded index are visible to this thread.
+	// Does not move the cursor, as the producer may query the fill level too (i.e. for drift tracking)
+	UINT64 nRead = pCursor->nRead.load(std::memory_order_acquire);
+	UINT64 nWrite = this->nWrite.load(std::memory_order_acquire);
+
+	// A lapped consumer skips ahead to the oldest frame still in the buffer on its next read
+	return (UINT32)min(nWrite - nRead, (UINT64)this->nBufferSize);
 }
 
-BOOL RingBufferChannel::SetConsumedFlag(AudioEffect* pEffect)
+UINT32 RingBufferChannel::GetFramesFree()
 {
-    for (UINT32 i = 0; i < this->nAudioEffect; i++)
-        if (this->pAudioEffectMap[i].pAudioEffect == pEffect)
-        {
-            this->pAudioEffectMap[i].bConsumed = TRUE;
-            return TRUE;
-        }
-
-    return FALSE;
+	UINT64 nWrite = this->nWrite.load(std::memory_order_relaxed);
+	UINT64 nReclaim = nWrite;
+
+	// Slowest bound AudioEffect sets the reclaim point, the default consumer only when none are bound
+	if (this->nAudioEffect.load(std::memory_order_acquire) > 0)
+	{
+		for (UINT32 i = 0; i < RINGBUFFER_MAX_CONSUMERS; i++)
+		{
+			// A slot still being bound holds the previous consumer's cursor
+			AudioEffect* pBound = this->pCursor[i].pAudioEffect.load(std::memory_order_acquire);
+			if (pBound != NULL && pBound != RINGBUFFER_CURSOR_RESERVED)
+				nReclaim = min(nReclaim, this->pCursor[i].nRead.load(std::memory_order_acquire));
+		}
+	}
+	else
+		nReclaim = this->tDefaultCursor.nRead.load(std::memory_order_acquire);
+
+	// Full, or the slowest consumer is lapped and has yet to skip ahead
+	return (nWrite - nReclaim >= this->nBufferSize) ? 0 : (UINT32)(this->nBufferSize - (nWrite - nReclaim));
 }
 
-BOOL RingBufferChannel::IsReadByAll()
+BOOL RingBufferChannel::WaitForFrames(UINT32 nFrames, DWORD dwMilliseconds)
 {
-    for (UINT32 i = 0; i < this->nAudioEffect; i++)
-        if (this->pAudioEffectMap[i].bConsumed == FALSE) return FALSE;
-    
-    return TRUE;
+	return this->WaitForFrames(NULL, nFrames, dwMilliseconds);
 }
 
-BOOL RingBufferChannel::ReadNextPacket(AudioEffect* pEffect)
+BOOL RingBufferChannel::WaitForFrames(AudioEffect* pAudioEffect, UINT32 nFrames, DWORD dwMilliseconds)
 {
-    //AcquireSRWLockShared(&this->srwFramesAvailable);
+	RINGBUFFERCURSOR* pCursor = this->GetCursor(pAudioEffect);
+	if (pCursor == NULL) return FALSE;
 
-    // Feed data to the calling audio effect thread into the provided callback
-    DSPPACKET iDSPPacket = {
-        this,
-        this->nFramesAvailable
-    };
-    pEffect->Process(&iDSPPacket);
+	// A watermark above the capacity could never be reached
+	nFrames = min(max(nFrames, (UINT32)1), this->nBufferSize);
 
-    this->SetConsumedFlag(pEffect);
+	ULONGLONG nDeadline = GetTickCount64() + dwMilliseconds;
 
-    if (this->IsReadByAll())
-    {
-        //////////////////////////////////////////////////////////////////////////////
-        //////////////// TODO: Remove chunk lock, update read offset, ////////////////
-        ////////////////       clear condition variable if no more    //////////////// 
-        ////////////////       data available yet                     ////////////////
-        //////////////////////////////////////////////////////////////////////////////
-        // Update read pointer respecting the circular buffer traversal
-        this->nReadOffset = (this->nReadOffset + this->nFramesAvailable) % this->nBufferSize;
+	while (TRUE)
+	{
+		UINT64 nWrite = this->nWrite.load(std::memory_order_acquire);
+		UINT64 nRead = pCursor->nRead.load(std::memory_order_acquire);
+		if (nWrite - nRead >= nFrames) return TRUE;
 
-        this->bWriteAheadReadByLap = (this->nReadOffset > this->nWriteOffset);
-    }
+		// Lower the wake-up point to this consumer's watermark, unless another one waits for less
+		UINT64 nTarget = nRead + nFrames;
+		UINT64 nWakeAt = this->nWakeAt.load(std::memory_order_relaxed);
+		while (nTarget < nWakeAt && !this->nWakeAt.compare_exchange_weak(nWakeAt, nTarget, std::memory_order_acq_rel));
 
-    //ReleaseSRWLockShared(&this->srwFramesAvailable);
+		// Pairs with the fence in CommitWrite: either the producer sees the watermark, or this load sees its commit
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (this->nWrite.load(std::memory_order_acquire) != nWrite) continue;
 
-    return TRUE;
-}
+		ULONGLONG nNow = GetTickCount64();
+		if (nNow >= nDeadline) return FALSE;
 
-HRESULT RingBufferChannel::WriteNextPacket(AudioEffect* pEffect)
-{
-    // Output DSP'ed data into the output ring buffer
-
-    // Get pointer to the processed data buffer
-    FLOAT* pData = pEffect->GetResult(this);
-    UINT32 nSamplesWritten = pEffect->GetNumSamples(this);
-
-    if ((this->nWriteOffset + nSamplesWritten) < this->nBufferSize)
-    {
-        // If moving data does not result in circular traversal of ring buffer, copy data directly in chunk
-        memcpy(this->pBuffer + this->nWriteOffset,
-            pData,
-            sizeof(FLOAT) * nSamplesWritten);
-    }
-    else
-    {
-        // If moving data will result in circular traversal of ring buffer,
-        // first copy only the data up till the end of ring buffer
-        memcpy(this->pBuffer + this->nWriteOffset,
-            pData,
-            sizeof(FLOAT) * (nSamplesWritten - ((this->nWriteOffset + nSamplesWritten) % this->nBufferSize)));
-
-        // Then copy the rest into the beginning of the ring buffer, 
-        // don't forget to offset into the source buffer by the number of samples written previously
-        memcpy(this->pBuffer,
-            pData + (nSamplesWritten - ((this->nWriteOffset + nSamplesWritten) % this->nBufferSize)),
-            sizeof(FLOAT) * ((this->nWriteOffset + nSamplesWritten) % this->nBufferSize));
-    }
-
-    //-------------------- End --------------------//
-    UINT32 nWriteOffsetOld = this->nWriteOffset, nReadOffsetOld = this->nReadOffset;
-    UINT32 nWriteOffsetNew = (nWriteOffsetOld + nSamplesWritten) % this->nBufferSize;
-    BOOL bWriteAheadReadByLap = this->bWriteAheadReadByLap;
-
-    // Update the offset to position after the last frame of the current chunk
-    this->nWriteOffset = nWriteOffsetNew;
-
-    // If write offset exceeded read offset by a whole lap, update read offset to the position of write offset,
-    // hence drop frames that were delayed and try to catch up from the new position
-    if (((nWriteOffsetOld > nReadOffsetOld || (bWriteAheadReadByLap && nWriteOffsetOld == nReadOffsetOld)) &&
-        nWriteOffsetNew > nReadOffsetOld &&
-        nWriteOffsetNew < nWriteOffsetOld) ||
-        ((nWriteOffsetOld < nReadOffsetOld || (bWriteAheadReadByLap && nWriteOffsetOld == nReadOffsetOld)) &&
-            nWriteOffsetNew < nReadOffsetOld &&
-            nWriteOffsetNew < nWriteOffsetOld) ||
-        ((nWriteOffsetOld < nReadOffsetOld || (bWriteAheadReadByLap && nWriteOffsetOld == nReadOffsetOld)) &&
-            nWriteOffsetNew > nReadOffsetOld))
-    {
-        // Set read offset from the same point as the last non-overwritten sample
-        this->nReadOffset = nWriteOffsetNew;
-    }
-
-    // Write offset catching up on read offset from the left (lower array indices)
-    // indicating that if both match and write offset increased, then read offset is 
-    // about to read overwritten newest data - not good, jump to the oldest valid instead
-    this->bWriteAheadReadByLap = (
-        (nWriteOffsetNew <= nReadOffsetOld && nWriteOffsetOld > nReadOffsetOld) ||
-        (nWriteOffsetNew <= nReadOffsetOld && nWriteOffsetOld < nWriteOffsetNew)
-    );
-
-    return ERROR_SUCCESS;
+		// Returns at once if the producer published anything since the load above
+		WaitOnAddress(&this->nWrite, &nWrite, sizeof(UINT64), (DWORD)(nDeadline - nNow));
+	}
 }
 
-BOOL RingBufferChannel::PrepareToPullDataIn()
+BOOL RingBufferChannel::ReadNextPacket(AudioEffect* pEffect)
 {
-    
+	if (this->GetCursor(pEffect) == NULL) return FALSE;
 
-    return TRUE;
-}
+	// Feed data to the calling audio effect thread into the provided callback,
+	// no more than the AudioEffect can output in one go
+	UINT32 nFrames = min(this->GetFramesAvailable(pEffect), (UINT32)AUDIOEFFECT_OUTPUT_BUFFER_SIZE);
+	if (nFrames == 0) return TRUE;
 
-BOOL RingBufferChannel::FinishToPullDataIn()
-{
+	DSPPACKET iDSPPacket = {
+		this,
+		nFrames
+	};
+	pEffect->Process(&iDSPPacket);
+
+	// Hand the frames back to the producer only once the AudioEffect is done with them
+	this->CommitRead(pEffect, nFrames);
 
 	return TRUE;
 }
 
-BOOL RingBufferChannel::PrepareToPushDataOut()
+HRESULT RingBufferChannel::WriteNextPacket(AudioEffect* pEffect)
 {
+	// Output DSP'ed data into the output ring buffer
 
-	return TRUE;
-}
+	// Get pointer to the processed data buffer
+	FLOAT* pData = pEffect->GetResult(this);
+	UINT32 nSamplesWritten = pEffect->GetNumSamples(this);
+	UINT32 nWriteOffset = this->GetWriteOffset();
 
-BOOL RingBufferChannel::FinishToPushDataOut()
-{
+	if ((nWriteOffset + nSamplesWritten) < this->nBufferSize || this->bMirrored)
+	{
+		// If moving data does not result in circular traversal of ring buffer, 
+		// or the mirror view takes the overflow, copy data directly in chunk
+		memcpy(this->pBuffer + nWriteOffset,
+			pData,
+			sizeof(FLOAT) * nSamplesWritten);
+	}
+	else
+	{
+		// If moving data will result in circular traversal of ring buffer,
+		// first copy only the data up till the end of ring buffer
+		memcpy(this->pBuffer + nWriteOffset,
+			pData,
+			sizeof(FLOAT) * (this->nBufferSize - nWriteOffset));
+
+		// Then copy the rest into the beginning of the ring buffer, 
+		// don't forget to offset into the source buffer by the number of samples written previously
+		memcpy(this->pBuffer,
+			pData + (this->nBufferSize - nWriteOffset),
+			sizeof(FLOAT) * (nSamplesWritten - (this->nBufferSize - nWriteOffset)));
+	}
 
-	return TRUE;
+	// Publish the frames only after they are in place
+	this->CommitWrite(nSamplesWritten);
+
+	return ERROR_SUCCESS;
 }
 
 UINT32 RingBufferChannel::GetBufferSize()
@@ -248,37 +259,144 @@ UINT32 RingBufferChannel::GetBufferSize()
 	return this->nBufferSize;
 }
 
+UINT32 RingBufferChannel::GetBufferMask()
+{
+	return this->nBufferMask;
+}
+
 FLOAT* RingBufferChannel::GetBufferPointer()
 {
 	return this->pBuffer;
 }
 
+BOOL RingBufferChannel::IsMirrored()
+{
+	return this->bMirrored;
+}
+
 UINT32 RingBufferChannel::GetWriteOffset()
 {
-	return this->nWriteOffset;
+	// Only the producer advances the write index, so its own view is always current
+	return (UINT32)this->nWrite.load(std::memory_order_relaxed) & this->nBufferMask;
 }
 
-void RingBufferChannel::SetWriteOffset(UINT32 nOffset)
+void RingBufferChannel::CommitWrite(UINT32 nFrames)
 {
-	this->nWriteOffset;
+	UINT64 nWrite = this->nWrite.load(std::memory_order_relaxed) + nFrames;
+	this->nWrite.store(nWrite, std::memory_order_release);
+
+	// Store-then-load on two atomics, release and acquire alone would let this and a waiter both miss the other
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	// Only a single load while no consumer sleeps or the lowest watermark is not reached yet.
+	// Consumers can only lower the wake-up point, so retry until it is either reset here or above the write index
+	UINT64 nWakeAt = this->nWakeAt.load(std::memory_order_acquire);
+	while (nWrite >= nWakeAt)
+	{
+		if (this->nWakeAt.compare_exchange_weak(nWakeAt, MAXUINT64, std::memory_order_acq_rel))
+		{
+			// Sleepers with a higher watermark go back to sleep and register it again
+			WakeByAddressAll(&this->nWrite);
+			break;
+		}
+	}
 }
 
 UINT32 RingBufferChannel::GetReadOffset()
 {
-	return this->nReadOffset;
+	return this->GetReadOffset(NULL);
+}
+
+UINT32 RingBufferChannel::GetReadOffset(AudioEffect* pAudioEffect)
+{
+	RINGBUFFERCURSOR* pCursor = this->GetCursor(pAudioEffect);
+	if (pCursor == NULL) pCursor = &this->tDefaultCursor;
+
+	return (UINT32)this->Resync(pCursor) & this->nBufferMask;
+}
+
+void RingBufferChannel::CommitRead(UINT32 nFrames)
+{
+	this->CommitRead(NULL, nFrames);
+}
+
+void RingBufferChannel::CommitRead(AudioEffect* pAudioEffect, UINT32 nFrames)
+{
+	RINGBUFFERCURSOR* pCursor = this->GetCursor(pAudioEffect);
+	if (pCursor == NULL) return;
+
+	// Never move past the producer, release pairs with the acquire in GetFramesFree
+	UINT64 nRead = this->Resync(pCursor);
+	UINT64 nWrite = this->nWrite.load(std::memory_order_acquire);
+	pCursor->nRead.store(min(nRead + nFrames, nWrite), std::memory_order_release);
 }
 
-void RingBufferChannel::SetReadOffset(UINT32 nOffset)
+RINGBUFFERCURSOR* RingBufferChannel::GetCursor(AudioEffect* pAudioEffect)
 {
-	this->nReadOffset = nOffset;
+	if (pAudioEffect == NULL) return &this->tDefaultCursor;
+
+	for (UINT32 i = 0; i < RINGBUFFER_MAX_CONSUMERS; i++)
+		if (this->pCursor[i].pAudioEffect.load(std::memory_order_acquire) == pAudioEffect)
+			return &this->pCursor[i];
+
+	return NULL;
 }
 
-BOOL RingBufferChannel::GetWriteAheadReadByLap()
+UINT64 RingBufferChannel::Resync(RINGBUFFERCURSOR* pCursor)
 {
-	return this->bWriteAheadReadByLap;
+	UINT64 nRead = pCursor->nRead.load(std::memory_order_relaxed);
+	UINT64 nWrite = this->nWrite.load(std::memory_order_acquire);
+
+	// If the producer overran this consumer, drop the overwritten frames and
+	// continue from the oldest frame still in the buffer
+	if (nWrite - nRead > this->nBufferSize)
+	{
+		nRead = nWrite - this->nBufferSize;
+		pCursor->nRead.store(nRead, std::memory_order_release);
+	}
+
+	return nRead;
 }
 
-void RingBufferChannel::SetWriteAheadReadByLap(BOOL bAhead)
+BOOL RingBufferChannel::MapMirrored(SIZE_T nBytes)
 {
-	this->bWriteAheadReadByLap = bAhead;
+	// Reserve address space for both views at once, then split it into 2 adjacent placeholders
+	BYTE* pPlaceholder = (BYTE*)VirtualAlloc2(NULL, NULL, 2 * nBytes, MEM_RESERVE | MEM_RESERVE_PLACEHOLDER, PAGE_NOACCESS, NULL, 0);
+	if (pPlaceholder == NULL) return FALSE;
+
+	if (!VirtualFree(pPlaceholder, nBytes, MEM_RELEASE | MEM_PRESERVE_PLACEHOLDER))
+	{
+		VirtualFree(pPlaceholder, 0, MEM_RELEASE);
+		return FALSE;
+	}
+
+	// Pagefile-backed section holding the samples once
+	HANDLE hSection = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((UINT64)nBytes >> 32), (DWORD)nBytes, NULL);
+
+	// Map it into both placeholders, the second view aliases the first one's pages
+	void* pView = (hSection != NULL) ? 
+		MapViewOfFile3(hSection, NULL, pPlaceholder, 0, nBytes, MEM_REPLACE_PLACEHOLDER, PAGE_READWRITE, NULL, 0) : 
+		NULL;
+	void* pMirror = (pView != NULL) ? 
+		MapViewOfFile3(hSection, NULL, pPlaceholder + nBytes, 0, nBytes, MEM_REPLACE_PLACEHOLDER, PAGE_READWRITE, NULL, 0) : 
+		NULL;
+
+	// Views keep the section alive on their own
+	if (hSection != NULL) CloseHandle(hSection);
+
+	if (pMirror == NULL)
+	{
+		// Release whatever still occupies either half of the reservation
+		if (pView != NULL)
+			UnmapViewOfFile(pView);
+		else
+			VirtualFree(pPlaceholder, 0, MEM_RELEASE);
+		VirtualFree(pPlaceholder + nBytes, 0, MEM_RELEASE);
+		return FALSE;
+	}
+
+	this->pBuffer = (FLOAT*)pView;
+	this->bMirrored = TRUE;
+
+	return TRUE;
 }
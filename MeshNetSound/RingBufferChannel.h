@@ -1,81 +1,215 @@
 #pragma once
 #include <windows.h>
+#include <atomic>
 #include "config.h"
 #include "AudioEffect.h"
 
-typedef struct AudioEffectMapEl {
-	AudioEffect* pAudioEffect;
-	BOOL bConsumed;
-} AUDIOEFFECTMAPEL;
-
+// Marks a cursor slot claimed by BindAudioEffect whose read index is not set yet
+#define RINGBUFFER_CURSOR_RESERVED ((AudioEffect*)(UINT_PTR)1)
+
+/// <summary>
+/// <para>Read position of a single consumer of the ring buffer channel.</para>
+/// <para>Padded to a cache line so that consumers running on different cores
+/// do not invalidate each other's, or the producer's, cache lines when advancing.</para>
+/// </summary>
+typedef struct alignas(RINGBUFFER_CACHE_LINE) RingBufferCursor {
+	std::atomic<UINT64> nRead;						// Frames consumed since creation of the channel, never wraps
+	std::atomic<AudioEffect*> pAudioEffect;			// Consumer owning the cursor, NULL if the slot is free, RINGBUFFER_CURSOR_RESERVED while binding
+} RINGBUFFERCURSOR;
+
+/// <summary>
+/// <para>Lock-free single producer, multiple consumer ring buffer of one audio channel.</para>
+/// <para>Producer and consumers exchange monotonically increasing frame counters with
+/// acquire/release ordering: the producer publishes frames by a release store of the write index
+/// after filling them, each consumer releases frames by a release store of its own cursor after reading them.</para>
+/// <para>Each bound AudioEffect owns a cursor and may read concurrently with the others.
+/// Without bound AudioEffects, the default cursor is used (i.e. by AudioBuffer feeding a render device).
+/// The slowest consumer sets the reclaim point up to which the producer may overwrite frames.</para>
+/// <para>Note: producer never blocks. If it overruns a consumer, that consumer skips ahead to the oldest
+/// frame still in the buffer on its next read.</para>
+/// </summary>
 class RingBufferChannel
 {
 	public:
-		RingBufferChannel();
+		/// <summary>
+		/// <para>Allocates a ring of at least nFrames samples, rounded up to a power of two
+		/// so that offsets wrap with a mask instead of a division.</para>
+		/// <para>Samples are aligned to a cache line. With RINGBUFFER_LARGE_PAGES, rings spanning
+		/// a large page are backed by large pages when the process may lock them.</para>
+		/// <para>With RINGBUFFER_MIRRORED, the samples are mapped twice back to back, so that
+		/// GetBufferPointer() + offset is contiguous for up to the size of the buffer.
+		/// Capacity then is at least one allocation granularity, falls back to a plain buffer if mapping fails.</para>
+		/// <para>Note: on allocation failure the buffer pointer is NULL and the size is 0.</para>
+		/// </summary>
+		/// <param name="nFrames">- minimum capacity in frames.</param>
+		RingBufferChannel(UINT32 nFrames = AGGREGATOR_CIRCULAR_BUFFER_SIZE);
 
 		~RingBufferChannel();
 
+		/// <summary>
+		/// <para>Claims a read cursor for the AudioEffect starting at the current write index.</para>
+		/// <para>Safe to call while the channel streams.</para>
+		/// </summary>
+		/// <param name="pAudioEffect">- consumer to bind.</param>
+		/// <returns>FALSE if already bound, NULL, or RINGBUFFER_MAX_CONSUMERS are bound already.</returns>
 		BOOL BindAudioEffect(AudioEffect* pAudioEffect);
 
+		/// <summary>
+		/// <para>Releases the read cursor of the AudioEffect, it no longer holds back the reclaim point.</para>
+		/// </summary>
+		/// <param name="pAudioEffect">- consumer to unbind.</param>
+		/// <returns>FALSE if the AudioEffect was not bound.</returns>
 		BOOL UnbindAudioEffect(AudioEffect* pAudioEffect);
 
+		/// <summary>
+		/// <para>Gets number of frames published but not yet read by the default consumer.</para>
+		/// </summary>
+		/// <returns>Number of frames, at most the size of the buffer.</returns>
 		UINT32 GetFramesAvailable();
 
-		BOOL SetConsumedFlag(AudioEffect* pEffect);
-
-		BOOL IsReadByAll();
-
+		/// <summary>
+		/// <para>Gets number of frames published but not yet read by the AudioEffect.</para>
+		/// </summary>
+		/// <param name="pAudioEffect">- bound consumer.</param>
+		/// <returns>Number of frames, at most the size of the buffer, 0 if not bound.</returns>
+		UINT32 GetFramesAvailable(AudioEffect* pAudioEffect);
+
+		/// <summary>
+		/// <para>Gets number of frames the producer can write without overrunning the slowest consumer.</para>
+		/// </summary>
+		/// <returns>Number of free frames.</returns>
+		UINT32 GetFramesFree();
+
+		/// <summary>
+		/// <para>Blocks until at least nFrames frames are available to the default consumer, or the timeout elapses.</para>
+		/// </summary>
+		/// <param name="nFrames">- watermark in frames, clamped to the size of the buffer.</param>
+		/// <param name="dwMilliseconds">- longest time to block.</param>
+		/// <returns>TRUE if the watermark is reached, FALSE on timeout.</returns>
+		BOOL WaitForFrames(UINT32 nFrames, DWORD dwMilliseconds);
+
+		/// <summary>
+		/// <para>Blocks until at least nFrames frames are available to the AudioEffect, or the timeout elapses.</para>
+		/// <para>Sleeps on the write index with WaitOnAddress, the producer wakes sleepers only once
+		/// it publishes past the lowest watermark, so idle consumers cost no CPU and busy ones no syscalls.</para>
+		/// </summary>
+		/// <param name="pAudioEffect">- bound consumer.</param>
+		/// <param name="nFrames">- watermark in frames, clamped to the size of the buffer.</param>
+		/// <param name="dwMilliseconds">- longest time to block.</param>
+		/// <returns>TRUE if the watermark is reached, FALSE on timeout or if not bound.</returns>
+		BOOL WaitForFrames(AudioEffect* pAudioEffect, UINT32 nFrames, DWORD dwMilliseconds);
+
+		/// <summary>
+		/// <para>Feeds the frames available to the AudioEffect into its callback and advances its cursor.</para>
+		/// <para>Note: must be called only from the thread running the AudioEffect.</para>
+		/// </summary>
+		/// <param name="pEffect">- bound consumer.</param>
+		/// <returns>FALSE if the AudioEffect is not bound.</returns>
 		BOOL ReadNextPacket(AudioEffect* pEffect);
 
+		/// <summary>
+		/// <para>Copies the AudioEffect's processed frames for this channel into the buffer and publishes them.</para>
+		/// <para>Note: must be called only from the single producer thread of the channel.</para>
+		/// </summary>
+		/// <param name="pEffect">- AudioEffect holding the processed frames.</param>
+		/// <returns>ERROR_SUCCESS.</returns>
 		HRESULT WriteNextPacket(AudioEffect* pEffect);
 
+		UINT32 GetBufferSize();
 
+		/// <summary>
+		/// <para>Gets mask that wraps any index into the buffer, equal to the size less one.</para>
+		/// </summary>
+		/// <returns>Index mask.</returns>
+		UINT32 GetBufferMask();
 
-		BOOL PrepareToPullDataIn();
-
-		BOOL FinishToPullDataIn();
-
-		BOOL PrepareToPushDataOut();
-
-		BOOL FinishToPushDataOut();
-
-		
-		UINT32 GetBufferSize();
+		/// <summary>
+		/// <para>Checks if the samples are mapped twice back to back.</para>
+		/// </summary>
+		/// <returns>TRUE if any span of up to the size of the buffer starting at any offset is contiguous.</returns>
+		BOOL IsMirrored();
 
 		FLOAT* GetBufferPointer();
 
+		/// <summary>
+		/// <para>Gets index into the buffer at which the producer writes the next frame.</para>
+		/// </summary>
+		/// <returns>Write offset.</returns>
 		UINT32 GetWriteOffset();
 
-		void SetWriteOffset(UINT32 nOffset);
-
+		/// <summary>
+		/// <para>Publishes nFrames frames the producer wrote starting at the write offset.</para>
+		/// <para>Release store: consumers observing the new write index also observe the frames.</para>
+		/// <para>Wakes consumers blocked in WaitForFrames if their watermark is reached.</para>
+		/// </summary>
+		/// <param name="nFrames">- number of frames written.</param>
+		void CommitWrite(UINT32 nFrames);
+
+		/// <summary>
+		/// <para>Gets index into the buffer of the next frame of the default consumer.</para>
+		/// <para>Skips the cursor ahead if the producer has overrun it.</para>
+		/// </summary>
+		/// <returns>Read offset.</returns>
 		UINT32 GetReadOffset();
 
-		void SetReadOffset(UINT32 nOffset);
-
-		BOOL GetWriteAheadReadByLap();
-
-		void SetWriteAheadReadByLap(BOOL bAhead);
+		/// <summary>
+		/// <para>Gets index into the buffer of the next frame of the AudioEffect.</para>
+		/// <para>Skips the cursor ahead if the producer has overrun it.</para>
+		/// </summary>
+		/// <param name="pAudioEffect">- bound consumer.</param>
+		/// <returns>Read offset, that of the default consumer if not bound.</returns>
+		UINT32 GetReadOffset(AudioEffect* pAudioEffect);
+
+		/// <summary>
+		/// <para>Releases nFrames frames read by the default consumer back to the producer.</para>
+		/// </summary>
+		/// <param name="nFrames">- number of frames read.</param>
+		void CommitRead(UINT32 nFrames);
+
+		/// <summary>
+		/// <para>Releases nFrames frames read by the AudioEffect back to the producer.</para>
+		/// </summary>
+		/// <param name="pAudioEffect">- bound consumer.</param>
+		/// <param name="nFrames">- number of frames read.</param>
+		void CommitRead(AudioEffect* pAudioEffect, UINT32 nFrames);
 
 	private:
-		FLOAT				pBuffer[AGGREGATOR_CIRCULAR_BUFFER_SIZE]	{ 0 };
-
-		UINT32				nWriteOffset					{ 0 },
-							nReadOffset						{ 0 },
-							nAudioEffect					{ 0 },
-							nBufferSize						{ AGGREGATOR_CIRCULAR_BUFFER_SIZE },
-							nFramesAvailable				{ 0 };
-
-		BOOL				bWriteAheadReadByLap			{ FALSE };
-
-		AUDIOEFFECTMAPEL	*pAudioEffectMap				{ NULL };
-
-		SRWLOCK				srwWriteOffset,					// R/W Locks protect buffer offset variables from being overwritten by 
-							srwReadOffset,					// a producer thread while a consumer thread uses them.
-							srwWriteAheadReadByLap,			// Ensures that ring buffer samples of a corresponding device can be
-							srwFramesAvailable;				// overwritten (in case consumer is slower than producer, i.e DSP vs. capture)
-															// only when no consumer thread is in the process of reading data 
-															// from the ring buffer.
+		/// <summary>
+		/// <para>Looks up the cursor of the AudioEffect, default cursor for NULL.</para>
+		/// </summary>
+		/// <returns>Pointer to the cursor or NULL if not bound.</returns>
+		RINGBUFFERCURSOR* GetCursor(AudioEffect* pAudioEffect);
+
+		/// <summary>
+		/// <para>Maps a pagefile-backed section of nBytes twice into adjacent placeholders.</para>
+		/// </summary>
+		/// <param name="nBytes">- size of the section, multiple of the allocation granularity.</param>
+		/// <returns>TRUE on success, leaves no reservation behind otherwise.</returns>
+		BOOL MapMirrored(SIZE_T nBytes);
+
+		/// <summary>
+		/// <para>Moves the cursor past frames the producer has already overwritten.</para>
+		/// </summary>
+		/// <returns>Position of the cursor.</returns>
+		UINT64 Resync(RINGBUFFERCURSOR* pCursor);
+
+		FLOAT				*pBuffer						{ NULL };
+
+		UINT32				nBufferSize						{ 0 },		// Power of two
+							nBufferMask						{ 0 };
+
+		BOOL				bLargePages						{ FALSE },	// Buffer comes from VirtualAlloc rather than the heap
+							bMirrored						{ FALSE };	// Buffer is followed by a second view of the same pages
+
+		// Producer-owned index on its own cache line, away from the consumers' cursors
+		alignas(RINGBUFFER_CACHE_LINE)
+		std::atomic<UINT64>	nWrite							{ 0 },		// Frames published since creation of the channel, never wraps
+							nWakeAt							{ MAXUINT64 };	// Lowest write index a blocked consumer waits for
+
+		RINGBUFFERCURSOR	tDefaultCursor;									// Cursor of the consumer that is not an AudioEffect
+		RINGBUFFERCURSOR	pCursor[RINGBUFFER_MAX_CONSUMERS];				// Cursors of bound AudioEffects
+		std::atomic<UINT32>	nAudioEffect					{ 0 };		// Number of bound AudioEffects
 
 		UINT32				nInstance;						
-		static UINT32		nNewInstance;					
+		static UINT32		nNewInstance;
 };
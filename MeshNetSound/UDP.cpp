@@ -7,12 +7,13 @@ SOCKET* CreateSocketUDP()
 	SOCKET* pUDPSocket = (SOCKET*)malloc(sizeof(SOCKET));
 	if (pUDPSocket == NULL) return NULL;
 
-	if ((*pUDPSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET)
+	if ((*pUDPSocket = WSASocket(AF_INET, SOCK_DGRAM, IPPROTO_UDP, NULL, 0, WSA_FLAG_REGISTERED_IO)) == INVALID_SOCKET)
 	{
 		std::cout << ERR << "Failed creating a UDP socket. Error Code: "
 			<< WSAGetLastError()
 			<< std::endl;
 		
+		free(pUDPSocket);
 		return NULL;
 	}
 	std::cout << ERR << "Successfully created a UDP socket." << std::endl;
@@ -29,3 +30,165 @@ void CloseSocketUDP(SOCKET* pUDPSocket)
 		pUDPSocket = NULL;
 	}
 }
+
+UDPBATCH* CreateBatchUDP(SOCKET* pUDPSocket)
+{
+	GUID tRIOGuid = WSAID_MULTIPLE_RIO;
+	DWORD nBytes = 0;
+	DWORD nSlabBytes = UDP_BATCH_PACKETS * (UDP_PACKET_BYTES + sizeof(SOCKADDR_INET));
+	RIO_NOTIFICATION_COMPLETION tNotification = {};
+
+	if (pUDPSocket == NULL) return NULL;
+
+	UDPBATCH* pBatch = new UDPBATCH();
+	pBatch->tRIO.cbSize = sizeof(RIO_EXTENSION_FUNCTION_TABLE);
+	pBatch->hCompletionQueue = RIO_INVALID_CQ;
+	pBatch->hRequestQueue = RIO_INVALID_RQ;
+	pBatch->hSlab = RIO_INVALID_BUFFERID;
+
+	if (WSAIoctl(*pUDPSocket, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &tRIOGuid, sizeof(GUID),
+		&pBatch->tRIO, sizeof(RIO_EXTENSION_FUNCTION_TABLE), &nBytes, NULL, NULL) != 0)
+	{
+		delete pBatch;
+		return NULL;
+	}
+
+	// Page-aligned and locked by the registration, the kernel writes datagrams straight into it
+	pBatch->pSlab = (BYTE*)VirtualAlloc(NULL, nSlabBytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	pBatch->hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+	if (pBatch->pSlab != NULL && pBatch->hEvent != NULL)
+	{
+		pBatch->hSlab = pBatch->tRIO.RIORegisterBuffer((PCHAR)pBatch->pSlab, nSlabBytes);
+
+		tNotification.Type = RIO_EVENT_COMPLETION;
+		tNotification.Event.EventHandle = pBatch->hEvent;
+		tNotification.Event.NotifyReset = TRUE;
+
+		// Sends and receives share the queue, a batch is used for one direction only
+		pBatch->hCompletionQueue = pBatch->tRIO.RIOCreateCompletionQueue(2 * UDP_BATCH_PACKETS, &tNotification);
+	}
+
+	if (pBatch->hSlab != RIO_INVALID_BUFFERID && pBatch->hCompletionQueue != RIO_INVALID_CQ)
+		pBatch->hRequestQueue = pBatch->tRIO.RIOCreateRequestQueue(*pUDPSocket,
+			UDP_BATCH_PACKETS, 1, UDP_BATCH_PACKETS, 1,
+			pBatch->hCompletionQueue, pBatch->hCompletionQueue, NULL);
+
+	if (pBatch->hRequestQueue == RIO_INVALID_RQ)
+	{
+		std::cout << WRN << "Registered I/O unavailable, UDP falls back to a syscall per datagram. Error Code: "
+			<< WSAGetLastError()
+			<< END << std::endl;
+
+		CloseBatchUDP(pBatch);
+		return NULL;
+	}
+
+	return pBatch;
+}
+
+void CloseBatchUDP(UDPBATCH* pBatch)
+{
+	if (pBatch == NULL) return;
+
+	// Request queue goes away with its socket
+	if (pBatch->hCompletionQueue != RIO_INVALID_CQ) pBatch->tRIO.RIOCloseCompletionQueue(pBatch->hCompletionQueue);
+	if (pBatch->hSlab != RIO_INVALID_BUFFERID) pBatch->tRIO.RIODeregisterBuffer(pBatch->hSlab);
+	if (pBatch->pSlab != NULL) VirtualFree(pBatch->pSlab, 0, MEM_RELEASE);
+	if (pBatch->hEvent != NULL) CloseHandle(pBatch->hEvent);
+
+	delete pBatch;
+}
+
+BYTE* GetPacketUDP(UDPBATCH* pBatch, UINT32 nSlot)
+{
+	return pBatch->pSlab + (SIZE_T)nSlot * UDP_PACKET_BYTES;
+}
+
+SOCKADDR_INET* GetPeerUDP(UDPBATCH* pBatch, UINT32 nSlot)
+{
+	return (SOCKADDR_INET*)(pBatch->pSlab + (SIZE_T)UDP_BATCH_PACKETS * UDP_PACKET_BYTES) + nSlot;
+}
+
+BOOL PostReceiveUDP(UDPBATCH* pBatch, UINT32 nSlot, BOOL bCommit)
+{
+	RIO_BUF tData = { pBatch->hSlab, nSlot * UDP_PACKET_BYTES, UDP_PACKET_BYTES };
+	RIO_BUF tPeer = { pBatch->hSlab, UDP_BATCH_PACKETS * UDP_PACKET_BYTES + nSlot * (ULONG)sizeof(SOCKADDR_INET), sizeof(SOCKADDR_INET) };
+
+	// Slot index comes back as the request context of the completion
+	return pBatch->tRIO.RIOReceiveEx(pBatch->hRequestQueue, &tData, 1, NULL, &tPeer, NULL, NULL,
+		bCommit ? 0 : RIO_MSG_DEFER, (PVOID)(ULONG_PTR)nSlot);
+}
+
+UINT32 ReceiveBatchUDP(UDPBATCH* pBatch, DWORD nTimeout)
+{
+	ULONG nResults = pBatch->tRIO.RIODequeueCompletion(pBatch->hCompletionQueue, pBatch->pResult, UDP_BATCH_PACKETS);
+	if (nResults == RIO_CORRUPT_CQ) return 0;
+
+	// Nothing queued yet, arm the event once and sleep on it
+	if (nResults == 0)
+	{
+		if (!pBatch->bNotifying)
+			pBatch->bNotifying = (pBatch->tRIO.RIONotify(pBatch->hCompletionQueue) == ERROR_SUCCESS);
+
+		if (!pBatch->bNotifying || WaitForSingleObject(pBatch->hEvent, nTimeout) != WAIT_OBJECT_0) return 0;
+
+		pBatch->bNotifying = FALSE;
+
+		nResults = pBatch->tRIO.RIODequeueCompletion(pBatch->hCompletionQueue, pBatch->pResult, UDP_BATCH_PACKETS);
+		if (nResults == RIO_CORRUPT_CQ) return 0;
+	}
+
+	return nResults;
+}
+
+BYTE* AcquireSendUDP(UDPBATCH* pBatch)
+{
+	// Datagrams of one request queue complete in order, so the oldest slots are the ones freed
+	if (pBatch->nSendsInFlight == UDP_BATCH_PACKETS)
+	{
+		ULONG nResults = pBatch->tRIO.RIODequeueCompletion(pBatch->hCompletionQueue, pBatch->pResult, UDP_BATCH_PACKETS);
+		if (nResults != RIO_CORRUPT_CQ) pBatch->nSendsInFlight -= nResults;
+	}
+
+	if (pBatch->nSendsInFlight == UDP_BATCH_PACKETS) return NULL;
+
+	return GetPacketUDP(pBatch, pBatch->nNextSend);
+}
+
+BOOL PostSendUDP(UDPBATCH* pBatch, const SOCKADDR_IN* pTo, UINT32 nBytes)
+{
+	UINT32 nSlot = pBatch->nNextSend;
+	RIO_BUF tData = { pBatch->hSlab, nSlot * UDP_PACKET_BYTES, min(nBytes, (UINT32)UDP_PACKET_BYTES) };
+	RIO_BUF tPeer = { pBatch->hSlab, UDP_BATCH_PACKETS * UDP_PACKET_BYTES + nSlot * (ULONG)sizeof(SOCKADDR_INET), sizeof(SOCKADDR_INET) };
+
+	memset(GetPeerUDP(pBatch, nSlot), 0, sizeof(SOCKADDR_INET));
+	GetPeerUDP(pBatch, nSlot)->Ipv4 = *pTo;
+
+	if (!pBatch->tRIO.RIOSendEx(pBatch->hRequestQueue, &tData, 1, NULL, &tPeer, NULL, NULL, RIO_MSG_DEFER, (PVOID)(ULONG_PTR)nSlot))
+		return FALSE;
+
+	pBatch->nNextSend = (nSlot + 1) % UDP_BATCH_PACKETS;
+	pBatch->nSendsInFlight++;
+	pBatch->nSendsDeferred++;
+
+	return TRUE;
+}
+
+void CommitSendUDP(UDPBATCH* pBatch)
+{
+	if (pBatch->nSendsDeferred == 0) return;
+
+	if (!pBatch->tRIO.RIOSend(pBatch->hRequestQueue, NULL, 0, RIO_MSG_COMMIT_ONLY, NULL))
+	{
+		std::cout << ERR << "UDP batch send failed. Error Code: "
+			<< WSAGetLastError()
+			<< std::endl;
+	}
+
+	pBatch->nSendsDeferred = 0;
+
+	// Reap what completed meanwhile, so slots rarely run out
+	ULONG nResults = pBatch->tRIO.RIODequeueCompletion(pBatch->hCompletionQueue, pBatch->pResult, UDP_BATCH_PACKETS);
+	if (nResults != RIO_CORRUPT_CQ) pBatch->nSendsInFlight -= nResults;
+}
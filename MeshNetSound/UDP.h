@@ -1,8 +1,34 @@
 #pragma once
 #include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+#include "config.h"
+
+/// <summary>
+/// <para>Slab of datagram slots exchanged with the kernel through Registered I/O,
+/// the Windows counterpart of recvmmsg/sendmmsg.</para>
+/// <para>Slots and their peer addresses sit in one buffer registered once, so no datagram is copied
+/// through an intermediate buffer or needs a memset. Requests are posted deferred and committed together,
+/// and completions are dequeued by the dozen, so one syscall moves up to UDP_BATCH_PACKETS datagrams.</para>
+/// </summary>
+typedef struct UDPBatch {
+	RIO_EXTENSION_FUNCTION_TABLE	tRIO;
+	RIO_CQ				hCompletionQueue;
+	RIO_RQ				hRequestQueue;
+	RIO_BUFFERID		hSlab;
+	BYTE				* pSlab;			// UDP_BATCH_PACKETS slots of UDP_PACKET_BYTES, followed by a SOCKADDR_INET each
+	RIORESULT			pResult[UDP_BATCH_PACKETS];	// Completions of the last dequeue
+	HANDLE				hEvent;				// Signaled when completions arrive after RIONotify
+	BOOL				bNotifying;			// RIONotify was called and the event has not fired yet
+
+	UINT32				nNextSend;			// Slot the next datagram to send goes into
+	UINT32				nSendsInFlight;		// Sends posted whose completion was not dequeued yet
+	UINT32				nSendsDeferred;		// Sends posted since the last commit
+} UDPBATCH;
 
 /// <summary>
 /// <para>Creates a UDP socket.</para>
+/// <para>Sockets are created for Registered I/O, which plain Winsock calls work on just as well.</para>
 /// </summary>
 SOCKET* CreateSocketUDP();
 
@@ -11,3 +37,73 @@ SOCKET* CreateSocketUDP();
 /// </summary>
 /// <param name="pUDPSocket">- location to retreive from socket to be destroyed.</param>
 void CloseSocketUDP(SOCKET* pUDPSocket);
+
+/// <summary>
+/// <para>Registers a slab of datagram slots and the queues to move them in batches on a socket.</para>
+/// </summary>
+/// <param name="pUDPSocket">- socket created by CreateSocketUDP, at most one batch each.</param>
+/// <returns>Batch of the socket, NULL if Registered I/O is unavailable and plain calls must be used.</returns>
+UDPBATCH* CreateBatchUDP(SOCKET* pUDPSocket);
+
+/// <summary>
+/// <para>Frees the slab and queues of a batch.</para>
+/// <para>Note: close the socket first, that cancels requests still using the slab.</para>
+/// </summary>
+/// <param name="pBatch">- batch to free, may be NULL.</param>
+void CloseBatchUDP(UDPBATCH* pBatch);
+
+/// <summary>
+/// <para>Gets the datagram buffer of a slot.</para>
+/// </summary>
+/// <param name="pBatch">- batch of the socket.</param>
+/// <param name="nSlot">- slot index.</param>
+/// <returns>UDP_PACKET_BYTES bytes of the slot.</returns>
+BYTE* GetPacketUDP(UDPBATCH* pBatch, UINT32 nSlot);
+
+/// <summary>
+/// <para>Gets the peer address of a slot, the sender once a receive into it completed.</para>
+/// </summary>
+/// <param name="pBatch">- batch of the socket.</param>
+/// <param name="nSlot">- slot index.</param>
+/// <returns>Address of the slot.</returns>
+SOCKADDR_INET* GetPeerUDP(UDPBATCH* pBatch, UINT32 nSlot);
+
+/// <summary>
+/// <para>Posts a receive into a slot, deferred until the next commit.</para>
+/// </summary>
+/// <param name="pBatch">- batch of a bound socket.</param>
+/// <param name="nSlot">- free slot index.</param>
+/// <param name="bCommit">- hands all deferred receives to the kernel in one call.</param>
+/// <returns>FALSE if the receive could not be posted.</returns>
+BOOL PostReceiveUDP(UDPBATCH* pBatch, UINT32 nSlot, BOOL bCommit);
+
+/// <summary>
+/// <para>Dequeues completed receives, sleeping up to a timeout if there are none yet.</para>
+/// <para>Slots of the completions, in UDPBATCH::pResult, stay taken until posted again.</para>
+/// </summary>
+/// <param name="pBatch">- batch of a bound socket.</param>
+/// <param name="nTimeout">- longest wait in milliseconds.</param>
+/// <returns>Number of completions, 0 on timeout.</returns>
+UINT32 ReceiveBatchUDP(UDPBATCH* pBatch, DWORD nTimeout);
+
+/// <summary>
+/// <para>Takes the next slot to send a datagram from, reaping completed sends if all are in flight.</para>
+/// </summary>
+/// <param name="pBatch">- batch of the socket.</param>
+/// <returns>Buffer of UDP_PACKET_BYTES to fill, NULL if every slot is still in flight.</returns>
+BYTE* AcquireSendUDP(UDPBATCH* pBatch);
+
+/// <summary>
+/// <para>Posts the datagram filled into the slot from AcquireSendUDP, deferred until CommitSendUDP.</para>
+/// </summary>
+/// <param name="pBatch">- batch of the socket.</param>
+/// <param name="pTo">- receiver of the datagram.</param>
+/// <param name="nBytes">- size of the datagram.</param>
+/// <returns>FALSE if the send could not be posted.</returns>
+BOOL PostSendUDP(UDPBATCH* pBatch, const SOCKADDR_IN* pTo, UINT32 nBytes);
+
+/// <summary>
+/// <para>Hands all deferred sends to the kernel in one call.</para>
+/// </summary>
+/// <param name="pBatch">- batch of the socket.</param>
+void CommitSendUDP(UDPBATCH* pBatch);
@@ -1,23 +1,28 @@
-/*
-	TODO:
-		I.------include packet sequence number in each packet to synchronize sender and receiver.
-*/
-
 #include "UDPAudioBuffer.h"
+#include <cfloat>
+#include <cmath>
 
 #pragma comment(lib, "Ws2_32.lib")
 
-void UDPAudioBuffer::ReceiveDataUDP(SOCKET* pUDPSocket, CHAR* sUDPServerIP, UDPAudioBuffer** pUDPAudioBuffer, UINT32 nWASANNodes, BOOL* bDone)
+void UDPAudioBuffer::ReceiveDataUDP(SOCKET* pUDPSocket, UDPBATCH* pBatch, CHAR* sUDPServerIP, UINT16 nPort, UDPAudioBuffer** pUDPAudioBuffer, UINT32 nWASANNodes, BOOL* bDone)
 {
 	SOCKADDR_IN UDPServer, UDPClient;
 	INT32 nClientLength = sizeof(UDPClient), nBytesIn;
-	CHAR buf[TEMP_UDP_BUFFER_SIZE];
+	alignas(8) BYTE buf[UDP_PACKET_BYTES];
 	UDPAudioBuffer* pUDPCaptureClient;
+	UDPNODETABLE tNodeTable = {};
+
+	// Nodes are fixed for the lifetime of the thread, index them once by their binary address
+	if (BuildNodeTable(&tNodeTable, pUDPAudioBuffer, nWASANNodes) != ERROR_SUCCESS)
+	{
+		std::cout << ERR << "Failed to allocate WASAN node table." << std::endl;
+		return;
+	}
 	
 	// Fill sockaddr struct with IP and port number on which to listen to UDP traffic
 	UDPServer.sin_family = AF_INET;
 	UDPServer.sin_addr.s_addr = inet_addr(sUDPServerIP);
-	UDPServer.sin_port = htons(UDP_RCV_PORT);
+	UDPServer.sin_port = htons(nPort);
 
 	// Bind server socket
 	if (bind(*pUDPSocket, (SOCKADDR*)&UDPServer, sizeof(UDPServer)) == SOCKET_ERROR)
@@ -29,47 +34,449 @@ void UDPAudioBuffer::ReceiveDataUDP(SOCKET* pUDPSocket, CHAR* sUDPServerIP, UDPA
 		WSACleanup();
 		exit(EXIT_FAILURE);
 	}
-	std::cout << MSG << "Server UDP socket bind succeeded." << std::endl;
+	std::cout << MSG << "Server UDP socket bind on port " << nPort << " succeeded." << std::endl;
+
+	// Without a playout delay a rebuilt datagram is always behind the stream and dropped as late
+	if (UDP_FEC && !UDP_JITTER_BUFFER)
+		std::cout << WRN << "Parity of WASAN capture nodes is ignored without UDP_JITTER_BUFFER." END << std::endl;
+
+	// Pace the datagrams of each node by their timestamps and fill the gaps of those lost
+	for (UINT32 i = 0; i < nWASANNodes; i++)
+	{
+		// Datagrams rebuilt from parity arrive a group late, the playout delay makes room for them
+		if (UDP_JITTER_BUFFER)
+			pUDPAudioBuffer[i]->pJitterBuffer = new JitterBuffer(pUDPAudioBuffer[i]->GetEndpointFmt()->nSamplesPerSec, UDP_FEC ? UDP_FEC_GROUP : 0);
+
+		if (UDP_FEC && UDP_JITTER_BUFFER)
+			pUDPAudioBuffer[i]->pParity = new PacketParity();
+
+		if (UDP_PLC && pUDPAudioBuffer[i]->InitConcealer() != ERROR_SUCCESS)
+			std::cout << WRN << "Failed to allocate packet loss concealment, gaps of " << pUDPAudioBuffer[i]->pWASANNodeIP << " stay unfilled." END << std::endl;
+
+		if (pUDPAudioBuffer[i]->InitCodec() != ERROR_SUCCESS)
+			std::cout << WRN << "Failed to allocate the decoder, compressed datagrams of " << pUDPAudioBuffer[i]->pWASANNodeIP << " are dropped." END << std::endl;
+	}
+
+	// Hand every slot of the batch to the kernel at once
+	for (UINT32 i = 0; pBatch != NULL && i < UDP_BATCH_PACKETS; i++)
+		PostReceiveUDP(pBatch, i, i == UDP_BATCH_PACKETS - 1);
 
-	while (!*bDone)
+	while (!*bDone && pBatch != NULL)
 	{
-		// Clear buffer from previous junk
-		memset(buf, 0, TEMP_UDP_BUFFER_SIZE);
-		// Blocking receive call
-		if ((nBytesIn = recvfrom(*pUDPSocket, buf, TEMP_UDP_BUFFER_SIZE, 0, (SOCKADDR*)&UDPClient, &nClientLength)) != SOCKET_ERROR)
+		// Single dequeue for all datagrams arrived since the last one, times out for the next playout or to notice the stop flag
+		UINT32 nResults = ReceiveBatchUDP(pBatch, GetPlayoutTimeout(pUDPAudioBuffer, nWASANNodes));
+
+		for (UINT32 i = 0; i < nResults; i++)
 		{
-			// Get sender's IP address
-			CHAR* UDPClientIP = inet_ntoa(UDPClient.sin_addr);
+			UINT32 nSlot = (UINT32)pBatch->pResult[i].RequestContext;
 
-			// Get the UDPAudioBuffer instance corresponding to this IP or drop the data otherwise
-			if ((pUDPCaptureClient = GetBufferByIP(pUDPAudioBuffer, nWASANNodes, UDPClientIP)) != NULL)
-			{
-				// Update the endpoint size with the actual UDP packet length
-				pUDPCaptureClient->SetEndpointBufferSize(nBytesIn);
+			// Read the header in place, from the registered slot the kernel wrote the datagram into
+			const UDPAUDIOHEADER* pHeader = (pBatch->pResult[i].Status == NO_ERROR) ?
+				ParseHeader(GetPacketUDP(pBatch, nSlot), pBatch->pResult[i].BytesTransferred) : NULL;
 
-				// Get data and pull it into the corresponding ring buffer location
-				pUDPCaptureClient->PullData((BYTE*)buf);
-			}
+			// Get the UDPAudioBuffer instance corresponding to the sender's stream or drop the data otherwise
+			if (pHeader != NULL && (pUDPCaptureClient = GetBufferByAddress(&tNodeTable, &GetPeerUDP(pBatch, nSlot)->Ipv4, pHeader->nStreamId)) != NULL)
+				pUDPCaptureClient->ReceivePacket(pHeader, pBatch->pResult[i].BytesTransferred);
+
+			// Recycle the slot, all of them reach the kernel together with the last one
+			PostReceiveUDP(pBatch, nSlot, i == nResults - 1);
+		}
+
+		DOUBLE fNow = JitterBuffer::GetTime();
+		for (UINT32 i = 0; i < nWASANNodes; i++)
+			pUDPAudioBuffer[i]->PlayOut(fNow);
+	}
+
+	// Registered I/O unavailable, one syscall per datagram
+	while (!*bDone && pBatch == NULL)
+	{
+		// Blocking receive call, bounded by the next playout time
+		DWORD nTimeout = GetPlayoutTimeout(pUDPAudioBuffer, nWASANNodes);
+		setsockopt(*pUDPSocket, SOL_SOCKET, SO_RCVTIMEO, (const CHAR*)&nTimeout, sizeof(DWORD));
+
+		if ((nBytesIn = recvfrom(*pUDPSocket, (CHAR*)buf, UDP_PACKET_BYTES, 0, (SOCKADDR*)&UDPClient, &nClientLength)) != SOCKET_ERROR)
+		{
+			const UDPAUDIOHEADER* pHeader = ParseHeader(buf, nBytesIn);
+
+			// Get the UDPAudioBuffer instance corresponding to the sender's stream or drop the data otherwise
+			if (pHeader != NULL && (pUDPCaptureClient = GetBufferByAddress(&tNodeTable, &UDPClient, pHeader->nStreamId)) != NULL)
+				pUDPCaptureClient->ReceivePacket(pHeader, nBytesIn);
+		}
+
+		DOUBLE fNow = JitterBuffer::GetTime();
+		for (UINT32 i = 0; i < nWASANNodes; i++)
+			pUDPAudioBuffer[i]->PlayOut(fNow);
+	}
+
+	// Report streams that did not arrive whole
+	for (UINT32 i = 0; i < nWASANNodes; i++)
+	{
+		UDPAudioBuffer* pNode = pUDPAudioBuffer[i];
+
+		if (pNode->pJitterBuffer != NULL)
+		{
+			pNode->nPacketsLost += pNode->pJitterBuffer->GetPacketsLost();
+			pNode->nPacketsLate += pNode->pJitterBuffer->GetPacketsLate();
+
+			std::cout << MSG << "WASAN node " << pNode->pWASANNodeIP << " stream " << pNode->nStreamId
+				<< ": jitter " << 1000.0 * pNode->pJitterBuffer->GetJitter() << " ms, playout delay "
+				<< 1000.0 * pNode->pJitterBuffer->GetTargetDelay() << " ms." END << std::endl;
+
+			delete pNode->pJitterBuffer;
+			pNode->pJitterBuffer = NULL;
 		}
+
+		if (pNode->nPacketsLost + pNode->nPacketsLate + pNode->nPacketsRejected + pNode->nPacketsCorrupt > 0)
+			std::cout << WRN << "WASAN node " << pNode->pWASANNodeIP << " stream " << pNode->nStreamId
+				<< ": " << pNode->nPacketsLost << " packets lost, "
+				<< pNode->nPacketsLate << " late, "
+				<< pNode->nPacketsRejected << " of another format, "
+				<< pNode->nPacketsCorrupt << " undecodable, "
+				<< pNode->nPacketsRecovered << " rebuilt from parity, "
+				<< ((pNode->pConcealer != NULL) ? pNode->pConcealer->GetFramesConcealed() : 0) << " frames concealed." END << std::endl;
+
+		pNode->FreeConcealer();
+		pNode->FreeCodec();
+
+		delete pNode->pParity;
+		pNode->pParity = NULL;
 	}
+
+	FreeNodeTable(&tNodeTable);
+}
+
+HRESULT UDPAudioBuffer::ReceivePacket(const UDPAUDIOHEADER* pHeader, UINT32 nBytes)
+{
+	BYTE* pFrames;
+
+	// Parity gives back the one datagram of its group that went missing, which then goes the way of any other
+	if (pHeader->nCodec == UDPCODEC_PARITY)
+	{
+		const BYTE* pRebuilt = NULL;
+		UINT32 nRebuilt = (this->pParity != NULL) ? this->pParity->Recover(pHeader, nBytes, &pRebuilt) : 0;
+
+		if (nRebuilt == 0 || (pHeader = ParseHeader(pRebuilt, nRebuilt)) == NULL || pHeader->nCodec == UDPCODEC_PARITY)
+			return ERROR_SUCCESS;
+
+		nBytes = nRebuilt;
+		this->nPacketsRecovered++;
+	}
+	else if (this->pParity != NULL)
+		this->pParity->Keep(pHeader, nBytes);
+
+	// Ring buffer and SRC are set up for the negotiated format, the header cannot change it on the fly.
+	// Compressed payloads are decoded into the endpoint's format whatever the sender's was
+	if ((pHeader->nCodec == UDPCODEC_PCM && pHeader->nFormat != this->GetSampleFormat()) ||
+		pHeader->nChannels != this->GetEndpointFmt()->nChannels)
+	{
+		this->nPacketsRejected++;
+		return ERROR_NOT_SUPPORTED;
+	}
+
+	// Held whole until its playout time, reordered with the datagrams around it, decoded only when played out
+	if (this->pJitterBuffer != NULL)
+		return this->pJitterBuffer->Insert(pHeader->nSequence, pHeader->nTimestamp, (const BYTE*)pHeader,
+			pHeader->nFrames, nBytes, JitterBuffer::GetTime());
+
+	// Sequence numbers wrap, compare by their signed distance
+	INT32 nAhead = (INT32)(pHeader->nSequence - this->nSequence);
+
+	if (this->bSynced && nAhead < 0 && nAhead > -UDP_SEQUENCE_WINDOW)
+	{
+		// Ring buffer only appends, frames of a late datagram have no place anymore
+		this->nPacketsLate++;
+		return ERROR_INVALID_DATA;
+	}
+
+	// Far behind is a restarted sender rather than a late datagram, follow it
+	if (this->bSynced && nAhead > 0)
+	{
+		this->nPacketsLost += nAhead;
+
+		// Frames missing are told by the timestamps, datagrams need not be of equal length
+		if (pHeader->nTimestamp > this->nTimestamp)
+			this->ConcealFrames((UINT32)min(pHeader->nTimestamp - this->nTimestamp, (UINT64)MAXUINT32));
+	}
+
+	this->nSequence = pHeader->nSequence + 1;
+	this->nTimestamp = pHeader->nTimestamp + pHeader->nFrames;
+	this->bSynced = TRUE;
+
+	// A datagram that does not decode is as good as lost
+	if (this->DecodePacket(pHeader, nBytes, &pFrames) != ERROR_SUCCESS)
+	{
+		this->nPacketsCorrupt++;
+		this->ConcealFrames(pHeader->nFrames);
+		return ERROR_INVALID_DATA;
+	}
+
+	// Frame count comes from the header, a raw payload is pushed straight from the datagram
+	this->PushPacket(pFrames, pHeader->nFrames);
+	return ERROR_SUCCESS;
+}
+
+HRESULT UDPAudioBuffer::DecodePacket(const UDPAUDIOHEADER* pHeader, UINT32 nBytes, BYTE** pFrames)
+{
+	const ENDPOINTFMT* pFmt = this->GetEndpointFmt();
+
+	if (pHeader->nCodec == UDPCODEC_PCM)
+	{
+		*pFrames = (BYTE*)(pHeader + 1);
+		return ERROR_SUCCESS;
+	}
+
+	if (this->pCodec == NULL) return ENOMEM;
+
+	// Senders keep compressed datagrams to the frames of a raw one, more would not fit the staging buffers
+	if (pHeader->nFrames > this->nCodecFrames) return ERROR_NOT_SUPPORTED;
+
+	HRESULT hr = this->pCodec->Decode(pHeader->nCodec, (const BYTE*)(pHeader + 1), nBytes - sizeof(UDPAUDIOHEADER), pHeader->nFrames, this->pCodecFrames);
+	if (hr != ERROR_SUCCESS) return hr;
+
+	BYTE* pFrame = this->pCodecPacket;
+	for (UINT32 j = 0; j < pHeader->nFrames; j++, pFrame += pFmt->nBlockAlign)
+		for (UINT32 i = 0; i < pFmt->nChannels; i++)
+			this->WriteSample(pFrame, i, this->pCodecFrames[j * pFmt->nChannels + i]);
+
+	*pFrames = this->pCodecPacket;
+	return ERROR_SUCCESS;
+}
+
+void UDPAudioBuffer::PlayOut(DOUBLE fNow)
+{
+	BYTE* pPacket, * pFrames;
+	UINT32 nFrames, nBytes;
+
+	if (this->pJitterBuffer == NULL) return;
+
+	while ((nFrames = this->pJitterBuffer->Pop(fNow, &pPacket, &nBytes)) > 0)
+	{
+		if (pPacket == NULL)
+			this->ConcealFrames(nFrames);
+		else if (this->DecodePacket((const UDPAUDIOHEADER*)pPacket, nBytes, &pFrames) == ERROR_SUCCESS)
+			this->PushPacket(pFrames, nFrames);
+		else
+		{
+			this->nPacketsCorrupt++;
+			this->ConcealFrames(nFrames);
+		}
+	}
+}
+
+void UDPAudioBuffer::PushPacket(BYTE* pPayload, UINT32 nFrames)
+{
+	const ENDPOINTFMT* pFmt = this->GetEndpointFmt();
+
+	// Concealer keeps the audio as float, and fades the packet in if it ends a loss
+	if (this->pConcealer != NULL && nFrames <= this->nConcealFrames)
+	{
+		BYTE* pFrame = pPayload;
+		for (UINT32 j = 0; j < nFrames; j++, pFrame += pFmt->nBlockAlign)
+			for (UINT32 i = 0; i < pFmt->nChannels; i++)
+				this->pConcealFrames[j * pFmt->nChannels + i] = this->ReadSample(pFrame, i);
+
+		UINT32 nFaded = this->pConcealer->Resume(this->pConcealFrames, nFrames);
+
+		pFrame = pPayload;
+		for (UINT32 j = 0; j < nFaded; j++, pFrame += pFmt->nBlockAlign)
+			for (UINT32 i = 0; i < pFmt->nChannels; i++)
+				this->WriteSample(pFrame, i, this->pConcealFrames[j * pFmt->nChannels + i]);
+	}
+
+	this->SetEndpointBufferSize(nFrames);
+	this->PushData(pPayload);
+}
+
+void UDPAudioBuffer::ConcealFrames(UINT32 nFrames)
+{
+	const ENDPOINTFMT* pFmt = this->GetEndpointFmt();
+	UINT32 nMaxFrames = pFmt->nSamplesPerSec * UDP_PLC_MAX_MILLISEC / 1000;
+
+	// Gap too long to be worth filling, start the SRC over as after silence
+	if (this->pConcealer == NULL || nFrames > nMaxFrames)
+	{
+		this->PushData(NULL);
+		return;
+	}
+
+	// Packet at a time, the cost per concealed frame stays bounded however long the gap
+	while (nFrames > 0)
+	{
+		UINT32 nChunk = min(nFrames, this->nConcealFrames);
+
+		this->pConcealer->Conceal(this->pConcealFrames, nChunk);
+
+		BYTE* pFrame = this->pConcealPacket;
+		for (UINT32 j = 0; j < nChunk; j++, pFrame += pFmt->nBlockAlign)
+			for (UINT32 i = 0; i < pFmt->nChannels; i++)
+				this->WriteSample(pFrame, i, this->pConcealFrames[j * pFmt->nChannels + i]);
+
+		this->SetEndpointBufferSize(nChunk);
+		this->PushData(this->pConcealPacket);
+
+		nFrames -= nChunk;
+	}
+}
+
+HRESULT UDPAudioBuffer::InitConcealer()
+{
+	const ENDPOINTFMT* pFmt = this->GetEndpointFmt();
+
+	// Largest payload a datagram carries
+	this->nConcealFrames = (pFmt->nBlockAlign > 0) ? (UINT32)(UDP_PACKET_BYTES / pFmt->nBlockAlign) : 0;
+
+	this->pConcealer = new PacketConcealer(pFmt->nChannels, pFmt->nSamplesPerSec);
+	this->pConcealFrames = (FLOAT*)malloc((SIZE_T)this->nConcealFrames * pFmt->nChannels * sizeof(FLOAT));
+	this->pConcealPacket = (BYTE*)malloc(UDP_PACKET_BYTES);
+
+	if (this->nConcealFrames == 0 || this->pConcealFrames == NULL || this->pConcealPacket == NULL)
+	{
+		this->FreeConcealer();
+		return ENOMEM;
+	}
+
+	return ERROR_SUCCESS;
+}
+
+void UDPAudioBuffer::FreeConcealer()
+{
+	delete this->pConcealer;
+	free(this->pConcealFrames);
+	free(this->pConcealPacket);
+
+	this->pConcealer = NULL;
+	this->pConcealFrames = NULL;
+	this->pConcealPacket = NULL;
+	this->nConcealFrames = 0;
+}
+
+HRESULT UDPAudioBuffer::InitCodec()
+{
+	const ENDPOINTFMT* pFmt = this->GetEndpointFmt();
+
+	// Decoded frames never outnumber those of a raw datagram
+	this->nCodecFrames = (pFmt->nBlockAlign > 0) ? (UINT32)(UDP_PACKET_BYTES / pFmt->nBlockAlign) : 0;
+
+	this->pCodec = new UDPCodec(pFmt->nChannels);
+	this->pCodecFrames = (FLOAT*)malloc((SIZE_T)this->nCodecFrames * pFmt->nChannels * sizeof(FLOAT));
+	this->pCodecPacket = (BYTE*)malloc(UDP_PACKET_BYTES);
+
+	if (this->nCodecFrames == 0 || this->pCodecFrames == NULL || this->pCodecPacket == NULL)
+	{
+		this->FreeCodec();
+		return ENOMEM;
+	}
+
+	return ERROR_SUCCESS;
+}
+
+void UDPAudioBuffer::FreeCodec()
+{
+	delete this->pCodec;
+	free(this->pCodecFrames);
+	free(this->pCodecPacket);
+
+	this->pCodec = NULL;
+	this->pCodecFrames = NULL;
+	this->pCodecPacket = NULL;
+	this->nCodecFrames = 0;
+}
+
+DWORD UDPAudioBuffer::GetPlayoutTimeout(UDPAudioBuffer** pUDPAudioBuffer, UINT32 nUDPAudioBuffer)
+{
+	DOUBLE fDeadline = DBL_MAX;
+
+	for (UINT32 i = 0; i < nUDPAudioBuffer; i++)
+		if (pUDPAudioBuffer[i]->pJitterBuffer != NULL)
+			fDeadline = min(fDeadline, pUDPAudioBuffer[i]->pJitterBuffer->GetDeadline());
+
+	if (fDeadline == DBL_MAX) return UDP_RECEIVE_TIMEOUT_MILLISEC;
+
+	// Round up so the wait does not end just short of the deadline, at least 1 ms so it never spins
+	DOUBLE fWait = ceil((fDeadline - JitterBuffer::GetTime()) * 1000.0);
+	return (DWORD)min(max(fWait, 1.0), (DOUBLE)UDP_RECEIVE_TIMEOUT_MILLISEC);
 }
 
 void UDPAudioBuffer::SendDataUDP(UINT32 nFrames)
 {
-	SOCKADDR_IN UDPServer;
-	CHAR buf[TEMP_UDP_BUFFER_SIZE];
-	INT32 nServerLength = sizeof(UDPServer);
+	alignas(8) BYTE buf[UDP_PACKET_BYTES];
+	BYTE* pPacket = (this->pUDPBatch != NULL) ? AcquireSendUDP(this->pUDPBatch) : NULL;
+	UINT32 nFrameBytes = this->GetEndpointFmt()->nBlockAlign;
 
-	// Specify receiver details
-	UDPServer.sin_family = AF_INET;
-	UDPServer.sin_addr.s_addr = inet_addr(this->pWASANNodeIP);
-	UDPServer.sin_port = htons(UDP_RCV_PORT);
+	// Stage into a registered slot with a batch, sent together with the other nodes' on UDPAudioBuffer::CommitSendUDP()
+	if (pPacket == NULL) pPacket = buf;
+
+	// Parity of the group must fit a datagram along with its own header
+	UINT32 nRoom = UDP_PACKET_BYTES - sizeof(UDPAUDIOHEADER) - ((this->pParity != NULL) ? sizeof(UDPPARITYHEADER) : 0);
+
+	// Send no more than fits a datagram, the rest stays in the ring for the next pass
+	nFrames = min(nFrames, nRoom / nFrameBytes);
+
+	// Compressed datagrams carry no more frames than raw ones, the latency stays and only the size shrinks
+	if (this->nCodec != UDPCODEC_PCM)
+		nFrames = min(nFrames, UDPCodec::GetMaxFrames(this->nCodec, this->GetEndpointFmt()->nChannels, nRoom));
+
+	UDPAUDIOHEADER* pHeader = (UDPAUDIOHEADER*)pPacket;
+	pHeader->nMagic = UDP_AUDIO_MAGIC;
+	pHeader->nVersion = UDP_AUDIO_VERSION;
+	pHeader->nFormat = this->GetSampleFormat();
+	pHeader->nChannels = (BYTE)this->GetEndpointFmt()->nChannels;
+	pHeader->nCodec = this->nCodec;
+	pHeader->nStreamId = this->nStreamId;
+
+	// Ring frames are input frames, SRC to a node of another rate may produce fewer of them than asked for.
+	// Pull first so the datagram only carries, counts and timestamps the frames that were produced.
+	// PCM lands right behind the header, the codec takes its frames from a packet of its own
+	UINT32 nFramesOut = 0;
+	this->PullData((this->nCodec == UDPCODEC_PCM) ? (BYTE*)(pHeader + 1) : this->pCodecPacket, nFrames, &nFramesOut);
+
+	// Nothing to send, the slot is left unposted and the sequence is not spent
+	if (nFramesOut == 0) return;
+
+	nFrames = nFramesOut;
+
+	pHeader->nFrames = (UINT16)nFrames;
+	pHeader->nSequence = this->nSequence++;
+	pHeader->nTimestamp = this->nTimestamp;
+
+	this->nTimestamp += nFrames;
+
+	UINT32 nPayload = nFrames * nFrameBytes;
+
+	if (this->nCodec != UDPCODEC_PCM)
+	{
+		const ENDPOINTFMT* pFmt = this->GetEndpointFmt();
+
+		// Codec works on float, whatever the endpoint's format
+		BYTE* pFrame = this->pCodecPacket;
+		for (UINT32 j = 0; j < nFrames; j++, pFrame += nFrameBytes)
+			for (UINT32 i = 0; i < pFmt->nChannels; i++)
+				this->pCodecFrames[j * pFmt->nChannels + i] = this->ReadSample(pFrame, i);
+
+		UINT32 nEncoded = this->pCodec->Encode(this->nCodec, this->pCodecFrames, nFrames, pHeader->nSequence, (BYTE*)(pHeader + 1));
+
+		// Codec could not take them, the frames are out of the ring already so they go raw
+		if (nEncoded > 0)
+			nPayload = nEncoded;
+		else
+		{
+			pHeader->nCodec = UDPCODEC_PCM;
+			memcpy(pHeader + 1, this->pCodecPacket, nPayload);
+		}
+	}
+
+	UINT32 nBytes = sizeof(UDPAUDIOHEADER) + nPayload;
+	const BYTE* pParity = NULL;
+	UINT32 nParityBytes = (this->pParity != NULL) ? this->pParity->Protect(pHeader, nBytes, &pParity) : 0;
+
+	// Every destination of a fan-out gets the same bytes, the parity of a completed group right behind its last datagram
+	BOOL bSent = this->PostPacketUDP(pPacket, nBytes, pPacket != buf);
+
+	if (nParityBytes > 0)
+		bSent &= this->PostPacketUDP(pParity, nParityBytes, FALSE);
 
-	// Push data into the UDP sending buffer
-	this->PullData((BYTE*)buf, nFrames);
-	
 	// Send UDP packet to WASAN render node
-	if (sendto(*this->pUDPSocket, buf, nFrames + 1, 0, (SOCKADDR*)&UDPServer, nServerLength) == SOCKET_ERROR)
+	if (!bSent)
 	{
 		std::cout	<< ERR << "UDP packet send failed. Error Code: "
 					<< WSAGetLastError()
@@ -77,6 +484,34 @@ void UDPAudioBuffer::SendDataUDP(UINT32 nFrames)
 	}
 }
 
+BOOL UDPAudioBuffer::PostPacketUDP(const BYTE* pPacket, UINT32 nBytes, BOOL bStaged)
+{
+	const SOCKADDR_IN* pTo = (this->nFanout > 0) ? this->pFanout : &this->tWASANNode;
+	UINT32 nTo = max(this->nFanout, (UINT32)1);
+	BOOL bSent = TRUE;
+
+	for (UINT32 i = 0; i < nTo; i++)
+	{
+		// Only the staged datagram is in its slot already, a slot per further destination takes a copy
+		BYTE* pSlot = (bStaged && i == 0) ? (BYTE*)pPacket : (this->pUDPBatch != NULL) ? AcquireSendUDP(this->pUDPBatch) : NULL;
+
+		if (pSlot != NULL)
+		{
+			if (pSlot != pPacket) memcpy(pSlot, pPacket, nBytes);
+			bSent &= PostSendUDP(this->pUDPBatch, &pTo[i], nBytes);
+		}
+		else
+			bSent &= sendto(*this->pUDPSocket, (const CHAR*)pPacket, nBytes, 0, (const SOCKADDR*)&pTo[i], sizeof(SOCKADDR_IN)) != SOCKET_ERROR;
+	}
+
+	return bSent;
+}
+
+void UDPAudioBuffer::CommitSendUDP()
+{
+	if (this->pUDPBatch != NULL) ::CommitSendUDP(this->pUDPBatch);
+}
+
 void UDPAudioBuffer::SetSocketUDP(SOCKET* pSocket)
 {
 	this->pUDPSocket = pSocket;
@@ -87,11 +522,270 @@ SOCKET* UDPAudioBuffer::GetSocketUDP()
 	return this->pUDPSocket;
 }
 
-UDPAudioBuffer* UDPAudioBuffer::GetBufferByIP(UDPAudioBuffer** pUDPAudioBuffer, UINT32 nUDPAudioBuffer, CHAR* sIP)
+void UDPAudioBuffer::SetBatchUDP(UDPBATCH* pBatch)
 {
+	this->pUDPBatch = pBatch;
+}
+
+UDPBATCH* UDPAudioBuffer::GetBatchUDP()
+{
+	return this->pUDPBatch;
+}
+
+HRESULT UDPAudioBuffer::SetCodecUDP(BYTE nCodec)
+{
+	if (nCodec >= UDPCODEC_COUNT || nCodec == UDPCODEC_PARITY ||
+		(nCodec != UDPCODEC_PCM && UDPCodec::GetMaxFrames(nCodec, this->GetEndpointFmt()->nChannels, UDP_PACKET_BYTES - sizeof(UDPAUDIOHEADER)) == 0))
+		return ERROR_NOT_SUPPORTED;
+
+	if (nCodec == UDPCODEC_PCM)
+		this->FreeCodec();
+	else if (this->pCodec == NULL && this->InitCodec() != ERROR_SUCCESS)
+		return ENOMEM;
+
+	this->nCodec = nCodec;
+	return ERROR_SUCCESS;
+}
+
+void UDPAudioBuffer::AssignStreams(UDPAudioBuffer** pUDPAudioBuffer, UINT32 nUDPAudioBuffer)
+{
+	// Node lists are short and this runs once per thread, a quadratic count is fine
 	for (UINT32 i = 0; i < nUDPAudioBuffer; i++)
 	{
-		if (strcmp(pUDPAudioBuffer[i]->pWASANNodeIP, sIP) == 0) return pUDPAudioBuffer[i];
+		pUDPAudioBuffer[i]->nStreamId = 0;
+
+		for (UINT32 j = 0; j < i; j++)
+			if (pUDPAudioBuffer[j]->tWASANNode.sin_addr.s_addr == pUDPAudioBuffer[i]->tWASANNode.sin_addr.s_addr)
+				pUDPAudioBuffer[i]->nStreamId++;
+	}
+}
+
+UINT32 UDPAudioBuffer::AssignShards(UDPAudioBuffer** pUDPAudioBuffer, UINT32 nUDPAudioBuffer, UINT32 nShards, UDPAudioBuffer** pSharded, UINT32* pShardNodes)
+{
+	UINT32* pShard = (UINT32*)malloc(max(nUDPAudioBuffer, (UINT32)1) * sizeof(UINT32));
+	UINT32 nAddresses = 0;
+
+	if (pShard == NULL || nShards == 0)
+	{
+		free(pShard);
+		return 0;
 	}
+
+	// Streams of an address follow its first one, a new address goes to the next shard
+	for (UINT32 i = 0; i < nUDPAudioBuffer; i++)
+	{
+		UINT32 j = 0;
+		while (j < i && pUDPAudioBuffer[j]->tWASANNode.sin_addr.s_addr != pUDPAudioBuffer[i]->tWASANNode.sin_addr.s_addr) j++;
+
+		pShard[i] = (j < i) ? pShard[j] : nAddresses++ % nShards;
+
+		// Nothing tells the node its port, it has to be configured to it by hand
+		if (j == i)
+			std::cout << MSG << "WASAN capture node " << pUDPAudioBuffer[i]->pWASANNodeIP << " is received on port " << UDP_RCV_PORT + pShard[i] << "." END << std::endl;
+	}
+
+	nShards = min(nShards, nAddresses);
+
+	// Stable, so stream ids numbered on a shard's nodes come out as on all of them
+	for (UINT32 k = 0, n = 0; k < nShards; k++)
+	{
+		pShardNodes[k] = 0;
+
+		for (UINT32 i = 0; i < nUDPAudioBuffer; i++)
+			if (pShard[i] == k)
+			{
+				pSharded[n++] = pUDPAudioBuffer[i];
+				pShardNodes[k]++;
+			}
+	}
+
+	free(pShard);
+	return nShards;
+}
+
+HRESULT UDPAudioBuffer::AssignFanout(UDPAudioBuffer** pUDPAudioBuffer, UINT32 nUDPAudioBuffer, BYTE nMode)
+{
+	HRESULT hr = ERROR_SUCCESS;
+	UINT32 nGroups = 0;
+
+	if (nMode >= UDPFANOUT_COUNT) return ERROR_NOT_SUPPORTED;
+
+	for (UINT32 i = 0; i < nUDPAudioBuffer; i++)
+	{
+		free(pUDPAudioBuffer[i]->pFanout);
+		pUDPAudioBuffer[i]->pFanout = NULL;
+		pUDPAudioBuffer[i]->pFanoutLeader = NULL;
+		pUDPAudioBuffer[i]->nFanout = 0;
+	}
+
+	if (nMode == UDPFANOUT_NONE) return ERROR_SUCCESS;
+
+	// Node lists are short and this runs once per thread, a quadratic search is fine
+	for (UINT32 i = 0; i < nUDPAudioBuffer; i++)
+	{
+		UDPAudioBuffer* pNode = pUDPAudioBuffer[i];
+		const ENDPOINTFMT* pFmt = pNode->GetEndpointFmt();
+		UDPAudioBuffer* pLeader = NULL;
+
+		// Receivers key streams by their sender's address and stream id, so only nodes of the same stream id can share one
+		for (UINT32 j = 0; j < i && pLeader == NULL; j++)
+		{
+			UDPAudioBuffer* pOther = pUDPAudioBuffer[j];
+			const ENDPOINTFMT* pOtherFmt = pOther->GetEndpointFmt();
+
+			if (pOther->pFanoutLeader == NULL && pOther->pFanout != NULL &&
+				pOtherFmt->channelMask == pFmt->channelMask && pOtherFmt->nChannels == pFmt->nChannels &&
+				pOtherFmt->nSamplesPerSec == pFmt->nSamplesPerSec && pOtherFmt->nBlockAlign == pFmt->nBlockAlign &&
+				pOther->GetSampleFormat() == pNode->GetSampleFormat() && pOther->nCodec == pNode->nCodec &&
+				(pOther->pParity != NULL) == (pNode->pParity != NULL) && pOther->nStreamId == pNode->nStreamId)
+				pLeader = pOther;
+		}
+
+		if (pLeader != NULL)
+		{
+			pNode->pFanoutLeader = pLeader;
+			if (nMode == UDPFANOUT_UNICAST) pLeader->pFanout[pLeader->nFanout++] = pNode->tWASANNode;
+			else LogGroup(pNode, pLeader->pFanout[0].sin_addr.s_addr);
+			continue;
+		}
+
+		// First of its kind, room for every node after it in case all of them join
+		pNode->pFanout = (SOCKADDR_IN*)malloc((SIZE_T)(nUDPAudioBuffer - i) * sizeof(SOCKADDR_IN));
+		if (pNode->pFanout == NULL)
+		{
+			hr = ENOMEM;
+			continue;
+		}
+
+		pNode->pFanout[0] = pNode->tWASANNode;
+		pNode->nFanout = 1;
+
+		// A group sends to its own address once, render nodes join the group their channel mask maps to
+		if (nMode == UDPFANOUT_MULTICAST)
+		{
+			pNode->pFanout[0].sin_addr.s_addr = htonl(ntohl(inet_addr(UDP_MULTICAST_ADDRESS)) + nGroups);
+
+			DWORD nTTL = UDP_MULTICAST_TTL;
+			setsockopt(*pNode->pUDPSocket, IPPROTO_IP, IP_MULTICAST_TTL, (const CHAR*)&nTTL, sizeof(DWORD));
+
+			LogGroup(pNode, pNode->pFanout[0].sin_addr.s_addr);
+		}
+
+		nGroups++;
+	}
+
+	return hr;
+}
+
+void UDPAudioBuffer::LogGroup(UDPAudioBuffer* pNode, ULONG nGroup)
+{
+	nGroup = ntohl(nGroup);
+
+	std::cout << MSG << "WASAN render node " << pNode->pWASANNodeIP << " must join multicast group "
+		<< (nGroup >> 24) << "." << ((nGroup >> 16) & 0xFF) << "." << ((nGroup >> 8) & 0xFF) << "." << (nGroup & 0xFF) << "." END << std::endl;
+}
+
+UDPAudioBuffer* UDPAudioBuffer::GetFanoutLeader()
+{
+	return (this->pFanoutLeader != NULL) ? this->pFanoutLeader : this;
+}
+
+void UDPAudioBuffer::SetParityUDP(BOOL bParity)
+{
+	// A fresh one starts a fresh group, the receiver finds groups by the parity's sequence numbers
+	delete this->pParity;
+	this->pParity = bParity ? new PacketParity() : NULL;
+}
+
+const UDPAUDIOHEADER* UDPAudioBuffer::ParseHeader(const BYTE* pPacket, UINT32 nBytes)
+{
+	static const UINT32 nSampleBytes[UDPFORMAT_COUNT] = { sizeof(FLOAT), sizeof(INT16), sizeof(INT32) };
+
+	if (nBytes < sizeof(UDPAUDIOHEADER)) return NULL;
+
+	const UDPAUDIOHEADER* pHeader = (const UDPAUDIOHEADER*)pPacket;
+
+	if (pHeader->nMagic != UDP_AUDIO_MAGIC || pHeader->nVersion != UDP_AUDIO_VERSION ||
+		pHeader->nFormat >= UDPFORMAT_COUNT || pHeader->nCodec >= UDPCODEC_COUNT || pHeader->nChannels == 0 || pHeader->nFrames == 0)
+		return NULL;
+
+	// Truncated datagrams would push or decode past their end
+	UINT32 nPayload = (pHeader->nCodec == UDPCODEC_PCM) ?
+		(UINT32)pHeader->nFrames * pHeader->nChannels * nSampleBytes[pHeader->nFormat] :
+		(pHeader->nCodec == UDPCODEC_PARITY) ? (UINT32)sizeof(UDPPARITYHEADER) :
+		UDPCodec::GetMinBytes(pHeader->nCodec, pHeader->nChannels, pHeader->nFrames);
+
+	if (nBytes < sizeof(UDPAUDIOHEADER) + nPayload)
+		return NULL;
+
+	return pHeader;
+}
+
+BYTE UDPAudioBuffer::GetSampleFormat()
+{
+	// Same mapping AudioBuffer::ReadSample() and AudioBuffer::WriteSample() read and write the packets with
+	if (!this->GetFixedPoint())
+		return UDPFORMAT_FLOAT32;
+	else if (this->GetEndpointFmt()->wBitsPerSample == 16)
+		return UDPFORMAT_INT16;
+	else
+		return UDPFORMAT_INT32;
+}
+
+HRESULT UDPAudioBuffer::BuildNodeTable(UDPNODETABLE* pTable, UDPAudioBuffer** pUDPAudioBuffer, UINT32 nUDPAudioBuffer)
+{
+	// At most half full keeps probe sequences short
+	UINT32 nSlots = 16, nShift = 28;
+	while (nSlots < 2 * nUDPAudioBuffer) { nSlots <<= 1; nShift--; }
+
+	pTable->pKey = (UINT64*)calloc(nSlots, sizeof(UINT64));
+	pTable->pNode = (UDPAudioBuffer**)calloc(nSlots, sizeof(UDPAudioBuffer*));
+	pTable->nMask = nSlots - 1;
+	pTable->nShift = nShift;
+
+	if (pTable->pKey == NULL || pTable->pNode == NULL)
+	{
+		FreeNodeTable(pTable);
+		return ENOMEM;
+	}
+
+	AssignStreams(pUDPAudioBuffer, nUDPAudioBuffer);
+
+	for (UINT32 i = 0; i < nUDPAudioBuffer; i++)
+	{
+		ULONG nAddress = pUDPAudioBuffer[i]->tWASANNode.sin_addr.s_addr;
+		UINT64 nKey = ((UINT64)pUDPAudioBuffer[i]->nStreamId << 32) | nAddress;
+
+		// Unparsable addresses never match a sender
+		if (nAddress == INADDR_ANY || nAddress == INADDR_NONE) continue;
+
+		UINT32 j = ((UINT32)nAddress * 0x9E3779B1u + pUDPAudioBuffer[i]->nStreamId) >> nShift;
+		while (pTable->pKey[j] != 0 && pTable->pKey[j] != nKey) j = (j + 1) & pTable->nMask;
+
+		pTable->pKey[j] = nKey;
+		pTable->pNode[j] = pUDPAudioBuffer[i];
+	}
+
+	return ERROR_SUCCESS;
+}
+
+void UDPAudioBuffer::FreeNodeTable(UDPNODETABLE* pTable)
+{
+	free(pTable->pKey);
+	free(pTable->pNode);
+	pTable->pKey = NULL;
+	pTable->pNode = NULL;
+}
+
+UDPAudioBuffer* UDPAudioBuffer::GetBufferByAddress(const UDPNODETABLE* pTable, const SOCKADDR_IN* pSender, UINT16 nStreamId)
+{
+	ULONG nAddress = pSender->sin_addr.s_addr;
+	UINT64 nKey = ((UINT64)nStreamId << 32) | nAddress;
+
+	// Fibonacci hashing spreads addresses differing only in the last octet across the table,
+	// streams of one address land in neighbouring slots
+	for (UINT32 j = ((UINT32)nAddress * 0x9E3779B1u + nStreamId) >> pTable->nShift; pTable->pKey[j] != 0; j = (j + 1) & pTable->nMask)
+		if (pTable->pKey[j] == nKey) return pTable->pNode[j];
+
 	return NULL;
 }
@@ -4,6 +4,79 @@
 #include "config.h"
 #include "AudioBuffer.h"
 #include "UDP.h"
+#include "JitterBuffer.h"
+#include "PacketConcealer.h"
+#include "UDPCodec.h"
+#include "PacketParity.h"
+
+class UDPAudioBuffer;
+
+/// <summary>
+/// <para>Sample encodings of the payload of a WASAN audio datagram.</para>
+/// </summary>
+typedef enum UDPSampleFormat {
+	UDPFORMAT_FLOAT32,								// 32-bit IEEE float
+	UDPFORMAT_INT16,								// 16-bit PCM
+	UDPFORMAT_INT32,								// 32-bit PCM, also 24-bit PCM in 32-bit containers
+	UDPFORMAT_COUNT
+} UDPSAMPLEFORMAT;
+
+/// <summary>
+/// <para>Wire header leading every WASAN audio datagram, followed by nFrames interleaved frames encoded by nCodec.</para>
+/// <para>Format, channels and frames describe the audio as decoded, the payload size follows from the datagram's.</para>
+/// <para>Little-endian and naturally aligned, 24 bytes keep the payload 8-byte aligned,
+/// so a received datagram is read in place and its payload pushed into the ring without a copy.</para>
+/// </summary>
+typedef struct UDPAudioHeader {
+	UINT32				nMagic;				// UDP_AUDIO_MAGIC
+	BYTE				nVersion;			// UDP_AUDIO_VERSION
+	BYTE				nFormat;			// UDPSAMPLEFORMAT of the payload
+	BYTE				nChannels;			// Samples per frame
+	BYTE				nCodec;				// UDPCODECTYPE of the payload
+	UINT16				nStreamId;			// Stream of the sender, several share an address and socket
+	UINT16				nFrames;			// Frames in the payload
+	UINT32				nSequence;			// Datagram counter of the stream, wraps around
+	UINT64				nTimestamp;			// Frames of the stream sent before this payload's first one
+} UDPAUDIOHEADER;
+
+static_assert(sizeof(UDPAUDIOHEADER) == 24, "UDPAUDIOHEADER must match the wire layout");
+
+/// <summary>
+/// <para>Follows the UDPAUDIOHEADER of a UDPCODEC_PARITY datagram, then the XOR of the payloads of its group.</para>
+/// <para>The outer header carries the sequence number and timestamp of the group's first datagram,
+/// and the number of datagrams in the group in place of nFrames.</para>
+/// </summary>
+typedef struct UDPParityHeader {
+	UINT64				nTimestamp;			// XOR of the timestamps of the group
+	UINT16				nFrames;			// XOR of the frame counts
+	UINT16				nBytes;				// XOR of the payload sizes
+	BYTE				nCodec;				// XOR of the codecs
+	BYTE				pReserved[3];		// 0
+} UDPPARITYHEADER;
+
+static_assert(sizeof(UDPPARITYHEADER) == 16, "UDPPARITYHEADER must match the wire layout");
+
+/// <summary>
+/// <para>Ways WASAN render nodes of one channel mask and format share the stream sent to them, for UDP_FANOUT.</para>
+/// </summary>
+typedef enum UDPFanoutMode {
+	UDPFANOUT_NONE,									// Every node pulls, encodes and sends a stream of its own
+	UDPFANOUT_UNICAST,								// First node of a group sends its datagrams to every node of it in the same batch
+	UDPFANOUT_MULTICAST,							// First node of a group sends its datagrams once, to the group's multicast address the nodes must join
+	UDPFANOUT_COUNT
+} UDPFANOUTMODE;
+
+/// <summary>
+/// <para>Open-addressing hash table routing datagrams to WASAN capture nodes by binary IPv4 address and stream id.</para>
+/// <para>Built once from the configured nodes, linear probing over a power of two number of slots
+/// at most half full, so a lookup is a multiply, a shift and on average a slot or two.</para>
+/// </summary>
+typedef struct UDPNodeTable {
+	UINT64				* pKey;				// Stream id over node address in network byte order, 0 marks a free slot
+	UDPAudioBuffer		** pNode;
+	UINT32				nMask;				// Number of slots less 1
+	UINT32				nShift;				// 32 less log2 of the number of slots
+} UDPNODETABLE;
 
 /// <summary>
 /// Class porting WiFi-Direct connected UDP devices to similar AudioBuffer interface
@@ -16,6 +89,11 @@ class UDPAudioBuffer : public AudioBuffer
 		{
 			// Point to the beginning of the corresponding IP address string
 			pWASANNodeIP = ip;
+
+			// Parse the address once, datagrams are matched and sent on its binary form
+			tWASANNode.sin_family = AF_INET;
+			tWASANNode.sin_addr.s_addr = inet_addr(ip);
+			tWASANNode.sin_port = htons(UDP_RCV_PORT);
 		};
 
 		/// <summary>
@@ -24,25 +102,89 @@ class UDPAudioBuffer : public AudioBuffer
 		/// corresponding to this device. Listens to port for incoming UDP traffic
 		/// and drops any packets if arrived from clients not selected
 		/// as AudioBuffer capture nodes.</para>
-		/// <para>Note: Provide an overload if multiple threads, each dedicated to 
-		/// an individual socket is desired.</para>
+		/// <para>Runs on as many threads as UDPAudioBuffer::AssignShards() dealt the nodes out to,
+		/// each with a socket and port of its own and touching the state of its own nodes only.</para>
 		/// </summary>
 		/// <param name="pUDPSocket">- server socket to bind to.</param>
+		/// <param name="pBatch">- Registered I/O batch of the socket to receive datagrams many at a time,
+		/// NULL to receive them one recvfrom at a time.</param>
 		/// <param name="sUDPServerIP">- server IP address on which to listen to traffic to.</param>
+		/// <param name="nPort">- port of the nodes' shard on which to listen to traffic to.</param>
 		/// <param name="pUDPAudioBuffer">- array of pointers to UDPAudioBuffer objects
 		/// to match traffic with WASAN capture node objects.</param>
 		/// <param name="nWASANNodes">- number of WASAN capture nodes in the array.</param>
 		/// <param name="bDone">- indicator when user terminated the program.</param>
-		static void ReceiveDataUDP(SOCKET* pUDPSocket, CHAR* sUDPServerIP, UDPAudioBuffer** pUDPAudioBuffer, UINT32 nWASANNodes, BOOL* bDone);
+		static void ReceiveDataUDP(SOCKET* pUDPSocket, UDPBATCH* pBatch, CHAR* sUDPServerIP, UINT16 nPort, UDPAudioBuffer** pUDPAudioBuffer, UINT32 nWASANNodes, BOOL* bDone);
 		
 		/// <summary>
 		/// <para>UDP client sender functionality to push data to WASAN render nodes.</para>
+		/// <para>Prefixes the frames with a UDPAUDIOHEADER carrying the stream's sequence number and sample timestamp,
+		/// as many frames as fit a datagram are sent, encoded by the codec set with UDPAudioBuffer::SetCodecUDP().</para>
+		/// <para>With a batch set, the datagram is only staged and leaves with the others
+		/// on UDPAudioBuffer::CommitSendUDP().</para>
 		/// <para>Note: if socket error occurs, data does not get resent.</para>
 		/// </summary>
 		/// <param name="nFrames">- number of frames from output ring buffer to push over UDP
 		/// for the associated socket.</param>
 		void SendDataUDP(UINT32 nFrames);
 
+		/// <summary>
+		/// <para>Sends all datagrams staged on the batch of this UDPAudioBuffer in one call.</para>
+		/// <para>Nodes sharing a batch need it called on only one of them per render pass.</para>
+		/// </summary>
+		void CommitSendUDP();
+
+		/// <summary>
+		/// <para>Numbers the streams of nodes sharing an address in the order they are configured in.</para>
+		/// <para>Must be called the same way on both ends, the n-th node of an address sends and receives stream n.</para>
+		/// </summary>
+		/// <param name="pUDPAudioBuffer">- array of UDPAudioBuffer pointers.</param>
+		/// <param name="nUDPAudioBuffer">- number of UDPAudioBuffer objects in the array.</param>
+		static void AssignStreams(UDPAudioBuffer** pUDPAudioBuffer, UINT32 nUDPAudioBuffer);
+
+		/// <summary>
+		/// <para>Deals WASAN capture nodes out to receive threads, a socket and port each, as Winsock has no SO_REUSEPORT
+		/// to spread one port over several sockets.</para>
+		/// <para>Addresses are dealt round-robin in the order they first appear, so the streams of an address stay together
+		/// and keep their numbers. The k-th address is received on port UDP_RCV_PORT + k modulo the number of shards.</para>
+		/// <para>Note: nodes are not told their port, each address is logged with it to configure the node by.</para>
+		/// </summary>
+		/// <param name="pUDPAudioBuffer">- array of UDPAudioBuffer pointers.</param>
+		/// <param name="nUDPAudioBuffer">- number of UDPAudioBuffer objects in the array.</param>
+		/// <param name="nShards">- most receive threads wanted.</param>
+		/// <param name="pSharded">- receives the nodes of the first shard, then of the second and so on, each in configured order.</param>
+		/// <param name="pShardNodes">- receives the number of nodes of each shard, room for nShards.</param>
+		/// <returns>Number of shards used, fewer than wanted if there are fewer addresses, 0 on allocation failure.</returns>
+		static UINT32 AssignShards(UDPAudioBuffer** pUDPAudioBuffer, UINT32 nUDPAudioBuffer, UINT32 nShards, UDPAudioBuffer** pSharded, UINT32* pShardNodes);
+
+		/// <summary>
+		/// <para>Groups WASAN render nodes that take the same stream, equal in channel mask, format, codec, parity and stream id.</para>
+		/// <para>The first node of a group becomes its leader and sends for all of them, so each distinct stream is pulled,
+		/// resampled and encoded once however many nodes listen to it. The others are left alone by the render thread.</para>
+		/// <para>Must be called after the socket, codec and parity are set, again with UDPFANOUT_NONE before they change.</para>
+		/// <para>Note: with UDPFANOUT_MULTICAST nothing makes the render nodes join their group, each node is logged with
+		/// the group address it has to join on its own.</para>
+		/// </summary>
+		/// <param name="pUDPAudioBuffer">- array of UDPAudioBuffer pointers.</param>
+		/// <param name="nUDPAudioBuffer">- number of UDPAudioBuffer objects in the array.</param>
+		/// <param name="nMode">- UDPFANOUTMODE, UDPFANOUT_MULTICAST numbers the groups' addresses from UDP_MULTICAST_ADDRESS.</param>
+		/// <returns>ERROR_SUCCESS, ERROR_NOT_SUPPORTED for an unknown mode, or ENOMEM. Nodes failing to group send on their own.</returns>
+		static HRESULT AssignFanout(UDPAudioBuffer** pUDPAudioBuffer, UINT32 nUDPAudioBuffer, BYTE nMode);
+
+		/// <summary>
+		/// <para>Gets the node sending the stream of this WASAN render node.</para>
+		/// </summary>
+		/// <returns>This UDPAudioBuffer, unless UDPAudioBuffer::AssignFanout() made another one send for it.</returns>
+		UDPAudioBuffer* GetFanoutLeader();
+
+		/// <summary>
+		/// <para>Validates a datagram as a WASAN audio packet in place.</para>
+		/// </summary>
+		/// <param name="pPacket">- first byte of the datagram.</param>
+		/// <param name="nBytes">- size of the datagram.</param>
+		/// <returns>Header of the datagram, NULL if the magic, version, format, codec or size is off.</returns>
+		static const UDPAUDIOHEADER* ParseHeader(const BYTE* pPacket, UINT32 nBytes);
+
 		/// <summary>
 		/// Sets socket pointer on the UDPAudioBuffer object.
 		/// </summary>
@@ -57,17 +199,189 @@ class UDPAudioBuffer : public AudioBuffer
 		/// <returns>Pointer to a UDP socket of this UDPAudioBuffer.</returns>
 		SOCKET* GetSocketUDP();
 
+		/// <summary>
+		/// <para>Sets the Registered I/O batch of the socket, which may be shared with other nodes.</para>
+		/// </summary>
+		/// <param name="pBatch">- batch created on the socket of this UDPAudioBuffer, NULL to send one sendto at a time.</param>
+		void SetBatchUDP(UDPBATCH* pBatch);
+
+		/// <summary>
+		/// <para>Gets the Registered I/O batch of the UDPAudioBuffer object.</para>
+		/// </summary>
+		/// <returns>Pointer to the batch of this UDPAudioBuffer, NULL if none.</returns>
+		UDPBATCH* GetBatchUDP();
+
+		/// <summary>
+		/// <para>Sets the codec the datagrams sent to this WASAN render node are encoded by.</para>
+		/// <para>Must be called after the format is set, allocates the codec's buffers for it.</para>
+		/// </summary>
+		/// <param name="nCodec">- UDPCODECTYPE, UDPCODEC_PCM frees the buffers again.</param>
+		/// <returns>ERROR_SUCCESS, ERROR_NOT_SUPPORTED if the codec cannot carry the format, or ENOMEM.
+		/// The previous codec stays on failure.</returns>
+		HRESULT SetCodecUDP(BYTE nCodec);
+
+		/// <summary>
+		/// <para>Follows every UDP_FEC_GROUP datagrams sent to this WASAN render node with a parity datagram.</para>
+		/// </summary>
+		/// <param name="bParity">- TRUE to protect the datagrams sent from here on, FALSE to stop.</param>
+		void SetParityUDP(BOOL bParity);
+
 	private:
 		/// <summary>
-		/// <para>Iterates over the array of UDPAudioBuffer pointers and 
-		/// seeks one with matching IP address.</para>
+		/// <para>Builds the table routing datagrams to the WASAN capture nodes.</para>
+		/// <para>Nodes are keyed by address and stream id, not by port, as nodes send from ephemeral ports.
+		/// Numbers the streams with UDPAudioBuffer::AssignStreams().</para>
+		/// </summary>
+		/// <param name="pTable">- table to fill, freed with UDPAudioBuffer::FreeNodeTable().</param>
+		/// <param name="pUDPAudioBuffer">- array of UDPAudioBuffer pointers.</param>
+		/// <param name="nUDPAudioBuffer">- number of UDPAudioBuffer objects in the array.</param>
+		/// <returns>ERROR_SUCCESS or ENOMEM.</returns>
+		static HRESULT BuildNodeTable(UDPNODETABLE* pTable, UDPAudioBuffer** pUDPAudioBuffer, UINT32 nUDPAudioBuffer);
+
+		/// <summary>
+		/// <para>Frees the slots of a table built by UDPAudioBuffer::BuildNodeTable().</para>
+		/// </summary>
+		/// <param name="pTable">- table to free.</param>
+		static void FreeNodeTable(UDPNODETABLE* pTable);
+
+		/// <summary>
+		/// <para>Looks up the WASAN capture node a datagram came from.</para>
+		/// <para>No string formatting and no shared state, safe on any number of receive threads.</para>
+		/// </summary>
+		/// <param name="pTable">- table built by UDPAudioBuffer::BuildNodeTable().</param>
+		/// <param name="pSender">- source address of the datagram.</param>
+		/// <param name="nStreamId">- stream id in the header of the datagram.</param>
+		/// <returns>Pointer to UDPAudioBuffer object having this IPv4 address and stream, NULL if none.</returns>
+		static UDPAudioBuffer* GetBufferByAddress(const UDPNODETABLE* pTable, const SOCKADDR_IN* pSender, UINT16 nStreamId);
+
+		/// <summary>
+		/// <para>Sends a datagram to every destination of the stream, one after the other in the batch if set.</para>
+		/// </summary>
+		/// <param name="pPacket">- datagram to send.</param>
+		/// <param name="nBytes">- size of the datagram.</param>
+		/// <param name="bStaged">- datagram sits in the slot UDP.h's AcquireSendUDP() handed out last,
+		/// the first destination takes it from there and the others from copies.</param>
+		/// <returns>FALSE if any send failed.</returns>
+		BOOL PostPacketUDP(const BYTE* pPacket, UINT32 nBytes, BOOL bStaged);
+
+		/// <summary>
+		/// <para>Logs the multicast group a WASAN render node has to join, nothing joins it for the node.</para>
+		/// </summary>
+		/// <param name="pNode">- render node of a fan-out group.</param>
+		/// <param name="nGroup">- multicast address of the group, in network byte order.</param>
+		static void LogGroup(UDPAudioBuffer* pNode, ULONG nGroup);
+
+		/// <summary>
+		/// <para>Queues the payload of a parsed datagram in the jitter buffer, or without one pushes it into
+		/// the ring buffer straight from the datagram.</para>
+		/// <para>Counts the datagrams skipped by a sequence gap as lost, drops late and duplicate ones.
+		/// A parity datagram instead hands in the datagram of its group it rebuilds, if any.</para>
+		/// </summary>
+		/// <param name="pHeader">- header returned by UDPAudioBuffer::ParseHeader(), payload follows it.</param>
+		/// <param name="nBytes">- size of the datagram.</param>
+		/// <returns>ERROR_SUCCESS, ERROR_INVALID_DATA if the datagram is late or corrupt, or ERROR_NOT_SUPPORTED if its format differs.</returns>
+		HRESULT ReceivePacket(const UDPAUDIOHEADER* pHeader, UINT32 nBytes);
+
+		/// <summary>
+		/// <para>Gets the frames of a datagram in the endpoint's format, decoding compressed payloads.</para>
+		/// </summary>
+		/// <param name="pHeader">- header of the datagram, payload follows it.</param>
+		/// <param name="nBytes">- size of the datagram.</param>
+		/// <param name="pFrames">- set to the payload itself for PCM, to the decoded frames otherwise,
+		/// valid until the next call.</param>
+		/// <returns>ERROR_SUCCESS, ERROR_INVALID_DATA if the payload is corrupt, ERROR_NOT_SUPPORTED or ENOMEM.</returns>
+		HRESULT DecodePacket(const UDPAUDIOHEADER* pHeader, UINT32 nBytes, BYTE** pFrames);
+
+		/// <summary>
+		/// <para>Pushes the datagrams of the jitter buffer whose playout time has come into the ring buffer.</para>
+		/// <para>Lost datagrams are concealed.</para>
+		/// </summary>
+		/// <param name="fNow">- local time from JitterBuffer::GetTime().</param>
+		void PlayOut(DOUBLE fNow);
+
+		/// <summary>
+		/// <para>Pushes received frames into the ring buffer, through the concealer's history if UDP_PLC.</para>
+		/// </summary>
+		/// <param name="pPayload">- interleaved frames of the endpoint's format, faded in place after a loss.</param>
+		/// <param name="nFrames">- number of frames.</param>
+		void PushPacket(BYTE* pPayload, UINT32 nFrames);
+
+		/// <summary>
+		/// <para>Pushes concealment for lost frames into the ring buffer, up to UDP_PLC_MAX_MILLISEC of them.</para>
+		/// <para>Without a concealer pushes nothing, resetting the SRC history as a silent WASAPI packet does.</para>
+		/// </summary>
+		/// <param name="nFrames">- number of frames lost.</param>
+		void ConcealFrames(UINT32 nFrames);
+
+		/// <summary>
+		/// <para>Allocates the concealer and its staging buffers for the endpoint's format.</para>
+		/// </summary>
+		/// <returns>ERROR_SUCCESS or ENOMEM.</returns>
+		HRESULT InitConcealer();
+
+		/// <summary>
+		/// <para>Frees what UDPAudioBuffer::InitConcealer() allocated.</para>
+		/// </summary>
+		void FreeConcealer();
+
+		/// <summary>
+		/// <para>Allocates the codec and its staging buffers for the endpoint's format.</para>
+		/// </summary>
+		/// <returns>ERROR_SUCCESS or ENOMEM.</returns>
+		HRESULT InitCodec();
+
+		/// <summary>
+		/// <para>Frees what UDPAudioBuffer::InitCodec() allocated.</para>
+		/// </summary>
+		void FreeCodec();
+
+		/// <summary>
+		/// <para>Gets how long the receive thread may wait for datagrams without missing a playout time.</para>
 		/// </summary>
 		/// <param name="pUDPAudioBuffer">- array of UDPAudioBuffer pointers.</param>
 		/// <param name="nUDPAudioBuffer">- number of UDPAudioBuffer objects in the array.</param>
-		/// <param name="sIP">- IP address to use to look up the matching UDPAudioBuffer.</param>
-		/// <returns>Pointer to UDPAudioBuffer object having this IPv4 address.</returns>
-		static UDPAudioBuffer* GetBufferByIP(UDPAudioBuffer** pUDPAudioBuffer, UINT32 nUDPAudioBuffer, CHAR* sIP);
+		/// <returns>Milliseconds until the earliest playout time, between 1 and UDP_RECEIVE_TIMEOUT_MILLISEC.</returns>
+		static DWORD GetPlayoutTimeout(UDPAudioBuffer** pUDPAudioBuffer, UINT32 nUDPAudioBuffer);
+
+		/// <summary>
+		/// <para>Gets the wire sample format of the endpoint's packets.</para>
+		/// </summary>
+		/// <returns>UDPSAMPLEFORMAT of the ring buffer's endpoint side.</returns>
+		BYTE GetSampleFormat();
 
 		CHAR* pWASANNodeIP;
+		SOCKADDR_IN tWASANNode;
 		SOCKET* pUDPSocket;
+		UDPBATCH* pUDPBatch = NULL;
+
+		// Stream state, of the sender on render nodes and of the receiver on capture nodes
+		UINT16 nStreamId = 0;
+		UINT32 nSequence = 0;						// Next sequence number to send or expected
+		UINT64 nTimestamp = 0;						// Frames sent so far, or timestamp expected next
+		BOOL bSynced = FALSE;						// Receiver saw a datagram of the stream already
+
+		JitterBuffer* pJitterBuffer = NULL;			// Reorders and paces datagrams of capture nodes if UDP_JITTER_BUFFER
+		PacketConcealer* pConcealer = NULL;			// Fills gaps of lost datagrams of capture nodes if UDP_PLC
+		FLOAT* pConcealFrames = NULL;				// Float frames exchanged with the concealer
+		BYTE* pConcealPacket = NULL;				// Concealment in the endpoint's format
+		UINT32 nConcealFrames = 0;					// Capacity of both in frames
+
+		BYTE nCodec = UDPCODEC_PCM;					// Codec datagrams are sent with, receivers follow the header
+		UDPCodec* pCodec = NULL;					// Encoder of render nodes, decoder of capture nodes
+		FLOAT* pCodecFrames = NULL;					// Float frames exchanged with the codec
+		BYTE* pCodecPacket = NULL;					// Same frames in the endpoint's format
+		UINT32 nCodecFrames = 0;					// Capacity of both in frames
+
+		PacketParity* pParity = NULL;				// Parity of the group sent or datagrams received if UDP_FEC
+
+		UDPAudioBuffer* pFanoutLeader = NULL;		// Node sending this render node's stream, NULL if it sends its own
+		SOCKADDR_IN* pFanout = NULL;				// Destinations of a leader's datagrams, its own node and followers or a multicast group
+		UINT32 nFanout = 0;							// Number of them, 0 sends to the node alone
+
+		// Receive statistics, reported when the receive thread exits
+		UINT64 nPacketsLost = 0;
+		UINT64 nPacketsLate = 0;
+		UINT64 nPacketsRejected = 0;
+		UINT64 nPacketsCorrupt = 0;
+		UINT64 nPacketsRecovered = 0;
 };
@@ -0,0 +1,156 @@
+#include "UDPCodec.h"
+#include <cmath>
+
+//-------- IMA ADPCM
+static const INT32 pStepSize[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const INT32 pIndexStep[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+static inline void StepADPCM(UDPADPCMSTATE* pState, UINT32 nNibble)
+{
+	// Encoder and decoder reconstruct identically, so they never drift apart
+	INT32 nStep = pStepSize[pState->nIndex];
+	INT32 nDelta = nStep >> 3;
+
+	if (nNibble & 4) nDelta += nStep;
+	if (nNibble & 2) nDelta += nStep >> 1;
+	if (nNibble & 1) nDelta += nStep >> 2;
+
+	INT32 nPredictor = (nNibble & 8) ? pState->nPredictor - nDelta : pState->nPredictor + nDelta;
+
+	pState->nPredictor = (INT16)min(max(nPredictor, -32768), 32767);
+	pState->nIndex = (BYTE)min(max((INT32)pState->nIndex + pIndexStep[nNibble & 7], 0), 88);
+}
+
+static inline UINT32 EncodeADPCM(UDPADPCMSTATE* pState, INT32 nSample)
+{
+	INT32 nDiff = nSample - pState->nPredictor;
+	INT32 nStep = pStepSize[pState->nIndex];
+	UINT32 nNibble = 0;
+
+	if (nDiff < 0)
+	{
+		nNibble = 8;
+		nDiff = -nDiff;
+	}
+
+	// Quantize the difference to 3 bits of multiples of a quarter step
+	if (nDiff >= nStep) { nNibble |= 4; nDiff -= nStep; }
+	if (nDiff >= nStep >> 1) { nNibble |= 2; nDiff -= nStep >> 1; }
+	if (nDiff >= nStep >> 2) nNibble |= 1;
+
+	StepADPCM(pState, nNibble);
+
+	return nNibble;
+}
+
+UDPCodec::UDPCodec(UINT32 nChannels)
+{
+	this->nChannels = nChannels;
+
+	// Encoding a FLAC frame takes 2 blocks, decoding one a block per channel
+	this->pScratch = (INT32*)malloc((SIZE_T)max(min(nChannels, (UINT32)8), (UINT32)2) * FLACCODEC_BLOCK_FRAMES * sizeof(INT32));
+	this->pState = (UDPADPCMSTATE*)calloc(max(nChannels, (UINT32)1), sizeof(UDPADPCMSTATE));
+}
+
+UDPCodec::~UDPCodec()
+{
+	free(this->pScratch);
+	free(this->pState);
+}
+
+UINT32 UDPCodec::Encode(BYTE nCodec, const FLOAT* pFrames, UINT32 nFrames, UINT32 nSequence, BYTE* pPayload)
+{
+	if (this->pScratch == NULL || this->pState == NULL) return 0;
+
+	if (nCodec == UDPCODEC_LOSSLESS && this->nChannels <= 8)
+		return FLACCodec::EncodeFrame(pFrames, nFrames, this->nChannels, nSequence, this->pScratch, pPayload);
+
+	if (nCodec != UDPCODEC_ADPCM) return 0;
+
+	// State each channel starts from, then the nibbles of the interleaved samples, low nibble first
+	BYTE* pNibbles = pPayload + this->nChannels * sizeof(UDPADPCMSTATE);
+	memcpy(pPayload, this->pState, this->nChannels * sizeof(UDPADPCMSTATE));
+	memset(pNibbles, 0, ((SIZE_T)nFrames * this->nChannels + 1) / 2);
+
+	for (UINT32 i = 0; i < this->nChannels; i++)
+		for (UINT32 j = 0; j < nFrames; j++)
+		{
+			UINT32 k = j * this->nChannels + i;
+			INT32 nSample = (INT32)min(max(floor(pFrames[k] * 32768.0f + 0.5f), -32768.0f), 32767.0f);
+
+			pNibbles[k >> 1] |= (BYTE)(EncodeADPCM(&this->pState[i], nSample) << ((k & 1) << 2));
+		}
+
+	return UDPCodec::GetMinBytes(UDPCODEC_ADPCM, this->nChannels, nFrames);
+}
+
+HRESULT UDPCodec::Decode(BYTE nCodec, const BYTE* pPayload, UINT32 nBytes, UINT32 nFrames, FLOAT* pFrames)
+{
+	if (this->pScratch == NULL) return ENOMEM;
+
+	if (nCodec == UDPCODEC_LOSSLESS && this->nChannels <= 8)
+	{
+		UINT32 nDecoded = 0;
+
+		HRESULT hr = FLACCodec::DecodeFrame(pPayload, nBytes, this->nChannels, this->pScratch, pFrames, &nDecoded);
+		if (hr != ERROR_SUCCESS) return hr;
+
+		// Header and frame must agree, the ring takes the header's count
+		return (nDecoded == nFrames) ? ERROR_SUCCESS : ERROR_INVALID_DATA;
+	}
+
+	if (nCodec != UDPCODEC_ADPCM) return ERROR_NOT_SUPPORTED;
+
+	if (nBytes < UDPCodec::GetMinBytes(UDPCODEC_ADPCM, this->nChannels, nFrames)) return ERROR_INVALID_DATA;
+
+	const BYTE* pNibbles = pPayload + this->nChannels * sizeof(UDPADPCMSTATE);
+
+	for (UINT32 i = 0; i < this->nChannels; i++)
+	{
+		UDPADPCMSTATE tState;
+		memcpy(&tState, pPayload + i * sizeof(UDPADPCMSTATE), sizeof(UDPADPCMSTATE));
+
+		if (tState.nIndex > 88) return ERROR_INVALID_DATA;
+
+		for (UINT32 j = 0; j < nFrames; j++)
+		{
+			UINT32 k = j * this->nChannels + i;
+
+			StepADPCM(&tState, (pNibbles[k >> 1] >> ((k & 1) << 2)) & 0x0F);
+			pFrames[k] = (FLOAT)tState.nPredictor / 32768.0f;
+		}
+	}
+
+	return ERROR_SUCCESS;
+}
+
+UINT32 UDPCodec::GetMaxFrames(BYTE nCodec, UINT32 nChannels, UINT32 nBytes)
+{
+	if (nChannels == 0) return 0;
+
+	if (nCodec == UDPCODEC_ADPCM)
+		return (nBytes > nChannels * sizeof(UDPADPCMSTATE)) ?
+			min((UINT32)((nBytes - nChannels * sizeof(UDPADPCMSTATE)) * 2 / nChannels), (UINT32)MAXUINT16) : 0;
+
+	// Same worst case of all channels verbatim FLACCodec::GetMaxFrameBytes() assumes, for a shorter block
+	if (nCodec == UDPCODEC_LOSSLESS && nChannels <= 8 && nBytes > 19 + 6 * nChannels)
+		return min((nBytes - 19 - 6 * nChannels) * 8 / (nChannels * FLACCODEC_BITS_PER_SAMPLE), (UINT32)FLACCODEC_BLOCK_FRAMES);
+
+	return 0;
+}
+
+UINT32 UDPCodec::GetMinBytes(BYTE nCodec, UINT32 nChannels, UINT32 nFrames)
+{
+	if (nCodec == UDPCODEC_ADPCM)
+		return nChannels * sizeof(UDPADPCMSTATE) + (nFrames * nChannels + 1) / 2;
+
+	// Frame header, a constant subframe per channel and the footer, FLACCodec checks the rest
+	return 6 + nChannels + 2;
+}
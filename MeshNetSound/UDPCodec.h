@@ -0,0 +1,96 @@
+#pragma once
+#include <windows.h>
+#include "config.h"
+#include "FLACCodec.h"
+
+/// <summary>
+/// <para>Encodings of the payload of a WASAN audio datagram, in UDPAUDIOHEADER::nCodec.</para>
+/// </summary>
+typedef enum UDPCodecType {
+	UDPCODEC_PCM,									// Frames as they are, in the header's sample format
+	UDPCODEC_ADPCM,									// 4-bit IMA ADPCM, an encoder state per channel leading the nibbles
+	UDPCODEC_LOSSLESS,								// One FLAC frame of FLACCODEC_BITS_PER_SAMPLE bit samples, up to 8 channels, exact for integer PCM only
+	UDPCODEC_PARITY,								// XOR of a group of datagrams for PacketParity, carries no audio of its own
+	UDPCODEC_COUNT
+} UDPCODECTYPE;
+
+/// <summary>
+/// <para>IMA ADPCM encoder state of a channel, as it leads an ADPCM payload.</para>
+/// <para>Sent with every datagram, so a datagram decodes on its own and a lost one does not derail the next.</para>
+/// </summary>
+typedef struct UDPADPCMState {
+	INT16				nPredictor;			// 16-bit sample the first nibble is a step from
+	BYTE				nIndex;				// Step size index, 0 to 88
+	BYTE				nReserved;			// 0
+} UDPADPCMSTATE;
+
+static_assert(sizeof(UDPADPCMSTATE) == 4, "UDPADPCMSTATE must match the wire layout");
+
+/// <summary>
+/// <para>Compresses the payload of the datagrams of one WASAN stream and expands it again.</para>
+/// <para>Every datagram is self-contained: IMA ADPCM carries the encoder state it starts from, at 4 bits per sample
+/// an eighth of float32 and a quarter of 16-bit PCM, for a few integer operations per sample either way.
+/// The lossless mode codes the datagram as a single FLAC frame with FLACCodec, typically halving the size.</para>
+/// <para>Note: lossless only for integer PCM of up to FLACCODEC_BITS_PER_SAMPLE bits. Float streams, the default WASAN
+/// format, are quantized to FLACCODEC_BITS_PER_SAMPLE bits and clipped to [-1, 1), so they do not come back exactly.</para>
+/// <para>Decoding is driven by UDPAUDIOHEADER::nCodec alone, so a receiver follows whichever codec the sender picked.
+/// Nothing is negotiated, a sender only picks a compressed codec for nodes known to decode it.</para>
+/// <para>Note: not thread-safe, each stream's sending or receiving thread owns its UDPCodec.</para>
+/// </summary>
+class UDPCodec
+{
+	public:
+		/// <summary>
+		/// <para>Allocates the scratch space and encoder state of a stream.</para>
+		/// <para>Note: on allocation failure UDPCodec::Encode() and UDPCodec::Decode() fail.</para>
+		/// </summary>
+		/// <param name="nChannels">- number of samples in a frame.</param>
+		UDPCodec(UINT32 nChannels);
+
+		~UDPCodec();
+
+		/// <summary>
+		/// <para>Encodes the frames of one datagram.</para>
+		/// </summary>
+		/// <param name="nCodec">- UDPCODEC_ADPCM or UDPCODEC_LOSSLESS.</param>
+		/// <param name="pFrames">- interleaved float frames in [-1, 1), clipped otherwise.</param>
+		/// <param name="nFrames">- number of frames, at most UDPCodec::GetMaxFrames().</param>
+		/// <param name="nSequence">- sequence number of the datagram.</param>
+		/// <param name="pPayload">- receives the encoded payload.</param>
+		/// <returns>Size of the payload, 0 if the codec cannot encode the stream.</returns>
+		UINT32 Encode(BYTE nCodec, const FLOAT* pFrames, UINT32 nFrames, UINT32 nSequence, BYTE* pPayload);
+
+		/// <summary>
+		/// <para>Decodes the payload of one datagram.</para>
+		/// </summary>
+		/// <param name="nCodec">- codec in the header of the datagram.</param>
+		/// <param name="pPayload">- first byte of the payload.</param>
+		/// <param name="nBytes">- size of the payload.</param>
+		/// <param name="nFrames">- number of frames in the header of the datagram.</param>
+		/// <param name="pFrames">- receives the interleaved float frames.</param>
+		/// <returns>ERROR_SUCCESS, ERROR_INVALID_DATA if the payload is corrupt, ERROR_NOT_SUPPORTED or ENOMEM.</returns>
+		HRESULT Decode(BYTE nCodec, const BYTE* pPayload, UINT32 nBytes, UINT32 nFrames, FLOAT* pFrames);
+
+		/// <summary>
+		/// <para>Gets the most frames a codec is sure to fit into a payload, whatever the audio.</para>
+		/// </summary>
+		/// <param name="nCodec">- UDPCODEC_ADPCM or UDPCODEC_LOSSLESS.</param>
+		/// <param name="nChannels">- number of samples in a frame.</param>
+		/// <param name="nBytes">- room for the payload.</param>
+		/// <returns>Number of frames, 0 if the codec does not support the channel count.</returns>
+		static UINT32 GetMaxFrames(BYTE nCodec, UINT32 nChannels, UINT32 nBytes);
+
+		/// <summary>
+		/// <para>Gets the least size of a payload the header describes, to reject truncated datagrams before decoding.</para>
+		/// </summary>
+		/// <param name="nCodec">- UDPCODEC_ADPCM or UDPCODEC_LOSSLESS.</param>
+		/// <param name="nChannels">- number of samples in a frame.</param>
+		/// <param name="nFrames">- number of frames.</param>
+		/// <returns>Size in bytes, exact for ADPCM.</returns>
+		static UINT32 GetMinBytes(BYTE nCodec, UINT32 nChannels, UINT32 nFrames);
+
+	private:
+		INT32				* pScratch			{ NULL };	// FLACCodec scratch, enough for encoding and decoding
+		UDPADPCMSTATE		* pState			{ NULL };	// ADPCM encoder state per channel, carried across datagrams
+		UINT32				nChannels			{ 0 };
+};
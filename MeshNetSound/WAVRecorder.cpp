@@ -0,0 +1,847 @@
+#include "WAVRecorder.h"
+#include "FLACCodec.h"
+#include <iostream>
+
+WAVRecorder* WAVRecorder::pInstance{ NULL };
+UINT32 WAVRecorder::nReferences{ 0 };
+SRWLOCK WAVRecorder::tInstanceLock = SRWLOCK_INIT;
+
+WAVRecorder* WAVRecorder::Acquire()
+{
+	AcquireSRWLockExclusive(&WAVRecorder::tInstanceLock);
+
+	if (WAVRecorder::pInstance == NULL)
+	{
+		WAVRecorder* pRecorder = new WAVRecorder();
+
+		// Recorder is useless without its thread
+		if (pRecorder->hThread == NULL)
+		{
+			std::cout << ERR "Failed to start WAV recorder thread." END << std::endl;
+			delete pRecorder;
+		}
+		else
+			WAVRecorder::pInstance = pRecorder;
+	}
+
+	if (WAVRecorder::pInstance != NULL) WAVRecorder::nReferences++;
+
+	WAVRecorder* pRecorder = WAVRecorder::pInstance;
+
+	ReleaseSRWLockExclusive(&WAVRecorder::tInstanceLock);
+
+	return pRecorder;
+}
+
+void WAVRecorder::Release()
+{
+	AcquireSRWLockExclusive(&WAVRecorder::tInstanceLock);
+
+	if (WAVRecorder::nReferences > 0 && --WAVRecorder::nReferences == 0)
+	{
+		delete WAVRecorder::pInstance;
+		WAVRecorder::pInstance = NULL;
+	}
+
+	ReleaseSRWLockExclusive(&WAVRecorder::tInstanceLock);
+}
+
+WAVRecorder::WAVRecorder()
+{
+	this->hStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (this->hStop == NULL) return;
+
+	// Encoder threads themselves only start with the first FLAC track
+	this->hEncoderStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+	this->hJobs = CreateSemaphore(NULL, 0, WAVRECORDER_MAX_TRACKS * WAVRECORDER_ENCODER_BLOCKS, NULL);
+
+	// Batches of all files go out in one call per pass where the system has I/O rings, a WriteFile each otherwise
+	if (WAVRECORDER_IORING)
+		this->bRing = this->InitRing();
+
+	this->hThread = CreateThread(NULL, 0, WAVRecorder::RecorderThread, (LPVOID)this, 0, NULL);
+
+	// Disk writes must never preempt capture, render or DSP threads
+	if (this->hThread != NULL)
+		SetThreadPriority(this->hThread, THREAD_PRIORITY_BELOW_NORMAL);
+}
+
+WAVRecorder::~WAVRecorder()
+{
+	if (this->hThread != NULL)
+	{
+		SetEvent(this->hStop);
+		WaitForSingleObject(this->hThread, INFINITE);
+		CloseHandle(this->hThread);
+	}
+
+	if (this->hStop != NULL) CloseHandle(this->hStop);
+
+	// Complete files whose owners did not close them
+	for (UINT32 i = 0; i < WAVRECORDER_MAX_TRACKS; i++)
+		if (this->pTrack[i] != NULL)
+			this->CloseTrack(this->pTrack[i]);
+
+	// FLAC tracks needed the encoders until closed
+	if (this->hEncoderStop != NULL) SetEvent(this->hEncoderStop);
+
+	for (UINT32 i = 0; i < WAVRECORDER_ENCODER_THREADS; i++)
+		if (this->hEncoderThread[i] != NULL)
+		{
+			WaitForSingleObject(this->hEncoderThread[i], INFINITE);
+			CloseHandle(this->hEncoderThread[i]);
+		}
+
+	if (this->hEncoderStop != NULL) CloseHandle(this->hEncoderStop);
+	if (this->hJobs != NULL) CloseHandle(this->hJobs);
+
+#if WAVRECORDER_IORING
+	// Closing the tracks waited for all their writes
+	if (this->bRing) this->tRing.CloseIoRing(this->tRing.hRing);
+#endif
+}
+
+WAVRECORDERTRACK* WAVRecorder::OpenTrack(std::string sPath, const BYTE* pFormat, UINT32 nFormatBytes)
+{
+	// RIFF, JUNK or ds64 of 28 bytes, fmt and data chunk headers around the format
+	UINT32 nHeaderBytes = 12 + 36 + 8 + nFormatBytes + 8;
+	if (nFormatBytes < 16 || (nFormatBytes & 1) || nHeaderBytes > WAVRECORDER_SECTOR_BYTES) return NULL;
+
+	WAVRECORDERTRACK* pTrack = this->CreateTrack(sPath);
+	if (pTrack == NULL) return NULL;
+
+	BYTE* pHeader = pTrack->pSector;
+
+	// RIFF Header
+	memcpy(pHeader, "RIFF----WAVE", 12);
+	// Room for a ds64 chunk should the file outgrow 32-bit sizes
+	memcpy(pHeader + 12, "JUNK", 4);
+	*(DWORD*)(pHeader + 16) = 28;
+	// Format-Section
+	memcpy(pHeader + 48, "fmt ", 4);
+	*(DWORD*)(pHeader + 52) = nFormatBytes;
+	memcpy(pHeader + 56, pFormat, nFormatBytes);
+	// Data-Section
+	memcpy(pHeader + 56 + nFormatBytes, "data----", 8);
+
+	pTrack->nBlockAlign = ((const WAVEFORMATEX*)pFormat)->nBlockAlign;
+	WAVRecorder::SetHeaderSizes(pHeader, nHeaderBytes, 0, pTrack->nBlockAlign);
+
+	return this->AddTrack(pTrack, nHeaderBytes);
+}
+
+WAVRECORDERTRACK* WAVRecorder::OpenFLACTrack(std::string sPath, UINT32 nChannels, DWORD nSamplesPerSec)
+{
+	if (nChannels < 1 || nChannels > 8 || nSamplesPerSec == 0 || nSamplesPerSec >= (1 << 20)) return NULL;
+
+	WAVRECORDERTRACK* pTrack = this->CreateTrack(sPath);
+	if (pTrack == NULL) return NULL;
+
+	BOOL bSuccess = TRUE;
+
+	pTrack->pBlock = new WAVRECORDERBLOCK[WAVRECORDER_ENCODER_BLOCKS]();
+
+	for (UINT32 i = 0; i < WAVRECORDER_ENCODER_BLOCKS; i++)
+	{
+		WAVRECORDERBLOCK* pBlock = &pTrack->pBlock[i];
+
+		pBlock->pFrames = (FLOAT*)malloc(FLACCODEC_BLOCK_FRAMES * nChannels * sizeof(FLOAT));
+		pBlock->pScratch = (INT32*)malloc(2 * FLACCODEC_BLOCK_FRAMES * sizeof(INT32));
+		pBlock->pFrame = (BYTE*)malloc(FLACCodec::GetMaxFrameBytes(nChannels));
+		pBlock->nChannels = nChannels;
+		pBlock->bDone.store(TRUE, std::memory_order_relaxed);
+
+		bSuccess &= (pBlock->pFrames != NULL && pBlock->pScratch != NULL && pBlock->pFrame != NULL);
+	}
+
+	if (!bSuccess)
+	{
+		CloseHandle(pTrack->hFile);
+		DeleteFileA(sPath.c_str());
+		WAVRecorder::FreeTrack(pTrack);
+		return NULL;
+	}
+
+	// Encoder pool starts with the first FLAC track, WAV-only recordings never pay for it
+	AcquireSRWLockExclusive(&this->tLock);
+
+	for (UINT32 i = 0; i < WAVRECORDER_ENCODER_THREADS && this->hJobs != NULL && this->hEncoderStop != NULL; i++)
+		if (this->hEncoderThread[i] == NULL)
+		{
+			this->hEncoderThread[i] = CreateThread(NULL, 0, WAVRecorder::EncoderThread, (LPVOID)this, 0, NULL);
+
+			// Encoding is bulk work just like the disk writes it feeds
+			if (this->hEncoderThread[i] != NULL)
+				SetThreadPriority(this->hEncoderThread[i], THREAD_PRIORITY_BELOW_NORMAL);
+		}
+
+	ReleaseSRWLockExclusive(&this->tLock);
+
+	// Producer queues float frames as for a float WAV track
+	pTrack->nBlockAlign = (WORD)(nChannels * sizeof(FLOAT));
+
+	return this->AddTrack(pTrack, FLACCodec::MakeStreamHeader(pTrack->pSector, nChannels, nSamplesPerSec));
+}
+
+WAVRECORDERTRACK* WAVRecorder::CreateTrack(std::string sPath)
+{
+	WAVRECORDERTRACK* pTrack = new WAVRECORDERTRACK();
+
+	pTrack->sPath = sPath;
+	pTrack->bMapped = WAVRECORDER_MAPPED;
+	// Mapped views always go through the system cache
+	pTrack->bUnbuffered = WAVRECORDER_UNBUFFERED && !pTrack->bMapped;
+	// Mapping a file for writing needs read access too
+	pTrack->hFile = CreateFileA(sPath.c_str(), GENERIC_WRITE | (pTrack->bMapped ? GENERIC_READ : 0), FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN | (pTrack->bUnbuffered ? FILE_FLAG_NO_BUFFERING : 0), NULL);
+
+	// Unbuffered writes need buffers aligned to the sector size, which also suits buffered ones
+	pTrack->pQueue = (BYTE*)malloc(WAVRECORDER_QUEUE_BYTES);
+	pTrack->pSector = (BYTE*)_aligned_malloc(WAVRECORDER_SECTOR_BYTES, WAVRECORDER_SECTOR_BYTES);
+	pTrack->nQueueMask = WAVRECORDER_QUEUE_BYTES - 1;
+
+	// Mapped files take data straight from the queue, without staging. With the I/O ring, one buffer fills while the others are written
+	BOOL bBatches = TRUE;
+	for (UINT32 i = 0; i < (this->bRing ? WAVRECORDER_IORING_DEPTH : 1) && !pTrack->bMapped; i++)
+	{
+		pTrack->pWrite[i].pBuffer = (BYTE*)_aligned_malloc(WAVRECORDER_BATCH_BYTES, WAVRECORDER_SECTOR_BYTES);
+		pTrack->pWrite[i].pTrack = pTrack;
+		bBatches &= (pTrack->pWrite[i].pBuffer != NULL);
+	}
+
+	pTrack->pBatch = pTrack->pWrite[0].pBuffer;
+
+	if (pTrack->hFile == INVALID_HANDLE_VALUE || pTrack->pQueue == NULL || !bBatches || pTrack->pSector == NULL)
+	{
+		if (pTrack->hFile != INVALID_HANDLE_VALUE) CloseHandle(pTrack->hFile);
+		WAVRecorder::FreeTrack(pTrack);
+		return NULL;
+	}
+
+	memset(pTrack->pSector, 0, WAVRECORDER_SECTOR_BYTES);
+
+	pTrack->nBatchBytes = 0;
+	pTrack->nWrite = 0;
+	pTrack->nFileBytes = 0;
+	pTrack->nAllocatedBytes = 0;
+	pTrack->nCheckpointBytes = 0;
+	pTrack->nCheckpointTick = GetTickCount64();
+	pTrack->hMapping = NULL;
+	pTrack->pView = NULL;
+	pTrack->nViewOffset = 0;
+	pTrack->pBlock = NULL;
+	pTrack->nBlocksSubmitted = 0;
+	pTrack->nBlocksWritten = 0;
+	pTrack->nStreamFrames = 0;
+	pTrack->nMinFrameBytes = 0;
+	pTrack->nMaxFrameBytes = 0;
+	pTrack->nHead.store(0, std::memory_order_relaxed);
+	pTrack->nTail.store(0, std::memory_order_relaxed);
+	pTrack->nDropped.store(0, std::memory_order_relaxed);
+
+	return pTrack;
+}
+
+WAVRECORDERTRACK* WAVRecorder::AddTrack(WAVRECORDERTRACK* pTrack, UINT32 nHeaderBytes)
+{
+	BOOL bSuccess = TRUE;
+	UINT32 i = WAVRECORDER_MAX_TRACKS;
+
+	pTrack->nHeaderBytes = nHeaderBytes;
+
+	// Header goes out with the first batch, so every write starts on a batch boundary
+	if (pTrack->bMapped)
+		bSuccess = this->WriteMapped(pTrack, pTrack->pSector, nHeaderBytes);
+	else
+	{
+		memcpy(pTrack->pBatch, pTrack->pSector, nHeaderBytes);
+		pTrack->nBatchBytes = nHeaderBytes;
+	}
+
+	if (bSuccess)
+	{
+		AcquireSRWLockExclusive(&this->tLock);
+
+		i = 0;
+		while (i < WAVRECORDER_MAX_TRACKS && this->pTrack[i] != NULL) i++;
+		if (i < WAVRECORDER_MAX_TRACKS) this->pTrack[i] = pTrack;
+
+		ReleaseSRWLockExclusive(&this->tLock);
+	}
+
+	// File could not be mapped or all slots are taken
+	if (i == WAVRECORDER_MAX_TRACKS)
+	{
+		if (pTrack->pView != NULL) UnmapViewOfFile(pTrack->pView);
+		if (pTrack->hMapping != NULL) CloseHandle(pTrack->hMapping);
+		CloseHandle(pTrack->hFile);
+		DeleteFileA(pTrack->sPath.c_str());
+		WAVRecorder::FreeTrack(pTrack);
+		return NULL;
+	}
+
+	return pTrack;
+}
+
+void WAVRecorder::FreeTrack(WAVRECORDERTRACK* pTrack)
+{
+	if (pTrack->pBlock != NULL)
+		for (UINT32 i = 0; i < WAVRECORDER_ENCODER_BLOCKS; i++)
+		{
+			free(pTrack->pBlock[i].pFrames);
+			free(pTrack->pBlock[i].pScratch);
+			free(pTrack->pBlock[i].pFrame);
+		}
+
+	delete[] pTrack->pBlock;
+	free(pTrack->pQueue);
+	for (UINT32 i = 0; i < WAVRECORDER_IORING_DEPTH; i++)
+		_aligned_free(pTrack->pWrite[i].pBuffer);
+	_aligned_free(pTrack->pSector);
+	delete pTrack;
+}
+
+BOOL WAVRecorder::Record(WAVRECORDERTRACK* pTrack, const void* pData, UINT32 nBytes)
+{
+	UINT64 nHead = pTrack->nHead.load(std::memory_order_relaxed);
+	UINT64 nTail = pTrack->nTail.load(std::memory_order_acquire);
+
+	// Never wait for the disk, losing recorded data beats a capture dropout
+	if (WAVRECORDER_QUEUE_BYTES - (nHead - nTail) < nBytes)
+	{
+		pTrack->nDropped.fetch_add(nBytes, std::memory_order_relaxed);
+		return FALSE;
+	}
+
+	UINT32 nOffset = (UINT32)nHead & pTrack->nQueueMask;
+	UINT32 nFirst = min(nBytes, WAVRECORDER_QUEUE_BYTES - nOffset);
+
+	memcpy(pTrack->pQueue + nOffset, pData, nFirst);
+	memcpy(pTrack->pQueue, (const BYTE*)pData + nFirst, nBytes - nFirst);
+
+	// Release pairs with the acquire in Drain: the recorder thread sees the bytes before the new head
+	pTrack->nHead.store(nHead + nBytes, std::memory_order_release);
+
+	return TRUE;
+}
+
+UINT32 WAVRecorder::GetQueueSpace(WAVRECORDERTRACK* pTrack)
+{
+	UINT64 nHead = pTrack->nHead.load(std::memory_order_relaxed);
+	UINT64 nTail = pTrack->nTail.load(std::memory_order_acquire);
+
+	return WAVRECORDER_QUEUE_BYTES - (UINT32)(nHead - nTail);
+}
+
+void WAVRecorder::CloseTrack(WAVRECORDERTRACK* pTrack)
+{
+	if (pTrack == NULL) return;
+
+	// Keep the recorder thread off the track while it is written out and freed
+	AcquireSRWLockExclusive(&this->tLock);
+
+	for (UINT32 i = 0; i < WAVRECORDER_MAX_TRACKS; i++)
+		if (this->pTrack[i] == pTrack)
+			this->pTrack[i] = NULL;
+
+	// The I/O ring is shared by all tracks, keep the recorder thread off it too until the file is complete
+	if (!this->bRing)
+		ReleaseSRWLockExclusive(&this->tLock);
+
+	this->Drain(pTrack, TRUE);
+	this->Finalize(pTrack);
+
+	if (this->bRing)
+		ReleaseSRWLockExclusive(&this->tLock);
+
+	UINT64 nDropped = pTrack->nDropped.load(std::memory_order_relaxed);
+	if (nDropped > 0)
+		std::cout << WRN "WAV recorder dropped " << nDropped << " bytes of " << pTrack->sPath << ", disk could not keep up." END << std::endl;
+
+	WAVRecorder::FreeTrack(pTrack);
+}
+
+DWORD WINAPI WAVRecorder::RecorderThread(LPVOID lpParam)
+{
+	WAVRecorder* pRecorder = (WAVRecorder*)lpParam;
+
+	// Wake up periodically, the queues hold far more than one period of audio
+	while (WaitForSingleObject(pRecorder->hStop, WAVRECORDER_FLUSH_MILLISEC) == WAIT_TIMEOUT)
+	{
+		AcquireSRWLockShared(&pRecorder->tLock);
+
+		ULONGLONG nNow = GetTickCount64();
+
+		for (UINT32 i = 0; i < WAVRECORDER_MAX_TRACKS; i++)
+		{
+			WAVRECORDERTRACK* pTrack = pRecorder->pTrack[i];
+			if (pTrack == NULL) continue;
+
+			pRecorder->Drain(pTrack, FALSE);
+
+			// Keep the header in step with the data on disk, so the file stays readable after a crash
+			if (nNow - pTrack->nCheckpointTick >= WAVRECORDER_CHECKPOINT_MILLISEC)
+			{
+				if (pTrack->nFileBytes > pTrack->nCheckpointBytes)
+					pRecorder->Checkpoint(pTrack);
+
+				pTrack->nCheckpointTick = nNow;
+			}
+		}
+
+		// Single call for the batches of every file filled during this pass
+		if (pRecorder->bRing)
+			pRecorder->SubmitWrites(FALSE);
+
+		ReleaseSRWLockShared(&pRecorder->tLock);
+	}
+
+	return 0;
+}
+
+DWORD WINAPI WAVRecorder::EncoderThread(LPVOID lpParam)
+{
+	WAVRecorder* pRecorder = (WAVRecorder*)lpParam;
+	HANDLE pEvents[2] = { pRecorder->hEncoderStop, pRecorder->hJobs };
+
+	// Each signal of the semaphore stands for one block in the FIFO
+	while (WaitForMultipleObjects(2, pEvents, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
+	{
+		AcquireSRWLockExclusive(&pRecorder->tJobLock);
+
+		WAVRECORDERBLOCK* pBlock = pRecorder->pJob[pRecorder->nJobTail % (WAVRECORDER_MAX_TRACKS * WAVRECORDER_ENCODER_BLOCKS)];
+		pRecorder->nJobTail++;
+
+		ReleaseSRWLockExclusive(&pRecorder->tJobLock);
+
+		pBlock->nFrameBytes = FLACCodec::EncodeFrame(pBlock->pFrames, pBlock->nFrames, pBlock->nChannels, pBlock->nFrameNumber, pBlock->pScratch, pBlock->pFrame);
+
+		// Release pairs with the acquire in DrainEncoded: the recorder thread sees the frame before the flag
+		pBlock->bDone.store(TRUE, std::memory_order_release);
+		WakeByAddressAll(&pBlock->bDone);
+	}
+
+	return 0;
+}
+
+void WAVRecorder::SubmitBlock(WAVRECORDERBLOCK* pBlock)
+{
+	BOOL bQueued = FALSE;
+
+	AcquireSRWLockExclusive(&this->tJobLock);
+
+	// FIFO fits every block of every open track, only tracks being closed meanwhile can overflow it
+	if (this->hEncoderThread[0] != NULL && this->nJobHead - this->nJobTail < WAVRECORDER_MAX_TRACKS * WAVRECORDER_ENCODER_BLOCKS)
+	{
+		this->pJob[this->nJobHead % (WAVRECORDER_MAX_TRACKS * WAVRECORDER_ENCODER_BLOCKS)] = pBlock;
+		this->nJobHead++;
+		bQueued = TRUE;
+	}
+
+	ReleaseSRWLockExclusive(&this->tJobLock);
+
+	if (bQueued)
+		ReleaseSemaphore(this->hJobs, 1, NULL);
+	else
+	{
+		pBlock->nFrameBytes = FLACCodec::EncodeFrame(pBlock->pFrames, pBlock->nFrames, pBlock->nChannels, pBlock->nFrameNumber, pBlock->pScratch, pBlock->pFrame);
+		pBlock->bDone.store(TRUE, std::memory_order_release);
+	}
+}
+
+void WAVRecorder::Drain(WAVRECORDERTRACK* pTrack, BOOL bFinal)
+{
+	if (pTrack->pBlock != NULL)
+	{
+		this->DrainEncoded(pTrack, bFinal);
+		return;
+	}
+
+	UINT64 nHead = pTrack->nHead.load(std::memory_order_acquire);
+	UINT64 nTail = pTrack->nTail.load(std::memory_order_relaxed);
+
+	while (nTail < nHead)
+	{
+		// Contiguous run of the queue that still fits into the staging buffer
+		UINT32 nOffset = (UINT32)nTail & pTrack->nQueueMask;
+		UINT32 nChunk = (UINT32)min(nHead - nTail, (UINT64)(WAVRECORDER_QUEUE_BYTES - nOffset));
+		if (!pTrack->bMapped) nChunk = min(nChunk, WAVRECORDER_BATCH_BYTES - pTrack->nBatchBytes);
+
+		// Mapped files take the run straight into the system cache, no write call per batch
+		if (pTrack->bMapped)
+		{
+			if (!this->WriteMapped(pTrack, pTrack->pQueue + nOffset, nChunk))
+				std::cout << ERR "WAV recorder failed to map " << pTrack->sPath << "." END << std::endl;
+		}
+		else
+		{
+			memcpy(pTrack->pBatch + pTrack->nBatchBytes, pTrack->pQueue + nOffset, nChunk);
+			pTrack->nBatchBytes += nChunk;
+		}
+
+		nTail += nChunk;
+
+		// Hand the space back to the producer before the slow write
+		pTrack->nTail.store(nTail, std::memory_order_release);
+
+		if (!pTrack->bMapped && pTrack->nBatchBytes == WAVRECORDER_BATCH_BYTES)
+			this->WriteBatch(pTrack);
+	}
+
+	if (bFinal && pTrack->nBatchBytes > 0)
+		this->WriteBatch(pTrack);
+}
+
+void WAVRecorder::DrainEncoded(WAVRECORDERTRACK* pTrack, BOOL bFinal)
+{
+	UINT32 nFrameBytes = pTrack->nBlockAlign;
+	UINT32 nBlockBytes = FLACCODEC_BLOCK_FRAMES * nFrameBytes;
+
+	while (TRUE)
+	{
+		// Frames go into the file in stream order, however the encoders finish
+		while (pTrack->nBlocksWritten < pTrack->nBlocksSubmitted)
+		{
+			WAVRECORDERBLOCK* pBlock = &pTrack->pBlock[pTrack->nBlocksWritten % WAVRECORDER_ENCODER_BLOCKS];
+			UINT32 bDone = pBlock->bDone.load(std::memory_order_acquire);
+
+			if (!bDone)
+			{
+				// Only wait on the encoders when closing, or when no block is left to fill
+				if (!bFinal && pTrack->nBlocksSubmitted - pTrack->nBlocksWritten < WAVRECORDER_ENCODER_BLOCKS) break;
+
+				WaitOnAddress(&pBlock->bDone, &bDone, sizeof(UINT32), INFINITE);
+				continue;
+			}
+
+			this->Append(pTrack, pBlock->pFrame, pBlock->nFrameBytes);
+
+			pTrack->nStreamFrames += pBlock->nFrames;
+			pTrack->nMinFrameBytes = (pTrack->nMinFrameBytes == 0) ? pBlock->nFrameBytes : min(pTrack->nMinFrameBytes, pBlock->nFrameBytes);
+			pTrack->nMaxFrameBytes = max(pTrack->nMaxFrameBytes, pBlock->nFrameBytes);
+			pTrack->nBlocksWritten++;
+		}
+
+		UINT64 nHead = pTrack->nHead.load(std::memory_order_acquire);
+		UINT64 nTail = pTrack->nTail.load(std::memory_order_relaxed);
+
+		// Whole blocks only, but for the last one of the file
+		if (pTrack->nBlocksSubmitted - pTrack->nBlocksWritten == WAVRECORDER_ENCODER_BLOCKS ||
+			nHead - nTail < (bFinal ? nFrameBytes : nBlockBytes))
+			break;
+
+		WAVRECORDERBLOCK* pBlock = &pTrack->pBlock[pTrack->nBlocksSubmitted % WAVRECORDER_ENCODER_BLOCKS];
+		UINT32 nBytes = (UINT32)min(nHead - nTail, (UINT64)nBlockBytes);
+		nBytes -= nBytes % nFrameBytes;
+
+		UINT32 nOffset = (UINT32)nTail & pTrack->nQueueMask;
+		UINT32 nFirst = min(nBytes, WAVRECORDER_QUEUE_BYTES - nOffset);
+
+		memcpy(pBlock->pFrames, pTrack->pQueue + nOffset, nFirst);
+		memcpy((BYTE*)pBlock->pFrames + nFirst, pTrack->pQueue, nBytes - nFirst);
+
+		// Block holds its own copy, hand the space back to the producer before encoding
+		pTrack->nTail.store(nTail + nBytes, std::memory_order_release);
+
+		pBlock->nFrames = nBytes / nFrameBytes;
+		pBlock->nFrameNumber = pTrack->nBlocksSubmitted++;
+		pBlock->bDone.store(FALSE, std::memory_order_relaxed);
+
+		this->SubmitBlock(pBlock);
+	}
+
+	if (bFinal && pTrack->nBatchBytes > 0)
+		this->WriteBatch(pTrack);
+}
+
+void WAVRecorder::Append(WAVRECORDERTRACK* pTrack, const BYTE* pData, UINT32 nBytes)
+{
+	if (pTrack->bMapped)
+	{
+		if (!this->WriteMapped(pTrack, pData, nBytes))
+			std::cout << ERR "WAV recorder failed to map " << pTrack->sPath << "." END << std::endl;
+		return;
+	}
+
+	while (nBytes > 0)
+	{
+		UINT32 nChunk = min(nBytes, WAVRECORDER_BATCH_BYTES - pTrack->nBatchBytes);
+
+		memcpy(pTrack->pBatch + pTrack->nBatchBytes, pData, nChunk);
+		pTrack->nBatchBytes += nChunk;
+		pData += nChunk;
+		nBytes -= nChunk;
+
+		if (pTrack->nBatchBytes == WAVRECORDER_BATCH_BYTES)
+			this->WriteBatch(pTrack);
+	}
+}
+
+BOOL WAVRecorder::WriteBatch(WAVRECORDERTRACK* pTrack)
+{
+	DWORD nBytes = pTrack->nBatchBytes;
+
+	// Only the last batch of a file is partial, pad it to whole sectors and trim the file afterwards
+	if (pTrack->bUnbuffered)
+	{
+		nBytes = (nBytes + WAVRECORDER_SECTOR_BYTES - 1) & ~(DWORD)(WAVRECORDER_SECTOR_BYTES - 1);
+		memset(pTrack->pBatch + pTrack->nBatchBytes, 0, nBytes - pTrack->nBatchBytes);
+	}
+
+	// Remember the sector holding the header, unbuffered checkpoints can only rewrite it whole
+	if (pTrack->nFileBytes == 0)
+		memcpy(pTrack->pSector, pTrack->pBatch, WAVRECORDER_SECTOR_BYTES);
+
+	// Every batch but the last is full, so each starts on a batch boundary. The ring only queues it and moves pBatch on
+	BOOL bSuccess = this->bRing ?
+		this->QueueWrite(pTrack, pTrack->nFileBytes, nBytes) :
+		this->WriteAt(pTrack, pTrack->nFileBytes, pTrack->pBatch, nBytes);
+
+	// Data is lost either way, carry on with the next batch
+	if (!bSuccess)
+		std::cout << ERR "WAV recorder failed to write to " << pTrack->sPath << "." END << std::endl;
+
+	pTrack->nFileBytes += pTrack->nBatchBytes;
+	pTrack->nBatchBytes = 0;
+
+	return bSuccess;
+}
+
+BOOL WAVRecorder::QueueWrite(WAVRECORDERTRACK* pTrack, UINT64 nOffset, DWORD nBytes)
+{
+#if WAVRECORDER_IORING
+	WAVRECORDERWRITE* pWrite = &pTrack->pWrite[pTrack->nWrite];
+
+	this->Reserve(pTrack, nOffset + nBytes);
+
+	HRESULT hr = this->tRing.BuildIoRingWriteFile(this->tRing.hRing, IoRingHandleRefFromHandle(pTrack->hFile), IoRingBufferRefFromPointer(pWrite->pBuffer),
+		nBytes, nOffset, FILE_WRITE_FLAGS_NONE, (UINT_PTR)pWrite, IOSQE_FLAGS_NONE);
+
+	// Ring is full of this pass's writes already, send them off to make room
+	if (hr == IORING_E_SUBMISSION_QUEUE_FULL)
+	{
+		this->SubmitWrites(FALSE);
+		hr = this->tRing.BuildIoRingWriteFile(this->tRing.hRing, IoRingHandleRefFromHandle(pTrack->hFile), IoRingBufferRefFromPointer(pWrite->pBuffer),
+			nBytes, nOffset, FILE_WRITE_FLAGS_NONE, (UINT_PTR)pWrite, IOSQE_FLAGS_NONE);
+	}
+
+	// Ring only saves syscalls, write the batch right away if it does not take it
+	if (FAILED(hr))
+		return this->WriteAt(pTrack, nOffset, pWrite->pBuffer, nBytes);
+
+	pWrite->bBusy = TRUE;
+
+	// Next buffer takes over staging once its previous write is done
+	pTrack->nWrite = (pTrack->nWrite + 1) % WAVRECORDER_IORING_DEPTH;
+	this->WaitWrite(&pTrack->pWrite[pTrack->nWrite]);
+	pTrack->pBatch = pTrack->pWrite[pTrack->nWrite].pBuffer;
+
+	return TRUE;
+#else
+	return this->WriteAt(pTrack, nOffset, pTrack->pBatch, nBytes);
+#endif
+}
+
+void WAVRecorder::SubmitWrites(BOOL bWait)
+{
+#if WAVRECORDER_IORING
+	IORING_CQE tCompletion;
+
+	this->tRing.SubmitIoRing(this->tRing.hRing, bWait ? 1 : 0, bWait ? WAVRECORDER_FLUSH_MILLISEC : 0, NULL);
+
+	while (this->tRing.PopIoRingCompletion(this->tRing.hRing, &tCompletion) == S_OK)
+	{
+		WAVRECORDERWRITE* pWrite = (WAVRECORDERWRITE*)tCompletion.UserData;
+
+		// Data is lost either way, the buffer is free for the next batch
+		if (FAILED(tCompletion.ResultCode))
+			std::cout << ERR "WAV recorder failed to write to " << pWrite->pTrack->sPath << "." END << std::endl;
+
+		pWrite->bBusy = FALSE;
+	}
+#endif
+}
+
+void WAVRecorder::WaitWrite(WAVRECORDERWRITE* pWrite)
+{
+	// Its completion may be in already, only sleep if it is not
+	if (pWrite->bBusy)
+		this->SubmitWrites(FALSE);
+
+	while (pWrite->bBusy)
+		this->SubmitWrites(TRUE);
+}
+
+BOOL WAVRecorder::InitRing()
+{
+#if WAVRECORDER_IORING
+	HMODULE hKernel = GetModuleHandleA("kernelbase.dll");
+	if (hKernel == NULL) return FALSE;
+
+	this->tRing.CreateIoRing = (decltype(&::CreateIoRing))GetProcAddress(hKernel, "CreateIoRing");
+	this->tRing.BuildIoRingWriteFile = (decltype(&::BuildIoRingWriteFile))GetProcAddress(hKernel, "BuildIoRingWriteFile");
+	this->tRing.SubmitIoRing = (decltype(&::SubmitIoRing))GetProcAddress(hKernel, "SubmitIoRing");
+	this->tRing.PopIoRingCompletion = (decltype(&::PopIoRingCompletion))GetProcAddress(hKernel, "PopIoRingCompletion");
+	this->tRing.CloseIoRing = (decltype(&::CloseIoRing))GetProcAddress(hKernel, "CloseIoRing");
+
+	if (this->tRing.CreateIoRing == NULL || this->tRing.BuildIoRingWriteFile == NULL || this->tRing.SubmitIoRing == NULL ||
+		this->tRing.PopIoRingCompletion == NULL || this->tRing.CloseIoRing == NULL)
+		return FALSE;
+
+	// Rings before version 3 only read files
+	IORING_CREATE_FLAGS tFlags = { IORING_CREATE_REQUIRED_FLAGS_NONE, IORING_CREATE_ADVISORY_FLAGS_NONE };
+	if (FAILED(this->tRing.CreateIoRing(IORING_VERSION_3, tFlags, WAVRECORDER_IORING_ENTRIES, 2 * WAVRECORDER_IORING_ENTRIES, &this->tRing.hRing)))
+	{
+		std::cout << WRN "No I/O ring able to write files, WAV recorder falls back to WriteFile." END << std::endl;
+		return FALSE;
+	}
+
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+void WAVRecorder::Reserve(WAVRECORDERTRACK* pTrack, UINT64 nEnd)
+{
+	if (nEnd <= pTrack->nAllocatedBytes) return;
+
+	FILE_ALLOCATION_INFO tAllocation;
+
+	pTrack->nAllocatedBytes = nEnd + WAVRECORDER_PREALLOCATE_BYTES;
+	tAllocation.AllocationSize.QuadPart = (LONGLONG)pTrack->nAllocatedBytes;
+
+	// Only a hint, the write extends the file anyway if the volume does not support it
+	SetFileInformationByHandle(pTrack->hFile, FileAllocationInfo, &tAllocation, sizeof(FILE_ALLOCATION_INFO));
+}
+
+BOOL WAVRecorder::WriteAt(WAVRECORDERTRACK* pTrack, UINT64 nOffset, const BYTE* pData, DWORD nBytes)
+{
+	this->Reserve(pTrack, nOffset + nBytes);
+
+	OVERLAPPED tOverlapped = {};
+	tOverlapped.Offset = (DWORD)nOffset;
+	tOverlapped.OffsetHigh = (DWORD)(nOffset >> 32);
+
+	DWORD nWritten = 0;
+	return WriteFile(pTrack->hFile, pData, nBytes, &nWritten, &tOverlapped) && nWritten == nBytes;
+}
+
+BOOL WAVRecorder::WriteMapped(WAVRECORDERTRACK* pTrack, const BYTE* pData, UINT32 nBytes)
+{
+	while (nBytes > 0)
+	{
+		// Move on to the next window once the data reaches the end of the current one
+		if (pTrack->pView == NULL || pTrack->nFileBytes == pTrack->nViewOffset + WAVRECORDER_MAP_WINDOW_BYTES)
+			if (!this->MapWindow(pTrack, pTrack->nFileBytes - pTrack->nFileBytes % WAVRECORDER_MAP_WINDOW_BYTES))
+				return FALSE;
+
+		UINT32 nOffset = (UINT32)(pTrack->nFileBytes - pTrack->nViewOffset);
+		UINT32 nChunk = min(nBytes, WAVRECORDER_MAP_WINDOW_BYTES - nOffset);
+
+		memcpy(pTrack->pView + nOffset, pData, nChunk);
+
+		pTrack->nFileBytes += nChunk;
+		pData += nChunk;
+		nBytes -= nChunk;
+	}
+
+	return TRUE;
+}
+
+BOOL WAVRecorder::MapWindow(WAVRECORDERTRACK* pTrack, UINT64 nOffset)
+{
+	// Finished window is not touched again, have it written back now rather than by the lazy writer
+	if (pTrack->pView != NULL)
+	{
+		FlushViewOfFile(pTrack->pView, 0);
+		UnmapViewOfFile(pTrack->pView);
+		pTrack->pView = NULL;
+	}
+
+	// A mapping extends the file to its size, recreate it larger to reserve disk space well ahead
+	if (nOffset + WAVRECORDER_MAP_WINDOW_BYTES > pTrack->nAllocatedBytes)
+	{
+		if (pTrack->hMapping != NULL) CloseHandle(pTrack->hMapping);
+
+		UINT64 nAllocatedBytes = nOffset + WAVRECORDER_MAP_WINDOW_BYTES + WAVRECORDER_PREALLOCATE_BYTES;
+		pTrack->hMapping = CreateFileMapping(pTrack->hFile, NULL, PAGE_READWRITE, (DWORD)(nAllocatedBytes >> 32), (DWORD)nAllocatedBytes, NULL);
+		pTrack->nAllocatedBytes = (pTrack->hMapping != NULL) ? nAllocatedBytes : 0;
+
+		if (pTrack->hMapping == NULL) return FALSE;
+	}
+
+	pTrack->pView = (BYTE*)MapViewOfFile(pTrack->hMapping, FILE_MAP_WRITE, (DWORD)(nOffset >> 32), (DWORD)nOffset, WAVRECORDER_MAP_WINDOW_BYTES);
+	pTrack->nViewOffset = nOffset;
+
+	return pTrack->pView != NULL;
+}
+
+void WAVRecorder::Checkpoint(WAVRECORDERTRACK* pTrack)
+{
+	// Header is still in the staging buffer and goes out with the first batch
+	if (pTrack->nFileBytes == 0) return;
+
+	// Data must reach the disk before the header describing it
+	if (pTrack->pView != NULL) FlushViewOfFile(pTrack->pView, 0);
+
+	for (UINT32 i = 0; i < WAVRECORDER_IORING_DEPTH && this->bRing; i++)
+		this->WaitWrite(&pTrack->pWrite[i]);
+
+	if (pTrack->pBlock != NULL)
+		FLACCodec::SetStreamInfo(pTrack->pSector, pTrack->nStreamFrames, pTrack->nMinFrameBytes, pTrack->nMaxFrameBytes);
+	else
+		WAVRecorder::SetHeaderSizes(pTrack->pSector, pTrack->nHeaderBytes, pTrack->nFileBytes - pTrack->nHeaderBytes, pTrack->nBlockAlign);
+
+	// Unbuffered handles only take whole sectors, the copy holds the data sharing the first one
+	this->WriteAt(pTrack, 0, pTrack->pSector, pTrack->bUnbuffered ? WAVRECORDER_SECTOR_BYTES : pTrack->nHeaderBytes);
+	FlushFileBuffers(pTrack->hFile);
+
+	pTrack->nCheckpointBytes = pTrack->nFileBytes;
+}
+
+void WAVRecorder::SetHeaderSizes(BYTE* pHeader, UINT32 nHeaderBytes, UINT64 nDataBytes, WORD nBlockAlign)
+{
+	UINT64 nRiffBytes = nHeaderBytes - 8 + nDataBytes;
+
+	if (nRiffBytes <= 0xFFFFFFFF)
+	{
+		// Plain RIFF while sizes fit, the reserved ds64 space stays a JUNK chunk readers skip
+		memcpy(pHeader, "RIFF", 4);
+		*(DWORD*)(pHeader + 4) = (DWORD)nRiffBytes;
+		memcpy(pHeader + 12, "JUNK", 4);
+		memset(pHeader + 20, 0, 28);
+		*(DWORD*)(pHeader + nHeaderBytes - 4) = (DWORD)nDataBytes;
+	}
+	else
+	{
+		// RF64: 32-bit sizes are set to -1 and the real ones move into the ds64 chunk
+		memcpy(pHeader, "RF64", 4);
+		*(DWORD*)(pHeader + 4) = 0xFFFFFFFF;
+		memcpy(pHeader + 12, "ds64", 4);
+		*(UINT64*)(pHeader + 20) = nRiffBytes;
+		*(UINT64*)(pHeader + 28) = nDataBytes;
+		*(UINT64*)(pHeader + 36) = (nBlockAlign > 0) ? nDataBytes / nBlockAlign : 0;
+		*(DWORD*)(pHeader + 44) = 0;
+		*(DWORD*)(pHeader + nHeaderBytes - 4) = 0xFFFFFFFF;
+	}
+}
+
+void WAVRecorder::Finalize(WAVRECORDERTRACK* pTrack)
+{
+	this->Checkpoint(pTrack);
+
+	// Mapped sections pin the file size, release them before trimming
+	if (pTrack->pView != NULL) UnmapViewOfFile(pTrack->pView);
+	if (pTrack->hMapping != NULL) CloseHandle(pTrack->hMapping);
+	pTrack->pView = NULL;
+	pTrack->hMapping = NULL;
+
+	// Cut off sector padding of the last batch and give back space reserved ahead
+	FILE_END_OF_FILE_INFO tEndOfFile;
+	tEndOfFile.EndOfFile.QuadPart = (LONGLONG)pTrack->nFileBytes;
+	SetFileInformationByHandle(pTrack->hFile, FileEndOfFileInfo, &tEndOfFile, sizeof(FILE_END_OF_FILE_INFO));
+
+	CloseHandle(pTrack->hFile);
+	pTrack->hFile = INVALID_HANDLE_VALUE;
+}
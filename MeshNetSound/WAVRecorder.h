@@ -0,0 +1,360 @@
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <string>
+#include "config.h"
+
+#if WAVRECORDER_IORING
+#include <ioringapi.h>
+
+/// <summary>
+/// <para>I/O ring of the recorder and the functions driving it.</para>
+/// <para>Looked up at run time, so the program still starts on releases without I/O rings and writes with WriteFile there.</para>
+/// </summary>
+typedef struct WAVRecorderIoRing {
+	HIORING								hRing;
+	decltype(&::CreateIoRing)			CreateIoRing;
+	decltype(&::BuildIoRingWriteFile)	BuildIoRingWriteFile;
+	decltype(&::SubmitIoRing)			SubmitIoRing;
+	decltype(&::PopIoRingCompletion)	PopIoRingCompletion;
+	decltype(&::CloseIoRing)			CloseIoRing;
+} WAVRECORDERIORING;
+#endif
+
+struct WAVRecorderTrack;
+
+/// <summary>
+/// <para>Staging buffer of a track, handed to the I/O ring once full and reused once its write completes.</para>
+/// </summary>
+typedef struct WAVRecorderWrite {
+	BYTE				* pBuffer;			// WAVRECORDER_BATCH_BYTES, sector-aligned
+	WAVRecorderTrack	* pTrack;			// Track the buffer belongs to, for the completion
+	BOOL				bBusy;				// Write queued on the I/O ring and not completed yet
+} WAVRECORDERWRITE;
+
+/// <summary>
+/// <para>Block of float frames of a FLAC track, encoded by one of the encoder threads.</para>
+/// <para>The recorder thread fills and submits blocks of a track in turn, and writes their frames in the same order
+/// once each is done, so encoding runs in parallel while the file stays in sequence.</para>
+/// </summary>
+typedef struct WAVRecorderBlock {
+	FLOAT				* pFrames;			// Interleaved frames taken from the queue
+	INT32				* pScratch;			// Quantized samples and residual of one channel
+	BYTE				* pFrame;			// Encoded FLAC frame
+	UINT32				nFrames;
+	UINT32				nChannels;
+	UINT64				nFrameNumber;		// Index of the block in the stream
+	UINT32				nFrameBytes;		// Size of the encoded frame, valid once done
+
+	std::atomic<UINT32>	bDone;				// Set by the encoder thread with release ordering, waited on with WaitOnAddress
+} WAVRECORDERBLOCK;
+
+/// <summary>
+/// <para>Single file fed by one real-time producer and drained by the recorder thread.</para>
+/// <para>Producer and recorder thread exchange monotonically increasing byte counters
+/// with acquire/release ordering, the same way RingBufferChannel does for frames.</para>
+/// </summary>
+typedef struct WAVRecorderTrack {
+	HANDLE				hFile;
+	std::string			sPath;
+
+	BYTE				* pQueue;			// Byte queue between the producer and the recorder thread, power of two
+	UINT32				nQueueMask;
+
+	BYTE				* pBatch;			// Sector-aligned staging buffer, written to the file once full
+	UINT32				nBatchBytes;		// Bytes pending in the staging buffer
+	WAVRECORDERWRITE	pWrite[WAVRECORDER_IORING_DEPTH];	// Staging buffers taking turns as pBatch with an I/O ring, only the first without
+	UINT32				nWrite;				// Index of pBatch among them
+
+	BYTE				* pSector;			// Copy of the first sector of the file holding the header, rewritten on checkpoints
+	UINT32				nHeaderBytes;
+	WORD				nBlockAlign;		// Bytes per frame, for the sample count of the ds64 chunk
+
+	UINT64				nFileBytes,			// Bytes written to the file so far, without sector padding
+						nAllocatedBytes,	// Bytes reserved on disk for the file so far
+						nCheckpointBytes;	// Size of the file the header last described
+	ULONGLONG			nCheckpointTick;
+
+	BOOL				bUnbuffered;		// File bypasses the system cache, all writes are whole sectors
+
+	BOOL				bMapped;			// File is written through a view of WAVRECORDER_MAP_WINDOW_BYTES moving along it
+	HANDLE				hMapping;			// Mapping spanning the file up to nAllocatedBytes
+	BYTE				* pView;			// Window of the file data goes into, NULL until the first write
+	UINT64				nViewOffset;		// Offset of the window into the file
+
+	WAVRECORDERBLOCK	* pBlock;			// WAVRECORDER_ENCODER_BLOCKS blocks in flight if the file is FLAC, NULL for WAV
+	UINT64				nBlocksSubmitted,	// Blocks handed to the encoder threads since opening
+						nBlocksWritten;		// Blocks whose frames are in the file, the oldest in flight is next
+	UINT64				nStreamFrames;		// Frames of all blocks written, for the STREAMINFO length
+	UINT32				nMinFrameBytes,
+						nMaxFrameBytes;
+
+	alignas(RINGBUFFER_CACHE_LINE)
+	std::atomic<UINT64>	nHead;				// Bytes queued by the producer since opening, never wraps
+	std::atomic<UINT64>	nDropped;			// Bytes the producer dropped because the queue was full
+
+	alignas(RINGBUFFER_CACHE_LINE)
+	std::atomic<UINT64>	nTail;				// Bytes taken by the recorder thread since opening, never wraps
+} WAVRECORDERTRACK;
+
+/// <summary>
+/// <para>Process-wide recorder moving WAV data off the real-time threads.</para>
+/// <para>Capture and render threads only copy blocks into a lock-free queue per file.
+/// A single low priority thread drains all queues every WAVRECORDER_FLUSH_MILLISEC
+/// into a staging buffer per file and writes it in WAVRECORDER_BATCH_BYTES chunks,
+/// so the real-time path never makes a syscall or takes a stdio lock.</para>
+/// <para>With WAVRECORDER_UNBUFFERED, files are opened with FILE_FLAG_NO_BUFFERING
+/// and written in whole sectors from sector-aligned buffers, bypassing the system cache.</para>
+/// <para>With WAVRECORDER_MAPPED, the recorder thread instead copies queued bytes straight into a mapped
+/// window of the file, and flushes and unmaps each window once it moves past it.</para>
+/// <para>With WAVRECORDER_IORING, full batches of all files are queued on one I/O ring and handed to the kernel together
+/// once per pass, while the next of WAVRECORDER_IORING_DEPTH staging buffers of a file fills up. Without I/O ring
+/// support in the system, each batch is written with WriteFile as it fills.</para>
+/// <para>Tracks opened with WAVRecorder::OpenFLACTrack() are losslessly compressed instead: the recorder thread cuts the
+/// queue into blocks of FLACCODEC_BLOCK_FRAMES frames, WAVRECORDER_ENCODER_THREADS worker threads encode them with the
+/// FLACCodec, and the recorder thread writes the frames in order through the same staging, mapping and checkpoints.</para>
+/// <para>Files start out as RIFF with a JUNK chunk reserving room for a ds64 chunk, and turn into
+/// RF64 (EBU Tech 3306) once they outgrow 32-bit sizes, so short recordings stay readable by any WAV reader.
+/// Disk space is reserved ahead in WAVRECORDER_PREALLOCATE_BYTES steps, and the header is brought up to date
+/// with the data on disk every WAVRECORDER_CHECKPOINT_MILLISEC, so a crash loses at most that much of a recording.</para>
+/// </summary>
+class WAVRecorder
+{
+	public:
+		/// <summary>
+		/// <para>Gets the shared recorder, creates it and starts its thread on first use.</para>
+		/// </summary>
+		/// <returns>Pointer to the recorder, NULL if it could not be started.</returns>
+		static WAVRecorder* Acquire();
+
+		/// <summary>
+		/// <para>Drops a reference to the shared recorder, stops its thread with the last one.</para>
+		/// </summary>
+		static void Release();
+
+		/// <summary>
+		/// <para>Creates the file and queues its header.</para>
+		/// </summary>
+		/// <param name="sPath">- path of the file, overwritten if it exists.</param>
+		/// <param name="pFormat">- body of the fmt chunk, starting with a WAVEFORMATEX.</param>
+		/// <param name="nFormatBytes">- size of the fmt chunk body, even.</param>
+		/// <returns>Track to record into, NULL on failure.</returns>
+		WAVRECORDERTRACK* OpenTrack(std::string sPath, const BYTE* pFormat, UINT32 nFormatBytes);
+
+		/// <summary>
+		/// <para>Creates a FLAC file and queues its header.</para>
+		/// <para>The producer records interleaved float frames into it, just as into a float WAV track.</para>
+		/// </summary>
+		/// <param name="sPath">- path of the file, overwritten if it exists.</param>
+		/// <param name="nChannels">- number of channels of each frame, 1 to 8.</param>
+		/// <param name="nSamplesPerSec">- sample rate of the recording.</param>
+		/// <returns>Track to record into, NULL on failure.</returns>
+		WAVRECORDERTRACK* OpenFLACTrack(std::string sPath, UINT32 nChannels, DWORD nSamplesPerSec);
+
+		/// <summary>
+		/// <para>Queues a block for the recorder thread to write.</para>
+		/// <para>Lock-free and never blocks, safe to call from the real-time thread owning the track.</para>
+		/// </summary>
+		/// <param name="pTrack">- open track.</param>
+		/// <param name="pData">- block to record.</param>
+		/// <param name="nBytes">- size of the block.</param>
+		/// <returns>FALSE if the queue is full and the block was dropped.</returns>
+		BOOL Record(WAVRECORDERTRACK* pTrack, const void* pData, UINT32 nBytes);
+
+		/// <summary>
+		/// <para>Gets the number of bytes the producer can queue without dropping them.</para>
+		/// <para>Note: only meaningful on the thread recording into the track.</para>
+		/// </summary>
+		/// <param name="pTrack">- open track.</param>
+		/// <returns>Free bytes in the queue, more may free up meanwhile.</returns>
+		UINT32 GetQueueSpace(WAVRECORDERTRACK* pTrack);
+
+		/// <summary>
+		/// <para>Writes out everything queued, brings the header up to date and closes the file.</para>
+		/// <para>Note: the producer must have stopped recording into the track.</para>
+		/// </summary>
+		/// <param name="pTrack">- open track, freed on return.</param>
+		void CloseTrack(WAVRECORDERTRACK* pTrack);
+
+	private:
+		WAVRecorder();
+
+		~WAVRecorder();
+
+		/// <summary>
+		/// <para>Drains all open tracks periodically until stopped.</para>
+		/// </summary>
+		/// <param name="lpParam">- pointer to the WAVRecorder.</param>
+		/// <returns>0.</returns>
+		static DWORD WINAPI RecorderThread(LPVOID lpParam);
+
+		/// <summary>
+		/// <para>Encodes submitted FLAC blocks until stopped.</para>
+		/// </summary>
+		/// <param name="lpParam">- pointer to the WAVRecorder.</param>
+		/// <returns>0.</returns>
+		static DWORD WINAPI EncoderThread(LPVOID lpParam);
+
+		/// <summary>
+		/// <para>Opens the file and allocates the buffers of a track.</para>
+		/// </summary>
+		/// <param name="sPath">- path of the file, overwritten if it exists.</param>
+		/// <returns>Track with an empty header sector, NULL on failure.</returns>
+		WAVRECORDERTRACK* CreateTrack(std::string sPath);
+
+		/// <summary>
+		/// <para>Queues the header built in the track's first sector and starts draining the track.</para>
+		/// </summary>
+		/// <param name="pTrack">- track built by CreateTrack.</param>
+		/// <param name="nHeaderBytes">- size of the header.</param>
+		/// <returns>The track, NULL if it failed and was deleted along with its file.</returns>
+		WAVRECORDERTRACK* AddTrack(WAVRECORDERTRACK* pTrack, UINT32 nHeaderBytes);
+
+		/// <summary>
+		/// <para>Frees the buffers of a track.</para>
+		/// </summary>
+		/// <param name="pTrack">- track with its file closed, freed on return.</param>
+		static void FreeTrack(WAVRECORDERTRACK* pTrack);
+
+		/// <summary>
+		/// <para>Moves queued bytes into the staging buffer, writing it out each time it fills up.</para>
+		/// </summary>
+		/// <param name="pTrack">- open track.</param>
+		/// <param name="bFinal">- also writes out the partially filled staging buffer.</param>
+		void Drain(WAVRECORDERTRACK* pTrack, BOOL bFinal);
+
+		/// <summary>
+		/// <para>Writes out the FLAC frames of finished blocks in order, and submits queued frames in new blocks.</para>
+		/// </summary>
+		/// <param name="pTrack">- open FLAC track.</param>
+		/// <param name="bFinal">- also submits a partial last block and waits for all blocks to be written.</param>
+		void DrainEncoded(WAVRECORDERTRACK* pTrack, BOOL bFinal);
+
+		/// <summary>
+		/// <para>Appends encoded data to the file, through the staging buffer or the mapped window.</para>
+		/// </summary>
+		/// <param name="pTrack">- open track.</param>
+		/// <param name="pData">- block to append.</param>
+		/// <param name="nBytes">- size of the block.</param>
+		void Append(WAVRECORDERTRACK* pTrack, const BYTE* pData, UINT32 nBytes);
+
+		/// <summary>
+		/// <para>Hands a filled block to the encoder threads, or encodes it right away if there are none or all are busy with a full FIFO.</para>
+		/// </summary>
+		/// <param name="pBlock">- block of frames, not done.</param>
+		void SubmitBlock(WAVRECORDERBLOCK* pBlock);
+
+		/// <summary>
+		/// <para>Writes the staging buffer to the file, padded to whole sectors if unbuffered.</para>
+		/// </summary>
+		/// <param name="pTrack">- open track.</param>
+		/// <returns>FALSE if the write failed.</returns>
+		BOOL WriteBatch(WAVRECORDERTRACK* pTrack);
+
+		/// <summary>
+		/// <para>Queues the full staging buffer of a track on the I/O ring and moves staging on to the next buffer,
+		/// waiting for its previous write to complete if needed.</para>
+		/// </summary>
+		/// <param name="pTrack">- open track.</param>
+		/// <param name="nOffset">- offset into the file, sector-aligned if unbuffered.</param>
+		/// <param name="nBytes">- size of the batch, whole sectors if unbuffered.</param>
+		/// <returns>FALSE if the write failed, it is written right away if the ring does not take it.</returns>
+		BOOL QueueWrite(WAVRECORDERTRACK* pTrack, UINT64 nOffset, DWORD nBytes);
+
+		/// <summary>
+		/// <para>Hands every write queued on the I/O ring to the kernel in one call and reaps the completed ones.</para>
+		/// </summary>
+		/// <param name="bWait">- sleeps up to WAVRECORDER_FLUSH_MILLISEC for a write to complete.</param>
+		void SubmitWrites(BOOL bWait);
+
+		/// <summary>
+		/// <para>Waits for the write of a staging buffer to complete.</para>
+		/// </summary>
+		/// <param name="pWrite">- staging buffer of an open track.</param>
+		void WaitWrite(WAVRECORDERWRITE* pWrite);
+
+		/// <summary>
+		/// <para>Looks up the I/O ring functions and creates the ring.</para>
+		/// </summary>
+		/// <returns>FALSE if the system has no I/O rings able to write files.</returns>
+		BOOL InitRing();
+
+		/// <summary>
+		/// <para>Reserves disk space well ahead of the end of a write, so the file does not fragment as it grows.</para>
+		/// </summary>
+		/// <param name="pTrack">- open track.</param>
+		/// <param name="nEnd">- offset the write ends at.</param>
+		void Reserve(WAVRECORDERTRACK* pTrack, UINT64 nEnd);
+
+		/// <summary>
+		/// <para>Writes a block at an offset of the file, reserving more disk space ahead of it if needed.</para>
+		/// </summary>
+		/// <param name="pTrack">- open track.</param>
+		/// <param name="nOffset">- offset into the file, sector-aligned if unbuffered.</param>
+		/// <param name="pData">- block to write, sector-aligned if unbuffered.</param>
+		/// <param name="nBytes">- size of the block, whole sectors if unbuffered.</param>
+		/// <returns>FALSE if the write failed.</returns>
+		BOOL WriteAt(WAVRECORDERTRACK* pTrack, UINT64 nOffset, const BYTE* pData, DWORD nBytes);
+
+		/// <summary>
+		/// <para>Copies a block into the mapped window at the end of the file, mapping the next window as it fills up.</para>
+		/// </summary>
+		/// <param name="pTrack">- open mapped track.</param>
+		/// <param name="pData">- block to write.</param>
+		/// <param name="nBytes">- size of the block.</param>
+		/// <returns>FALSE if a window could not be mapped, the rest of the block is lost.</returns>
+		BOOL WriteMapped(WAVRECORDERTRACK* pTrack, const BYTE* pData, UINT32 nBytes);
+
+		/// <summary>
+		/// <para>Writes back and unmaps the current window and maps the one at an offset,
+		/// growing the mapping ahead of it if needed.</para>
+		/// </summary>
+		/// <param name="pTrack">- open mapped track.</param>
+		/// <param name="nOffset">- offset of the window into the file, multiple of WAVRECORDER_MAP_WINDOW_BYTES.</param>
+		/// <returns>FALSE if the window could not be mapped.</returns>
+		BOOL MapWindow(WAVRECORDERTRACK* pTrack, UINT64 nOffset);
+
+		/// <summary>
+		/// <para>Rewrites the header to describe the data written to the file so far and flushes it to disk.</para>
+		/// </summary>
+		/// <param name="pTrack">- open track.</param>
+		void Checkpoint(WAVRECORDERTRACK* pTrack);
+
+		/// <summary>
+		/// <para>Fills in the chunk sizes of a header, as RIFF if they fit into 32 bits and as RF64 otherwise.</para>
+		/// </summary>
+		/// <param name="pHeader">- header built by OpenTrack.</param>
+		/// <param name="nHeaderBytes">- size of the header.</param>
+		/// <param name="nDataBytes">- size of the data chunk.</param>
+		/// <param name="nBlockAlign">- bytes per frame.</param>
+		static void SetHeaderSizes(BYTE* pHeader, UINT32 nHeaderBytes, UINT64 nDataBytes, WORD nBlockAlign);
+
+		/// <summary>
+		/// <para>Writes the final header, trims sector padding and closes the file.</para>
+		/// </summary>
+		/// <param name="pTrack">- track whose data is all written.</param>
+		void Finalize(WAVRECORDERTRACK* pTrack);
+
+		SRWLOCK				tLock							{ SRWLOCK_INIT };	// Held shared by the recorder thread, exclusive when opening or closing tracks
+		WAVRECORDERTRACK	* pTrack[WAVRECORDER_MAX_TRACKS]	{ NULL };
+		HANDLE				hThread							{ NULL },
+							hStop							{ NULL };
+
+		BOOL				bRing							{ FALSE };	// Batches are written through the I/O ring
+#if WAVRECORDER_IORING
+		WAVRECORDERIORING	tRing							{ NULL };
+#endif
+
+		// FLAC encoder pool, blocks are handed over through a FIFO that can hold every block of every track
+		SRWLOCK				tJobLock						{ SRWLOCK_INIT };
+		WAVRECORDERBLOCK	* pJob[WAVRECORDER_MAX_TRACKS * WAVRECORDER_ENCODER_BLOCKS]	{ NULL };
+		UINT32				nJobHead						{ 0 },
+							nJobTail						{ 0 };
+		HANDLE				hJobs							{ NULL },	// Semaphore counting submitted blocks
+							hEncoderStop					{ NULL },	// Set only after the last track is closed
+							hEncoderThread[WAVRECORDER_ENCODER_THREADS]	{ NULL };
+
+		static WAVRecorder	* pInstance;
+		static UINT32		nReferences;
+		static SRWLOCK		tInstanceLock;
+};
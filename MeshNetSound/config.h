@@ -16,6 +16,10 @@
     #define WAV_FILE_OPEN_ATTEMPTS 5
 #endif
 
+#ifndef WAV_FILE_INTERLEAVED
+    #define WAV_FILE_INTERLEAVED FALSE              // record all channels of a device into one file instead of a mono file per channel
+#endif
+
 #ifndef ENDPOINT_BUFFER_PERIOD_MILLISEC
     #define ENDPOINT_BUFFER_PERIOD_MILLISEC 500     // buffer period of each device
 #endif
@@ -35,7 +39,23 @@
 #endif
 
 #ifndef AGGREGATOR_CIRCULAR_BUFFER_SIZE
-    #define AGGREGATOR_CIRCULAR_BUFFER_SIZE 44100   // number of endpoint buffer sized packets to fit
+    #define AGGREGATOR_CIRCULAR_BUFFER_SIZE 44100   // min frames per ring buffer channel, rounded up to a power of two
+#endif
+
+#ifndef AGGREGATOR_FRAME_RING
+    #define AGGREGATOR_FRAME_RING FALSE             // store all channels of a device in one FrameRingBuffer instead of a RingBufferChannel each
+#endif
+
+#ifndef AGGREGATOR_FRAME_RING_LAYOUT
+    #define AGGREGATOR_FRAME_RING_LAYOUT FRAMERING_INTERLEAVED  // or FRAMERING_PLANAR for a contiguous block per channel
+#endif
+
+#ifndef AGGREGATOR_WAIT_TIMEOUT_MILLISEC
+    #define AGGREGATOR_WAIT_TIMEOUT_MILLISEC 10     // longest a capture, render or AudioEffect thread sleeps before rechecking its stop flag
+#endif
+
+#ifndef AGGREGATOR_FLIGHT_RECORDER
+    #define AGGREGATOR_FLIGHT_RECORDER FALSE        // keep a FlightRecorder history of each capture device for the trigger command
 #endif
 
 #ifndef AGGREGATOR_OP_ATTEMPTS
@@ -45,6 +65,228 @@
 #ifndef AUDIOEFFECT_OUTPUT_BUFFER_SIZE
     #define AUDIOEFFECT_OUTPUT_BUFFER_SIZE 2048
 #endif
+
+#ifndef AUDIOEFFECT_WAKE_WATERMARK
+    #define AUDIOEFFECT_WAKE_WATERMARK 64           // frames the input ring buffer must hold to wake an AudioEffect thread
+#endif
+
+#ifndef UDP_WAKE_WATERMARK
+    #define UDP_WAKE_WATERMARK 1                    // frames a WASAN node's ring buffer must hold to wake the render thread
+#endif
+
+#ifndef UDP_BATCH_PACKETS
+    #define UDP_BATCH_PACKETS 64                    // datagrams moved per Registered I/O dequeue or commit
+#endif
+
+#ifndef UDP_PACKET_BYTES
+    #define UDP_PACKET_BYTES TEMP_UDP_BUFFER_SIZE   // bytes of each registered datagram slot
+#endif
+
+#ifndef UDP_SEQUENCE_WINDOW
+    #define UDP_SEQUENCE_WINDOW 1024                // packets a datagram may lag the stream by before the sender is taken as restarted
+#endif
+
+#ifndef UDP_JITTER_BUFFER
+    #define UDP_JITTER_BUFFER TRUE                  // reorder and pace received datagrams by their timestamps before the ring buffer
+#endif
+
+#ifndef UDP_JITTER_SLOTS
+    #define UDP_JITTER_SLOTS 32                     // datagrams held per WASAN stream for reordering, power of two
+#endif
+
+#ifndef UDP_JITTER_FACTOR
+    #define UDP_JITTER_FACTOR 4                     // playout delay in multiples of the measured inter-arrival jitter
+#endif
+
+#ifndef UDP_JITTER_MIN_MILLISEC
+    #define UDP_JITTER_MIN_MILLISEC 5               // least playout delay on top of the fastest transit
+#endif
+
+#ifndef UDP_JITTER_MAX_MILLISEC
+    #define UDP_JITTER_MAX_MILLISEC 200             // most playout delay, keep below UDP_JITTER_SLOTS datagrams
+#endif
+
+#ifndef UDP_PLC
+    #define UDP_PLC TRUE                            // fill gaps of lost datagrams by repeating the last pitch period
+#endif
+
+#ifndef UDP_PLC_MIN_PITCH_HZ
+    #define UDP_PLC_MIN_PITCH_HZ 50                 // lowest pitch searched, bounds the period search and the history kept
+#endif
+
+#ifndef UDP_PLC_MAX_PITCH_HZ
+    #define UDP_PLC_MAX_PITCH_HZ 400                // highest pitch searched
+#endif
+
+#ifndef UDP_PLC_OVERLAP_MILLISEC
+    #define UDP_PLC_OVERLAP_MILLISEC 2              // cross-fade between repetitions and back into received audio
+#endif
+
+#ifndef UDP_PLC_HOLD_MILLISEC
+    #define UDP_PLC_HOLD_MILLISEC 20                // concealment at full level before it starts to fade
+#endif
+
+#ifndef UDP_PLC_FADE_MILLISEC
+    #define UDP_PLC_FADE_MILLISEC 60                // fade of longer bursts into silence
+#endif
+
+#ifndef UDP_PLC_MAX_MILLISEC
+    #define UDP_PLC_MAX_MILLISEC 500                // longest gap filled, longer ones are left for the ring buffer drift to absorb
+#endif
+
+#ifndef UDP_CODEC
+    #define UDP_CODEC 0                             // payload codec of WASAN render streams: 0 raw PCM, 1 IMA ADPCM, 2 lossless, not negotiated, 1 and 2 need receivers that decode them
+#endif
+
+#ifndef UDP_FEC
+    #define UDP_FEC FALSE                           // follow groups of datagrams with an XOR parity datagram rebuilding one lost per group, needs UDP_JITTER_BUFFER to receive
+#endif
+
+#ifndef UDP_FEC_GROUP
+    #define UDP_FEC_GROUP 4                         // datagrams per parity datagram, 1/N bandwidth and N datagrams of playout delay on top
+#endif
+
+#ifndef UDP_FEC_HISTORY
+    #define UDP_FEC_HISTORY 16                      // datagrams a receiver keeps to rebuild from, power of two of at least UDP_FEC_GROUP
+#endif
+
+#ifndef UDP_FANOUT
+    #define UDP_FANOUT 0                            // render nodes of one channel mask and format: 0 a stream each, 1 one stream unicast to all, 2 one multicast stream the nodes join themselves
+#endif
+
+#ifndef UDP_MULTICAST_ADDRESS
+    #define UDP_MULTICAST_ADDRESS "239.255.77.1"    // multicast group of the first fan-out group, the n-th one sends to the n-th address after it
+#endif
+
+#ifndef UDP_MULTICAST_TTL
+    #define UDP_MULTICAST_TTL 1                     // routers a multicast datagram may cross, 1 keeps it on the local network
+#endif
+
+#ifndef UDP_RECEIVE_TIMEOUT_MILLISEC
+    #define UDP_RECEIVE_TIMEOUT_MILLISEC 100        // longest wait for datagrams before the receive thread checks for exit
+#endif
+
+#ifndef UDP_RECEIVE_THREADS
+    #define UDP_RECEIVE_THREADS 1                   // most receive threads of WASAN capture nodes, the k-th listens on UDP_RCV_PORT + k, nodes must be set to the logged port
+#endif
+
+#ifndef UDP_RECEIVE_CORE
+    #define UDP_RECEIVE_CORE 1                      // logical processor the first receive thread is pinned to, the others to the ones after it
+#endif
+
+//-------- RingBufferChannel Macros
+#ifndef RINGBUFFER_MAX_CONSUMERS
+    #define RINGBUFFER_MAX_CONSUMERS 8              // most AudioEffects reading a single ring buffer channel concurrently
+#endif
+
+#ifndef RINGBUFFER_LARGE_PAGES
+    #define RINGBUFFER_LARGE_PAGES FALSE            // back rings spanning a large page by large pages, needs SeLockMemoryPrivilege
+#endif
+
+#ifndef RINGBUFFER_MIRRORED
+    #define RINGBUFFER_MIRRORED FALSE               // map the samples twice back to back so any span up to the capacity is contiguous
+#endif
+
+#define RINGBUFFER_CACHE_LINE 64                    // samples and read cursors are aligned to a cache line to avoid false sharing between DSP threads
+
+//-------- WAVRecorder Macros
+#ifndef WAVRECORDER_QUEUE_BYTES
+    #define WAVRECORDER_QUEUE_BYTES (1 << 21)       // per file queue between real-time thread and recorder thread, power of two
+#endif
+
+#ifndef WAVRECORDER_BATCH_BYTES
+    #define WAVRECORDER_BATCH_BYTES (1 << 18)       // size of each write to a file, multiple of WAVRECORDER_SECTOR_BYTES
+#endif
+
+#ifndef WAVRECORDER_SECTOR_BYTES
+    #define WAVRECORDER_SECTOR_BYTES 4096           // alignment of unbuffered writes, covers 512e and 4Kn drives
+#endif
+
+#ifndef WAVRECORDER_FLUSH_MILLISEC
+    #define WAVRECORDER_FLUSH_MILLISEC 50           // period at which the recorder thread drains the queues
+#endif
+
+#ifndef WAVRECORDER_MAX_TRACKS
+    #define WAVRECORDER_MAX_TRACKS 256              // most files recorded at once
+#endif
+
+#ifndef WAVRECORDER_UNBUFFERED
+    #define WAVRECORDER_UNBUFFERED FALSE            // bypass the system cache with FILE_FLAG_NO_BUFFERING
+#endif
+
+#ifndef WAVRECORDER_STAGING_SAMPLES
+    #define WAVRECORDER_STAGING_SAMPLES 1024        // frames converted per block handed to the recorder
+#endif
+
+#ifndef WAVRECORDER_PREALLOCATE_BYTES
+    #define WAVRECORDER_PREALLOCATE_BYTES (1 << 26) // disk space reserved ahead of the data written to a file
+#endif
+
+#ifndef WAVRECORDER_MAPPED
+    #define WAVRECORDER_MAPPED FALSE                // write files through mapped views instead of WriteFile, overrides WAVRECORDER_UNBUFFERED
+#endif
+
+#ifndef WAVRECORDER_MAP_WINDOW_BYTES
+    #define WAVRECORDER_MAP_WINDOW_BYTES (1 << 24)  // size of the mapped view moving along a file, multiple of the 64 KiB allocation granularity
+#endif
+
+#ifndef WAVRECORDER_CHECKPOINT_MILLISEC
+    #define WAVRECORDER_CHECKPOINT_MILLISEC 5000    // period at which headers are updated on disk, bounds loss on a crash
+#endif
+
+#ifndef WAVRECORDER_FLAC
+    #define WAVRECORDER_FLAC FALSE                  // record losslessly compressed FLAC files of integer devices of up to 24 bits, float WAV of the rest
+#endif
+
+#ifndef WAVRECORDER_ENCODER_THREADS
+    #define WAVRECORDER_ENCODER_THREADS 4           // worker threads encoding FLAC blocks of all tracks
+#endif
+
+#ifndef WAVRECORDER_ENCODER_BLOCKS
+    #define WAVRECORDER_ENCODER_BLOCKS 8            // FLAC blocks of a track in flight between recorder thread and encoder threads
+#endif
+
+#ifndef WAVRECORDER_IORING
+    #define WAVRECORDER_IORING FALSE                // queue batches of all files on one I/O ring submitted once per flush, needs Windows 11 22H2
+#endif
+
+#ifndef WAVRECORDER_IORING_DEPTH
+    #define WAVRECORDER_IORING_DEPTH 4              // staging buffers per file taking turns, all but the one filling may be in flight
+#endif
+
+#ifndef WAVRECORDER_IORING_ENTRIES
+    #define WAVRECORDER_IORING_ENTRIES 1024         // writes queued on the ring per submission before it is submitted early
+#endif
+
+//-------- FLACCodec Macros
+#ifndef FLACCODEC_BLOCK_FRAMES
+    #define FLACCODEC_BLOCK_FRAMES 4096             // frames per FLAC frame, multiple of 2^FLACCODEC_MAX_PARTITION_ORDER
+#endif
+
+#ifndef FLACCODEC_BITS_PER_SAMPLE
+    #define FLACCODEC_BITS_PER_SAMPLE 24            // resolution float samples are quantized to, exact for integer sources up to it, lossy for float ones
+#endif
+
+#ifndef FLACCODEC_MAX_PARTITION_ORDER
+    #define FLACCODEC_MAX_PARTITION_ORDER 8         // most Rice partitions of a residual searched, as 2^order
+#endif
+
+#define FLACCODEC_MAX_FIXED_ORDER 4                 // highest order of the FLAC fixed polynomial predictors
+#define FLACCODEC_HEADER_BYTES 42                   // "fLaC" marker and the STREAMINFO block, all a recorded stream carries
+
+//-------- FlightRecorder Macros
+#ifndef FLIGHTRECORDER_PRE_TRIGGER_SEC
+    #define FLIGHTRECORDER_PRE_TRIGGER_SEC 30       // seconds of history before a trigger written out by it
+#endif
+
+#ifndef FLIGHTRECORDER_POST_TRIGGER_SEC
+    #define FLIGHTRECORDER_POST_TRIGGER_SEC 10      // seconds after a trigger written out by it
+#endif
+
+#ifndef FLIGHTRECORDER_INT16
+    #define FLIGHTRECORDER_INT16 TRUE               // hold the history as 16-bit integers instead of float, halving its memory
+#endif
+
 //-------- Resampler Macros
 #define RESAMPLER_IZERO_EPSILON 1E-21               // Max error acceptable in Izero 
 #define RESAMPLER_ROLLOFF_FREQ 0.9                  //  
@@ -57,6 +299,50 @@
 #define RESAMPLER_N_QUALITY_L 13		            // Audio quality parameter
 #define RESAMPLER_N_QUALITY_H 35		            // Some freaky alien quality
 
+#ifndef RESAMPLER_POLYPHASE_MAX_PHASES
+    #define RESAMPLER_POLYPHASE_MAX_PHASES 4096     // largest L for which a polyphase bank is built, interpolating SRC otherwise
+#endif
+
+#ifndef RESAMPLER_FIXED_POINT
+    #define RESAMPLER_FIXED_POINT FALSE             // integer Q15/Q31 SRC for devices and nodes streaming 16/32-bit integer PCM
+#endif
+
+#ifndef RESAMPLER_Q31_GUARD_BITS
+    #define RESAMPLER_Q31_GUARD_BITS 16             // bits dropped off each Q62 product in Q31 SRC as headroom for the 64-bit sum
+#endif
+
+#ifndef RESAMPLER_STREAMING
+    #define RESAMPLER_STREAMING TRUE                // carry SRC history and phase across packets instead of 0-padding each
+#endif
+
+#ifndef RESAMPLER_DRIFT_TRACKING
+    #define RESAMPLER_DRIFT_TRACKING FALSE          // adjust resampling ratio to ring buffer fill level to follow device clock drift
+#endif
+
+#ifndef RESAMPLER_DRIFT_MIN_PHASES
+    #define RESAMPLER_DRIFT_MIN_PHASES 256          // least number of phases of the bank for drift tracking SRC
+#endif
+
+#ifndef RESAMPLER_DRIFT_MAX_PPM
+    #define RESAMPLER_DRIFT_MAX_PPM 2000            // largest correction of the resampling ratio, in parts per million
+#endif
+
+#ifndef RESAMPLER_DRIFT_BANDWIDTH_HZ
+    #define RESAMPLER_DRIFT_BANDWIDTH_HZ 0.02       // natural frequency of the drift control loop
+#endif
+
+#ifndef RESAMPLER_DRIFT_DAMPING
+    #define RESAMPLER_DRIFT_DAMPING 1.0             // damping ratio of the drift control loop, critically damped
+#endif
+
+#ifndef RESAMPLER_DRIFT_AVERAGING_SEC
+    #define RESAMPLER_DRIFT_AVERAGING_SEC 1.0       // time constant of the ring buffer fill level low-pass
+#endif
+
+#ifndef RESAMPLER_DRIFT_TARGET_PACKETS
+    #define RESAMPLER_DRIFT_TARGET_PACKETS 2        // ring buffer fill level to hold, in minimum SRC output packets
+#endif
+
 //-------- Debug Macros
 #define DEBUG
 
@@ -85,6 +371,8 @@
 
 //-------- UDP Macros
 #define UDP_RCV_PORT 42069
+#define UDP_AUDIO_MAGIC 0x4E415357                  // "WSAN" as the first bytes of every WASAN audio datagram
+#define UDP_AUDIO_VERSION 2                         // wire header revision, datagrams of any other are dropped
 
 //-------- Error Macros
 #define ERR_OK 0
@@ -4,6 +4,7 @@
 */
 
 #include "Aggregator.h"
+#include "FLACCodec.h"
 #include <iostream>
 #include "lib/cli/cli.h"
 #include "lib/cli/clifilesession.h"
@@ -45,6 +46,31 @@ int main(int argc, char* argv[])
         "answer",
         [](std::ostream& out, int x) { out << "The answer is: " << x << "\n"; },
         "Print the answer to Life, the Universe and Everything ");
+    rootMenu->Insert(
+        "trigger",
+        [&pAggregator](std::ostream& out)
+        {
+            HRESULT hr = pAggregator.TriggerFlightRecorder();
+            if (hr == ERROR_SUCCESS) out << "Dumping flight recorders\n";
+            else out << ERR "Failed to trigger flight recorders, error " << hr << "." END "\n";
+        },
+        "Write the audio around this moment of each capture device to disk");
+    rootMenu->Insert(
+        "decode",
+        [](std::ostream& out, std::string sSource, std::string sDestination)
+        {
+            HRESULT hr = FLACCodec::DecodeFile(sSource, sDestination);
+            out << (hr == ERROR_SUCCESS ? "Decoded " : "Failed to decode ") << sSource << "\n";
+        },
+        "Decode a recorded FLAC file into an integer PCM WAV file");
+    rootMenu->Insert(
+        "roundtrip",
+        [](std::ostream& out, std::string sPath, int nBits)
+        {
+            HRESULT hr = FLACCodec::CheckRoundTrip(sPath, (UINT32)nBits, 2);
+            out << (hr == ERROR_SUCCESS ? "Lossless round trip of " : "Failed round trip of ") << nBits << "-bit samples through " << sPath << ".flac\n";
+        },
+        "Encode integer samples of the given width to FLAC, decode them back to WAV and compare");
     rootMenu->Insert(
         "color",
         [](std::ostream& out) { out << "Colors ON\n"; SetColor(); },